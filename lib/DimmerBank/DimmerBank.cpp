@@ -0,0 +1,61 @@
+#include "DimmerBank.h"
+
+#include <chrono>
+#include <thread>
+
+DimmerBank::DimmerBank(const std::string &instanceID) : ZeroCrossing(instanceID) {
+    isrInit();
+}
+
+DimmerBank::~DimmerBank() {
+    std::scoped_lock l(channelsMutex);
+    if(channels.size() > 0)
+        Logger::logw(TAG, "Destroyed with %zu dimmers still in it", channels.size());
+}
+
+int DimmerBank::addChannel(const uint8_t pin, const bool inverted, const ChannelKind kind, mains_timing::Fade *fade) {
+    std::scoped_lock l(channelsMutex);
+    const int channel = channels.add(pin, inverted, kind, fade);
+    if(channel < 0)
+        Logger::loge(TAG, "Can't add pin %d, bank is full (max %d) or pin isn't supported", pin, DIMMER_BANK_MAX_CHANNELS);
+    else
+        LOGV(TAG, "[addChannel] Added pin %d as channel %d", pin, channel);
+    return channel;
+}
+
+void DimmerBank::removeChannel(const int channel) {
+    static constexpr std::chrono::milliseconds MAX_WAIT{100}; // ISRs run every tick or half cycle, unless stopped
+    std::scoped_lock l(channelsMutex);
+    channels.remove(channel);
+    const uint32_t passes = isrPasses.load();
+    const auto end = std::chrono::steady_clock::now() + MAX_WAIT;
+    while(isrPasses.load() == passes && std::chrono::steady_clock::now() < end)
+        std::this_thread::yield();
+}
+
+void DimmerBank::timerISRCall(ZeroCrossing* instance, const unsigned currCyclePercentage) {
+    auto *bank = (DimmerBank*)instance;
+    if(currCyclePercentage > RESOLUTION_MAX_SIZE/2) { // same half cycle detection as PulseSkipModulationDimmer
+        bank->currHalfCycleCalcDone = false;
+    } else if(!bank->currHalfCycleCalcDone) {
+        bank->currHalfCycleCalcDone = true;
+        uint32_t next_us;
+        bank->channels.halfCycleStart(halfPeriod_us, next_us); // pulse skip decisions, outputs are set by tick()
+    }
+    writePins(bank->channels.tick(currCyclePercentage));
+    bank->isrPasses.fetch_add(1, std::memory_order_release);
+}
+
+void DimmerBank::eventISRCall(ZeroCrossing* instance, const InstanceEvent event, const uint32_t halfCycleStart_us, const unsigned halfPeriod_us) {
+    auto *bank = (DimmerBank*)instance;
+    uint32_t next_us;
+    if(event == InstanceEvent::HALF_CYCLE_START)
+        writePins(bank->channels.halfCycleStart(halfPeriod_us, next_us));
+    else
+        writePins(bank->channels.fire(bank->nextFire_us, next_us));
+    // one FIRE at a time, for the next channels due
+    bank->nextFire_us = next_us;
+    if(next_us != mains_timing::NO_FIRING)
+        scheduleEvent(instance, &DimmerBank::eventISRCall, halfCycleStart_us + next_us);
+    bank->isrPasses.fetch_add(1, std::memory_order_release);
+}
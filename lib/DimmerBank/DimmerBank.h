@@ -0,0 +1,65 @@
+#ifndef DIMMER_BANK_H
+#define DIMMER_BANK_H
+
+#include "ZeroCrossing.h"
+
+#include <ChannelBank.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef DIMMER_BANK_MAX_CHANNELS // dimmers one DimmerBank can drive, up to 32
+#define DIMMER_BANK_MAX_CHANNELS 4
+#endif
+
+/*
+ * DimmerBank drives several dimmers on the same zero crossing from a single ISR call: their state is kept in a
+ *  mains_timing::ChannelBank and each tick (or event) writes all their pins with one set and one clear of the GPIO
+ *  registers, instead of one dispatched call and pin write per dimmer. Dimmers join by being constructed with the bank,
+ *  ex.: `LeadingEdgePhaseDimmer runLight{"run_light", RUN_LIGHT_EN_OUT_B, true, 128, &bank}`, and keep their own
+ *  HasData keys. The bank's keys are ZeroCrossing's.
+ */
+class DimmerBank : public ZeroCrossing {
+    public:
+        inline static constexpr const char *TAG{"DimBk"};
+        using Channels = mains_timing::ChannelBank<DIMMER_BANK_MAX_CHANNELS, RESOLUTION_MAX_SIZE>;
+        using ChannelKind = Channels::Kind;
+
+        explicit DimmerBank(const std::string &instanceID);
+        ~DimmerBank() override;
+
+        [[nodiscard]] const char * getTag() const override { return TAG; }
+        // Get tags for all classes in hierarchy
+        [[nodiscard]] static std::vector<std::string> getTags() { return {TAG, ZeroCrossing::TAG}; }
+
+        // For dimmers, returns the channel or -1 if the bank is full, the channel starts off and steps `fade` if any
+        int addChannel(uint8_t pin, bool inverted, ChannelKind kind, mains_timing::Fade *fade = nullptr);
+        // Returns once the ISR no longer drives the channel's pin
+        void removeChannel(int channel);
+        void setOnPosition(const int channel, const int32_t onPosition) { channels.setOnPosition(channel, onPosition); }
+        void setPulseSkip(const int channel, const uint16_t brightness, const uint16_t cycles) { channels.setPulseSkip(channel, brightness, cycles); }
+
+    private:
+        Channels channels{};
+        std::mutex channelsMutex{};
+        std::atomic<uint32_t> isrPasses{0}; // to wait for the ISR to be done with a removed channel
+        bool currHalfCycleCalcDone{false};
+        uint32_t nextFire_us{mains_timing::NO_FIRING}; // event driven, delay of the scheduled FIRE in the half cycle
+
+        static void IRAM_ATTR timerISRCall(ZeroCrossing* instance, unsigned currCyclePercentage);
+        static void IRAM_ATTR eventISRCall(ZeroCrossing* instance, InstanceEvent event, uint32_t halfCycleStart_us, unsigned halfPeriod_us);
+        static void IRAM_ATTR writePins(const Channels::Masks &masks) {
+            mains_hal::outputSet(masks.set);
+            mains_hal::outputClear(masks.clear);
+        }
+        void addInstanceTimerISR() override {
+            InstanceISRFunc timerISR = &DimmerBank::timerISRCall;
+            InstanceEventFunc eventISR = &DimmerBank::eventISRCall;
+            if(!instancesISRs.add(this, timerISR) || !instancesEventISRs.add(this, eventISR))
+                Logger::loge(TAG, "Too many zero crossing instances, max is %zu", instancesISRs.capacity());
+        }
+};
+
+#endif // DIMMER_BANK_H
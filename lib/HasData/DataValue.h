@@ -0,0 +1,120 @@
+#ifndef DATA_VALUE_H_
+#define DATA_VALUE_H_
+
+#include <variant>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * DataValue holds a HasData value in its native type (integer, float, bool or string) so internal consumers can read and
+ *  write numbers without formatting/parsing them. Strings are only produced on request with `toString()`, ex.: at the
+ *  MQTT/dashboard boundary, and string values are parsed on request by the `asX()` accessors, so a value set from an
+ *  MQTT payload can still be read as a number.
+ *
+ *  An empty DataValue (std::monostate) means the key wasn't found or the value isn't set, see HasData::EMPTY_VALUE.
+ *  Strings are owned rather than viewed since values are usually read under `_dataMutex` and used after it's released.
+ */
+class DataValue {
+    public:
+        using Variant = std::variant<std::monostate, int64_t, double, bool, std::string>;
+
+        DataValue() = default;
+        template<class T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+        DataValue(const T value) : value((int64_t)value) { } // NOLINT(google-explicit-constructor) want to able to easily instantiate
+        template<class T, std::enable_if_t<std::is_floating_point_v<T>, int> = 0>
+        DataValue(const T value) : value((double)value) { } // NOLINT(google-explicit-constructor)
+        DataValue(const bool value) : value(value) { } // NOLINT(google-explicit-constructor)
+        DataValue(std::string value) : value(std::move(value)) { } // NOLINT(google-explicit-constructor)
+        DataValue(const char *value) : value(std::string(value)) { } // NOLINT(google-explicit-constructor)
+        DataValue(const std::string_view value) : value(std::string(value)) { } // NOLINT(google-explicit-constructor)
+
+        [[nodiscard]] bool isEmpty() const { return std::holds_alternative<std::monostate>(value); }
+        [[nodiscard]] bool isString() const { return std::holds_alternative<std::string>(value); }
+        [[nodiscard]] const Variant &getVariant() const { return value; }
+
+        // Integer value, strings must be a whole base 10 number, floats are truncated
+        [[nodiscard]] std::optional<int64_t> asInt() const {
+            if(const auto *i = std::get_if<int64_t>(&value))
+                return *i;
+            if(const auto *d = std::get_if<double>(&value))
+                return (int64_t)*d;
+            if(const auto *b = std::get_if<bool>(&value))
+                return *b ? 1 : 0;
+            if(const auto *s = std::get_if<std::string>(&value)) {
+                const char *begin = s->c_str();
+                const char *end = begin + s->length();
+                if(begin != end && *begin == '+')
+                    begin++;
+                int64_t parsed;
+                const auto [ptr, ec] = std::from_chars(begin, end, parsed);
+                if(ec == std::errc() && ptr == end && begin != end)
+                    return parsed;
+            }
+            return std::nullopt;
+        }
+
+        [[nodiscard]] std::optional<double> asFloat() const {
+            if(const auto *d = std::get_if<double>(&value))
+                return *d;
+            if(const auto *i = std::get_if<int64_t>(&value))
+                return (double)*i;
+            if(const auto *b = std::get_if<bool>(&value))
+                return *b ? 1.0 : 0.0;
+            if(const auto *s = std::get_if<std::string>(&value)) {
+                if(s->empty())
+                    return std::nullopt;
+                char *end = nullptr;
+                const double parsed = std::strtod(s->c_str(), &end); // from_chars for floats isn't available on all toolchains
+                if(end == s->c_str() + s->length())
+                    return parsed;
+            }
+            return std::nullopt;
+        }
+
+        // Accepts true/false, 1/0, on/off and yes/no for strings
+        [[nodiscard]] std::optional<bool> asBool() const {
+            if(const auto *b = std::get_if<bool>(&value))
+                return *b;
+            if(const auto *i = std::get_if<int64_t>(&value))
+                return *i != 0;
+            if(const auto *d = std::get_if<double>(&value))
+                return *d != 0.0;
+            if(const auto *s = std::get_if<std::string>(&value)) {
+                if(*s == "true" || *s == "1" || *s == "on" || *s == "yes")
+                    return true;
+                if(*s == "false" || *s == "0" || *s == "off" || *s == "no")
+                    return false;
+            }
+            return std::nullopt;
+        }
+
+        // Formats the value, `emptyValue` is returned when there is no value
+        [[nodiscard]] std::string toString(const char *emptyValue = "") const {
+            if(const auto *s = std::get_if<std::string>(&value))
+                return *s;
+            if(const auto *i = std::get_if<int64_t>(&value))
+                return std::to_string(*i);
+            if(const auto *b = std::get_if<bool>(&value))
+                return *b ? "true" : "false";
+            if(const auto *d = std::get_if<double>(&value)) {
+                char buf[32];
+                std::snprintf(buf, sizeof(buf), "%.6g", *d);
+                return buf;
+            }
+            return emptyValue;
+        }
+
+        bool operator==(const DataValue &other) const { return value == other.value; }
+        bool operator!=(const DataValue &other) const { return value != other.value; }
+
+    private:
+        Variant value;
+};
+
+#endif // DATA_VALUE_H_
@@ -2,12 +2,35 @@
 #define HAS_DATA_H_
 
 #include <mutex>
+#include <atomic>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include <string>
 #include <algorithm>
-#include <any>
+#include <string_view>
+#include <type_traits>
 #include <utility>
+#include <cstdint>
 #include <Logger.h>
+#include <utils.h>
+#include "DataValue.h"
+#include "NvsWriteBehind.h"
+
+// Readers of HasData values share `_dataMutex` so they don't block each other, set to 0 for a plain std::mutex
+#ifndef HAS_DATA_SHARED_MUTEX
+#define HAS_DATA_SHARED_MUTEX 1
+#endif
+
+#if HAS_DATA_SHARED_MUTEX
+#include <shared_mutex>
+#endif
+
+// Save NVS values as one CRC-protected blob per namespace (see NvsBlob) instead of one string per key, per-key data
+// found when loading is migrated to the blob. Can also be chosen per class by overriding HasData::isNvsBlob()
+#ifndef HAS_DATA_NVS_BLOB
+#define HAS_DATA_NVS_BLOB 0
+#endif
 
 /*
  * HasData is a base class for classes that need to store data in NVS and/or provide generic get/set methods for data
@@ -27,6 +50,16 @@
  *  data from/to NVS, respectively. Method getNvsNamespace() by default uses the instanceID string, which must be
  *  shorter than 15 characters if used as NVS and will be truncated if not. Constructors must set the instanceID,
  *  which may be used for the NVS namespace and to differentiate instances.
+ *
+ *  Values can also be read/written natively with getValue()/setValue() as a DataValue. By default these go through the
+ *  string methods, but classes with numeric values should override getValueWithOptLock()/setValueWithOptLockAndUpdate()
+ *  and implement the string methods on top of them so formatting only happens at the string (MQTT/dashboard) boundary.
+ *
+ *  Changed keys are tracked in a dirty bitset (see takeDirtyKeys()) so consumers like MQTTController can publish only
+ *  what changed. Values changed outside of the set methods, ex.: by a direct setter, should call markDirty().
+ *
+ *  `_dataMutex` is a shared mutex unless HAS_DATA_SHARED_MUTEX is 0, getters should lock it with DataReadLock so they
+ *  only wait for writers.
  */
 
 template<class L = Logger<>>
@@ -38,7 +71,8 @@ class HasData {
         const std::string instanceID;
         // Emtpy value ("-0-") to let you know that a value is not set, different from an empty string
         inline static constexpr const char * const EMPTY_VALUE{"-0-"};
-        virtual ~HasData() = default;
+        // Drops a save still pending in NvsWriteBehind, one in progress doesn't call into the object, see updateObj()
+        virtual ~HasData() { NvsWriteBehind::instance().cancel(this); }
 
 
         [[nodiscard]] const std::string& getInstanceID() const { return instanceID; }
@@ -60,12 +94,52 @@ class HasData {
 
         /* Sets the keys/values in newData in based on implemented `setWithOptLockAndUpdate()` and then runs `updateObj()` if changed
          *   which may intern call `saveNvsData()` in `updateObj()` (by default).
+         *   The batch is applied as a whole under one `_dataMutex` lock: every value is checked with `validateValue()`
+         *   first and nothing is set if any is invalid, then `updateObj()` is run once for all changed keys.
          *   Only returns true if the values were changed and the update was successful. */
         [[nodiscard]] virtual bool setData(const std::map<std::string, std::string> &newData);
         /* Sets new value for key based on implemented `setWithOptLockAndUpdate()` and then runs `updateObj()` if changed.
          *   May or may not call `saveNvsData()` in `updateObj()` depending on how it's implemented by the concrete class.
          *   Only returns true if the values were changed and the update was successful. */
-        [[nodiscard]] virtual bool set(const std::string &key, const std::string &value) { return setWithOptLockAndUpdate(key, value, false, true); }
+        [[nodiscard]] virtual bool set(const std::string &key, const std::string &value) {
+            const bool updated = setWithOptLockAndUpdate(key, value, false, true);
+            if(updated)
+                markDirty(key);
+            return updated;
+        }
+
+        // Native typed value for key, empty DataValue if not found, see `getValueWithOptLock()`
+        [[nodiscard]] virtual DataValue getValue(const std::string &key) const { return getValueWithOptLock(key, false); }
+        // Same as `set()` but with a native typed value, see `setValueWithOptLockAndUpdate()`
+        [[nodiscard]] virtual bool setValue(const std::string &key, const DataValue &value) {
+            const bool updated = setValueWithOptLockAndUpdate(key, value, false, true);
+            if(updated)
+                markDirty(key);
+            return updated;
+        }
+
+        /* Change tracking, keys are tracked by their index in `getKeys()` in a bitset that is set when they are changed
+         *   through `set()`/`setValue()`/`setData()`/`loadNvsData()` or `markDirty()` by the concrete class.
+         *   Keys with an index past MAX_DIRTY_KEYS mark every key as dirty. */
+        inline static constexpr size_t MAX_DIRTY_KEYS{64};
+
+        // Incremented every time a key is marked dirty, cheap way to check if anything changed
+        [[nodiscard]] uint32_t getDataVersion() const { return _dataVersion.load(std::memory_order_acquire); }
+
+        /* Returns the keys changed since the last call as a bitset of their index in `getKeys()` and clears them,
+         *   so only meant for a single consumer, ex.: MQTTController publishing only changed keys. */
+        [[nodiscard]] uint64_t takeDirtyKeys() { return _dirtyKeys.exchange(0, std::memory_order_acq_rel); }
+        // Marks keys taken with `takeDirtyKeys()` dirty again, ex.: the ones that failed to publish
+        void restoreDirtyKeys(const uint64_t dirtyKeys) {
+            if(dirtyKeys != 0)
+                _dirtyKeys.fetch_or(dirtyKeys, std::memory_order_acq_rel);
+        }
+
+        [[nodiscard]] inline static bool isKeyDirty(const uint64_t dirtyKeys, const size_t keyIndex) {
+            if(keyIndex >= MAX_DIRTY_KEYS)
+                return dirtyKeys == ~(uint64_t)0;
+            return (dirtyKeys >> keyIndex) & 1;
+        }
 
 
         /****** Methods that should/must be implemented ******/
@@ -80,70 +154,257 @@ class HasData {
             return instanceID;
         }
 
+        /* Key lists are returned as views of storage that must outlive the object, usually `inline static const` vectors
+         *   in the concrete class, and must not change after the first `hasKey()`/`isReadOnlyKey()`/`isNvsKey()` call. */
+
+        // Whether NVS data is saved as one NvsBlob in the namespace rather than a string per key, see HAS_DATA_NVS_BLOB
+        [[nodiscard]] virtual bool isNvsBlob() const { return HAS_DATA_NVS_BLOB; }
+
         // Keys used to load/save data from/to NVS
-        [[nodiscard]] virtual std::vector<std::string> getNvsKeys() const { return {}; }
+        [[nodiscard]] virtual const std::vector<std::string> &getNvsKeys() const { return NO_KEYS; }
 
         // Keys that are read-only and also won't be written to NVS or have affect if set
-        [[nodiscard]] virtual std::vector<std::string> getReadOnlyKeys() const { return {"blah"}; }
+        [[nodiscard]] virtual const std::vector<std::string> &getReadOnlyKeys() const { return NO_KEYS; }
 
         // Keys used to get/set data
-        [[nodiscard]] virtual std::vector<std::string> getKeys() const = 0;
+        [[nodiscard]] virtual const std::vector<std::string> &getKeys() const = 0;
+
+        // O(1) key membership, built from the key lists on first use
+        [[nodiscard]] bool hasKey(const std::string_view key) const { return findKey(key) != nullptr; }
+        [[nodiscard]] bool isReadOnlyKey(const std::string_view key) const {
+            const auto *info = findKey(key);
+            return info != nullptr && (info->flags & KEY_READ_ONLY);
+        }
+        [[nodiscard]] bool isNvsKey(const std::string_view key) const {
+            const auto *info = findKey(key);
+            return info != nullptr && (info->flags & KEY_NVS);
+        }
 
         [[nodiscard]] virtual const char * getTag() const = 0;
 
 
     protected:
+        /* Lock `_dataMutex` with `DataReadLock` when only reading values and with std::unique_lock/std::scoped_lock when
+         *   writing, so readers (MQTT publishing, config pages, getters) only wait for writers. */
+#if HAS_DATA_SHARED_MUTEX
+        using DataMutex = std::shared_mutex;
+        using DataReadLock = std::shared_lock<DataMutex>;
+#else
+        using DataMutex = std::mutex;
+        using DataReadLock = std::unique_lock<DataMutex>;
+#endif
+
         inline static std::mutex nvsDataMutex;
-        mutable std::mutex _dataMutex;
+        mutable DataMutex _dataMutex;
 
         // `instanceID` must be shorter than 15 characters if used as NVS namespace
         explicit HasData(std::string instanceID) : instanceID(std::move(instanceID)) {}
 
+        inline static const std::vector<std::string> NO_KEYS{};
+
+        // Flag key as changed for `takeDirtyKeys()`, for values changed outside of `set()`, doesn't lock `_dataMutex`
+        void markDirty(const std::string_view key) {
+            const auto *info = findKey(key);
+            if(info == nullptr || info->index < 0)
+                return;
+            const auto index = (size_t)info->index;
+            _dirtyKeys.fetch_or(index < MAX_DIRTY_KEYS ? (uint64_t)1 << index : ~(uint64_t)0, std::memory_order_acq_rel);
+            _dataVersion.fetch_add(1, std::memory_order_acq_rel);
+        }
+
         /****** Methods that should/must be implemented ******/
         [[nodiscard]] virtual std::string getWithOptLock(const std::string &key, bool noLock) const = 0;
         [[nodiscard]] virtual bool setWithOptLockAndUpdate(const std::string &key, const std::string &value, bool noLock, bool doObjUpdate) = 0;
 
+        /* Typed versions of `getWithOptLock()`/`setWithOptLockAndUpdate()`, by default they convert from/to the string versions.
+         *   Override them to provide native values and implement the string versions with them instead, ex.:
+         *   `return getValueWithOptLock(key, noLock).toString(HasData::EMPTY_VALUE);` */
+        [[nodiscard]] virtual DataValue getValueWithOptLock(const std::string &key, const bool noLock) const {
+            const std::string value = getWithOptLock(key, noLock);
+            if(value == HasData::EMPTY_VALUE)
+                return {};
+            return value;
+        }
+        [[nodiscard]] virtual bool setValueWithOptLockAndUpdate(const std::string &key, const DataValue &value, const bool noLock, const bool doObjUpdate) {
+            return setWithOptLockAndUpdate(key, value.toString(HasData::EMPTY_VALUE), noLock, doObjUpdate);
+        }
+
+        /* Checks `value` is valid for `key` without applying it, used by `setData()` to validate the whole batch before
+         *   anything is set. Override for values that can be rejected, the setters should reject the same values. */
+        [[nodiscard]] virtual bool validateValue(const std::string &key, const DataValue &value) const { return true; }
+
+        /* Finishes a `setWithOptLockAndUpdate()`, `updatedKey` is the key that changed or empty if nothing did.
+         *   When `doObjUpdate` it's queued with any keys left pending by a previously failed update and `updateObj()`
+         *   is run once for all of them, so pending keys are per instance rather than shared by all instances.
+         *   `_dataMutex` may be locked already when calling this method if `noLock` is true. */
+        [[nodiscard]] bool queueObjUpdate(const std::string &updatedKey, const bool noLock, const bool doObjUpdate) {
+            const bool updated = !updatedKey.empty();
+            if(!doObjUpdate)
+                return updated;
+            std::unique_lock l{_dataMutex, std::defer_lock};
+            if(!noLock)
+                l.lock();
+            if(updated)
+                _pendingObjUpdateKeys.push_back(updatedKey);
+            if(_pendingObjUpdateKeys.empty())
+                return false;
+            const bool objUpdated = updateObj(_pendingObjUpdateKeys, true);
+            if(objUpdated) {
+                LOGV(getTag(), "Updated %s", utils::join(_pendingObjUpdateKeys, ", ").c_str());
+                _pendingObjUpdateKeys.clear();
+            } else {
+                Logger::logw(getTag(), "Failed to update %s, will retry with the next update", utils::join(_pendingObjUpdateKeys, ", ").c_str());
+            }
+            return objUpdated || updated; // include updated since vars were updated
+        }
+
         /* Save to NVS and update underlying details of the object (when overridden), ex.: update time from NTP server, server settings, etc.
              `_dataMutex` may be locked already when calling this method if `_dataAlreadyLocked` is true.
-             By default  `saveNvsData()` will be called to store data to NVS unless reimplemented */
+             By default  `saveNvsData()` will be called to store data to NVS unless reimplemented, it's deferred to
+             NvsWriteBehind when its window is set so setters return before the flash is written. The deferred save
+             writes a snapshot of the values taken here, so it never calls into an object that's being destroyed */
         [[nodiscard]] virtual bool updateObj(const std::vector<std::string> &keys, const bool _dataAlreadyLocked) {
             if(!keys.empty()) {
                 // check at least one key in keys is in getNvsKeys()
-                const auto nvsKeys = getNvsKeys();
                 for(const auto &key : keys) {
-                    if(std::find(nvsKeys.begin(), nvsKeys.end(), key) != nvsKeys.end())
-                        return saveNvsData(keys, _dataAlreadyLocked);
+                    if(!isNvsKey(key))
+                        continue;
+                    if(NvsWriteBehind::instance().isEnabled()) {
+                        NvsWriteBehind::instance().schedule(this, keys, [snapshot = takeNvsSnapshot(getNvsKeys(), _dataAlreadyLocked)](const std::vector<std::string> &savedKeys) {
+                            std::scoped_lock l{nvsDataMutex};
+                            return writeNvsSnapshot(snapshot, savedKeys);
+                        });
+                        return true;
+                    }
+                    return saveNvsData(keys, _dataAlreadyLocked);
                 }
             }
             return true;
         }
 
-        /* Helper method to generically get a string value from a map of key/T value ptr pairs, returns HasData::EMPTY_VALUE if key not found.
+        /* Key descriptor pairing a data key with its accessor `F` (ex.: a getter or setter function pointer).
+         *   The key hash is computed when the table is built so lookups only compare integers. */
+        template<class F>
+        struct DataKey {
+            const char *key{nullptr};
+            F func{};
+            uint64_t hash{0};
+
+            constexpr DataKey() = default;
+            constexpr DataKey(const char *key, F func) : key(key), func(func), hash(utils::hashstr(key)) { } // NOLINT(google-explicit-constructor) want to able to easily instantiate
+        };
+
+        /* Fixed table of `DataKey`s sorted by hash at compile time. Subclasses declare it once as a `static constexpr`
+         *   with `makeDataKeyTable()` instead of building a std::map on every get/set. */
+        template<class F, std::size_t N>
+        class DataKeyTable {
+            public:
+                constexpr explicit DataKeyTable(const DataKey<F> (&dataKeys)[N]) {
+                    for(std::size_t i = 0; i < N; i++)
+                        entries[i] = dataKeys[i];
+                    // insertion sort, N is small and std::sort isn't constexpr on all supported toolchains
+                    for(std::size_t i = 1; i < N; i++) {
+                        for(std::size_t j = i; j > 0 && entries[j-1].hash > entries[j].hash; j--) {
+                            const DataKey<F> tmp = entries[j];
+                            entries[j] = entries[j-1];
+                            entries[j-1] = tmp;
+                        }
+                    }
+                }
+
+                // Returns the entry for `key` or nullptr if not found, doesn't allocate
+                [[nodiscard]] constexpr const DataKey<F> *find(const char *key) const {
+                    const uint64_t hash = utils::hashstr(key);
+                    std::size_t lo = 0;
+                    std::size_t hi = N;
+                    while(lo < hi) {
+                        const std::size_t mid = lo + (hi - lo) / 2;
+                        if(entries[mid].hash < hash)
+                            lo = mid + 1;
+                        else
+                            hi = mid;
+                    }
+                    for(; lo < N && entries[lo].hash == hash; lo++) { // confirm in case of hash collision
+                        if(std::string_view(entries[lo].key) == std::string_view(key))
+                            return &entries[lo];
+                    }
+                    return nullptr;
+                }
+
+                [[nodiscard]] constexpr std::size_t size() const { return N; }
+                [[nodiscard]] constexpr const DataKey<F> *begin() const { return entries; }
+                [[nodiscard]] constexpr const DataKey<F> *end() const { return entries + N; }
+
+            private:
+                DataKey<F> entries[N]{};
+        };
+
+        template<class F, std::size_t N>
+        [[nodiscard]] static constexpr DataKeyTable<F, N> makeDataKeyTable(const DataKey<F> (&dataKeys)[N]) {
+            return DataKeyTable<F, N>(dataKeys);
+        }
+
+        // Accessor types for `DataKeyTable`s, `C` is the concrete class the table is declared in
+        template<class C>
+        using DataGetter = std::string(*)(const C *self);
+        template<class C>
+        using ValueGetter = DataValue(*)(const C *self);
+        // Returns true only if the value was valid and changed
+        template<class C>
+        using DataSetter = bool(*)(C *self, const std::string &value);
+        template<class C>
+        using ValueSetter = bool(*)(C *self, const DataValue &value);
+
+        /* Helper method to generically get a value from a table of key/getter pairs, returns HasData::EMPTY_VALUE (or an
+         *   empty DataValue for `ValueGetter`s) if key not found.
          *   `_dataMutex` may be locked already when calling this method if `noLock` is true. */
-        template<class T=std::string>
-        [[nodiscard]] T getStringDataHelper(const std::map<const std::string, const T&> &keyVarPairs,
-                                            const std::string &key, const bool noLock, const T& defaultVal = HasData::EMPTY_VALUE) const {
-            if(keyVarPairs.find(key) == keyVarPairs.end()) {
-                Logger::logv(getTag(), "Invalid key '%s', not found", key.c_str());
-                return defaultVal;
+        template<class R, class C, std::size_t N>
+        [[nodiscard]] R getDataKeyHelper(const DataKeyTable<R(*)(const C*), N> &getters, const C *self,
+                                         const std::string &key, const bool noLock) const {
+            const auto *dataKey = getters.find(key.c_str());
+            if(dataKey == nullptr) {
+                LOGV(getTag(), "Invalid key '%s', not found", key.c_str());
+                if constexpr(std::is_same_v<R, DataValue>)
+                    return {};
+                else
+                    return HasData::EMPTY_VALUE;
             }
 
-            std::unique_lock l{_dataMutex, std::defer_lock};
+            DataReadLock l{_dataMutex, std::defer_lock};
             if(!noLock)
                 l.lock();
-            return keyVarPairs.at(key);
+            return dataKey->func(self);
         }
 
-        class VarHolder {
-        public:
-            std::any varPtr;
-            using FuncType = bool(*)(const std::string &key, std::any varPtr, const std::string &value);
-            FuncType converterSetter;
-            VarHolder(std::any varPtr, FuncType converterSetter = nullptr) : varPtr(std::move(varPtr)), converterSetter(converterSetter) { } // NOLINT(google-explicit-constructor) want to able to easily instantiate
-        };
+        /* Helper method to generically set a value from a table of key/setter pairs, returns the table's key if the value changed
+         *   or nullptr if it didn't, was invalid or the key was not found/read-only.
+         *   `_dataMutex` may be locked already when calling this method if `noLock` is true. */
+        template<class V, class C, std::size_t N>
+        [[nodiscard]] const char *setDataKeyHelper(const DataKeyTable<bool(*)(C*, const V&), N> &setters, C *self,
+                                                   const std::string &key, const V &value, const bool noLock) {
+            if(isReadOnlyKey(key)) {
+                Logger::logw(getTag(), "Key '%s' is read-only", key.c_str());
+                return nullptr;
+            }
+            const auto *dataKey = setters.find(key.c_str());
+            if(dataKey == nullptr) {
+                LOGV(getTag(), "Invalid key '%s', not found", key.c_str());
+                return nullptr;
+            }
 
-        [[nodiscard]] inline static bool setStringDataHelperStringSetter(std::any &varPtr, const std::string &value) {
-            std::string &var = *std::any_cast<std::string*>(varPtr);
+            std::unique_lock l{_dataMutex, std::defer_lock};
+            if(!noLock)
+                l.lock();
+            if(!dataKey->func(self, value)) {
+                LOGV(getTag(), "Same or invalid value for key '%s'", key.c_str());
+                return nullptr;
+            }
+            return dataKey->key;
+        }
+
+        // Sets `var` to `value` for use in `DataSetter`s, returns true only if it changed
+        template<class T>
+        [[nodiscard]] inline static bool setIfChanged(T &var, const T &value) {
             if(var != value) {
                 var = value;
                 return true;
@@ -151,44 +412,52 @@ class HasData {
             return false;
         }
 
-//#if defined(ARDUINO)
-//        /* Helper method to generically set string value from a map of key/String value ptr pairs, returns empty string if value not changed.
-//         *   `_dataMutex` may be locked already when calling this method if `noLock` is true. */
-//        // <overloads>
-//        [[nodiscard]] std::string getStringDataHelper(const std::map<const std::string, const String&> &keyVarPairs,
-//                                                      const std::string &key, const bool noLock) const {
-//            return getStringDataHelper<String>(keyVarPairs, key, noLock, String{HasData::EMPTY_VALUE}).c_str();
-//        }
-//#endif
-
-        /* Helper method to generically set string value from a map of key/value ptr pairs, returns empty string if value not changed.
-         *   `_dataMutex` may be locked already when calling this method if `noLock` is true. 
-         *   `converterSetter` is optional and can be used to convert the value and set it using varPtr.*/
-        [[nodiscard]] std::string setStringDataHelper(std::map<const std::string, VarHolder> keyVarHolderPairs_,
-                                                     const std::string &key, const std::string &value, const bool noLock) {
-            const auto _readOnlyKeys = getReadOnlyKeys();
-            if(std::find(_readOnlyKeys.begin(), _readOnlyKeys.end(), key) != _readOnlyKeys.end()) {
-                Logger::logw(getTag(), "Key '%s' is read-only", key.c_str());
-                return "";
-            }
-            auto keyVarHolderPairs = std::move(keyVarHolderPairs_);
-            if(keyVarHolderPairs.find(key) == keyVarHolderPairs.end()) {
-                Logger::logv(getTag(), "Invalid key '%s', not found", key.c_str());
-                return "";
-            }
+    private:
+        std::vector<std::string> _pendingObjUpdateKeys; // guarded by `_dataMutex`, see `queueObjUpdate()`
+        std::atomic<uint64_t> _dirtyKeys{~(uint64_t)0}; // everything is new to the first consumer
+        std::atomic<uint32_t> _dataVersion{0};
 
-            std::unique_lock l{_dataMutex, std::defer_lock};
-            if(!noLock)
-                l.lock();
-            VarHolder &varHolder = keyVarHolderPairs.at(key);
-            if(varHolder.converterSetter != nullptr) {
-                if(!varHolder.converterSetter(key, varHolder.varPtr, value)) {
-                    Logger::logw(getTag(), "Same or invalid value or conversion failed for value '%s' for key '%s'", value.c_str(), key.c_str());
-                    return "";
-                }
-                return key;
-            }
-            return setStringDataHelperStringSetter(varHolder.varPtr, value) ? key : "";
+        inline static constexpr uint8_t KEY_READ_ONLY{1 << 0};
+        inline static constexpr uint8_t KEY_NVS{1 << 1};
+        struct KeyInfo {
+            int index{-1}; // position in `getKeys()`, -1 if only in the read-only or NVS keys
+            uint8_t flags{0};
+        };
+        // Views into the key lists, which outlive the object, so lookups don't allocate
+        mutable std::unordered_map<std::string_view, KeyInfo> _keyIndex;
+        mutable std::once_flag _keyIndexBuilt;
+
+        // NvsBlob of the NVS keys' values, `_dataMutex` must be locked
+        [[nodiscard]] std::vector<uint8_t> packNvsBlob() const;
+
+        // The values of all the NVS keys and where to save them, taken so saving doesn't need the object
+        struct NvsSnapshot {
+            std::string nvsNamespace;
+            const char *tag{nullptr};
+            bool isBlob{false};
+            std::vector<uint8_t> blob;
+            std::vector<std::pair<std::string, std::string>> values; // per key, when not a blob
+        };
+        // Values of `keys`, or the blob of all of them, `_dataMutex` may be locked already if `_dataAlreadyLocked` is true
+        [[nodiscard]] NvsSnapshot takeNvsSnapshot(const std::vector<std::string> &keys, bool _dataAlreadyLocked) const;
+        // Saves the values of `keys` in `snapshot`, or its blob, `nvsDataMutex` must be locked
+        [[nodiscard]] static bool writeNvsSnapshot(const NvsSnapshot &snapshot, const std::vector<std::string> &keys);
+        // Sets the NVS keys found in `blob`, false if it's corrupt, `_dataMutex` must be locked
+        [[nodiscard]] bool unpackNvsBlob(const std::vector<uint8_t> &blob);
+
+        [[nodiscard]] const KeyInfo *findKey(const std::string_view key) const {
+            // virtual key getters can't be used in the constructor, so build on first use
+            std::call_once(_keyIndexBuilt, [this]() {
+                const auto &_keys = getKeys();
+                for(size_t i = 0; i < _keys.size(); i++)
+                    _keyIndex[_keys[i]].index = (int)i;
+                for(const auto &key : getReadOnlyKeys())
+                    _keyIndex[key].flags |= KEY_READ_ONLY;
+                for(const auto &key : getNvsKeys())
+                    _keyIndex[key].flags |= KEY_NVS;
+            });
+            const auto it = _keyIndex.find(key);
+            return it == _keyIndex.end() ? nullptr : &it->second;
         }
 
 };
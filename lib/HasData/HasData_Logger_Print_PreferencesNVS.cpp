@@ -1,6 +1,7 @@
 #include "HasData.h"
+#include "NvsBlob.h"
 
-#include <Preferences.h>
+#include "NvsMetrics.h"
 
 #include <Logger.h>
 
@@ -10,18 +11,49 @@
 
 /*
  * This is a template class for HasData that uses the default Logger L type and Arduino Preferences to save NVS data.
+ *  Preferences are wrapped in MeteredPreferences so NVS operations are counted in NvsMetrics.
  */
 
+template<>
+std::vector<uint8_t> HasData<>::packNvsBlob() const {
+    NvsBlob::Entries entries;
+    for(const auto &key : getNvsKeys()) {
+        if(!isReadOnlyKey(key))
+            entries.emplace_back(key, getValueWithOptLock(key, true));
+    }
+    return NvsBlob::pack(entries);
+}
+
+template<>
+bool HasData<>::unpackNvsBlob(const std::vector<uint8_t> &blob) {
+    NvsBlob::Entries entries;
+    if(!NvsBlob::unpack(blob.data(), blob.size(), entries))
+        return false;
+    for(const auto &[key, value] : entries) {
+        if(!isNvsKey(key) || isReadOnlyKey(key)) {
+            LOGV(getTag(), "Skipping blob key %s, no longer an NVS key or read-only", key.c_str());
+            continue;
+        }
+        if(setValueWithOptLockAndUpdate(key, value, true, false)) {
+            LOGV(getTag(), "Loaded and set %s = %s", key.c_str(), value.toString().c_str());
+            markDirty(key);
+        } else {
+            Logger::loge(getTag(), "Failed to set loaded %s = %s (may have not changed)", key.c_str(), value.toString().c_str());
+        }
+    }
+    return true;
+}
+
 template<>
 bool HasData<>::loadNvsData() {
     const auto nvsNamespace = getNvsNamespace();
-    Logger::logv(getTag(), "[loadNVSData] for namespace %s", nvsNamespace.c_str());
+    LOGV(getTag(), "[loadNVSData] for namespace %s", nvsNamespace.c_str());
 
     if(getNvsKeys().empty()) {
         Logger::logw(getTag(), "No NVS IDs defined for namespace %s", nvsNamespace.c_str());
         return false;
     }
-    Preferences nvs;
+    MeteredPreferences nvs;
     std::scoped_lock l{nvsDataMutex, _dataMutex};
 
     if(!nvs.begin(nvsNamespace.c_str(), true)) {
@@ -36,28 +68,60 @@ bool HasData<>::loadNvsData() {
             Logger::loge(getTag(), "Failed to open NVS (ro) after successful init namespace %s", nvsNamespace.c_str());
             return false;
         }
-        Logger::logv(getTag(), "Namespace %s was just created, so no data to load", nvsNamespace.c_str());
+        LOGV(getTag(), "Namespace %s was just created, so no data to load", nvsNamespace.c_str());
         nvs.end();
         return true;
     }
 
+    bool blobLoaded = false;
+    bool blobCorrupt = false;
+    if(isNvsBlob() && nvs.isKey(NvsBlob::KEY)) {
+        std::vector<uint8_t> blob(nvs.getBytesLength(NvsBlob::KEY));
+        blobLoaded = nvs.getBytes(NvsBlob::KEY, blob.data(), blob.size()) == blob.size() && unpackNvsBlob(blob);
+        blobCorrupt = !blobLoaded;
+        if(blobCorrupt)
+            Logger::loge(getTag(), "Corrupt NVS blob in namespace %s, loading per-key data if any", nvsNamespace.c_str());
+    }
+
+    std::vector<std::string> migrateKeys;
 //    bool keysUpdated = false;
-    for(const auto &key : getNvsKeys()) {
-        const auto &readOnlyKeys = getReadOnlyKeys();
-        if(nvs.isKey(key.c_str()) &&
-                    std::find(readOnlyKeys.begin(), readOnlyKeys.end(), key) == readOnlyKeys.end()) {
+    // per-key data is only read without a valid blob, either the blob mode is off or it still needs migrating
+    for(const auto &key : blobLoaded ? NO_KEYS : getNvsKeys()) {
+        if(nvs.isKey(key.c_str()) && !isReadOnlyKey(key)) {
             const std::string value = nvs.getString(key.c_str(), EMPTY_VALUE).c_str();
             const bool wasUpdated = setWithOptLockAndUpdate(key, value, true, false);
+            migrateKeys.emplace_back(key);
 //            keysUpdated |= wasUpdated;
-            if(!wasUpdated)
+            if(!wasUpdated) {
                 Logger::loge(getTag(), "Failed to set loaded %s = %s (may have not changed)", key.c_str(), value.c_str());
-            else
-                Logger::logv(getTag(), "Loaded and set %s = %s", key.c_str(), value.c_str());
+            } else {
+                LOGV(getTag(), "Loaded and set %s = %s", key.c_str(), value.c_str());
+                markDirty(key);
+            }
         } else {
-            Logger::logv(getTag(), "Skipping key %s, either not in NVS or read-only", key.c_str());
+            LOGV(getTag(), "Skipping key %s, either not in NVS or read-only", key.c_str());
         }
     }
     nvs.end();
+
+    // Move per-key data into the blob, once it's written the per-key entries are no longer needed
+    if(isNvsBlob() && !migrateKeys.empty()) {
+        const auto blob = packNvsBlob();
+        if(!nvs.begin(nvsNamespace.c_str(), false)) {
+            Logger::loge(getTag(), "Failed to open (rw) NVS namespace %s to migrate to blob", nvsNamespace.c_str());
+            return true;
+        }
+        if(nvs.putBytes(NvsBlob::KEY, blob.data(), blob.size()) == blob.size()) {
+            for(const auto &key : migrateKeys)
+                nvs.remove(key.c_str());
+            Logger::logi(getTag(), "Migrated %zu NVS keys of namespace %s to blob", migrateKeys.size(), nvsNamespace.c_str());
+        } else {
+            Logger::loge(getTag(), "Failed to migrate NVS namespace %s to blob, keeping per-key data", nvsNamespace.c_str());
+        }
+        nvs.end();
+    } else if(blobCorrupt) {
+        return false;
+    }
     // Don't want to reload object automatically since may be recursive loop
     // bool updatedObj = true;
     // if(keysUpdated) 
@@ -69,10 +133,79 @@ bool HasData<>::loadNvsData() {
     return true;
 }
 
+template<>
+auto HasData<>::takeNvsSnapshot(const std::vector<std::string> &keys, const bool _dataAlreadyLocked) const -> NvsSnapshot {
+    NvsSnapshot snapshot{getNvsNamespace(), getTag(), isNvsBlob(), {}, {}};
+    DataReadLock l{_dataMutex, std::defer_lock};
+    if(!_dataAlreadyLocked)
+        l.lock();
+    if(snapshot.isBlob) {
+        snapshot.blob = packNvsBlob();
+        return snapshot;
+    }
+    for(const auto &key : keys) {
+        if(!isReadOnlyKey(key) && isNvsKey(key))
+            snapshot.values.emplace_back(key, getWithOptLock(key, true));
+    }
+    return snapshot;
+}
+
+template<>
+bool HasData<>::writeNvsSnapshot(const NvsSnapshot &snapshot, const std::vector<std::string> &keys) {
+    const char *tag = snapshot.tag;
+    MeteredPreferences nvs;
+    if(!nvs.begin(snapshot.nvsNamespace.c_str(), false)) {
+        Logger::loge(tag, "Failed to open (rw) NVS namespace %s", snapshot.nvsNamespace.c_str());
+        return false;
+    }
+
+    if(snapshot.isBlob) {
+        // the blob always holds all the NVS keys, so `keys` only matters to decide whether to save
+        const auto &blob = snapshot.blob;
+        if(nvs.isKey(NvsBlob::KEY) && nvs.getBytesLength(NvsBlob::KEY) == blob.size()) {
+            std::vector<uint8_t> saved(blob.size());
+            if(nvs.getBytes(NvsBlob::KEY, saved.data(), saved.size()) == saved.size() && saved == blob) {
+                LOGV(tag, "Skipping NVS blob, already saved");
+                nvs.skippedWrite();
+                nvs.end();
+                return true;
+            }
+        }
+        const bool saved = nvs.putBytes(NvsBlob::KEY, blob.data(), blob.size()) == blob.size();
+        if(!saved)
+            Logger::loge(tag, "Failed to save NVS blob of %zu bytes", blob.size());
+        else
+            LOGV(tag, "Saved NVS blob of %zu bytes", blob.size());
+        nvs.end();
+        return saved;
+    }
+
+    for(const auto &[key, value] : snapshot.values) {
+        if(std::find(keys.begin(), keys.end(), key) == keys.end())
+            continue;
+        if(std::string(nvs.getString(key.c_str(), EMPTY_VALUE).c_str()) == value) {
+           LOGV(tag, "Skipping %s = %s, already saved", key.c_str(), value.c_str());
+           nvs.skippedWrite();
+           continue;
+        }
+        if(value == EMPTY_VALUE) {
+            nvs.remove(key.c_str());
+        } else if(nvs.putString(key.c_str(), value.c_str()) != value.length()) {
+            Logger::loge(tag, "Failed to save %s = %s", key.c_str(), value.c_str());
+            nvs.end();
+            return false;
+        }
+        LOGV(tag, "Saved %s = %s", key.c_str(), value.c_str());
+    }
+
+    nvs.end();
+    return true;
+}
+
 template<>
 bool HasData<>::saveNvsData(const std::vector<std::string> &keys, const bool _dataAlreadyLocked) const {
     const auto nvsNamespace = getNvsNamespace();
-    Logger::logv(getTag(), "[saveNVSData] for namespace %s", nvsNamespace.c_str());
+    LOGV(getTag(), "[saveNVSData] for namespace %s", nvsNamespace.c_str());
 
     const auto &nvsKeys = getNvsKeys();
     if(nvsKeys.empty()) {
@@ -84,49 +217,22 @@ bool HasData<>::saveNvsData(const std::vector<std::string> &keys, const bool _da
         return false;
     }
 
-    Preferences nvs;
     std::unique_lock nvsLock{nvsDataMutex, std::defer_lock};
-    std::unique_lock _dataLock{_dataMutex, std::defer_lock};
+    DataReadLock _dataLock{_dataMutex, std::defer_lock};
     if(!_dataAlreadyLocked)
         std::lock(nvsLock, _dataLock);
     else
         nvsLock.lock();
 
-    if(!nvs.begin(nvsNamespace.c_str(), false)) {
-        Logger::loge(getTag(), "Failed to open (rw) NVS namespace %s", nvsNamespace.c_str());
-        return false;
-    }
-
-    const auto &readOnlyKeys = getReadOnlyKeys();
-    for(const auto &key : keys) {
-        if(std::find(readOnlyKeys.begin(), readOnlyKeys.end(), key) == readOnlyKeys.end() &&
-                  std::find(nvsKeys.begin(), nvsKeys.end(), key) != nvsKeys.end()) {
-            const auto value = getWithOptLock(key, true);
-            if(std::string(nvs.getString(key.c_str(), EMPTY_VALUE).c_str()) == value) {
-               Logger::logv(getTag(), "Skipping %s = %s, already saved", key.c_str(), value.c_str());
-               continue;
-            }
-            if(value == EMPTY_VALUE) {
-                nvs.remove(key.c_str());
-            } else if(nvs.putString(key.c_str(), value.c_str()) != value.length()) {
-                Logger::loge(getTag(), "Failed to save %s = %s", key.c_str(), value.c_str());
-                nvs.end();
-                return false;
-            }
-            Logger::logv(getTag(), "Saved %s = %s", key.c_str(), value.c_str());
-        }
-    }
-
-    nvs.end();
-    return true;
+    return writeNvsSnapshot(takeNvsSnapshot(keys, true), keys);
 }
 
 template<>
 bool HasData<>::deleteNvsData() const {
     const auto nvsNamespace = getNvsNamespace();
-    Logger::logv(getTag(), "[deleteNVSData] for namespace %s", nvsNamespace.c_str());
+    LOGV(getTag(), "[deleteNVSData] for namespace %s", nvsNamespace.c_str());
 
-    Preferences nvs;
+    MeteredPreferences nvs;
     std::scoped_lock l{nvsDataMutex};
 
     if(!nvs.begin(nvsNamespace.c_str(), false)) {
@@ -147,10 +253,10 @@ bool HasData<>::deleteNvsData() const {
 
 template<>
 std::map<std::string, std::string> HasData<>::getData() const {
-    Logger::logv(getTag(), "[getData] for instanceID %s", instanceID.c_str());
-    const auto keys = getKeys();
+    LOGV(getTag(), "[getData] for instanceID %s", instanceID.c_str());
+    const auto &keys = getKeys();
     std::map<std::string, std::string> data;
-    std::scoped_lock l{_dataMutex};
+    DataReadLock l{_dataMutex};
     for(auto &key : keys) {
         data.emplace(key, getWithOptLock(key, true));
     }
@@ -159,24 +265,37 @@ std::map<std::string, std::string> HasData<>::getData() const {
 
 template<>
 bool HasData<>::setData(const std::map<std::string, std::string> &newData) {
-    Logger::logv(getTag(), "[setData] for instanceID %s", instanceID.c_str());
-    std::vector<std::string> changedKeys;
-    const auto &readOnlyKeys = getReadOnlyKeys();
+    LOGV(getTag(), "[setData] for instanceID %s", instanceID.c_str());
     std::scoped_lock l{_dataMutex};
+
+    // validate the whole batch first so it's either all applied or none of it, the values validated are the ones set
+    std::map<std::string, std::string> cleanData;
+    for(const auto &[key, value] : newData) {
+        if(!hasKey(key) || isReadOnlyKey(key))
+            continue;
+        auto cleanValue = utils::trim_clean(value);
+        if(!validateValue(key, cleanValue)) {
+            Logger::loge(getTag(), "Invalid %s = %s, not saving any of the %zu values", key.c_str(), value.c_str(), newData.size());
+            return false;
+        }
+        cleanData.emplace(key, std::move(cleanValue));
+    }
+
+    std::vector<std::string> changedKeys;
     for(const auto &key : getKeys()) {
-        if (std::find(readOnlyKeys.begin(), readOnlyKeys.end(), key) == readOnlyKeys.end() &&
-                newData.find(key) != newData.end()) {
-            const auto &value = newData.at(key);
+        if (cleanData.find(key) != cleanData.end()) {
+            const auto &value = cleanData.at(key);
             if(setWithOptLockAndUpdate(key, value, true, false)) {
                 changedKeys.emplace_back(key);
+                markDirty(key);
             } else {
-                Logger::loge(getTag(), "Failed to save %s = %s", key.c_str(), value.c_str());
+                LOGV(getTag(), "Not saving %s = %s, unchanged", key.c_str(), value.c_str());
             }
         }
     }
-    const auto changed = !changedKeys.empty();
-    if(changed) {
-        return updateObj(changedKeys, true);
-    }
-    return changed;
+    if(changedKeys.empty())
+        return false;
+    // one update for the batch, also retries keys left pending by a failed update
+    _pendingObjUpdateKeys.insert(_pendingObjUpdateKeys.end(), changedKeys.begin(), changedKeys.end());
+    return queueObjUpdate({}, true, true);
 }
\ No newline at end of file
@@ -0,0 +1,157 @@
+#ifndef NVS_BLOB_H_
+#define NVS_BLOB_H_
+
+#include <utils.h>
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <variant>
+
+#include "DataValue.h"
+
+/*
+ * NvsBlob packs the NVS values of a HasData namespace into one binary record so it can be saved with a single
+ *  `Preferences::putBytes()`, values keep their DataValue type so they don't need formatting or parsing.
+ *
+ *  Layout (little endian):
+ *      uint8 version, uint16 entry count,
+ *      per entry: uint8 key length, key, uint8 type, value (int64, double, uint8 bool or uint16 length + string),
+ *      uint32 CRC-32 of everything before it.
+ *  Empty values aren't stored, same as the per-key layout.
+ */
+class NvsBlob {
+    public:
+        inline static constexpr uint8_t VERSION{1};
+        // Preferences key of the blob, NVS keys must be shorter than 16 characters
+        inline static constexpr const char * const KEY{"_hasdata_v1"};
+
+        using Entries = std::vector<std::pair<std::string, DataValue>>;
+
+        [[nodiscard]] static std::vector<uint8_t> pack(const Entries &entries) {
+            std::vector<uint8_t> blob;
+            blob.push_back(VERSION);
+            const size_t countPos = blob.size();
+            putInt<uint16_t>(blob, 0);
+            uint16_t count = 0;
+            for(const auto &[key, value] : entries) {
+                if(value.isEmpty() || key.length() > UINT8_MAX)
+                    continue;
+                blob.push_back((uint8_t)key.length());
+                blob.insert(blob.end(), key.begin(), key.end());
+                const auto &variant = value.getVariant();
+                blob.push_back((uint8_t)variant.index());
+                if(const auto *i = std::get_if<int64_t>(&variant)) {
+                    putInt<uint64_t>(blob, (uint64_t)*i);
+                } else if(const auto *d = std::get_if<double>(&variant)) {
+                    uint64_t bits;
+                    std::memcpy(&bits, d, sizeof(bits));
+                    putInt<uint64_t>(blob, bits);
+                } else if(const auto *b = std::get_if<bool>(&variant)) {
+                    blob.push_back(*b ? 1 : 0);
+                } else if(const auto *s = std::get_if<std::string>(&variant)) {
+                    const auto length = (uint16_t)std::min<size_t>(s->length(), UINT16_MAX);
+                    putInt<uint16_t>(blob, length);
+                    blob.insert(blob.end(), s->begin(), s->begin() + length);
+                }
+                count++;
+            }
+            blob[countPos] = (uint8_t)count;
+            blob[countPos + 1] = (uint8_t)(count >> 8);
+            putInt<uint32_t>(blob, utils::crc32(blob.data(), blob.size()));
+            return blob;
+        }
+
+        // Returns false if `blob` is truncated, has a bad CRC or an unknown version, `entries` is only set on success
+        [[nodiscard]] static bool unpack(const uint8_t *blob, const size_t length, Entries &entries) {
+            if(length < HEADER_SIZE + CRC_SIZE)
+                return false;
+            const size_t dataLength = length - CRC_SIZE;
+            if(utils::crc32(blob, dataLength) != (uint32_t)getInt<uint32_t>(blob + dataLength))
+                return false;
+            if(blob[0] != VERSION)
+                return false;
+
+            Entries unpacked;
+            const auto count = (uint16_t)getInt<uint16_t>(blob + 1);
+            unpacked.reserve(count);
+            size_t pos = HEADER_SIZE;
+            const auto has = [&pos, dataLength](const size_t n) { return dataLength - pos >= n; };
+            for(uint16_t i = 0; i < count; i++) {
+                if(!has(1) || !has(1 + (size_t)blob[pos] + 1))
+                    return false;
+                const size_t keyLength = blob[pos++];
+                std::string key((const char *)blob + pos, keyLength);
+                pos += keyLength;
+                const uint8_t type = blob[pos++];
+                DataValue value;
+                if(type == INT_TYPE || type == FLOAT_TYPE) {
+                    if(!has(8))
+                        return false;
+                    const uint64_t bits = getInt<uint64_t>(blob + pos);
+                    pos += 8;
+                    if(type == INT_TYPE) {
+                        value = (int64_t)bits;
+                    } else {
+                        double d;
+                        std::memcpy(&d, &bits, sizeof(d));
+                        value = d;
+                    }
+                } else if(type == BOOL_TYPE) {
+                    if(!has(1))
+                        return false;
+                    value = blob[pos++] != 0;
+                } else if(type == STRING_TYPE) {
+                    if(!has(2))
+                        return false;
+                    const size_t valueLength = getInt<uint16_t>(blob + pos);
+                    pos += 2;
+                    if(!has(valueLength))
+                        return false;
+                    value = std::string((const char *)blob + pos, valueLength);
+                    pos += valueLength;
+                } else {
+                    return false;
+                }
+                unpacked.emplace_back(std::move(key), std::move(value));
+            }
+            if(pos != dataLength)
+                return false;
+            entries = std::move(unpacked);
+            return true;
+        }
+
+    private:
+        inline static constexpr size_t HEADER_SIZE{3};
+        inline static constexpr size_t CRC_SIZE{4};
+        // DataValue::Variant indexes
+        inline static constexpr uint8_t INT_TYPE{1};
+        inline static constexpr uint8_t FLOAT_TYPE{2};
+        inline static constexpr uint8_t BOOL_TYPE{3};
+        inline static constexpr uint8_t STRING_TYPE{4};
+        static_assert(std::is_same_v<std::variant_alternative_t<INT_TYPE, DataValue::Variant>, int64_t> &&
+                      std::is_same_v<std::variant_alternative_t<FLOAT_TYPE, DataValue::Variant>, double> &&
+                      std::is_same_v<std::variant_alternative_t<BOOL_TYPE, DataValue::Variant>, bool> &&
+                      std::is_same_v<std::variant_alternative_t<STRING_TYPE, DataValue::Variant>, std::string>,
+                      "NvsBlob types must match DataValue::Variant");
+
+        template<class T>
+        static void putInt(std::vector<uint8_t> &blob, const T value) {
+            for(size_t i = 0; i < sizeof(T); i++)
+                blob.push_back((uint8_t)(value >> (8 * i)));
+        }
+
+        template<class T>
+        [[nodiscard]] static T getInt(const uint8_t *data) {
+            T value = 0;
+            for(size_t i = 0; i < sizeof(T); i++)
+                value |= (T)data[i] << (8 * i);
+            return value;
+        }
+};
+
+#endif // NVS_BLOB_H_
@@ -0,0 +1,128 @@
+#ifndef NVS_METRICS_H_
+#define NVS_METRICS_H_
+
+#include <Preferences.h>
+
+#include <mutex>
+#include <map>
+#include <string>
+#include <cstdint>
+#include <utility>
+
+/*
+ * NvsMetrics counts NVS operations per namespace so flash wear can be estimated, see NvsStats to publish them.
+ *  The counters are since boot, writes that were skipped because the value was already saved are counted separately
+ *  since they don't wear the flash.
+ */
+class NvsMetrics {
+    public:
+        struct Counters {
+            uint32_t opens{0};
+            uint32_t reads{0};
+            uint32_t writes{0};
+            uint32_t skippedWrites{0};
+            uint32_t removes{0}; // includes clearing the namespace
+            uint64_t bytesWritten{0};
+
+            Counters &operator+=(const Counters &other) {
+                opens += other.opens;
+                reads += other.reads;
+                writes += other.writes;
+                skippedWrites += other.skippedWrites;
+                removes += other.removes;
+                bytesWritten += other.bytesWritten;
+                return *this;
+            }
+        };
+
+        // Counters of `nvsNamespace`, or of all namespaces added together if it's empty
+        [[nodiscard]] static Counters get(const std::string &nvsNamespace) {
+            std::scoped_lock l{mutex};
+            if(!nvsNamespace.empty()) {
+                const auto it = counters.find(nvsNamespace);
+                return it == counters.end() ? Counters{} : it->second;
+            }
+            Counters total;
+            for(const auto &[_, c] : counters)
+                total += c;
+            return total;
+        }
+
+        template<class F>
+        static void update(const std::string &nvsNamespace, F &&f) {
+            std::scoped_lock l{mutex};
+            f(counters[nvsNamespace]);
+        }
+
+        static void reset() {
+            std::scoped_lock l{mutex};
+            counters.clear();
+        }
+
+    private:
+        inline static std::mutex mutex;
+        inline static std::map<std::string, Counters> counters;
+};
+
+/*
+ * Preferences that counts its operations in NvsMetrics under the namespace it was opened with. Callers that skip a
+ *  write because the value is already saved should call `skippedWrite()`.
+ */
+class MeteredPreferences {
+    public:
+        bool begin(const char *namespaceStr, const bool readOnly = false) {
+            const bool opened = nvs.begin(namespaceStr, readOnly);
+            if(opened) {
+                nvsNamespace = namespaceStr;
+                NvsMetrics::update(nvsNamespace, [](auto &c) { c.opens++; });
+            }
+            return opened;
+        }
+
+        void end() { nvs.end(); }
+
+        bool isKey(const char *key) { return nvs.isKey(key); }
+
+        template<class... Args>
+        auto getString(Args &&... args) {
+            NvsMetrics::update(nvsNamespace, [](auto &c) { c.reads++; });
+            return nvs.getString(std::forward<Args>(args)...);
+        }
+
+        size_t putString(const char *key, const char *value) {
+            const size_t written = nvs.putString(key, value);
+            NvsMetrics::update(nvsNamespace, [written](auto &c) { c.writes++; c.bytesWritten += written; });
+            return written;
+        }
+
+        size_t getBytesLength(const char *key) { return nvs.getBytesLength(key); }
+
+        size_t getBytes(const char *key, void *buf, const size_t maxLen) {
+            NvsMetrics::update(nvsNamespace, [](auto &c) { c.reads++; });
+            return nvs.getBytes(key, buf, maxLen);
+        }
+
+        size_t putBytes(const char *key, const void *value, const size_t len) {
+            const size_t written = nvs.putBytes(key, value, len);
+            NvsMetrics::update(nvsNamespace, [written](auto &c) { c.writes++; c.bytesWritten += written; });
+            return written;
+        }
+
+        bool remove(const char *key) {
+            NvsMetrics::update(nvsNamespace, [](auto &c) { c.removes++; });
+            return nvs.remove(key);
+        }
+
+        bool clear() {
+            NvsMetrics::update(nvsNamespace, [](auto &c) { c.removes++; });
+            return nvs.clear();
+        }
+
+        void skippedWrite() { NvsMetrics::update(nvsNamespace, [](auto &c) { c.skippedWrites++; }); }
+
+    private:
+        Preferences nvs;
+        std::string nvsNamespace;
+};
+
+#endif // NVS_METRICS_H_
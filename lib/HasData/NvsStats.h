@@ -0,0 +1,68 @@
+#ifndef NVS_STATS_H_
+#define NVS_STATS_H_
+
+#include "HasData.h"
+#include "NvsMetrics.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+
+/*
+ * NvsStats exposes the NvsMetrics counters of an NVS namespace, or of all of them if `nvsNamespace` is empty, as
+ *  read-only keys so they can be published, ex.: with MQTTController::registerHasDataItem().
+ */
+class NvsStats : public HasData<> {
+    public:
+        inline static constexpr const char * const TAG{"nvsst"};
+
+        // Data keys
+        inline static constexpr const char * const OPENS = "opens";
+        inline static constexpr const char * const READS = "reads";
+        inline static constexpr const char * const WRITES = "writes";
+        inline static constexpr const char * const SKIPPED_WRITES = "skipped_writes";
+        inline static constexpr const char * const REMOVES = "removes";
+        inline static constexpr const char * const BYTES_WRITTEN = "bytes_written";
+
+        explicit NvsStats(const std::string &instanceID, std::string nvsNamespace = "") :
+                            HasData(instanceID),
+                            nvsNamespace(std::move(nvsNamespace)) { }
+
+        [[nodiscard]] const char * getTag() const override { return TAG; }
+
+        using HasData::getData;
+        using HasData::get;
+        using HasData::getValue;
+        [[nodiscard]] const std::vector<std::string> &getKeys() const override { return readOnlyKeys; }
+        [[nodiscard]] const std::vector<std::string> &getReadOnlyKeys() const override { return readOnlyKeys; }
+
+    private:
+        inline static const std::vector<std::string> readOnlyKeys{OPENS, READS, WRITES, SKIPPED_WRITES, REMOVES, BYTES_WRITTEN};
+
+        const std::string nvsNamespace;
+
+        [[nodiscard]] std::string getWithOptLock(const std::string &key, const bool noLock) const override {
+            return getValueWithOptLock(key, noLock).toString(HasData::EMPTY_VALUE);
+        }
+
+        [[nodiscard]] NvsMetrics::Counters counters() const { return NvsMetrics::get(nvsNamespace); }
+
+        [[nodiscard]] DataValue getValueWithOptLock(const std::string &key, const bool noLock) const override {
+            static constexpr auto getters = makeDataKeyTable<ValueGetter<NvsStats>>({
+                                        {OPENS,          [](const NvsStats *self) -> DataValue { return self->counters().opens; }},
+                                        {READS,          [](const NvsStats *self) -> DataValue { return self->counters().reads; }},
+                                        {WRITES,         [](const NvsStats *self) -> DataValue { return self->counters().writes; }},
+                                        {SKIPPED_WRITES, [](const NvsStats *self) -> DataValue { return self->counters().skippedWrites; }},
+                                        {REMOVES,        [](const NvsStats *self) -> DataValue { return self->counters().removes; }},
+                                        {BYTES_WRITTEN,  [](const NvsStats *self) -> DataValue { return self->counters().bytesWritten; }}
+                                       });
+            return getDataKeyHelper(getters, this, key, noLock);
+        }
+
+        [[nodiscard]] bool setWithOptLockAndUpdate(const std::string &key, const std::string &value, const bool noLock, const bool doObjUpdate) override {
+            Logger::logw(TAG, "Key %s is read-only or not found", key.c_str());
+            return false;
+        }
+};
+
+#endif // NVS_STATS_H_
@@ -0,0 +1,169 @@
+#ifndef NVS_WRITE_BEHIND_H_
+#define NVS_WRITE_BEHIND_H_
+
+#include <Logger.h>
+#include <utils.h>
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#ifndef NVS_WRITE_BEHIND_RETRY_MS // shortest wait before retrying a failed save
+#define NVS_WRITE_BEHIND_RETRY_MS 1000
+#endif
+
+/*
+ * NvsWriteBehind defers HasData NVS saves to a background thread so setters don't wait for flash writes. Saves of the
+ *  same object scheduled within the window are coalesced into one save of all their keys, which is run when the window
+ *  of the first one ends. The window is 0 by default, which disables it and HasData saves synchronously as before.
+ *
+ *  `flush()` saves everything pending right away and must be called before restarting, ex.: factory reset and OTA,
+ *  otherwise pending values are lost. A failed save is logged and retried after the window, or NVS_WRITE_BEHIND_RETRY_MS
+ *  if that's longer, so a failing flash isn't retried in a tight loop.
+ */
+class NvsWriteBehind {
+    public:
+        inline static constexpr const char * const TAG{"nvswb"};
+        using Clock = std::chrono::steady_clock;
+        using Save = std::function<bool(const std::vector<std::string> &keys)>;
+
+        // Never destroyed so HasData objects with static storage can still cancel in their destructors at exit
+        static NvsWriteBehind &instance() {
+            static auto *writeBehind = new NvsWriteBehind();
+            return *writeBehind;
+        }
+
+        NvsWriteBehind(const NvsWriteBehind &) = delete;
+        NvsWriteBehind &operator=(const NvsWriteBehind &) = delete;
+
+        void setWindow(const std::chrono::milliseconds newWindow) {
+            std::scoped_lock l{mutex};
+            window = newWindow;
+        }
+        [[nodiscard]] std::chrono::milliseconds getWindow() const {
+            std::scoped_lock l{mutex};
+            return window;
+        }
+        [[nodiscard]] bool isEnabled() const { return getWindow().count() > 0; }
+
+        // Number of saves run, coalesced saves count once
+        [[nodiscard]] unsigned long getSaveCount() const {
+            std::scoped_lock l{mutex};
+            return saveCount;
+        }
+
+        /* Schedules `save` of `keys` for `owner`, merging the keys with a save already pending for it, in which case
+         *  the pending save's deadline is kept and `save` replaces its function, so the newest values are saved.
+         *  `save` runs on the writer thread, it must not use `owner`, which calls `cancel()` when it's destroyed. */
+        void schedule(const void *owner, const std::vector<std::string> &keys, Save save) {
+            {
+                std::scoped_lock l{mutex};
+                auto it = pending.find(owner);
+                if(it == pending.end()) {
+                    it = pending.emplace(owner, Pending{Clock::now() + window, {}, std::move(save)}).first;
+                    LOGV(TAG, "Scheduled save in %lldms", (long long)window.count());
+                } else {
+                    it->second.save = std::move(save);
+                }
+                for(const auto &key : keys)
+                    if(std::find(it->second.keys.begin(), it->second.keys.end(), key) == it->second.keys.end())
+                        it->second.keys.push_back(key);
+                if(!threadStarted) {
+                    std::thread t([this]() { loop(); });
+                    t.detach(); //NOSONAR - won't fix, intended to run indefinitely
+                    threadStarted = true;
+                }
+            }
+            cond.notify_all();
+        }
+
+        // Drops the save pending for `owner` and waits for it if it's being saved right now
+        void cancel(const void *owner) {
+            std::unique_lock l{mutex};
+            if(pending.erase(owner) > 0)
+                Logger<>::logw(TAG, "Dropped a pending NVS save, the object was destroyed before it was saved");
+            cond.wait(l, [this, owner]() { return saving != owner; });
+        }
+
+        // Runs all pending saves now, returns false if any failed (they stay pending)
+        bool flush() {
+            std::unique_lock l{mutex};
+            LOGV(TAG, "Flushing %zu pending saves", pending.size());
+            return saveDue(l, Clock::time_point::max());
+        }
+
+    private:
+        struct Pending {
+            Clock::time_point deadline;
+            std::vector<std::string> keys;
+            Save save;
+        };
+
+        mutable std::mutex mutex;
+        std::condition_variable cond;
+        bool threadStarted{false};
+        std::chrono::milliseconds window{0};
+        std::map<const void *, Pending> pending;
+        const void *saving{nullptr};
+        unsigned long saveCount{0};
+
+        NvsWriteBehind() = default;
+
+        [[noreturn]] void loop() {
+            std::unique_lock l{mutex};
+            while(true) {
+                if(pending.empty()) {
+                    cond.wait(l);
+                    continue;
+                }
+                const auto next = std::min_element(pending.begin(), pending.end(), [](const auto &a, const auto &b) {
+                    return a.second.deadline < b.second.deadline;
+                })->second.deadline;
+                if(cond.wait_until(l, next) == std::cv_status::timeout)
+                    saveDue(l, Clock::now());
+            }
+        }
+
+        // Saves everything due by `now` one at a time without holding `l` while saving, so setters aren't blocked
+        bool saveDue(std::unique_lock<std::mutex> &l, const Clock::time_point now) {
+            bool saved = true;
+            // wait for a save in progress on the writer thread so flush() returns after it's done
+            cond.wait(l, [this]() { return saving == nullptr; });
+            std::vector<const void *> due;
+            for(const auto &[owner, p] : pending)
+                if(p.deadline <= now)
+                    due.push_back(owner);
+            for(const auto *owner : due) {
+                const auto it = pending.find(owner);
+                if(it == pending.end())
+                    continue; // cancelled meanwhile
+                Pending p = std::move(it->second);
+                pending.erase(it);
+                saving = owner;
+                l.unlock();
+                const bool ok = p.save(p.keys);
+                l.lock();
+                saving = nullptr;
+                saveCount++;
+                if(!ok) {
+                    saved = false;
+                    const auto delay = std::max(window, std::chrono::milliseconds(NVS_WRITE_BEHIND_RETRY_MS));
+                    Logger<>::loge(TAG, "Failed to save %s, retrying in %lldms", utils::join(p.keys, ", ").c_str(), (long long)delay.count());
+                    auto &retry = pending.emplace(owner, Pending{Clock::now() + delay, {}, std::move(p.save)}).first->second;
+                    for(const auto &key : p.keys)
+                        if(std::find(retry.keys.begin(), retry.keys.end(), key) == retry.keys.end())
+                            retry.keys.push_back(key);
+                }
+                cond.notify_all();
+            }
+            return saved;
+        }
+};
+
+#endif // NVS_WRITE_BEHIND_H_
@@ -1,27 +1,38 @@
 #include "LeadingEdgePhaseDimmer.h"
-#include "settings.h"
 
 #include <string>
 
 LeadingEdgePhaseDimmer::LeadingEdgePhaseDimmer(const std::string &instanceID, const uint8_t triacPin,
-                                               const bool triacPinPolarityInverted, const uint16_t resolution) :
+                                               const bool triacPinPolarityInverted, const uint16_t resolution, DimmerBank *bank) :
             ZeroCrossing(instanceID),
             _triacPin(triacPin),
-            _triacPinPolarityInverted(triacPinPolarityInverted) {
+            _triacPinPolarityInverted(triacPinPolarityInverted),
+            _bank(bank) {
 
     setResolution(resolution);
-    pinMode(_triacPin, OUTPUT);
-    digitalWrite(_triacPin, LOW ^ _triacPinPolarityInverted);
+    mains_hal::pinOutput(_triacPin, _triacPinPolarityInverted); // off
 
-    isrInit();
+    if(_bank != nullptr) {
+        _bankChannel = _bank->addChannel(_triacPin, _triacPinPolarityInverted, DimmerBank::ChannelKind::LEADING_EDGE, &_fade);
+        if(_bankChannel < 0)
+            Logger::loge(TAG, "Dimmer bank %s is full, using own ISR", _bank->getInstanceID().c_str());
+        else
+            _bank->setOnPosition(_bankChannel, _onPosition);
+    }
+    if(_bankChannel < 0)
+        isrInit();
 }
 
 LeadingEdgePhaseDimmer::~LeadingEdgePhaseDimmer() {
-    digitalWrite(_triacPin, LOW ^ _triacPinPolarityInverted);
+    // no ISR may turn it back on once it's off
+    unregisterIsr();
+    if(_bankChannel >= 0)
+        _bank->removeChannel(_bankChannel);
+    setTriac(false);
 }
 
 void LeadingEdgePhaseDimmer::setBrightness(const uint16_t brightness, bool noLock) {
-    Logger::logv(TAG, "[setBrightness 1] Setting brightness to %d", brightness);
+    LOGV(TAG, "[setBrightness 1] Setting brightness to %d", brightness);
     std::unique_lock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
@@ -35,21 +46,25 @@ void LeadingEdgePhaseDimmer::setBrightness(const uint16_t brightness, bool noLoc
     } else {
         this->_brightness = brightness;
     }
+    updateOnPosition(mains_timing::leadingEdgeOnPosition<RESOLUTION_MAX_SIZE>(_brightness, _resolution));
+    markDirty(BRIGHTNESS);
+    markDirty(PERCENT_APPARENT_BRIGHTNESS);
 }
 
 void LeadingEdgePhaseDimmer::setBrightness(const uint16_t brightness, const uint16_t resolution, const uint16_t minNoFlickerBrightness, bool noLock) {
-    Logger::logv(TAG, "[setBrightness 2] Setting brightness to %d", brightness);
+    LOGV(TAG, "[setBrightness 2] Setting brightness to %d", brightness);
     std::unique_lock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
     _brightness = 0; // prevent out of range brightness temporarily
+    updateOnPosition(RESOLUTION_MAX_SIZE);
     setResolution(resolution, true);
     setMinNoFlickerBrightness(minNoFlickerBrightness, true);
     setBrightness(brightness, true);
 }
 
 void LeadingEdgePhaseDimmer::setPercentApparentBrightness(const uint8_t percent, bool noLock) {
-    Logger::logv(TAG, "[setPercentBrightness] Setting percent brightness to %d", percent);
+    LOGV(TAG, "[setPercentBrightness] Setting percent brightness to %d", percent);
     if(percent > 100) {
         Logger::loge(TAG, "Invalid percent, %d is greater than 100", percent);
         return;
@@ -57,12 +72,36 @@ void LeadingEdgePhaseDimmer::setPercentApparentBrightness(const uint8_t percent,
     std::unique_lock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
-    const double percHalfPeriod = std::acos(1-(double)2*percent/100)/PI;
-    setBrightness((uint16_t)percHalfPeriod *_resolution, true);
+    setBrightness(mains_timing::percentToBrightness(percent, _resolution), true);
+}
+
+void LeadingEdgePhaseDimmer::fadeTo(const uint16_t brightness, const uint32_t duration_ms, const FadeCurve curve, bool noLock) {
+    LOGV(TAG, "[fadeTo] Fading to brightness %d over %dms", brightness, duration_ms);
+    std::unique_lock l{_dataMutex, std::defer_lock};
+    if(!noLock)
+        l.lock();
+    if(brightness > _resolution) {
+        Logger::loge(TAG, "brightness %d is greater than resolution %d", brightness, _resolution);
+        return;
+    }
+    const uint32_t halfCycles = halfPeriod_us == 0 ? 0 : (uint32_t)((uint64_t)duration_ms * 1000 / halfPeriod_us);
+    if(halfCycles == 0) {
+        setBrightness(brightness, true);
+        return;
+    }
+    using namespace mains_timing;
+    const uint32_t from = _fade.isActive() ? _fade.level()
+                                           : leadingEdgeLevel<RESOLUTION_MAX_SIZE>(leadingEdgeOnPosition<RESOLUTION_MAX_SIZE>(_brightness, _resolution));
+    this->_brightness = brightness > 0 && brightness < _minNoFlickerBrightness ? _minNoFlickerBrightness : brightness;
+    const uint32_t to = leadingEdgeLevel<RESOLUTION_MAX_SIZE>(leadingEdgeOnPosition<RESOLUTION_MAX_SIZE>(_brightness, _resolution));
+    const uint32_t floor = leadingEdgeLevel<RESOLUTION_MAX_SIZE>(leadingEdgeOnPosition<RESOLUTION_MAX_SIZE>(_minNoFlickerBrightness, _resolution));
+    _fade.start(from, to, RESOLUTION_MAX_SIZE, halfCycles, curve, floor);
+    markDirty(BRIGHTNESS);
+    markDirty(PERCENT_APPARENT_BRIGHTNESS);
 }
 
 void LeadingEdgePhaseDimmer::setMinNoFlickerBrightness(const uint16_t minNoFlickerBrightness, bool noLock) {
-    Logger::logv(TAG, "[setMinNoFlickerBrightness] Setting minNoFlickerBrightness to %d", minNoFlickerBrightness);
+    LOGV(TAG, "[setMinNoFlickerBrightness] Setting minNoFlickerBrightness to %d", minNoFlickerBrightness);
     std::unique_lock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
@@ -71,13 +110,13 @@ void LeadingEdgePhaseDimmer::setMinNoFlickerBrightness(const uint16_t minNoFlick
         this->_minNoFlickerBrightness = _resolution/3;
         return;
     }
-    Logger::logv(TAG, "Setting minNoFlickerBrightness to %d", minNoFlickerBrightness);
+    LOGV(TAG, "Setting minNoFlickerBrightness to %d", minNoFlickerBrightness);
     this->_minNoFlickerBrightness = minNoFlickerBrightness;
     setBrightness(_brightness, true);
 }
 
 void LeadingEdgePhaseDimmer::setResolution(const uint16_t resolution, bool noLock) {
-    Logger::logv(TAG, "[setResolution] Setting resolution to %d", resolution);
+    LOGV(TAG, "[setResolution] Setting resolution to %d", resolution);
     if(resolution > RESOLUTION_MAX_SIZE || resolution < 2) {
         Logger::loge(TAG, "resolution %d is out of range (min 2 to max %d)", resolution, RESOLUTION_MAX_SIZE);
         return;
@@ -86,64 +125,97 @@ void LeadingEdgePhaseDimmer::setResolution(const uint16_t resolution, bool noLoc
     if(!noLock)
         l.lock();
     _brightness = 0; // prevent out of range brightness temporarily
+    updateOnPosition(RESOLUTION_MAX_SIZE);
     const auto newNoFlickerBrightess = _minNoFlickerBrightness * resolution / _resolution;
-    Logger::logv(TAG, "Adjusting no-flicker brightness to %d for new resolution", newNoFlickerBrightess);
+    LOGV(TAG, "Adjusting no-flicker brightness to %d for new resolution", newNoFlickerBrightess);
     _minNoFlickerBrightness = newNoFlickerBrightess;
     const auto newBrightness = _brightness * resolution / _resolution;
-    Logger::logv(TAG, "Setting resolution to %d (and brightness to %d)", resolution, newBrightness);
+    LOGV(TAG, "Setting resolution to %d (and brightness to %d)", resolution, newBrightness);
     _resolution = resolution;
+    markDirty(RESOLUTION);
     setBrightness(newBrightness, true);
 }
 
 uint16_t LeadingEdgePhaseDimmer::getResolution(bool noLock) const {
-    Logger::logv(TAG, "[getResolution] Getting resolution");
-    std::unique_lock l{_dataMutex, std::defer_lock};
+    LOGV(TAG, "[getResolution] Getting resolution");
+    DataReadLock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
     return _resolution;
 }
 
 uint16_t LeadingEdgePhaseDimmer::getBrightness(bool noLock) const {
-    Logger::logv(TAG, "[getBrightness] Getting brightness");
-    std::unique_lock l{_dataMutex, std::defer_lock};
+    LOGV(TAG, "[getBrightness] Getting brightness");
+    DataReadLock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
     return _brightness;
 }
 
 uint8_t LeadingEdgePhaseDimmer::getPercentApparentBrightness(bool noLock) const {
-    Logger::logv(TAG, "[getPercentBrightness] Getting percentbrightness");
-    std::unique_lock l{_dataMutex, std::defer_lock};
+    LOGV(TAG, "[getPercentBrightness] Getting percentbrightness");
+    DataReadLock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
-    return (uint8_t)std::round((0.5 - std::cos(((double)getBrightness(true)/_resolution)*PI)/2)*100);
+    return mains_timing::brightnessToPercent(getBrightness(true), _resolution);
 }
 
 uint16_t LeadingEdgePhaseDimmer::getMinNoFlickerBrightness(bool noLock) const {
-    Logger::logv(TAG, "[getMinNoFlickerBrightness] Getting minNoFlickerBrightness");
-    std::unique_lock l{_dataMutex, std::defer_lock};
+    LOGV(TAG, "[getMinNoFlickerBrightness] Getting minNoFlickerBrightness");
+    DataReadLock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
     return _minNoFlickerBrightness;
 }
 
+void LeadingEdgePhaseDimmer::updateOnPosition(const int32_t onPosition) {
+    if(_fade.isActive()) { // the ISR sets it when it ends the fade
+        _fade.jump(mains_timing::leadingEdgeLevel<RESOLUTION_MAX_SIZE>(onPosition));
+        return;
+    }
+    _onPosition = onPosition;
+    if(_bankChannel >= 0)
+        _bank->setOnPosition(_bankChannel, onPosition);
+}
+
+void LeadingEdgePhaseDimmer::setTriac(const bool on) const {
+    if(on ^ _triacPinPolarityInverted)
+        mains_hal::outputSet(1<<_triacPin);
+    else
+        mains_hal::outputClear(1<<_triacPin);
+}
+
+void LeadingEdgePhaseDimmer::fadeStep() {
+    uint32_t level;
+    if(_fade.step(level))
+        _onPosition = mains_timing::leadingEdgeOnPositionAtLevel<RESOLUTION_MAX_SIZE>(level);
+}
 
 void LeadingEdgePhaseDimmer::timerISRCall(ZeroCrossing* instance, const unsigned currCyclePercentage) {
     auto *thisOne = (LeadingEdgePhaseDimmer*)instance;
-    const unsigned onPercentage = RESOLUTION_MAX_SIZE - (RESOLUTION_MAX_SIZE * thisOne->_brightness/thisOne->_resolution);
-    if ((currCyclePercentage > onPercentage || thisOne->_brightness == thisOne->_resolution) && thisOne->_brightness != 0) {
-        // turn on triac
-        if(thisOne->_triacPinPolarityInverted)
-            GPIO.out_w1tc = 1<<thisOne->_triacPin;
-        else
-            GPIO.out_w1ts = 1<<thisOne->_triacPin;
-        return;
+    if(currCyclePercentage > RESOLUTION_MAX_SIZE/2) { // same half cycle detection as PulseSkipModulationDimmer
+        thisOne->currHalfCycleFadeDone = false;
+    } else if(!thisOne->currHalfCycleFadeDone) {
+        thisOne->currHalfCycleFadeDone = true;
+        thisOne->fadeStep();
     }
+    thisOne->setTriac(mains_timing::leadingEdgeOnAt(currCyclePercentage, thisOne->_onPosition));
+}
 
-    // turn off triac
-    if(thisOne->_triacPinPolarityInverted)
-        GPIO.out_w1ts = 1<<thisOne->_triacPin;
+void LeadingEdgePhaseDimmer::eventISRCall(ZeroCrossing* instance, const InstanceEvent event, const uint32_t halfCycleStart_us, const unsigned halfPeriod_us) {
+    auto *thisOne = (LeadingEdgePhaseDimmer*)instance;
+    if(event == InstanceEvent::FIRE) {
+        thisOne->setTriac(true);
+        return;
+    }
+    // turn off at the start of each half cycle, then fire after the phase delay
+    thisOne->setTriac(false);
+    thisOne->fadeStep();
+    const uint32_t delay_us = mains_timing::leadingEdgeDelayAt_us<RESOLUTION_MAX_SIZE>(thisOne->_onPosition, halfPeriod_us);
+    if(delay_us == mains_timing::NO_FIRING)
+        return;
+    if(delay_us == 0)
+        thisOne->setTriac(true);
     else
-        GPIO.out_w1tc = 1<<thisOne->_triacPin;
+        scheduleEvent(instance, &LeadingEdgePhaseDimmer::eventISRCall, halfCycleStart_us + delay_us);
 }
-
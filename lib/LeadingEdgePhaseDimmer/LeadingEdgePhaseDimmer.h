@@ -1,13 +1,19 @@
 #ifndef LEADING_EDGE_PHASE_DIMMER_CONTROLLER_H
 #define LEADING_EDGE_PHASE_DIMMER_CONTROLLER_H
 
+#if __has_include("settings.h")
 #include "settings.h"
+#endif
 #include "ZeroCrossing.h"
 
 #include <Logger.h>
 #include <HasData.h>
 #include <ZeroCrossing.h>
+#include <DimmerBank.h>
 #include <utils.h>
+#include <phase_control.h>
+#include <apparent_power.h>
+#include <Fade.h>
 
 #include <string>
 #include <thread>
@@ -20,7 +26,10 @@
 class LeadingEdgePhaseDimmer : public ZeroCrossing {
     public:
         inline static constexpr const char *TAG{"LEPhD"};
-        explicit LeadingEdgePhaseDimmer(const std::string &instanceID, uint8_t triacPin, bool triacPinPolarityInverted = true, uint16_t resolution = 128);
+        using FadeCurve = mains_timing::FadeCurve;
+        // With a `bank` the triac is driven by the bank's ISR, falls back to its own if the bank is full
+        explicit LeadingEdgePhaseDimmer(const std::string &instanceID, uint8_t triacPin, bool triacPinPolarityInverted = true, uint16_t resolution = 128,
+                                        DimmerBank *bank = nullptr);
         ~LeadingEdgePhaseDimmer() override;
 
         [[nodiscard]] const char * getTag() const override { return TAG; }
@@ -33,6 +42,10 @@ class LeadingEdgePhaseDimmer : public ZeroCrossing {
         void setBrightness(uint16_t brightness, bool noLock = false);
         void setBrightness(uint16_t brightness, uint16_t resolution, uint16_t minNoFlickerBrightness = 0, bool noLock = false);
         void setPercentApparentBrightness(uint8_t percent, bool noLock = false);
+        /* Ramps to `brightness` over `duration_ms`, stepped every half cycle by the ISR. getBrightness() returns the
+         *  target straight away, setting the brightness or resolution ends the fade. */
+        void fadeTo(uint16_t brightness, uint32_t duration_ms, FadeCurve curve = FadeCurve::PERCEPTUAL, bool noLock = false);
+        [[nodiscard]] bool isFading() const { return _fade.isActive(); }
         void setMinNoFlickerBrightness(uint16_t minNoFlickerBrightness, bool noLock = false);
         void setResolution(uint16_t resolution, bool noLock = false);
         [[nodiscard]] uint16_t getResolution(bool noLock = false) const;
@@ -48,8 +61,8 @@ class LeadingEdgePhaseDimmer : public ZeroCrossing {
         inline static const std::vector<std::string> keys = utils::concat(readOnlyKeys,
                                                                utils::concat(ZeroCrossing::keys, {RESOLUTION, BRIGHTNESS, PERCENT_APPARENT_BRIGHTNESS}, true), true);
 
-        [[nodiscard]] std::vector<std::string> getKeys() const override { return keys; }
-        [[nodiscard]] std::vector<std::string> getReadOnlyKeys() const override { return readOnlyKeys; }
+        [[nodiscard]] const std::vector<std::string> &getKeys() const override { return keys; }
+        [[nodiscard]] const std::vector<std::string> &getReadOnlyKeys() const override { return readOnlyKeys; }
 
 
     private:
@@ -59,99 +72,90 @@ class LeadingEdgePhaseDimmer : public ZeroCrossing {
         uint16_t _resolution{128};
         uint16_t _brightness{0};
         uint16_t _minNoFlickerBrightness{128/3};
+        // _brightness as a position of the half cycle for the ISRs, see mains_timing::leadingEdgeOnPosition()
+        int32_t _onPosition{RESOLUTION_MAX_SIZE};
+        DimmerBank * const _bank;
+        int _bankChannel{-1};
+        // levels are mains_timing::leadingEdgeLevel(), the ISR owns _onPosition while it's active
+        mains_timing::Fade _fade{};
+        bool currHalfCycleFadeDone{false};
+
+        void updateOnPosition(int32_t onPosition);
+        void IRAM_ATTR fadeStep();
 
         static void IRAM_ATTR timerISRCall(ZeroCrossing* instance, unsigned currCyclePercentage);
+        static void IRAM_ATTR eventISRCall(ZeroCrossing* instance, InstanceEvent event, uint32_t halfCycleStart_us, unsigned halfPeriod_us);
+        void IRAM_ATTR setTriac(bool on) const;
         void addInstanceTimerISR() override {
             InstanceISRFunc timerISR = &LeadingEdgePhaseDimmer::timerISRCall;
-            instancesISRs.emplace_back(this, timerISR);
+            InstanceEventFunc eventISR = &LeadingEdgePhaseDimmer::eventISRCall;
+            if(!instancesISRs.add(this, timerISR) || !instancesEventISRs.add(this, eventISR))
+                Logger::loge(TAG, "Too many zero crossing instances, max is %zu", instancesISRs.capacity());
         }
 
     // HasData
         [[nodiscard]] std::string getWithOptLock(const std::string &key, const bool noLock) const override {
-            Logger::logv(TAG, "[getWithOptLock] Getting %s", key.c_str());
-
-            using retType = std::string;
-            using FunPtrType = retType(*)(const LeadingEdgePhaseDimmer*, const bool noLock);
-            std::string thisData = getStringDataHelper<FunPtrType>({
-                {BRIGHTNESS, (FunPtrType)[](const auto l, const bool noLock) -> retType { return std::to_string(l->getBrightness(noLock)); }},
-                {PERCENT_APPARENT_BRIGHTNESS, (FunPtrType)[](const auto l, const bool noLock) -> retType { return std::to_string(l->getPercentApparentBrightness(noLock)); }},
-                {RESOLUTION, (FunPtrType)[](const auto l, const bool noLock) -> retType { return std::to_string(l->getResolution(noLock)); }}
-            }, key, true, (FunPtrType)[](const auto, const bool) -> retType { return HasData::EMPTY_VALUE; })(this, noLock);
-
-            if(!thisData.empty() && thisData != HasData::EMPTY_VALUE)
-                return thisData;
-            return ZeroCrossing::getWithOptLock(key, noLock);
+            return getValueWithOptLock(key, noLock).toString(HasData::EMPTY_VALUE);
+        }
+
+        [[nodiscard]] DataValue getValueWithOptLock(const std::string &key, const bool noLock) const override {
+            LOGV(TAG, "[getValueWithOptLock] Getting %s", key.c_str());
+
+            static constexpr auto getters = makeDataKeyTable<ValueGetter<LeadingEdgePhaseDimmer>>({
+                {BRIGHTNESS, [](const LeadingEdgePhaseDimmer *l) -> DataValue { return l->getBrightness(true); }},
+                {PERCENT_APPARENT_BRIGHTNESS, [](const LeadingEdgePhaseDimmer *l) -> DataValue { return l->getPercentApparentBrightness(true); }},
+                {RESOLUTION, [](const LeadingEdgePhaseDimmer *l) -> DataValue { return l->getResolution(true); }}
+            });
+            if(getters.find(key.c_str()) == nullptr)
+                return ZeroCrossing::getValueWithOptLock(key, noLock);
+            return getDataKeyHelper(getters, this, key, noLock);
         }
 
 
         [[nodiscard]] bool setWithOptLockAndUpdate(const std::string &key, const std::string &value_raw, const bool noLock, const bool doObjUpdate) override {
-            if(std::find(readOnlyKeys.begin(), readOnlyKeys.end(), key) != readOnlyKeys.end() ||
-                std::find(keys.begin(), keys.end(), key) == keys.end()) {
+            return setValueWithOptLockAndUpdate(key, utils::trim_clean(value_raw), noLock, doObjUpdate);
+        }
+
+        [[nodiscard]] bool setValueWithOptLockAndUpdate(const std::string &key, const DataValue &value, const bool noLock, const bool doObjUpdate) override {
+            if(isReadOnlyKey(key) || !hasKey(key)) {
                 Logger::logw(TAG, "Key %s is read-only or not found", key.c_str());
                 return false;
             }
-            const std::string value = utils::trim_clean(value_raw);
-            Logger::logv(TAG, "[setWithOptLockAndUpdate] Setting %s to %s", key.c_str(), value.c_str());
+            LOGV(TAG, "[setValueWithOptLockAndUpdate] Setting %s to %s", key.c_str(), value.toString(HasData::EMPTY_VALUE).c_str());
 
-            const bool zeroCrossingUpdated = ZeroCrossing::setWithOptLockAndUpdate(key, value, noLock, doObjUpdate);
+            const bool zeroCrossingUpdated = ZeroCrossing::setValueWithOptLockAndUpdate(key, value, noLock, doObjUpdate);
             if(zeroCrossingUpdated)
                 return true;
 
-            static std::vector<std::string> keysToUpdateOnObj = {};
-            bool updated;
-
             std::unique_lock l{_dataMutex, std::defer_lock};
+            if(!noLock)
+                l.lock();
+            if(!validateValue(key, value))
+                return false;
+            const auto val = *value.asInt();
+
+            // changed only if the setter took it, ex.: the brightness is raised to the minimum without flicker
+            bool updated;
             switch(utils::hashstr(key.c_str())) {
                 case utils::hashstr(BRIGHTNESS): {
-                    if(!utils::isPositiveNumber(value)) {
-                        Logger::loge(TAG, "Invalid BRIGHTNESS value %s", value.c_str());
-                        return false;
-                    }
-                    const uint16_t val = std::stoi(value);
-                    if(!noLock)
-                        l.lock();
-                    updated = val != getBrightness(true);
-                    if(updated) {
-                        setBrightness(val, true);
-                        if (doObjUpdate)
-                            keysToUpdateOnObj.push_back(key);
-                    }
+                    const auto before = getBrightness(true);
+                    if(val != before)
+                        setBrightness((uint16_t)val, true);
+                    updated = getBrightness(true) != before;
                     break;
                 }
                 case utils::hashstr(PERCENT_APPARENT_BRIGHTNESS): {
-                    if(!utils::isPositiveNumber(value)) {
-                        Logger::loge(TAG, "Invalid PERCENT_BRIGHTNESS value %s", value.c_str());
-                        return false;
-                    }
-                    const auto val = (unsigned)std::stof(value);
-                    if(val > 100) {
-                        Logger::loge(TAG, "Invalid PERCENT_BRIGHTNESS value %s", value.c_str());
-                        return false;
-                    }
-                    if(!noLock)
-                        l.lock();
-                    updated = val != getPercentApparentBrightness(true);
-                    if(updated) {
-                        setPercentApparentBrightness(val, true);
-                        if (doObjUpdate)
-                            keysToUpdateOnObj.push_back(key);
-                    }
+                    const auto before = getBrightness(true);
+                    if(val != getPercentApparentBrightness(true))
+                        setPercentApparentBrightness((uint8_t)val, true);
+                    updated = getBrightness(true) != before;
                     break;
                 }
                 case utils::hashstr(RESOLUTION): {
-                    if(!utils::isPositiveNumber(value)) {
-                        Logger::loge(TAG, "Invalid RESOLUTION value %s", value.c_str());
-                        return false;
-                    }
-                    const uint16_t val = std::stoi(value);
-                    if(!noLock)
-                        l.lock();
-                    updated = val != getResolution(true);
-                    if(updated) {
-                        setResolution(val, true);
-                        if (doObjUpdate)
-                            keysToUpdateOnObj.push_back(key);
-                    }
+                    const auto before = getResolution(true);
+                    if(val != before)
+                        setResolution((uint16_t)val, true);
+                    updated = getResolution(true) != before;
                     break;
                 }
                 default: {
@@ -159,16 +163,30 @@ class LeadingEdgePhaseDimmer : public ZeroCrossing {
                     return false;
                 }
             }
+            return queueObjUpdate(updated ? key : std::string(), noLock || l.owns_lock(), doObjUpdate);
+        }
 
-            if(doObjUpdate && !keysToUpdateOnObj.empty()) {
-                const bool objUpdated = updateObj(keysToUpdateOnObj, noLock || l.owns_lock()) || updated; // include updated since vars were updated
-                if(objUpdated) {
-                    Logger::logv(TAG, "Updated %s", utils::join(keysToUpdateOnObj, ", ").c_str());
-                    keysToUpdateOnObj.clear();
-                }
-                return objUpdated;
+        // The same ranges as the setters, `_dataMutex` must be held
+        [[nodiscard]] bool validateValue(const std::string &key, const DataValue &value) const override {
+            const auto val = value.asInt();
+            switch(utils::hashstr(key.c_str())) {
+                case utils::hashstr(BRIGHTNESS):
+                    if(val && *val >= 0 && *val <= _resolution)
+                        return true;
+                    break;
+                case utils::hashstr(RESOLUTION):
+                    if(val && *val >= 2 && *val <= RESOLUTION_MAX_SIZE)
+                        return true;
+                    break;
+                case utils::hashstr(PERCENT_APPARENT_BRIGHTNESS):
+                    if(val && *val >= 0 && *val <= 100)
+                        return true;
+                    break;
+                default:
+                    return ZeroCrossing::validateValue(key, value);
             }
-            return updated;
+            Logger::loge(TAG, "Invalid %s value %s", key.c_str(), value.toString(HasData::EMPTY_VALUE).c_str());
+            return false;
         }
 };
 
@@ -0,0 +1,246 @@
+#ifndef LOG_DEFERRED_H_
+#define LOG_DEFERRED_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+/*
+ * Deferred log records: a log call stores the addresses of its format string and tag, a timestamp and its raw
+ *  arguments instead of formatting them. Formatting happens later, on the device with render() since the addresses are
+ *  valid there, or on a computer with scripts/decode_deferred_log.py, which looks them up in the firmware ELF.
+ *
+ *  In the device's byte order, little endian on the ESP32, with ADDR the size of a pointer:
+ *      ADDR format | ADDR tag | uint32 time_us | arguments
+ *  Each argument is a type byte and its value: 'i' a 4 byte integer, 'l' an 8 byte integer, 'd' a double or 's' a uint8
+ *  length and that many characters. Arguments that don't fit the record are left out, strings are cut to fit.
+ *
+ *  frame() turns a record and its level into a line of text for byte streams, FRAME_PREFIX and the base64 of both.
+ */
+namespace log_deferred {
+    inline constexpr std::size_t HEADER_SIZE{2 * sizeof(uintptr_t) + sizeof(uint32_t)};
+    inline constexpr const char *FRAME_PREFIX{"#LB "};
+
+    class Writer {
+        public:
+            Writer(char *buffer, const std::size_t size) : pos(buffer), end(buffer + size) { }
+
+            template<class T>
+            void put(const char type, const T value) {
+                if(full || (std::size_t)(end - pos) < 1 + sizeof(T)) {
+                    full = true;
+                    return;
+                }
+                *pos++ = type;
+                std::memcpy(pos, &value, sizeof(T));
+                pos += sizeof(T);
+            }
+
+            void putString(const char *text) {
+                if(text == nullptr)
+                    text = "(null)";
+                if(full || end - pos < 2) {
+                    full = true;
+                    return;
+                }
+                std::size_t length = std::strlen(text);
+                const std::size_t room = (std::size_t)(end - pos) - 2;
+                length = length < room ? length : room;
+                length = length < UINT8_MAX ? length : UINT8_MAX;
+                *pos++ = 's';
+                *pos++ = (char)length;
+                std::memcpy(pos, text, length);
+                pos += length;
+            }
+
+            template<class T>
+            void arg(const T &value) {
+                using D = std::decay_t<T>;
+                if constexpr(std::is_same_v<D, const char *> || std::is_same_v<D, char *>) {
+                    putString(value);
+                } else if constexpr(std::is_floating_point_v<D>) {
+                    put('d', (double)value);
+                } else if constexpr(std::is_enum_v<D>) {
+                    arg((std::underlying_type_t<D>)value);
+                } else if constexpr(std::is_integral_v<D> && sizeof(D) <= sizeof(uint32_t)) {
+                    put('i', std::is_signed_v<D> ? (uint32_t)(int32_t)value : (uint32_t)value);
+                } else if constexpr(std::is_integral_v<D>) {
+                    put('l', (uint64_t)value);
+                } else if constexpr(std::is_pointer_v<D>) {
+                    if constexpr(sizeof(uintptr_t) == sizeof(uint32_t))
+                        put('i', (uint32_t)(uintptr_t)value);
+                    else
+                        put('l', (uint64_t)(uintptr_t)value);
+                } else {
+                    static_assert(std::is_pointer_v<D>, "log arguments must be numbers, enums, pointers or C strings");
+                }
+            }
+
+            [[nodiscard]] char *position() const { return pos; }
+
+        private:
+            char *pos;
+            char *const end;
+            bool full{false};
+    };
+
+    // Returns the record's length, 0 if `size` can't hold the header
+    template<typename... Args>
+    std::size_t encode(char *record, const std::size_t size, const char *format, const char *tag, const uint32_t time_us,
+                       const Args &... args) {
+        if(size < HEADER_SIZE)
+            return 0;
+        const auto formatAddress = (uintptr_t)format;
+        const auto tagAddress = (uintptr_t)tag;
+        std::memcpy(record, &formatAddress, sizeof(uintptr_t));
+        std::memcpy(record + sizeof(uintptr_t), &tagAddress, sizeof(uintptr_t));
+        std::memcpy(record + 2 * sizeof(uintptr_t), &time_us, sizeof(uint32_t));
+        Writer writer(record + HEADER_SIZE, size - HEADER_SIZE);
+        (writer.arg(args), ...);
+        return (std::size_t)(writer.position() - record);
+    }
+
+    [[nodiscard]] inline uint32_t timeOf(const char *record) {
+        uint32_t time_us;
+        std::memcpy(&time_us, record + 2 * sizeof(uintptr_t), sizeof(uint32_t));
+        return time_us;
+    }
+
+    /* Formats a record made on this device like a LogLine, "[tag  ] message", into `out`, cut to fit. Arguments
+     *  missing from the record, or of the wrong type for their conversion, show as "<?>". */
+    inline void render(const char *record, const std::size_t length, const int tagWidth, char *out, const std::size_t outSize) {
+        if(outSize == 0)
+            return;
+        out[0] = '\0';
+        if(length < HEADER_SIZE)
+            return;
+        uintptr_t formatAddress, tagAddress;
+        std::memcpy(&formatAddress, record, sizeof(uintptr_t));
+        std::memcpy(&tagAddress, record + sizeof(uintptr_t), sizeof(uintptr_t));
+        const char *args = record + HEADER_SIZE;
+        const char *const argsEnd = record + length;
+        std::size_t used = 0;
+        const auto append = [&](const int written) {
+            if(written > 0)
+                used += (std::size_t)written < outSize - used ? (std::size_t)written : outSize - 1 - used;
+        };
+        // the next argument if it has one of `types`, false if not
+        const auto next = [&](const char *types, char &type, const char *&value) {
+            if(args >= argsEnd || std::strchr(types, *args) == nullptr)
+                return false;
+            type = *args;
+            if(type == 's' && argsEnd - args < 2)
+                return false;
+            const std::size_t size = type == 'i' ? 4 : type == 's' ? 1 + (std::size_t)(uint8_t)args[1] : 8;
+            if((std::size_t)(argsEnd - args) < 1 + size)
+                return false;
+            value = args + 1;
+            args += 1 + size;
+            return true;
+        };
+        const auto integer = [](const char type, const char *value) -> int64_t {
+            if(type == 'i') {
+                int32_t i;
+                std::memcpy(&i, value, sizeof(i));
+                return i;
+            }
+            int64_t l;
+            std::memcpy(&l, value, sizeof(l));
+            return l;
+        };
+
+        append(std::snprintf(out, outSize, "[%-*.*s] ", tagWidth, tagWidth, (const char *)tagAddress));
+        for(const char *f = (const char *)formatAddress; *f != '\0' && used < outSize - 1; f++) {
+            if(*f != '%') {
+                out[used++] = *f;
+                continue;
+            }
+            // rebuild the conversion with the argument's own size: flags, width, precision, conversion
+            char spec[32];
+            std::size_t specLength = 0;
+            spec[specLength++] = *f++;
+            bool missing = false;
+            while(*f != '\0' && std::strchr("-+ #0123456789.*", *f) != nullptr && specLength < sizeof(spec) - 16) {
+                char type;
+                const char *value;
+                if(*f != '*')
+                    spec[specLength++] = *f;
+                else if(next("i", type, value))
+                    specLength += std::snprintf(spec + specLength, sizeof(spec) - specLength, "%d", (int)integer(type, value));
+                else
+                    missing = true;
+                f++;
+            }
+            while(*f != '\0' && std::strchr("hljztL", *f) != nullptr)
+                f++;
+            const char conversion = *f;
+            if(conversion == '\0')
+                break;
+            if(conversion == '%') {
+                out[used++] = '%';
+                continue;
+            }
+            char type;
+            const char *value;
+            std::size_t rest = outSize - used;
+            if(std::strchr("diouxX", conversion) != nullptr && !missing && next("il", type, value)) {
+                spec[specLength++] = 'l';
+                spec[specLength++] = 'l';
+                spec[specLength++] = conversion;
+                spec[specLength] = '\0';
+                int64_t i = integer(type, value);
+                if(type == 'i' && std::strchr("ouxX", conversion) != nullptr)
+                    i = (uint32_t)i;
+                append(std::snprintf(out + used, rest, spec, (long long)i));
+            } else if(conversion == 'c' && !missing && next("il", type, value)) {
+                spec[specLength++] = 'c';
+                spec[specLength] = '\0';
+                append(std::snprintf(out + used, rest, spec, (int)integer(type, value)));
+            } else if(std::strchr("eEfFgGaA", conversion) != nullptr && !missing && next("d", type, value)) {
+                double d;
+                std::memcpy(&d, value, sizeof(d));
+                spec[specLength++] = conversion;
+                spec[specLength] = '\0';
+                append(std::snprintf(out + used, rest, spec, d));
+            } else if(conversion == 's' && !missing && next("s", type, value)) {
+                char text[UINT8_MAX + 1];
+                std::memcpy(text, value + 1, (uint8_t)value[0]);
+                text[(uint8_t)value[0]] = '\0';
+                spec[specLength++] = 's';
+                spec[specLength] = '\0';
+                append(std::snprintf(out + used, rest, spec, text));
+            } else if(conversion == 'p' && !missing && next("il", type, value)) {
+                append(std::snprintf(out + used, rest, "%p", (void *)(uintptr_t)integer(type, value)));
+            } else {
+                append(std::snprintf(out + used, rest, "<?>"));
+            }
+        }
+        out[used] = '\0';
+    }
+
+    // Returns the frame's length without the terminating NUL, 0 if it doesn't fit `outSize`
+    inline std::size_t frame(const uint8_t level, const char *record, const std::size_t length, char *out, const std::size_t outSize) {
+        static constexpr const char *digits{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+        const std::size_t prefixLength = std::strlen(FRAME_PREFIX);
+        const std::size_t bytes = 1 + length;
+        const std::size_t frameLength = prefixLength + (bytes + 2) / 3 * 4;
+        if(frameLength + 1 > outSize)
+            return 0;
+        std::memcpy(out, FRAME_PREFIX, prefixLength);
+        char *pos = out + prefixLength;
+        const auto byte = [&](const std::size_t i) -> uint32_t { return i == 0 ? level : (uint8_t)record[i - 1]; };
+        for(std::size_t i = 0; i < bytes; i += 3) {
+            const uint32_t triple = byte(i) << 16 | (i + 1 < bytes ? byte(i + 1) << 8 : 0) | (i + 2 < bytes ? byte(i + 2) : 0);
+            *pos++ = digits[triple >> 18 & 0x3F];
+            *pos++ = digits[triple >> 12 & 0x3F];
+            *pos++ = i + 1 < bytes ? digits[triple >> 6 & 0x3F] : '=';
+            *pos++ = i + 2 < bytes ? digits[triple & 0x3F] : '=';
+        }
+        *pos = '\0';
+        return frameLength;
+    }
+}
+
+#endif // LOG_DEFERRED_H_
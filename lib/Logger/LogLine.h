@@ -0,0 +1,71 @@
+#ifndef LOG_LINE_H_
+#define LOG_LINE_H_
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+
+/*
+ * A log message with its "[tag  ] " prefix, formatted in one pass into a buffer of `Size` bytes on the caller's stack.
+ *  Only messages that don't fit are formatted again, on the heap, up to `MaxSize` bytes with the terminating NUL.
+ *  Longer ones are cut to that and end with TRUNCATION_MARK.
+ */
+template<std::size_t Size, std::size_t MaxSize>
+class LogLine {
+    static_assert(Size >= 16 && MaxSize >= Size, "LogLine sizes out of range");
+
+    public:
+        inline static constexpr const char *TRUNCATION_MARK{"..."};
+
+        template<typename... Args>
+        LogLine(const int tagWidth, const char *tag, const char *msg, Args&&... args) {
+            const int prefix = std::snprintf(buffer, Size, "[%-*.*s] ", tagWidth, tagWidth, tag);
+            if(prefix < 0 || (std::size_t)prefix >= Size) { // can only be a tag width out of proportion to Size
+                mark(buffer, Size);
+                return;
+            }
+            const int length = std::snprintf(buffer + prefix, Size - prefix, msg, std::forward<Args>(args)...);
+            if(length < 0) {
+                buffer[prefix] = '\0';
+                return;
+            }
+            const std::size_t total = (std::size_t)prefix + length;
+            if(total < Size)
+                return;
+            if(Size == MaxSize) {
+                mark(buffer, Size);
+                return;
+            }
+            const std::size_t heapSize = total < MaxSize ? total + 1 : MaxSize;
+            heap.assign(heapSize - 1, '\0');
+            std::memcpy(&heap[0], buffer, prefix);
+            std::snprintf(&heap[prefix], heapSize - prefix, msg, std::forward<Args>(args)...);
+            if(total >= MaxSize)
+                mark(&heap[0], heapSize);
+            text = heap.c_str();
+        }
+        LogLine(const LogLine &) = delete;
+        LogLine &operator=(const LogLine &) = delete;
+
+        [[nodiscard]] const char *c_str() const { return text; }
+        [[nodiscard]] bool isTruncated() const { return truncated; }
+        [[nodiscard]] bool isOnHeap() const { return text != buffer; }
+
+    private:
+        char buffer[Size];
+        std::string heap{};
+        const char *text{buffer};
+        bool truncated{false};
+
+        // `line` is `size` bytes, filled up to its last one
+        void mark(char *line, const std::size_t size) {
+            const std::size_t markLength = std::strlen(TRUNCATION_MARK);
+            std::memcpy(line + size - 1 - markLength, TRUNCATION_MARK, markLength);
+            line[size - 1] = '\0';
+            truncated = true;
+        }
+};
+
+#endif // LOG_LINE_H_
@@ -0,0 +1,99 @@
+#ifndef LOG_RING_H_
+#define LOG_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Bounded lock-free ring of formatted log records, written by any number of threads and read by one. Each slot has a
+ *  sequence number telling whose turn it is, so producers only race on a compare-exchange of the write position and
+ *  never wait for each other or the reader. A full ring drops the record and counts it instead of blocking, text
+ *  longer than a record is truncated and counted too.
+ */
+template<std::size_t Records, std::size_t RecordSize>
+class LogRing {
+    static_assert(Records >= 2 && (Records & (Records - 1)) == 0, "LogRing records must be a power of 2");
+    static_assert(RecordSize >= 16 && RecordSize <= UINT16_MAX, "LogRing record size out of range");
+
+    public:
+        struct Record {
+            uint8_t level;
+            uint16_t length; // of text, without the terminating NUL
+            char text[RecordSize];
+        };
+
+        LogRing() {
+            for(std::size_t i = 0; i < Records; i++)
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        LogRing(const LogRing &) = delete;
+        LogRing &operator=(const LogRing &) = delete;
+
+        // Any thread, returns false if the ring was full and the record dropped
+        bool push(const uint8_t level, const char *text) { return push(level, text, std::strlen(text)); }
+
+        // `data` doesn't need to be text, the record's copy is NUL terminated all the same
+        bool push(const uint8_t level, const char *data, std::size_t length) {
+            std::size_t pos = head.load(std::memory_order_relaxed);
+            Slot *slot;
+            while(true) {
+                slot = &slots[pos & (Records - 1)];
+                const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                const auto diff = (std::ptrdiff_t)(sequence - pos);
+                if(diff == 0) {
+                    if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if(diff < 0) { // the reader hasn't freed the slot a lap ago
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                } else {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+            if(length > RecordSize - 1) {
+                length = RecordSize - 1;
+                truncated.fetch_add(1, std::memory_order_relaxed);
+            }
+            slot->record.level = level;
+            slot->record.length = (uint16_t)length;
+            std::memcpy(slot->record.text, data, length);
+            slot->record.text[length] = '\0';
+            slot->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /* Single reader, copies the oldest record out so its slot is free while it's handled. Returns false if empty,
+         *  or if the oldest record is still being written. */
+        bool pop(Record &record) {
+            Slot &slot = slots[tail & (Records - 1)];
+            if(slot.sequence.load(std::memory_order_acquire) != tail + 1)
+                return false;
+            record.level = slot.record.level;
+            record.length = slot.record.length;
+            std::memcpy(record.text, slot.record.text, slot.record.length + 1);
+            slot.sequence.store(tail + Records, std::memory_order_release);
+            tail++;
+            return true;
+        }
+
+        // Records pushed so far, not counting dropped ones
+        [[nodiscard]] std::size_t pushedCount() const { return head.load(std::memory_order_relaxed); }
+        [[nodiscard]] unsigned long droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+        [[nodiscard]] unsigned long truncatedCount() const { return truncated.load(std::memory_order_relaxed); }
+
+    private:
+        struct Slot {
+            std::atomic<std::size_t> sequence{0}; // pos when free for the write at pos, pos + 1 when written
+            Record record{};
+        };
+
+        Slot slots[Records];
+        std::atomic<std::size_t> head{0};
+        std::size_t tail{0}; // reader only
+        std::atomic<unsigned long> dropped{0};
+        std::atomic<unsigned long> truncated{0};
+};
+
+#endif // LOG_RING_H_
@@ -0,0 +1,71 @@
+#ifndef LOG_TAG_LEVELS_H_
+#define LOG_TAG_LEVELS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Per tag log levels in a flat table that log calls read without locking. Tags are identified by a 32 bit hash of
+ *  their text, `id()` is constexpr so it's computed at compile time for constexpr TAGs, and `set()` claims slots by
+ *  linear probing, serialized by the caller. Tags without a level set log at every level.
+ */
+template<std::size_t Slots>
+class LogTagLevels {
+    static_assert(Slots > 0 && Slots <= 256, "LogTagLevels slots out of range");
+
+    public:
+        static constexpr uint8_t NOT_SET{UINT8_MAX};
+
+        // FNV-1a, 0 marks free slots
+        static constexpr uint32_t id(const char *tag) {
+            uint32_t hash = 2166136261u;
+            for(; tag != nullptr && *tag != '\0'; tag++)
+                hash = (hash ^ (unsigned char)*tag) * 16777619u;
+            return hash == 0 ? 1 : hash;
+        }
+
+        // Returns false if all slots are taken by other tags
+        bool set(const uint32_t tagId, const uint8_t level) {
+            for(std::size_t i = 0; i < Slots; i++) {
+                Slot &slot = slots[(tagId + i) % Slots];
+                const uint32_t slotId = slot.id.load(std::memory_order_relaxed);
+                if(slotId != tagId && slotId != 0)
+                    continue;
+                slot.level.store(level, std::memory_order_relaxed);
+                slot.id.store(tagId, std::memory_order_release); // publish after the level
+                if(level < lowest.load(std::memory_order_relaxed))
+                    lowest.store(level, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        [[nodiscard]] uint8_t get(const uint32_t tagId) const {
+            for(std::size_t i = 0; i < Slots; i++) {
+                const Slot &slot = slots[(tagId + i) % Slots];
+                const uint32_t slotId = slot.id.load(std::memory_order_acquire);
+                if(slotId == tagId)
+                    return slot.level.load(std::memory_order_relaxed);
+                if(slotId == 0)
+                    break;
+            }
+            return NOT_SET;
+        }
+
+        // Levels up to the lowest one set for any tag skip the lookup
+        [[nodiscard]] bool allows(const uint32_t tagId, const unsigned level) const {
+            return level <= lowest.load(std::memory_order_relaxed) || level <= get(tagId);
+        }
+
+    private:
+        struct Slot {
+            std::atomic<uint32_t> id{0};
+            std::atomic<uint8_t> level{NOT_SET};
+        };
+
+        Slot slots[Slots]{};
+        std::atomic<uint8_t> lowest{NOT_SET};
+};
+
+#endif // LOG_TAG_LEVELS_H_
@@ -8,13 +8,24 @@
 #if defined(ARDUINO)
 #include <HardwareSerial.h>
 #include <Print.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
 #endif
 
+#include "LogDeferred.h"
+#include "LogLine.h"
+#include "LogRing.h"
+#include "LogTagLevels.h"
+
+#include <algorithm>
 #include <cstdio>
 #include <vector>
 #include <memory>
 #include <mutex>
-#include <map>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 #ifndef LOG_LEVEL
 #define LOG_LEVEL LOG_LEVEL_INFO
@@ -41,6 +52,37 @@
 #define LOG_LEVEL_VERBOSE 5
 #endif
 
+#ifndef LOG_FORMAT_BUFFER_SIZE // messages up to this, with their tag, are formatted on the caller's stack
+#define LOG_FORMAT_BUFFER_SIZE 160
+#endif
+#ifndef LOG_FORMAT_MAX_SIZE // longer messages are formatted on the heap up to this, then truncated ending with "..."
+#define LOG_FORMAT_MAX_SIZE 1024
+#endif
+
+#ifndef LOG_TAG_SLOTS // tags that can have their own level, see setTagLevel()
+#define LOG_TAG_SLOTS 32
+#endif
+
+#ifndef LOG_ASYNC_RECORDS // records buffered for the drain task after Logger<>::startAsync(), a power of 2
+#define LOG_ASYNC_RECORDS 32
+#endif
+#ifndef LOG_ASYNC_RECORD_SIZE // longer messages are truncated when logging asynchronously
+#define LOG_ASYNC_RECORD_SIZE 160
+#endif
+#ifndef LOG_ASYNC_IDLE_MS // how long the drain task sleeps when there's nothing to log
+#define LOG_ASYNC_IDLE_MS 10
+#endif
+#ifndef LOG_ASYNC_STACK_SIZE // drain task stack, it runs the sinks
+#define LOG_ASYNC_STACK_SIZE 4096
+#endif
+
+#ifndef LOG_DEFERRED_RECORDS // records buffered for the drain task in deferred mode, see Logger<>::setDeferred()
+#define LOG_DEFERRED_RECORDS 64
+#endif
+#ifndef LOG_DEFERRED_RECORD_SIZE // arguments past this are left out of deferred records, see LogDeferred.h
+#define LOG_DEFERRED_RECORD_SIZE 64
+#endif
+
 #if defined(ARDUINO)
 template<class T = Print>
 #else
@@ -58,19 +100,140 @@ class Logger {
 
         inline static std::mutex logMutex = std::mutex();
 
+        // Whether loggers are called from the drain task, see startAsync()
+        static bool isAsync() { return async.load(std::memory_order_acquire); }
+
     private:
     inline static std::unique_ptr<std::vector<std::shared_ptr<Logger>>> loggers = nullptr;
-    inline static std::map<std::string, unsigned> tagLevels{};
+        inline static std::atomic<std::size_t> loggerCount{0}; // size of `loggers` for isEnabled(), which doesn't lock
+        using Line = LogLine<LOG_FORMAT_BUFFER_SIZE, LOG_FORMAT_MAX_SIZE>;
+        using TagLevels = LogTagLevels<LOG_TAG_SLOTS>;
+        inline static TagLevels tagLevels{};
+
+        /* Asynchronous logging, see startAsync(): log calls format and push to `ring`, the drain task is the only one
+         *  calling the sinks */
+        using Ring = LogRing<LOG_ASYNC_RECORDS, LOG_ASYNC_RECORD_SIZE>;
+        inline static Ring ring{};
+        inline static std::atomic<bool> async{false};
+        inline static std::atomic<std::size_t> drainedCount{0};
+
+        // Deferred logging, see setDeferred(): log calls push binary records to `deferredRing` instead of formatting
+        using DeferredRing = LogRing<LOG_DEFERRED_RECORDS, LOG_DEFERRED_RECORD_SIZE>;
+        inline static DeferredRing deferredRing{};
+        inline static std::atomic<bool> deferred{false};
 
         virtual void v_logv(const char *msg) const { /* do nothing if not enabled */ };
         virtual void v_logd(const char *msg) const { /* do nothing if not enabled */ };
         virtual void v_logi(const char *msg) const { /* do nothing if not enabled */ };
         virtual void v_logw(const char *msg) const { /* do nothing if not enabled */ };
         virtual void v_loge(const char *msg) const { /* do nothing if not enabled */ };
+        // Loggers that can send deferred records as they are, see LogDeferred.h, return true, others get them formatted
+        virtual bool v_logDeferred(const uint8_t level, const char *record, const std::size_t length) const { return false; }
+        // Called by the drain task about every LOG_ASYNC_IDLE_MS while there's nothing to log, ex.: to send batches
+        virtual void v_idle() const { /* nothing to do by default */ };
 
         static void dummy(...) { }
 
+        // Holding `logMutex`
+        static void toLogger(const Logger &logger, const unsigned level, const char *msg) {
+            switch(level) {
+                case LOG_LEVEL_ERROR:
+                    logger.v_loge(msg);
+                    break;
+                case LOG_LEVEL_WARN:
+                    logger.v_logw(msg);
+                    break;
+                case LOG_LEVEL_INFO:
+                    logger.v_logi(msg);
+                    break;
+                case LOG_LEVEL_DEBUG:
+                    logger.v_logd(msg);
+                    break;
+                default:
+                    logger.v_logv(msg);
+                    break;
+            }
+        }
+
+        static void toLoggers(const unsigned level, const char *msg) {
+            for(auto const &logger : *loggers)
+                toLogger(*logger, level, msg);
+        }
+
+        // Holding `logMutex`, formats the record once for the loggers that don't take it as it is
+        static void deferredToLoggers(const DeferredRing::Record &record) {
+            char text[LOG_FORMAT_BUFFER_SIZE];
+            bool rendered = false;
+            for(auto const &logger : *loggers) {
+                if(logger->v_logDeferred(record.level, record.text, record.length))
+                    continue;
+                if(!rendered)
+                    log_deferred::render(record.text, record.length, LOG_TAG_MAX_LEN, text, sizeof(text));
+                rendered = true;
+                toLogger(*logger, record.level, text);
+            }
+        }
+
+        static uint32_t now_us() {
+#if defined(ARDUINO)
+            return (uint32_t)esp_timer_get_time();
+#else
+            return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        static void publish(const unsigned level, const char *msg) {
+            if(async.load(std::memory_order_acquire)) {
+                ring.push((uint8_t)level, msg);
+                return;
+            }
+            std::scoped_lock l(logMutex);
+            toLoggers(level, msg);
+        }
+
+        [[noreturn]] static void drainLoop() {
+            Ring::Record record{};
+            DeferredRing::Record deferredRecord{};
+            unsigned long reportedDropped = 0;
+            while(true) {
+                bool drained = false;
+                while(ring.pop(record)) {
+                    std::scoped_lock l(logMutex);
+                    toLoggers(record.level, record.text);
+                    drainedCount.fetch_add(1, std::memory_order_release);
+                    drained = true;
+                }
+                while(deferredRing.pop(deferredRecord)) {
+                    std::scoped_lock l(logMutex);
+                    deferredToLoggers(deferredRecord);
+                    drainedCount.fetch_add(1, std::memory_order_release);
+                    drained = true;
+                }
+                const unsigned long dropped = getDroppedCount();
+                if(dropped != reportedDropped) {
+                    char msg[80];
+                    std::snprintf(msg, sizeof(msg), "[%-*.*s] %lu log messages dropped, the buffer was full", LOG_TAG_MAX_LEN,
+                                  LOG_TAG_MAX_LEN, TAG, dropped - reportedDropped);
+                    reportedDropped = dropped;
+                    std::scoped_lock l(logMutex);
+                    toLoggers(LOG_LEVEL_WARN, msg);
+                }
+                if(!drained) {
+                    {
+                        std::scoped_lock l(logMutex);
+                        if(loggers != nullptr)
+                            for(auto const &logger : *loggers)
+                                logger->v_idle();
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(LOG_ASYNC_IDLE_MS));
+                }
+            }
+        }
+
     public:
+        inline static constexpr const char *TAG{"loggr"};
+
         virtual ~Logger() = default;
         Logger(const Logger& obj) = delete; 
             
@@ -90,141 +253,192 @@ class Logger {
             if(loggers == nullptr)
                 loggers = std::make_unique<std::vector<std::shared_ptr<Logger>>>();
             loggers->push_back(std::move(logger));
+            loggerCount.store(loggers->size(), std::memory_order_release);
 #else
             (void)logger;            
 #endif
         }
 
-        static void setTagLevel(const std::string &tag, const unsigned level) {
+        // Returns false if `logger` wasn't added
+        static bool removeLogger(const std::shared_ptr<Logger> &logger) {
 #ifdef ENABLE_LOGGING
             std::scoped_lock l(logMutex);
-            tagLevels[tag] = level;
+            if(loggers == nullptr)
+                return false;
+            const auto it = std::find(loggers->begin(), loggers->end(), logger);
+            if(it == loggers->end())
+                return false;
+            loggers->erase(it);
+            loggerCount.store(loggers->size(), std::memory_order_release);
+            return true;
 #else
-            (void)tag;
-            (void)level;
+            (void)logger;
+            return false;
 #endif
         }
 
-        static void setTagsLevel(const std::vector<std::string> &tags, const unsigned level) {
+        /* From now on log calls only format their message and queue it, a background task calls the loggers, so
+         *  callers don't wait for serial or network sends. Messages logged while the queue is full are dropped and
+         *  counted, `flush()` waits for the queue to be logged, ex.: before restarting. */
+        static void startAsync() {
 #ifdef ENABLE_LOGGING
-            std::scoped_lock l(logMutex);
-            for(auto const &tag : tags)
-                tagLevels[tag] = level;
+            if(async.exchange(true))
+                return;
+#if defined(ARDUINO)
+            // not std::thread, for the stack size
+            xTaskCreate([](void *) { drainLoop(); }, "logDrain", LOG_ASYNC_STACK_SIZE, nullptr, 1, nullptr);
 #else
-            (void)tags;
-            (void)level;
+            std::thread t(drainLoop);
+            t.detach(); //NOSONAR - won't fix, intended to run indefinitely
+#endif
 #endif
         }
 
-        template<typename... Args>            
-        static void logv(const char* TAG, const char *msg, Args&&... args) {
-#if defined(ENABLE_LOGGING) && defined(LOG_LEVEL) && LOG_LEVEL >= LOG_LEVEL_VERBOSE
-            if(tagLevels.find(TAG) != tagLevels.end() && tagLevels[TAG] < LOG_LEVEL_VERBOSE)
-                return;
-            if(loggers == nullptr || loggers->empty())
-                return;
-            const std::string tag_msg = std::string("[%-*.*s] ") + msg;
-            const auto size = std::snprintf(nullptr, 0, tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::string parsed_msg(size + 1, '\0');
-            std::sprintf(&parsed_msg[0], tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::scoped_lock l(logMutex);
-            for(auto const &logger : *loggers)
-                logger->v_logv(parsed_msg.c_str());
-#else                
-            (void)TAG;
-            (void)msg;
-//            (void)args;
-            dummy(std::forward<Args>(args)...);
+        // Returns false if messages queued before the call weren't all logged within `timeout`
+        static bool flush(const std::chrono::milliseconds timeout = std::chrono::milliseconds(1000)) {
+#ifdef ENABLE_LOGGING
+            if(!async.load())
+                return true;
+            const std::size_t queued = ring.pushedCount() + deferredRing.pushedCount();
+            const auto end = std::chrono::steady_clock::now() + timeout;
+            while((std::ptrdiff_t)(drainedCount.load(std::memory_order_acquire) - queued) < 0) {
+                if(std::chrono::steady_clock::now() >= end)
+                    return false;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+#else
+            (void)timeout;
 #endif
+            return true;
         }
 
-        template<typename... Args>            
-        static void logd(const char* TAG, const char *msg, Args&&... args) {
-#if defined(ENABLE_LOGGING) && defined(LOG_LEVEL) && LOG_LEVEL >= LOG_LEVEL_DEBUG
-            if(tagLevels.find(TAG) != tagLevels.end() && tagLevels[TAG] < LOG_LEVEL_DEBUG)
-                return;
-            if(loggers == nullptr || loggers->empty())
-                return;
-            const std::string tag_msg = std::string("[%-*.*s] ") + msg;
-            const auto size = std::snprintf(nullptr, 0, tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::string parsed_msg(size + 1, '\0');
-            std::sprintf(&parsed_msg[0], tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::scoped_lock l(logMutex);
-            for(auto const &logger : *loggers)
-                logger->v_logd(parsed_msg.c_str());
-#else                
-            (void)TAG;
-            (void)msg;
-//            (void)args;
-            dummy(std::forward<Args>(args)...);
+        // Messages dropped or truncated since startAsync()
+        static unsigned long getDroppedCount() { return ring.droppedCount() + deferredRing.droppedCount(); }
+        static unsigned long getTruncatedCount() { return ring.truncatedCount(); }
+
+        /* While on, log calls only store the addresses of their format string and tag, a timestamp and their arguments,
+         *  see LogDeferred.h. The drain task formats them for the loggers, except for loggers that send the records as
+         *  they are, ex.: SimpleLogger over serial for scripts/decode_deferred_log.py. Starts logging asynchronously.
+         *  Format strings and tags must stay where they are, ex.: string literals and `constexpr` TAGs. */
+        static void setDeferred(const bool enable) {
+#ifdef ENABLE_LOGGING
+            if(enable)
+                startAsync();
+            deferred.store(enable, std::memory_order_release);
+#else
+            (void)enable;
 #endif
         }
-    
-        template<typename... Args>            
-        static void logi(const char *TAG, const char *msg, Args&&... args) {
-#if defined(ENABLE_LOGGING) && defined(LOG_LEVEL) && LOG_LEVEL >= LOG_LEVEL_INFO
-            if(tagLevels.find(TAG) != tagLevels.end() && tagLevels[TAG] < LOG_LEVEL_INFO)
-                return;
-            if(loggers == nullptr || loggers->empty())
-                return;
-            const std::string tag_msg = std::string("[%-*.*s] ") + msg;
-            const auto size = std::snprintf(nullptr, 0, tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::string parsed_msg(size + 1, '\0');
-            std::sprintf(&parsed_msg[0], tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::scoped_lock l(logMutex);
-            for(auto const &logger : *loggers)
-                logger->v_logi(parsed_msg.c_str());
-#else                
-            (void)TAG;
-            (void)msg;
-//            (void)args;
-            dummy(std::forward<Args>(args)...);
+
+        // Returns false if LOG_TAG_SLOTS other tags already have a level
+        static bool setTagLevel(const std::string &tag, const unsigned level) {
+#ifdef ENABLE_LOGGING
+            {
+                std::scoped_lock l(logMutex);
+                if(tagLevels.set(tagId(tag.c_str()), (uint8_t)level))
+                    return true;
+            }
+            loge(TAG, "No room for the level of tag %s, raise LOG_TAG_SLOTS", tag.c_str());
+            return false;
+#else
+            (void)tag;
+            (void)level;
+            return true;
 #endif
         }
 
-        template<typename... Args>            
-        static void logw(const char* TAG, const char *msg, Args&&... args) {
-#if defined(ENABLE_LOGGING) && defined(LOG_LEVEL) && LOG_LEVEL >= LOG_LEVEL_WARN
-            if(tagLevels.find(TAG) != tagLevels.end() && tagLevels[TAG] < LOG_LEVEL_WARN)
-                return;
-            if(loggers == nullptr || loggers->empty())
-                return;
-            const std::string tag_msg = std::string("[%-*.*s] ") + msg;
-            const auto size = std::snprintf(nullptr, 0, tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::string parsed_msg(size + 1, '\0');
-            std::sprintf(&parsed_msg[0], tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::scoped_lock l(logMutex);
-            for(auto const &logger : *loggers)
-                logger->v_logw(parsed_msg.c_str());
-#else                
-            (void)TAG;
-            (void)msg;
-//            (void)args;
-            dummy(std::forward<Args>(args)...);
+        static bool setTagsLevel(const std::vector<std::string> &tags, const unsigned level) {
+            bool set = true;
+            for(auto const &tag : tags)
+                set = setTagLevel(tag, level) && set;
+            return set;
+        }
+
+        /* Tags are identified by a hash of their text, computed by the compiler when the tag is a constant, ex.: a
+         *  `constexpr` TAG member */
+        static constexpr uint32_t tagId(const char *tag) { return TagLevels::id(tag); }
+
+        // Whether calls at `level` are built at all, see LOG_LEVEL
+        static constexpr bool isCompiledIn(const unsigned level) {
+#if defined(ENABLE_LOGGING) && defined(LOG_LEVEL)
+            return level != LOG_LEVEL_NONE && level <= LOG_LEVEL;
+#else
+            (void)level;
+            return false;
 #endif
         }
 
-        template<typename... Args>            
-        static void loge(const char* TAG, const char *msg, Args&&... args) {
-#if defined(ENABLE_LOGGING) && defined(LOG_LEVEL) && LOG_LEVEL >= LOG_LEVEL_ERROR
-            if(tagLevels.find(TAG) != tagLevels.end() && tagLevels[TAG] < LOG_LEVEL_ERROR)
-                return;
-            if(loggers == nullptr || loggers->empty())
-                return;
-            const std::string tag_msg = std::string("[%-*.*s] ") + msg;
-            const auto size = std::snprintf(nullptr, 0, tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::string parsed_msg(size + 1, '\0');
-            std::sprintf(&parsed_msg[0], tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, TAG, std::forward<Args>(args)...);
-            std::scoped_lock l(logMutex);
-            for(auto const &logger : *loggers)
-                logger->v_loge(parsed_msg.c_str());
-#else                
-            (void)TAG;
-            (void)msg;
-//            (void)args;
-            dummy(std::forward<Args>(args)...);
-#endif
-        }       
+        // Lock free, ex.: to skip building a message that won't be logged
+        static bool isEnabled(const unsigned level, const uint32_t id) {
+            return isCompiledIn(level) && tagLevels.allows(id, level) && loggerCount.load(std::memory_order_acquire) != 0;
+        }
+
+        /* The log calls below evaluate their arguments even when they won't log, the LOGV()..LOGE() macros don't, see
+         *  them after the class */
+        template<unsigned Level, typename... Args>
+        static void logAt(const uint32_t id, const char *TAG, const char *msg, Args&&... args) {
+            if constexpr(isCompiledIn(Level)) {
+                if(!isEnabled(Level, id))
+                    return;
+                if(deferred.load(std::memory_order_acquire)) {
+                    char record[LOG_DEFERRED_RECORD_SIZE - 1]; // the ring adds a NUL
+                    const std::size_t length = log_deferred::encode(record, sizeof(record), msg, TAG, now_us(), args...);
+                    deferredRing.push((uint8_t)Level, record, length);
+                    return;
+                }
+                const Line line(LOG_TAG_MAX_LEN, TAG, msg, std::forward<Args>(args)...);
+                publish(Level, line.c_str());
+            } else {
+                (void)id;
+                (void)TAG;
+                (void)msg;
+                dummy(std::forward<Args>(args)...);
+            }
+        }
+
+        template<typename... Args>
+        static void logv(const char *TAG, const char *msg, Args&&... args) {
+            logAt<LOG_LEVEL_VERBOSE>(tagId(TAG), TAG, msg, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        static void logd(const char *TAG, const char *msg, Args&&... args) {
+            logAt<LOG_LEVEL_DEBUG>(tagId(TAG), TAG, msg, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        static void logi(const char *TAG, const char *msg, Args&&... args) {
+            logAt<LOG_LEVEL_INFO>(tagId(TAG), TAG, msg, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        static void logw(const char *TAG, const char *msg, Args&&... args) {
+            logAt<LOG_LEVEL_WARN>(tagId(TAG), TAG, msg, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        static void loge(const char *TAG, const char *msg, Args&&... args) {
+            logAt<LOG_LEVEL_ERROR>(tagId(TAG), TAG, msg, std::forward<Args>(args)...);
+        }
 };
 
+/*
+ * Log calls that skip evaluating their arguments, ex.: `value.toString().c_str()`, when the level is filtered out.
+ *  Levels above LOG_LEVEL compile to nothing, otherwise the level set for the tag is checked before the arguments.
+ */
+#define LOG_AT_LEVEL(level, tag, ...) \
+    do { \
+        if constexpr(::Logger<>::isCompiledIn(level)) { \
+            const char *logTag_ = (tag); \
+            const uint32_t logTagId_ = ::Logger<>::tagId(logTag_); \
+            if(::Logger<>::isEnabled(level, logTagId_)) \
+                ::Logger<>::logAt<level>(logTagId_, logTag_, __VA_ARGS__); \
+        } \
+    } while(false)
+#define LOGV(tag, ...) LOG_AT_LEVEL(LOG_LEVEL_VERBOSE, tag, __VA_ARGS__)
+#define LOGD(tag, ...) LOG_AT_LEVEL(LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#define LOGI(tag, ...) LOG_AT_LEVEL(LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#define LOGW(tag, ...) LOG_AT_LEVEL(LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#define LOGE(tag, ...) LOG_AT_LEVEL(LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+
 #endif // LOGGER_H_
\ No newline at end of file
@@ -150,6 +150,15 @@ private:
         else
             printStream->printf("[ERROR] %s\n", msg);
     };
+
+    // One line per record for scripts/decode_deferred_log.py, the computer formats it
+    bool v_logDeferred(const uint8_t level, const char *record, const std::size_t length) const override {
+        char line[LOG_DEFERRED_RECORD_SIZE * 2];
+        if(log_deferred::frame(level, record, length, line, sizeof(line)) == 0)
+            return false;
+        printStream->printf("%s\n", line);
+        return true;
+    };
 #else
     : Logger() { void showTime; void printStream; void defaultPrintStreamLevel; };
 #endif // ENABLE_LOGGING
@@ -8,6 +8,8 @@
 
 #include <vector>
 #include <thread>
+#include <algorithm>
+#include <string_view>
 
 
 using std::vector;
@@ -23,7 +25,7 @@ void MQTTController::registerSubscriptions() {
     client.subscribe((topicPrefix + "/update/#").c_str());
 }
 
-void MQTTController::publishData() {
+void MQTTController::publishData(const bool full) {
 //    client.publish("coop/uptime", ntp_time::get(ntp_time::UPTIME).c_str(), true, 0);
 //    client.publish("coop/time", ntp_time::get(ntp_time::CURRENT_TIME).c_str(), true, 0);
 //    client.publish("coop/free_memory", ntp_time::get(ntp_time::FREE_MEMORY).c_str(), true, 0);
@@ -37,12 +39,41 @@ void MQTTController::publishData() {
 //    client.publish("coop/wifi/rssi", cwifi::get(cwifi::RSSI).c_str(), true, 0);
 
     std::scoped_lock l(hasDataItemsMutex);
+    unsigned published = 0;
+    unsigned failed = 0;
     for(auto const &item : hasDataItems) {
-        const auto &data = item->getData();
-        for(auto const &data_item : data) {
-            client.publish((topicPrefix + "/status/" + item->getInstanceID() + "/" + data_item.first).c_str(), data_item.second.c_str(), true, 0);
+        const uint64_t dirtyKeys = item->takeDirtyKeys();
+        uint64_t failedKeys = 0;
+        auto &lastReadOnly = lastPublishedReadOnly[item];
+        const auto &itemKeys = item->getKeys();
+        for(size_t i = 0; i < itemKeys.size(); i++) {
+            const auto &key = itemKeys[i];
+            const bool readOnly = item->isReadOnlyKey(key);
+            if(!full && !readOnly && !HasData<>::isKeyDirty(dirtyKeys, i))
+                continue;
+            const std::string value = item->get(key);
+            std::string *lastValue = nullptr;
+            if(readOnly) {
+                lastValue = &lastReadOnly[key];
+                if(!full && *lastValue == value)
+                    continue;
+            }
+            if(!client.publish((topicPrefix + "/status/" + item->getInstanceID() + "/" + key).c_str(), value.c_str(), true, 0)) {
+                // published again with the next changes
+                if(!readOnly)
+                    failedKeys |= i < HasData<>::MAX_DIRTY_KEYS ? (uint64_t)1 << i : ~(uint64_t)0;
+                failed++;
+                continue;
+            }
+            if(lastValue != nullptr)
+                *lastValue = value;
+            published++;
         }
+        item->restoreDirtyKeys(failedKeys);
     }
+    if(failed > 0)
+        Logger::logw(TAG, "[publishData] failed to publish %u values, will retry", failed);
+    Logger::logv(TAG, "[publishData] published %u %s values", published, full ? "(full)" : "changed");
 }
 
 void MQTTController::messageReceived(String &topic, String &payload) {
@@ -56,15 +87,21 @@ void MQTTController::messageReceived(String &topic, String &payload) {
     std::scoped_lock l(hasDataItemsMutex);
     if(hasDataItems.empty())
         return;
-    const std::vector<std::string> topic_parts = utils::split(topic.c_str(), '/');
-    const auto &item_key = topic_parts[topic_parts.size() - 2];
-    const auto &item_data_key = topic_parts[topic_parts.size() - 1];
+    // topic is .../<instanceID>/<key>, view the last two parts rather than splitting to avoid allocating
+    const std::string_view topicView{topic.c_str()};
+    const auto dataKeyStart = topicView.rfind('/');
+    if(dataKeyStart == std::string_view::npos || dataKeyStart == 0) {
+        Logger::logw(TAG, "Invalid topic %s", topic.c_str());
+        return;
+    }
+    const auto itemKeyStart = topicView.rfind('/', dataKeyStart - 1);
+    const auto item_key = topicView.substr(itemKeyStart == std::string_view::npos ? 0 : itemKeyStart + 1,
+                                           dataKeyStart - (itemKeyStart == std::string_view::npos ? 0 : itemKeyStart + 1));
+    const auto item_data_key = topicView.substr(dataKeyStart + 1);
     for(auto const &item : hasDataItems) {
-        const auto itemReadOnlyKeys = item->getReadOnlyKeys();
-        if(item_key == item->getInstanceID() &&
-                std::find(itemReadOnlyKeys.begin(), itemReadOnlyKeys.end(), item_data_key) == itemReadOnlyKeys.end()) {
-            if(!item->set(item_data_key, payload.c_str())) {
-                Logger::logw(TAG, "Failed to set %s to %s, may have not changed or was invalid", item_data_key.c_str(), payload.c_str());
+        if(item_key == item->getInstanceID() && !item->isReadOnlyKey(item_data_key)) {
+            if(!item->set(std::string(item_data_key), payload.c_str())) {
+                Logger::logw(TAG, "Failed to set %s to %s, may have not changed or was invalid", std::string(item_data_key).c_str(), payload.c_str());
             }
             return;
         }
@@ -92,6 +129,7 @@ void MQTTController::connect() {
         Logger::getDefaultPrintStream()->print("-mqtt-");
     }
     Logger::logi(TAG, "MQTT connected!");
+    fullPublishPending = true; // broker may have lost retained values
     if(!lastWillTopic.empty() && !onlineMsg.empty()) 
         client.publish(lastWillTopic.c_str(), onlineMsg.c_str(), true, 0);
   
@@ -111,14 +149,21 @@ void MQTTController::disconnect() {
 
 void MQTTController::mqttLoop() {
     static unsigned long lastPub = 0;
+    static unsigned long lastFullPub = 0;
     connect();
     while(utils::wait_for<std::chrono::milliseconds>(std::chrono::milliseconds(10), loopThreadMutex, loopThreadCond, loopThreadStop)) {
         if (!client.connected())
             connect();
         client.loop();
         if(millis() - lastPub > MQTT_PUB_INTERVAL_SECS * 1000) {
-            publishData();
+            const bool full = fullPublishPending || MQTT_PUB_FULL_INTERVAL_SECS == 0 ||
+                              millis() - lastFullPub > MQTT_PUB_FULL_INTERVAL_SECS * 1000;
+            publishData(full);
             lastPub = millis();
+            if(full) {
+                lastFullPub = lastPub;
+                fullPublishPending = false;
+            }
         }
     }
     disconnect();
@@ -280,4 +325,5 @@ void MQTTController::registerHasDataItem(HasData *item) {
 void MQTTController::unregisterHasDataItem(HasData *item) {
     std::scoped_lock l(hasDataItemsMutex);
     hasDataItems.erase(std::remove(hasDataItems.begin(), hasDataItems.end(), item), hasDataItems.end());
+    lastPublishedReadOnly.erase(item);
 }
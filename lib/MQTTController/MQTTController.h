@@ -17,7 +17,6 @@
 #include <thread>
 #include <condition_variable>
 #include <map>
-#include <any>
 
 
 #ifdef DEFAULT_MQTT_SERVER
@@ -82,9 +81,9 @@ class MQTTController : public HasData<>,
         using HasData::setData;
         using HasData::get;
         using HasData::set;
-        [[nodiscard]] std::vector<std::string> getKeys() const override { return keys; }
-        [[nodiscard]] std::vector<std::string> getReadOnlyKeys() const override { return readOnlyKeys; }
-        [[nodiscard]] std::vector<std::string> getNvsKeys() const override { return nvsDataKeys; }
+        [[nodiscard]] const std::vector<std::string> &getKeys() const override { return keys; }
+        [[nodiscard]] const std::vector<std::string> &getReadOnlyKeys() const override { return readOnlyKeys; }
+        [[nodiscard]] const std::vector<std::string> &getNvsKeys() const override { return nvsDataKeys; }
 
     private:
         int controllerID;
@@ -154,91 +153,67 @@ class MQTTController : public HasData<>,
         void connect();
         void disconnect();
         void mqttLoop();
-        void publishData();
+        void publishData(bool full);
         void registerSubscriptions();
         bool restart();
         std::string getTopicPrefix() const { return topicPrefix; }
 
         std::mutex hasDataItemsMutex;
         std::vector<HasData *> hasDataItems;
+        // Read-only values are derived so can't be tracked as dirty, last published values so only changes are sent
+        std::map<const HasData *, std::map<std::string, std::string>> lastPublishedReadOnly;
+        bool fullPublishPending{true};
 
         // HasData
         using HasData::updateObj;
 
         [[nodiscard]] std::string getWithOptLock(const std::string &key, const bool noLock) const override {
-            if(key == MQTT_PORT) {
-                std::unique_lock l{_dataMutex, std::defer_lock};
-                if (!noLock)
-                    l.lock();
-                return std::to_string(mqttPort);
-            }
-            return getStringDataHelper({{MQTT_SERVER, mqttServer},
-                                        {MQTT_USER, mqttUser},
-//                                         {MQTT_PORT, mqttPort},
-                                        {MQTT_PASSWORD, mqttPassword}},
-                                    key, noLock);
+            return getValueWithOptLock(key, noLock).toString(HasData::EMPTY_VALUE);
+        }
+
+        [[nodiscard]] DataValue getValueWithOptLock(const std::string &key, const bool noLock) const override {
+            static constexpr auto getters = makeDataKeyTable<ValueGetter<MQTTController>>({
+                {MQTT_SERVER,   [](const MQTTController *m) -> DataValue { return m->mqttServer; }},
+                {MQTT_PORT,     [](const MQTTController *m) -> DataValue { return m->mqttPort; }},
+                {MQTT_USER,     [](const MQTTController *m) -> DataValue { return m->mqttUser; }},
+                {MQTT_PASSWORD, [](const MQTTController *m) -> DataValue { return m->mqttPassword; }}
+            });
+            return getDataKeyHelper(getters, this, key, noLock);
         }
 
         [[nodiscard]] bool setWithOptLockAndUpdate(const std::string &key, const std::string &value_raw, const bool noLock, const bool doObjUpdate) override {
-            if(std::find(readOnlyKeys.begin(), readOnlyKeys.end(), key) != readOnlyKeys.end() ||
-                std::find(keys.begin(), keys.end(), key) == keys.end()) {
+            return setValueWithOptLockAndUpdate(key, utils::trim_clean(value_raw), noLock, doObjUpdate);
+        }
+
+        [[nodiscard]] bool setValueWithOptLockAndUpdate(const std::string &key, const DataValue &value, const bool noLock, const bool doObjUpdate) override {
+            if(isReadOnlyKey(key) || !hasKey(key)) {
                 Logger::logw(TAG, "Key %s is read-only or not found", key.c_str());
                 return false;
             }
-            const std::string value = utils::trim_clean(value_raw);
-
-            std::unique_lock l{_dataMutex, std::defer_lock};
 
-            std::string updatedKey;
+            static constexpr auto setters = makeDataKeyTable<ValueSetter<MQTTController>>({
+                {MQTT_SERVER,   [](MQTTController *m, const DataValue &value) { return setIfChanged(m->mqttServer, value.toString()); }},
+                {MQTT_USER,     [](MQTTController *m, const DataValue &value) { return setIfChanged(m->mqttUser, value.toString()); }},
+                {MQTT_PASSWORD, [](MQTTController *m, const DataValue &value) { return setIfChanged(m->mqttPassword, value.toString()); }},
+                {MQTT_PORT,     [](MQTTController *m, const DataValue &value) {
+                    LOGV(TAG, "[portConverter]");
+                    return m->validateValue(MQTT_PORT, value) && setIfChanged(m->mqttPort, (unsigned)*value.asInt());
+                }}
+            });
+
+            const char *updatedKey = setDataKeyHelper(setters, this, key, value, noLock);
+            return queueObjUpdate(updatedKey != nullptr ? updatedKey : std::string(), noLock, doObjUpdate);
+        }
 
-            const auto portConverter = [](const std::string &key, std::any varPtr, const std::string &value) {
-                Logger::logv(TAG, "[portConverter]");
-//                return lookupESPTimezone(value) && setStringDataHelperStringSetter(varPtr, value);
-                if(value.empty() || value == HasData::EMPTY_VALUE || !utils::isPositiveNumber(value)) {
-                    Logger::loge(TAG, "Invalid port %s, not saving %s", value.c_str(), key.c_str());
-                    return false;
-                }
-                auto numStoreValue = (unsigned)std::stoi(value);
-                if(numStoreValue > 65535 || numStoreValue <= 0) {
-                    Logger::loge(TAG, "Invalid port %s, not saving %s", value.c_str(), key.c_str());
+        [[nodiscard]] bool validateValue(const std::string &key, const DataValue &value) const override {
+            if(key == MQTT_PORT) {
+                const auto port = value.asInt();
+                if(!port || *port > 65535 || *port <= 0) {
+                    Logger::loge(TAG, "Invalid port %s, not saving %s", value.toString(HasData::EMPTY_VALUE).c_str(), MQTT_PORT);
                     return false;
                 }
-                unsigned &var = *std::any_cast<unsigned*>(varPtr);
-                if(var != numStoreValue) {
-                    var = numStoreValue;
-                    return true;
-                }
-                return false;
-            };
-            if(updatedKey.empty() && key != MQTT_PORT) {
-                updatedKey = setStringDataHelper({
-                                                 {MQTT_SERVER,   {&mqttServer}},
-                                                 {MQTT_USER,     {&mqttUser}},
-                                                 {MQTT_PORT, {&mqttPort, portConverter}},
-                                                 {MQTT_PASSWORD, {&mqttPassword}}},
-                                                            key, value, noLock || l.owns_lock());
-            }
-
-            static std::vector<std::string> keysToUpdateOnObj = {};
-            bool updated = !updatedKey.empty();
-            if(updated) {
-                if (doObjUpdate) {
-                    if (!noLock && !l.owns_lock())
-                        l.lock();
-
-                    keysToUpdateOnObj.push_back(updatedKey);
-                }
-            }
-
-            if(doObjUpdate && !keysToUpdateOnObj.empty()) {
-                const bool objUpdated = updateObj(keysToUpdateOnObj, noLock || l.owns_lock()) || updated; // include updated since vars were updated
-                if(objUpdated) {
-                    Logger::logv(TAG, "Updated %s", utils::join(keysToUpdateOnObj, ", ").c_str());
-                    keysToUpdateOnObj.clear();
-                }
-                return objUpdated;
             }
-            return updated;
+            return true;
         }
 
         bool updateObj(const std::vector<std::string> &_keys, const bool _dataAlreadyLocked) override {
@@ -0,0 +1,141 @@
+#ifndef PERSISTENT_LOG_RING_H_
+#define PERSISTENT_LOG_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifndef PERSISTENT_LOG_BYTES // log kept across resets, a power of 2, PersistentLogger's ring is in RTC slow memory
+#define PERSISTENT_LOG_BYTES 4096
+#endif
+#ifndef PERSISTENT_LOG_RECORD_SIZE // longer messages are truncated when kept
+#define PERSISTENT_LOG_RECORD_SIZE 128
+#endif
+
+/*
+ * Byte ring of log records meant to live in memory that isn't cleared on reset, ex.: RTC_NOINIT_ATTR. Each record is
+ *  a 2 byte length, its level, the uptime in ms and its text. Appending to a full ring drops the oldest records, so
+ *  every record is written once and dropped once, appending doesn't depend on the ring's size.
+ *
+ *  It has no constructor so the startup code leaves the memory as it was, call recover() once after booting, it keeps
+ *  the records if the ring is intact and clears it if not, ex.: after a power on. Records are written before `head`
+ *  moves past them, a reset in the middle of append() leaves the ring as it was before or after the call.
+ *
+ *  Not thread safe, PersistentLogger calls it holding Logger's mutex.
+ */
+template<std::size_t Bytes = PERSISTENT_LOG_BYTES>
+class PersistentLogRing {
+    static_assert(Bytes >= 256 && Bytes <= 65536 && (Bytes & (Bytes - 1)) == 0,
+                  "PersistentLogRing size must be a power of 2 from 256 to 65536");
+
+    public:
+        inline static constexpr std::size_t MAX_TEXT{PERSISTENT_LOG_RECORD_SIZE - 1};
+
+        struct Record {
+            uint8_t level;
+            uint32_t time_ms;
+            char text[MAX_TEXT + 1]; // NUL terminated
+        };
+
+        // Returns the number of records kept from before the reset, 0 if the ring wasn't intact and was cleared
+        std::size_t recover() {
+            if(magic != MAGIC || head - tail > Bytes) {
+                clear();
+                return 0;
+            }
+            std::size_t count = 0;
+            for(uint32_t pos = tail; pos != head; count++) {
+                Header header{};
+                if(head - pos < HEADER_SIZE) {
+                    clear();
+                    return 0;
+                }
+                copy(pos, (char *)&header, HEADER_SIZE);
+                // levels are Logger's, from error to verbose
+                if(header.length > MAX_TEXT || header.level < 1 || header.level > 5 || head - pos < HEADER_SIZE + header.length) {
+                    clear();
+                    return 0;
+                }
+                pos += HEADER_SIZE + header.length;
+            }
+            records = count;
+            return count;
+        }
+
+        void clear() {
+            head = 0;
+            tail = 0;
+            records = 0;
+            magic = MAGIC;
+        }
+
+        // Keeps up to MAX_TEXT characters of `text`, dropping the oldest records to make room
+        void append(const uint8_t level, const uint32_t time_ms, const char *text) {
+            const Header header{(uint16_t)strnlen(text, MAX_TEXT), level, time_ms};
+            const uint32_t size = HEADER_SIZE + header.length;
+            while(Bytes - (head - tail) < size) {
+                Header oldest{};
+                copy(tail, (char *)&oldest, HEADER_SIZE);
+                tail += HEADER_SIZE + oldest.length;
+                records--;
+            }
+            write(head, (const char *)&header, HEADER_SIZE);
+            write(head + HEADER_SIZE, text, header.length);
+            // the record is in memory before `head` covers it, even if a panic stops us here
+            std::atomic_signal_fence(std::memory_order_release);
+            head += size;
+            records++;
+        }
+
+        /* Copies the record at `cursor` to `out` and moves `cursor` to the next one, returns false past the newest.
+         *  Start at begin(). */
+        bool read(uint32_t &cursor, Record &out) const {
+            if(cursor == head)
+                return false;
+            Header header{};
+            copy(cursor, (char *)&header, HEADER_SIZE);
+            out.level = header.level;
+            out.time_ms = header.time_ms;
+            copy(cursor + HEADER_SIZE, out.text, header.length);
+            out.text[header.length] = '\0';
+            cursor += HEADER_SIZE + header.length;
+            return true;
+        }
+
+        [[nodiscard]] uint32_t begin() const { return tail; }
+        [[nodiscard]] std::size_t size() const { return records; }
+        [[nodiscard]] bool empty() const { return head == tail; }
+
+    private:
+        inline static constexpr uint32_t MAGIC{0x504c4f47 ^ (uint32_t)Bytes}; // "PLOG", a different size isn't intact
+
+        struct __attribute__((packed)) Header {
+            uint16_t length;
+            uint8_t level;
+            uint32_t time_ms;
+        };
+        inline static constexpr uint32_t HEADER_SIZE{sizeof(Header)};
+
+        // No initializers, see above. Positions keep growing, wrapped when indexing.
+        uint32_t magic;
+        uint32_t head;
+        uint32_t tail;
+        uint32_t records;
+        char buffer[Bytes];
+
+        void write(const uint32_t pos, const char *data, const std::size_t length) {
+            const std::size_t start = pos & (Bytes - 1);
+            const std::size_t first = length < Bytes - start ? length : Bytes - start;
+            std::memcpy(buffer + start, data, first);
+            std::memcpy(buffer, data + first, length - first);
+        }
+        void copy(const uint32_t pos, char *out, const std::size_t length) const {
+            const std::size_t start = pos & (Bytes - 1);
+            const std::size_t first = length < Bytes - start ? length : Bytes - start;
+            std::memcpy(out, buffer + start, first);
+            std::memcpy(out + first, buffer, length - first);
+        }
+};
+
+#endif // PERSISTENT_LOG_RING_H_
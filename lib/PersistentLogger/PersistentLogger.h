@@ -0,0 +1,119 @@
+#ifndef PERSISTENT_LOGGER_H_
+#define PERSISTENT_LOGGER_H_
+
+#include <Logger.h>
+#include "PersistentLogRing.h"
+
+#if defined(ARDUINO)
+#include <esp_system.h>
+#endif
+
+#include <chrono>
+
+/*
+ * Keeps the last PERSISTENT_LOG_BYTES of log messages in a PersistentLogRing that survives resets, ex.: panics,
+ *  watchdogs and restarts. Keeping a message costs the same whatever the ring's size, so it can stay on in release.
+ *
+ *  When it's created after a reset, it logs the messages kept from before it and why the chip was reset, then starts
+ *  over. Create it after the loggers they should go to, ex.: SyslogLogger, and before startAsync() so none are dropped.
+ *  It isn't added to the loggers yet, so they aren't kept again.
+ *
+ *  The ring is the caller's so it can be placed in memory that isn't cleared on reset:
+ *      RTC_NOINIT_ATTR static PersistentLogger::Ring crashLog;
+ *      Logger<>::addLogger(std::make_unique<PersistentLogger>(crashLog));
+ *  When logging asynchronously, the messages still queued for the drain task at a panic are lost.
+ */
+class PersistentLogger : public Logger<> {
+    public:
+        inline static constexpr const char * const TAG{"plog"};
+
+        using Ring = PersistentLogRing<PERSISTENT_LOG_BYTES>;
+
+        ~PersistentLogger() override = default;
+        explicit PersistentLogger(Ring &ring, const char *resetReason = getResetReason())
+#if defined(ENABLE_LOGGING)
+                : Logger(), ring(ring) {
+            const std::size_t kept = ring.recover();
+            if(kept == 0) {
+                Logger::logi(TAG, "Reset by %s, no log messages kept from before", resetReason);
+            } else {
+                Logger::logw(TAG, "Reset by %s, the last %u log messages from before follow", resetReason, (unsigned)kept);
+                replay();
+            }
+            ring.clear();
+#if defined(ARDUINO)
+            // restarts wait for the drain task to hand over what's queued
+            esp_register_shutdown_handler([]() { Logger<>::flush(std::chrono::milliseconds(200)); });
+#endif
+        };
+
+        // Why the chip was last reset, "unknown" off the chip
+        static const char *getResetReason() {
+#if defined(ARDUINO)
+            switch(esp_reset_reason()) {
+                case ESP_RST_POWERON:   return "power on";
+                case ESP_RST_EXT:       return "external pin";
+                case ESP_RST_SW:        return "restart";
+                case ESP_RST_PANIC:     return "panic";
+                case ESP_RST_INT_WDT:   return "interrupt watchdog";
+                case ESP_RST_TASK_WDT:  return "task watchdog";
+                case ESP_RST_WDT:       return "watchdog";
+                case ESP_RST_DEEPSLEEP: return "deep sleep wake up";
+                case ESP_RST_BROWNOUT:  return "brownout";
+                case ESP_RST_SDIO:      return "SDIO";
+                default:                return "unknown";
+            }
+#else
+            return "unknown";
+#endif
+        }
+
+    private:
+        Ring &ring;
+
+        void replay() const {
+            Ring::Record record{};
+            for(uint32_t cursor = ring.begin(); ring.read(cursor, record);) {
+                const unsigned long time_ms = record.time_ms;
+                switch(record.level) {
+                    case LOG_LEVEL_ERROR:
+                        Logger::loge(TAG, "before reset %lu.%03lus %s", time_ms / 1000, time_ms % 1000, record.text);
+                        break;
+                    case LOG_LEVEL_WARN:
+                        Logger::logw(TAG, "before reset %lu.%03lus %s", time_ms / 1000, time_ms % 1000, record.text);
+                        break;
+                    case LOG_LEVEL_INFO:
+                        Logger::logi(TAG, "before reset %lu.%03lus %s", time_ms / 1000, time_ms % 1000, record.text);
+                        break;
+                    case LOG_LEVEL_DEBUG:
+                        Logger::logd(TAG, "before reset %lu.%03lus %s", time_ms / 1000, time_ms % 1000, record.text);
+                        break;
+                    default:
+                        Logger::logv(TAG, "before reset %lu.%03lus %s", time_ms / 1000, time_ms % 1000, record.text);
+                        break;
+                }
+            }
+        }
+
+        static uint32_t uptime_ms() {
+#if defined(ARDUINO)
+            return millis();
+#else
+            return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        void v_logv(const char *msg) const override { ring.append(LOG_LEVEL_VERBOSE, uptime_ms(), msg); };
+        void v_logd(const char *msg) const override { ring.append(LOG_LEVEL_DEBUG, uptime_ms(), msg); };
+        void v_logi(const char *msg) const override { ring.append(LOG_LEVEL_INFO, uptime_ms(), msg); };
+        void v_logw(const char *msg) const override { ring.append(LOG_LEVEL_WARN, uptime_ms(), msg); };
+        void v_loge(const char *msg) const override { ring.append(LOG_LEVEL_ERROR, uptime_ms(), msg); };
+#else
+                : Logger() { (void)ring; (void)resetReason; };
+
+        static const char *getResetReason() { return "unknown"; }
+#endif // ENABLE_LOGGING
+};
+
+#endif // PERSISTENT_LOGGER_H_
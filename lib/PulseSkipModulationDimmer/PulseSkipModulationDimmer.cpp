@@ -2,20 +2,62 @@
 
 
 PulseSkipModulationDimmer::PulseSkipModulationDimmer(const std::string &instanceID, const uint8_t triacPin,
-                                               const bool triacPinPolarityInverted, const uint16_t cycles) :
+                                               const bool triacPinPolarityInverted, const uint16_t cycles, DimmerBank *bank) :
         ZeroCrossing(instanceID),
         _triacPin(triacPin),
-        _triacPinPolarityInverted(triacPinPolarityInverted) {
+        _triacPinPolarityInverted(triacPinPolarityInverted),
+        _bank(bank) {
 
     setCycles(cycles);
-    pinMode(_triacPin, OUTPUT);
-    digitalWrite(_triacPin, LOW ^ _triacPinPolarityInverted);
+    mains_hal::pinOutput(_triacPin, _triacPinPolarityInverted); // off
 
-    isrInit();
+    if(_bank != nullptr) {
+        _bankChannel = _bank->addChannel(_triacPin, _triacPinPolarityInverted, DimmerBank::ChannelKind::PULSE_SKIP, &_fade);
+        if(_bankChannel < 0)
+            Logger::loge(TAG, "Dimmer bank %s is full, using own ISR", _bank->getInstanceID().c_str());
+        else
+            publishBrightness();
+    }
+    if(_bankChannel < 0)
+        isrInit();
 }
 
 PulseSkipModulationDimmer::~PulseSkipModulationDimmer() {
-    digitalWrite(_triacPin, LOW ^ _triacPinPolarityInverted);
+    // no ISR may turn it back on once it's off
+    unregisterIsr();
+    if(_bankChannel >= 0)
+        _bank->removeChannel(_bankChannel);
+    setTriac(false);
+}
+
+void PulseSkipModulationDimmer::publishBrightness() {
+    if(_fade.isActive())
+        _fade.jump(_brightness);
+    if(_bankChannel >= 0)
+        _bank->setPulseSkip(_bankChannel, _brightness, _cycles);
+}
+
+void PulseSkipModulationDimmer::setTriac(const bool on) const {
+    if(on ^ _triacPinPolarityInverted)
+        mains_hal::outputSet(1<<_triacPin);
+    else
+        mains_hal::outputClear(1<<_triacPin);
+}
+
+void PulseSkipModulationDimmer::halfCycleStarted() {
+    uint32_t faded;
+    const bool fading = _fade.step(faded);
+    halfCycleCount++;
+    if(halfCycleCount%2 != 0) // ensure both halves of AC cycle, only change on even half cycles
+        return;
+
+    const unsigned brightness = fading ? faded : _brightness;
+#if PULSE_SKIP_SIGMA_DELTA
+    const bool shouldFire = mains_timing::sigmaDeltaStep(sigmaDeltaAccumulator, brightness, _cycles);
+#else
+    const bool shouldFire = mains_timing::pulseSkipRatioStep(halfCycleCount, cyclesFiredCount, brightness, _cycles);
+#endif
+    setTriac(shouldFire);
 }
 
 void PulseSkipModulationDimmer::timerISRCall(ZeroCrossing* instance, const unsigned currCyclePercentage) {
@@ -27,38 +69,17 @@ void PulseSkipModulationDimmer::timerISRCall(ZeroCrossing* instance, const unsig
 
     if(thisOne->currHalfCycleCalcDone) // only calc once per half cycle
         return;
-    thisOne->halfCycleCount++;
     thisOne->currHalfCycleCalcDone = true;
-    if(thisOne->halfCycleCount%2 != 0) // ensure both halves of AC cycle, only change on even half cycles
-        return;
-
-    if(thisOne->halfCycleCount/2 > thisOne->_cycles) {
-        thisOne->halfCycleCount = 0;
-        thisOne->cyclesFiredCount = 0;
-    }
-
-    const bool shouldFire = thisOne->_brightness > // check for div by 0
-            (thisOne->halfCycleCount == 0 ? 0 : (thisOne->_cycles * thisOne->cyclesFiredCount)/(thisOne->halfCycleCount/2) - 1);
-
-    if (shouldFire) {
-        thisOne->cyclesFiredCount++;
-        // turn on triac
-        if(thisOne->_triacPinPolarityInverted)
-            GPIO.out_w1tc = 1<<thisOne->_triacPin;
-        else
-            GPIO.out_w1ts = 1<<thisOne->_triacPin;
-        return;
-    }
+    thisOne->halfCycleStarted();
+}
 
-    // turn off triac
-    if(thisOne->_triacPinPolarityInverted)
-        GPIO.out_w1ts = 1<<thisOne->_triacPin;
-    else
-        GPIO.out_w1tc = 1<<thisOne->_triacPin;
+void PulseSkipModulationDimmer::eventISRCall(ZeroCrossing* instance, const InstanceEvent event, const uint32_t, const unsigned) {
+    if(event == InstanceEvent::HALF_CYCLE_START) // fires for whole cycles, so no events within the half cycle
+        ((PulseSkipModulationDimmer*)instance)->halfCycleStarted();
 }
 
 void PulseSkipModulationDimmer::setBrightness(const uint16_t brightness, bool noLock) {
-    Logger::logv(TAG, "[setBrightness 1] Setting brightness to %d", brightness);
+    LOGV(TAG, "[setBrightness 1] Setting brightness to %d", brightness);
     std::unique_lock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
@@ -68,20 +89,43 @@ void PulseSkipModulationDimmer::setBrightness(const uint16_t brightness, bool no
         return;
     }
     this->_brightness = brightness;
+    publishBrightness();
+    markDirty(BRIGHTNESS);
 }
 
 void PulseSkipModulationDimmer::setBrightness(const uint16_t brightness, const uint16_t cycles, bool noLock) {
-    Logger::logv(TAG, "[setBrightness 2] Setting brightness to %d", brightness);
+    LOGV(TAG, "[setBrightness 2] Setting brightness to %d", brightness);
     std::unique_lock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
     _brightness = 0; // prevent out of range brightness temporarily
+    publishBrightness();
     setCycles(cycles, true);
     setBrightness(brightness, true);
 }
 
+void PulseSkipModulationDimmer::fadeTo(const uint16_t brightness, const uint32_t duration_ms, const FadeCurve curve, bool noLock) {
+    LOGV(TAG, "[fadeTo] Fading to brightness %d over %dms", brightness, duration_ms);
+    std::unique_lock l{_dataMutex, std::defer_lock};
+    if(!noLock)
+        l.lock();
+    if(brightness > _cycles) {
+        Logger::loge(TAG, "brightness %d is greater than allowable (cycles) %d", brightness, _cycles);
+        return;
+    }
+    const uint32_t halfCycles = halfPeriod_us == 0 ? 0 : (uint32_t)((uint64_t)duration_ms * 1000 / halfPeriod_us);
+    if(halfCycles == 0) {
+        setBrightness(brightness, true);
+        return;
+    }
+    const uint32_t from = _fade.isActive() ? _fade.level() : _brightness;
+    this->_brightness = brightness; // the bank gets it from the fade
+    _fade.start(from, brightness, _cycles, halfCycles, curve);
+    markDirty(BRIGHTNESS);
+}
+
 void PulseSkipModulationDimmer::setCycles(const uint16_t cycles, bool noLock) {
-    Logger::logv(TAG, "[setResolution] Setting resolution to %d", cycles);
+    LOGV(TAG, "[setResolution] Setting resolution to %d", cycles);
     if(cycles > max_cycles || cycles < 2) {
         Logger::loge(TAG, "cycles %d is out of range (min 2 to max %d)", cycles, max_cycles);
         return;
@@ -90,15 +134,17 @@ void PulseSkipModulationDimmer::setCycles(const uint16_t cycles, bool noLock) {
     if(!noLock)
         l.lock();
     _brightness = 0; // prevent out of range brightness temporarily
+    publishBrightness();
     const auto newBrightness = _brightness * cycles / _cycles;
-    Logger::logv(TAG, "Setting cycles to %d (and brightness to %d)", cycles, newBrightness);
+    LOGV(TAG, "Setting cycles to %d (and brightness to %d)", cycles, newBrightness);
     _cycles = cycles;
+    markDirty(CYCLES);
     setBrightness(newBrightness, true);
 }
 
 uint16_t PulseSkipModulationDimmer::getCycles(bool noLock) const {
-    Logger::logv(TAG, "[getResolution] Getting resolution");
-    std::unique_lock l{_dataMutex, std::defer_lock};
+    LOGV(TAG, "[getResolution] Getting resolution");
+    DataReadLock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
     (void)noLock;
@@ -106,8 +152,8 @@ uint16_t PulseSkipModulationDimmer::getCycles(bool noLock) const {
 }
 
 uint16_t PulseSkipModulationDimmer::getBrightness(bool noLock) const {
-    Logger::logv(TAG, "[getBrightness] Getting brightness");
-    std::unique_lock l{_dataMutex, std::defer_lock};
+    LOGV(TAG, "[getBrightness] Getting brightness");
+    DataReadLock l{_dataMutex, std::defer_lock};
     if(!noLock)
         l.lock();
     return _brightness;
@@ -2,14 +2,24 @@
 #define PULSE_SKIP_MODULATION_DIMMER_CONTROLLER_H
 
 #include <ZeroCrossing.h>
+#include <DimmerBank.h>
+#include <pulse_skip.h>
+#include <Fade.h>
+
+#ifndef PULSE_SKIP_SIGMA_DELTA // 0 for the previous ratio based firing decisions, see mains_timing/pulse_skip.h
+#define PULSE_SKIP_SIGMA_DELTA 1
+#endif
 
 class PulseSkipModulationDimmer : public ZeroCrossing {
     public:
         inline static constexpr const char *TAG{"PSMD"};
+        using FadeCurve = mains_timing::FadeCurve;
 
         inline static constexpr DRAM_ATTR uint16_t max_cycles{128};
 
-        explicit PulseSkipModulationDimmer(const std::string &instanceID, uint8_t triacPin, bool triacPinPolarityInverted = true, uint16_t cycles = 128);
+        // With a `bank` the triac is driven by the bank's ISR, falls back to its own if the bank is full
+        explicit PulseSkipModulationDimmer(const std::string &instanceID, uint8_t triacPin, bool triacPinPolarityInverted = true, uint16_t cycles = 128,
+                                           DimmerBank *bank = nullptr);
         ~PulseSkipModulationDimmer() override;
 
         [[nodiscard]] const char * getTag() const override { return TAG; }
@@ -20,6 +30,10 @@ class PulseSkipModulationDimmer : public ZeroCrossing {
         void setOff() { setBrightness(0); }
         void setBrightness(uint16_t brightness, bool noLock = false);
         void setBrightness(uint16_t brightness, uint16_t cycles, bool noLock = false);
+        /* Ramps to `brightness` over `duration_ms`, stepped every half cycle by the ISR. getBrightness() returns the
+         *  target straight away, setting the brightness or cycles ends the fade. */
+        void fadeTo(uint16_t brightness, uint32_t duration_ms, FadeCurve curve = FadeCurve::PERCEPTUAL, bool noLock = false);
+        [[nodiscard]] bool isFading() const { return _fade.isActive(); }
         void setCycles(uint16_t cycles, bool noLock = false);
         [[nodiscard]] uint16_t getBrightness(bool noLock = false) const;
         [[nodiscard]] uint16_t getCycles(bool noLock = false) const;
@@ -32,8 +46,8 @@ class PulseSkipModulationDimmer : public ZeroCrossing {
         inline static const std::vector<std::string> keys = utils::concat(readOnlyKeys,
                                     utils::concat(ZeroCrossing::keys, {CYCLES, BRIGHTNESS}, true), true);
 
-        [[nodiscard]] std::vector<std::string> getKeys() const override { return keys; }
-        [[nodiscard]] std::vector<std::string> getReadOnlyKeys() const override { return readOnlyKeys; }
+        [[nodiscard]] const std::vector<std::string> &getKeys() const override { return keys; }
+        [[nodiscard]] const std::vector<std::string> &getReadOnlyKeys() const override { return readOnlyKeys; }
 
 
 private:
@@ -46,82 +60,83 @@ private:
     bool currHalfCycleCalcDone{false};
     unsigned halfCycleCount{0};
     unsigned cyclesFiredCount{0};
+    uint32_t sigmaDeltaAccumulator{0};
+    DimmerBank * const _bank;
+    int _bankChannel{-1};
+    mains_timing::Fade _fade{}; // levels are brightness, used by the ISR instead of _brightness while active
+
+    void publishBrightness(); // after _brightness or _cycles change, ends a fade
 
     /* Calculate if triac should fire on this cycle depending on brightness.
         Brightness is the number of cycles for which the triac should be on compared to the total number of cycles.
-        On cycles should be spread out across the total number of cycles.
+        On cycles should be spread out across the total number of cycles, with PULSE_SKIP_SIGMA_DELTA evenly.
      */
     static void IRAM_ATTR timerISRCall(ZeroCrossing* instance, unsigned currCyclePercentage);
+    static void IRAM_ATTR eventISRCall(ZeroCrossing* instance, InstanceEvent event, uint32_t halfCycleStart_us, unsigned halfPeriod_us);
+    void IRAM_ATTR halfCycleStarted();
+    void IRAM_ATTR setTriac(bool on) const;
     void addInstanceTimerISR() override {
         InstanceISRFunc timerISR = &PulseSkipModulationDimmer::timerISRCall;
-        instancesISRs.emplace_back(this, timerISR);
+        InstanceEventFunc eventISR = &PulseSkipModulationDimmer::eventISRCall;
+        if(!instancesISRs.add(this, timerISR) || !instancesEventISRs.add(this, eventISR))
+            Logger::loge(TAG, "Too many zero crossing instances, max is %zu", instancesISRs.capacity());
     }
 
     // HasData
     [[nodiscard]] std::string getWithOptLock(const std::string &key, const bool noLock) const override {
-        Logger::logv(TAG, "[getWithOptLock] Getting %s", key.c_str());
-
-        using retType = std::string;
-        using FunPtrType = retType(*)(const PulseSkipModulationDimmer*, const bool noLock);
-        std::string thisData = getStringDataHelper<FunPtrType>({
-                       {BRIGHTNESS, (FunPtrType)[](const auto l, const bool noLock) -> retType { return std::to_string(l->getBrightness(noLock)); }},
-                       {CYCLES, (FunPtrType)[](const auto l, const bool noLock) -> retType { return std::to_string(l->getCycles(noLock)); }},
-                       {MAX_CYCLES, (FunPtrType)[](const auto l, const bool noLock) -> retType { return std::to_string(max_cycles); }}
-               }, key, true, (FunPtrType)[](const auto, const bool) -> retType { return HasData::EMPTY_VALUE; })(this, noLock);
-
-        if(!thisData.empty() && thisData != HasData::EMPTY_VALUE)
-            return thisData;
-        return ZeroCrossing::getWithOptLock(key, noLock);
+        return getValueWithOptLock(key, noLock).toString(HasData::EMPTY_VALUE);
+    }
+
+    [[nodiscard]] DataValue getValueWithOptLock(const std::string &key, const bool noLock) const override {
+        LOGV(TAG, "[getValueWithOptLock] Getting %s", key.c_str());
+
+        static constexpr auto getters = makeDataKeyTable<ValueGetter<PulseSkipModulationDimmer>>({
+                {BRIGHTNESS, [](const PulseSkipModulationDimmer *p) -> DataValue { return p->getBrightness(true); }},
+                {CYCLES, [](const PulseSkipModulationDimmer *p) -> DataValue { return p->getCycles(true); }},
+                {MAX_CYCLES, [](const PulseSkipModulationDimmer *) -> DataValue { return max_cycles; }}
+        });
+        if(getters.find(key.c_str()) == nullptr)
+            return ZeroCrossing::getValueWithOptLock(key, noLock);
+        return getDataKeyHelper(getters, this, key, noLock);
     }
 
     [[nodiscard]] bool setWithOptLockAndUpdate(const std::string &key, const std::string &value_raw, const bool noLock, const bool doObjUpdate) override {
-        if(std::find(readOnlyKeys.begin(), readOnlyKeys.end(), key) != readOnlyKeys.end() ||
-           std::find(keys.begin(), keys.end(), key) == keys.end()) {
+        return setValueWithOptLockAndUpdate(key, utils::trim_clean(value_raw), noLock, doObjUpdate);
+    }
+
+    [[nodiscard]] bool setValueWithOptLockAndUpdate(const std::string &key, const DataValue &value, const bool noLock, const bool doObjUpdate) override {
+        if(isReadOnlyKey(key) || !hasKey(key)) {
             Logger::logw(TAG, "Key %s is read-only or not found", key.c_str());
             return false;
         }
-        const std::string value = utils::trim_clean(value_raw);
-        Logger::logv(TAG, "[setWithOptLockAndUpdate] Setting %s to %s", key.c_str(), value.c_str());
+        LOGV(TAG, "[setValueWithOptLockAndUpdate] Setting %s to %s", key.c_str(), value.toString(HasData::EMPTY_VALUE).c_str());
 
-        const bool zeroCrossingUpdated = ZeroCrossing::setWithOptLockAndUpdate(key, value, noLock, doObjUpdate);
+        const bool zeroCrossingUpdated = ZeroCrossing::setValueWithOptLockAndUpdate(key, value, noLock, doObjUpdate);
         if(zeroCrossingUpdated)
             return true;
 
-        static std::vector<std::string> keysToUpdateOnObj = {};
-        bool updated;
-
         std::unique_lock l{_dataMutex, std::defer_lock};
+        if(!noLock)
+            l.lock();
+        if(!validateValue(key, value))
+            return false;
+        const auto val = *value.asInt();
+
+        // changed only if the setter took it
+        bool updated;
         switch(utils::hashstr(key.c_str())) {
             case utils::hashstr(BRIGHTNESS): {
-                if(!utils::isPositiveNumber(value)) {
-                    Logger::loge(TAG, "Invalid BRIGHTNESS value %s", value.c_str());
-                    return false;
-                }
-                const uint16_t val = std::stoi(value);
-                if(!noLock)
-                    l.lock();
-                updated = val != getBrightness(true);
-                if(updated) {
-                    setBrightness(val, true);
-                    if (doObjUpdate)
-                        keysToUpdateOnObj.push_back(key);
-                }
+                const auto before = getBrightness(true);
+                if(val != before)
+                    setBrightness((uint16_t)val, true);
+                updated = getBrightness(true) != before;
                 break;
             }
             case utils::hashstr(CYCLES): {
-                if(!utils::isPositiveNumber(value)) {
-                    Logger::loge(TAG, "Invalid RESOLUTION value %s", value.c_str());
-                    return false;
-                }
-                const uint16_t val = std::stoi(value);
-                if(!noLock)
-                    l.lock();
-                updated = val != getCycles(true);
-                if(updated) {
-                    setCycles(val, true);
-                    if (doObjUpdate)
-                        keysToUpdateOnObj.push_back(key);
-                }
+                const auto before = getCycles(true);
+                if(val != before)
+                    setCycles((uint16_t)val, true);
+                updated = getCycles(true) != before;
                 break;
             }
             default: {
@@ -129,16 +144,26 @@ private:
                 return false;
             }
         }
+        return queueObjUpdate(updated ? key : std::string(), noLock || l.owns_lock(), doObjUpdate);
+    }
 
-        if(doObjUpdate && !keysToUpdateOnObj.empty()) {
-            const bool objUpdated = updateObj(keysToUpdateOnObj, noLock || l.owns_lock()) || updated; // include updated since vars were updated
-            if(objUpdated) {
-                Logger::logv(TAG, "Updated %s", utils::join(keysToUpdateOnObj, ", ").c_str());
-                keysToUpdateOnObj.clear();
-            }
-            return objUpdated;
+    // The same ranges as the setters, `_dataMutex` must be held
+    [[nodiscard]] bool validateValue(const std::string &key, const DataValue &value) const override {
+        const auto val = value.asInt();
+        switch(utils::hashstr(key.c_str())) {
+            case utils::hashstr(BRIGHTNESS):
+                if(val && *val >= 0 && *val <= _cycles)
+                    return true;
+                break;
+            case utils::hashstr(CYCLES):
+                if(val && *val >= 2 && *val <= max_cycles)
+                    return true;
+                break;
+            default:
+                return ZeroCrossing::validateValue(key, value);
         }
-        return updated;
+        Logger::loge(TAG, "Invalid %s value %s", key.c_str(), value.toString(HasData::EMPTY_VALUE).c_str());
+        return false;
     }
 };
 
@@ -0,0 +1,240 @@
+#ifndef SYSLOG_BATCHER_H_
+#define SYSLOG_BATCHER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifndef SYSLOG_PACKET_BYTES // largest datagram sent, keep it under the network's MTU
+#define SYSLOG_PACKET_BYTES 1024
+#endif
+#ifndef SYSLOG_BATCH_MESSAGES // messages per datagram, octet counted (RFC 6587), 1 for servers that want one per datagram
+#define SYSLOG_BATCH_MESSAGES 8
+#endif
+#ifndef SYSLOG_RATE_LIMIT // messages sent per second on average
+#define SYSLOG_RATE_LIMIT 50
+#endif
+#ifndef SYSLOG_RATE_BURST // messages that can be sent at once after a quiet period
+#define SYSLOG_RATE_BURST 100
+#endif
+#ifndef SYSLOG_SPOOL_BYTES // messages waiting to be sent, ex.: while WiFi is down, the oldest are dropped when it's full
+#define SYSLOG_SPOOL_BYTES 8192
+#endif
+#ifndef SYSLOG_FACILITY
+#define SYSLOG_FACILITY 0 // kern
+#endif
+
+// Where SyslogBatcher sends its datagrams, ex.: UDP over WiFi
+class SyslogTransport {
+    public:
+        virtual ~SyslogTransport() = default;
+        [[nodiscard]] virtual bool isConnected() const = 0;
+        virtual bool send(const char *packet, std::size_t length) = 0;
+};
+
+/*
+ * Byte ring of messages, each a 2 byte length and its text. Pushing to a full spool drops the oldest messages to make
+ *  room and counts them.
+ */
+template<std::size_t Bytes>
+class SyslogSpool {
+    static_assert(Bytes >= 64 && Bytes <= UINT16_MAX, "SyslogSpool size out of range");
+
+    public:
+        bool push(const char *text, const std::size_t length) {
+            if(length + 2 > Bytes) {
+                dropped++;
+                return false;
+            }
+            while(Bytes - (head - tail) < length + 2) {
+                pop();
+                dropped++;
+            }
+            const auto length16 = (uint16_t)length;
+            write(head, (const char *)&length16, 2);
+            write(head + 2, text, length);
+            head += length + 2;
+            count++;
+            return true;
+        }
+
+        // Copies the message at `cursor` to `out` and moves `cursor` to the next one, returns its length
+        std::size_t read(std::size_t &cursor, char *out) const {
+            uint16_t length;
+            copy(cursor, (char *)&length, 2);
+            copy(cursor + 2, out, length);
+            cursor += length + 2;
+            return length;
+        }
+
+        [[nodiscard]] std::size_t peekLength(const std::size_t cursor) const {
+            uint16_t length;
+            copy(cursor, (char *)&length, 2);
+            return length;
+        }
+
+        void pop() {
+            tail += peekLength(tail) + 2;
+            count--;
+        }
+
+        [[nodiscard]] std::size_t front() const { return tail; }
+        [[nodiscard]] std::size_t size() const { return count; }
+        [[nodiscard]] bool empty() const { return count == 0; }
+        [[nodiscard]] unsigned long droppedCount() const { return dropped; }
+
+    private:
+        char buffer[Bytes]{};
+        std::size_t head{0}; // positions keep growing, wrapped when indexing
+        std::size_t tail{0};
+        std::size_t count{0};
+        unsigned long dropped{0};
+
+        void write(const std::size_t pos, const char *data, const std::size_t length) {
+            for(std::size_t i = 0; i < length; i++)
+                buffer[(pos + i) % Bytes] = data[i];
+        }
+        void copy(const std::size_t pos, char *out, const std::size_t length) const {
+            for(std::size_t i = 0; i < length; i++)
+                out[i] = buffer[(pos + i) % Bytes];
+        }
+};
+
+/*
+ * Syslog messages in RFC 5424 format, queued in a spool and sent in batches of up to `batchMessages` per datagram
+ *  while the transport is connected and the rate limit allows, in the order they were logged. Messages logged while
+ *  disconnected wait in the spool and go out once the connection is back. Messages dropped from a full spool are
+ *  reported in a message ahead of the next datagram.
+ *
+ *  Not thread safe, SyslogLogger calls it holding Logger's mutex.
+ */
+template<std::size_t SpoolBytes = SYSLOG_SPOOL_BYTES>
+class SyslogBatcher {
+    public:
+        // RFC 5424 severities
+        inline static constexpr uint8_t SEVERITY_ERROR{3};
+        inline static constexpr uint8_t SEVERITY_WARNING{4};
+        inline static constexpr uint8_t SEVERITY_INFO{6};
+        inline static constexpr uint8_t SEVERITY_DEBUG{7};
+
+        SyslogBatcher(SyslogTransport &transport, const char *hostname, const char *appName,
+                      const uint32_t rateLimit = SYSLOG_RATE_LIMIT, const uint32_t rateBurst = SYSLOG_RATE_BURST,
+                      const std::size_t batchMessages = SYSLOG_BATCH_MESSAGES) :
+                transport(transport), hostname(hostname), appName(appName), rateLimit(rateLimit),
+                rateBurst(rateBurst), batchMessages(batchMessages < 1 ? 1 : batchMessages),
+                tokens(rateBurst * TOKEN) { }
+
+        /* Queues a message, `timestamp` is RFC 3339 or "-" if the time isn't known. Sends right away if there's a full
+         *  batch, otherwise it waits for pump(). */
+        void log(const uint8_t severity, const char *timestamp, const char *msg, const uint32_t now_ms) {
+            const int length = std::snprintf(line, MAX_MESSAGE + 1, "<%u>1 %s %s %s - - - %s", SYSLOG_FACILITY * 8 + severity,
+                                             timestamp, hostname, appName, msg);
+            if(length < 0)
+                return;
+            spool.push(line, (std::size_t)length < MAX_MESSAGE ? (std::size_t)length : MAX_MESSAGE);
+            if(spool.size() >= batchMessages)
+                send(now_ms, false);
+        }
+
+        // Sends what the connection and the rate limit allow, returns true if nothing is left waiting
+        bool pump(const uint32_t now_ms) { return send(now_ms, true); }
+
+        [[nodiscard]] std::size_t queuedCount() const { return spool.size(); }
+        [[nodiscard]] unsigned long sentCount() const { return sent; }
+        [[nodiscard]] unsigned long packetCount() const { return packets; }
+        [[nodiscard]] unsigned long droppedCount() const { return spool.droppedCount(); }
+
+    private:
+        inline static constexpr uint32_t TOKEN{1000}; // tokens are in thousandths of a message
+        inline static constexpr std::size_t MAX_MESSAGE{SYSLOG_PACKET_BYTES - 8}; // room for the octet count
+
+        SyslogTransport &transport;
+        const char *const hostname;
+        const char *const appName;
+        const uint32_t rateLimit;
+        const uint32_t rateBurst;
+        const std::size_t batchMessages;
+        uint32_t tokens;
+        uint32_t lastRefill_ms{0};
+        bool refilled{false};
+        SyslogSpool<SpoolBytes> spool{};
+        unsigned long reportedDropped{0};
+        unsigned long sent{0};
+        unsigned long packets{0};
+        char line[MAX_MESSAGE + 1]{};
+        char packet[SYSLOG_PACKET_BYTES]{};
+
+        void refill(const uint32_t now_ms) {
+            if(!refilled) {
+                refilled = true;
+                lastRefill_ms = now_ms;
+                return;
+            }
+            const uint32_t full_ms = rateLimit == 0 ? 0 : rateBurst * TOKEN / rateLimit + 1;
+            uint32_t elapsed_ms = now_ms - lastRefill_ms;
+            elapsed_ms = elapsed_ms < full_ms ? elapsed_ms : full_ms;
+            lastRefill_ms = now_ms;
+            tokens += elapsed_ms * rateLimit;
+            tokens = tokens < rateBurst * TOKEN ? tokens : rateBurst * TOKEN;
+        }
+
+        // Appends a message to `packet`, octet counted when batching, returns false if it doesn't fit
+        bool append(std::size_t &used, const char *text, const std::size_t length) {
+            if(batchMessages == 1) {
+                if(used > 0)
+                    return false;
+                std::memcpy(packet, text, length);
+                used = length;
+                return true;
+            }
+            char count[8];
+            const int countLength = std::snprintf(count, sizeof(count), "%u ", (unsigned)length);
+            if(used + countLength + length > sizeof(packet))
+                return false;
+            std::memcpy(packet + used, count, countLength);
+            std::memcpy(packet + used + countLength, text, length);
+            used += countLength + length;
+            return true;
+        }
+
+        // `partial` sends batches that aren't full too
+        bool send(const uint32_t now_ms, const bool partial) {
+            refill(now_ms);
+            while(!spool.empty() && (partial || spool.size() >= batchMessages)) {
+                if(!transport.isConnected() || tokens < TOKEN)
+                    break;
+                std::size_t used = 0;
+                std::size_t messages = 0;
+                const unsigned long dropped = spool.droppedCount() - reportedDropped;
+                if(dropped > 0) {
+                    const int length = std::snprintf(line, MAX_MESSAGE + 1, "<%u>1 - %s %s - - - %lu messages dropped, the spool was full",
+                                                     SYSLOG_FACILITY * 8 + SEVERITY_WARNING, hostname, appName, dropped);
+                    append(used, line, (std::size_t)length);
+                    messages++;
+                }
+                std::size_t cursor = spool.front();
+                std::size_t taken = 0;
+                while(taken < spool.size() && messages < batchMessages && tokens >= (messages + 1) * TOKEN) {
+                    std::size_t next = cursor;
+                    const std::size_t length = spool.read(next, line);
+                    if(!append(used, line, length))
+                        break;
+                    cursor = next;
+                    taken++;
+                    messages++;
+                }
+                if(!transport.send(packet, used))
+                    break;
+                packets++;
+                tokens -= messages * TOKEN;
+                reportedDropped += dropped;
+                sent += taken;
+                for(std::size_t i = 0; i < taken; i++)
+                    spool.pop();
+            }
+            return spool.empty();
+        }
+};
+
+#endif // SYSLOG_BATCHER_H_
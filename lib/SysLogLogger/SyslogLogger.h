@@ -1,89 +1,108 @@
 #ifndef SYSLOG_LOGGER_H_
 #define SYSLOG_LOGGER_H_
 
+#include <WiFi.h>
 #include <WiFiUdp.h>
 #include "settings.h"
 
 #include <Logger.h>
+#include "SyslogBatcher.h"
 
-#include <Syslog.h>
+#include <ctime>
+#include <sys/time.h>
 
+/*
+ * Sends log messages to SYSLOG_SERVER in batches, see SyslogBatcher. Messages logged while WiFi is down are kept and
+ *  sent when it's back. When logging asynchronously, batches go out when the drain task runs out of messages, otherwise
+ *  right after each message.
+ */
 class SyslogLogger : public Logger<> {
     public:
         inline static constexpr const char * const TAG{"syslg"};
 
         ~SyslogLogger() override = default;
-        explicit SyslogLogger(const char* server = SYSLOG_SERVER, uint16_t port = SYSLOG_PORT, uint8_t protocol = SYSLOG_PROTO_BSD)
-#if defined(SYSLOG_SERVER) && defined(ENABLE_LOGGING)       
-                : Logger(), 
-                    udpClient(),
-                    syslog(udpClient, protocol) {
+        explicit SyslogLogger(const char* server = SYSLOG_SERVER, uint16_t port = SYSLOG_PORT)
+#if defined(SYSLOG_SERVER) && defined(ENABLE_LOGGING)
+                : Logger(),
+                    transport(server, port),
+                    batcher(transport, HOSTNAME, "-") {
             // TODO: use HasData to allow dynamic setting of server/port
-            syslog.server(server, port);
-            syslog.deviceHostname(HOSTNAME);
-//            syslog.appName(PRODUCT_NAME);
-            syslog.defaultPriority(LOG_KERN);
-            Logger::logi(TAG, "Sending SysLogs to %s:%d", SYSLOG_SERVER, SYSLOG_PORT);
+            Logger::logi(TAG, "Sending SysLogs to %s:%d", server, port);
         };
 
     private:
-        WiFiUDP udpClient;
-        mutable Syslog syslog;
-
-    // Logger offers:
-    //   LOG_EMERG 0 - system is unusable */
-    //   LOG_ALERT 1 - action must be taken immediately */
-    //   LOG_CRIT  2 - critical conditions */
-    //   *LOG_ERR   3 - error conditions */
-    //   *LOG_WARNING 4 - warning conditions */
-    //   LOG_NOTICE  5 - normal but significant condition */
-    //   *LOG_INFO  6 - informational */
-    //   *LOG_DEBUG 7 - debug-level messages */
-    // only * implemented
-
-        inline static unsigned long lastPrintedNotConnected{0};
-        static bool isConnected() {
-            if ((WiFiGenericClass::getMode() == WIFI_STA || WiFiGenericClass::getMode() == WIFI_AP_STA)
-                    && WiFiSTAClass::status() == WL_CONNECTED)
-                    return true;
-            if(millis() - lastPrintedNotConnected >= 30000) {
-                // TODO: store up to so many messages and relay them when connected?
-                getDefaultPrintStream()->printf("[%s] Syslog not connected\n", TAG);
-                lastPrintedNotConnected = millis();
-            }
-            return false;
+        class WiFiUdpTransport : public SyslogTransport {
+            public:
+                WiFiUdpTransport(const char *server, const uint16_t port) : server(server), port(port) { }
+
+                [[nodiscard]] bool isConnected() const override {
+                    return (WiFiGenericClass::getMode() == WIFI_STA || WiFiGenericClass::getMode() == WIFI_AP_STA)
+                           && WiFiSTAClass::status() == WL_CONNECTED;
+                }
+
+                bool send(const char *packet, const std::size_t length) override {
+                    if(udpClient.beginPacket(server, port) != 1)
+                        return false;
+                    udpClient.write((const uint8_t *)packet, length);
+                    return udpClient.endPacket() == 1;
+                }
+
+            private:
+                WiFiUDP udpClient;
+                const char *const server;
+                const uint16_t port;
+        };
+
+        WiFiUdpTransport transport;
+        mutable SyslogBatcher<> batcher;
+
+        // RFC 3339 in UTC once the time is set, ex.: by NTP, "-" before
+        static const char *timestamp(char (&buffer)[32]) {
+            timeval now{};
+            gettimeofday(&now, nullptr);
+            if(now.tv_sec < 1600000000)
+                return "-";
+            tm utc{};
+            gmtime_r(&now.tv_sec, &utc);
+            const std::size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+            snprintf(buffer + length, sizeof(buffer) - length, ".%03ldZ", (long)now.tv_usec / 1000);
+            return buffer;
         }
-        
+
+        void send(const uint8_t severity, const char *msg) const {
+            char buffer[32];
+            batcher.log(severity, timestamp(buffer), msg, millis());
+            if(!isAsync())
+                batcher.pump(millis());
+        }
+
         void v_logv(const char *msg) const override {
-            if(isConnected())
-                v_logd(msg); // no Syslog logger for verbose, using debug
+            v_logd(msg); // no Syslog severity for verbose, using debug
         };
 
         void v_logd(const char *msg) const override {
-            if(isConnected())
-                syslog.log(LOG_DEBUG,  msg);
+            send(SyslogBatcher<>::SEVERITY_DEBUG, msg);
         };
 
-
         void v_logi(const char *msg) const override {
-            if(isConnected())
-                syslog.log(LOG_INFO,  msg);
+            send(SyslogBatcher<>::SEVERITY_INFO, msg);
         };
 
         void v_logw(const char *msg) const override {
-            if(isConnected())
-                syslog.log(LOG_WARNING,  msg);
+            send(SyslogBatcher<>::SEVERITY_WARNING, msg);
         };
 
-
         void v_loge(const char *msg) const override {
-            if(isConnected())
-                syslog.log(LOG_ERR,  msg);
+            send(SyslogBatcher<>::SEVERITY_ERROR, msg);
+        };
+
+        void v_idle() const override {
+            batcher.pump(millis());
         };
 #else
-                : Logger() {};       
-#endif // SYSLOG_SERVER && ENABLE_LOGGING    
+                : Logger() {};
+#endif // SYSLOG_SERVER && ENABLE_LOGGING
 };
 
 
-#endif // SYSLOG_LOGGER_H_
\ No newline at end of file
+#endif // SYSLOG_LOGGER_H_
@@ -1,114 +1,146 @@
 #include "ZeroCrossing.h"
-#include "settings.h"
-
-#include <esp_intr_alloc.h>
 
 #include <Logger.h>
 
-#include <freertos/task.h>
-
 
 void ZeroCrossing::isrInit() {
-    Logger::logv(getTag(), "[isrInit] Starting zeroCrossingISRInit task");
-    xTaskCreatePinnedToCore(
-            zeroCrossingISRInit,       //Function to implement the task
-            getTag(), //Name of the task (16 chars max)
-            3192,       //Stack size in words
-            this,       //Task input parameter
-            0,          //Priority of the task
-            nullptr,       //Task handle.
-            1);
+    LOGV(getTag(), "[isrInit] Starting zeroCrossingISRInit task");
+    mains_hal::runOnce(zeroCrossingISRInit, getTag(), 3192, this);
 }
 
 void ZeroCrossing::zeroCrossingISRInit(void* instance) {
-    Logger::logv(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] starting");
-#ifdef XC_GPIO_DEBUG_OUT      
-      pinMode(XC_GPIO_DEBUG_OUT, OUTPUT);
+    LOGV(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] starting");
+#ifdef XC_GPIO_DEBUG_OUT
+      mains_hal::pinOutput(XC_GPIO_DEBUG_OUT, false);
 #endif
-#ifdef TIMER_GPIO_DEBUG_OUT      
-      pinMode(TIMER_GPIO_DEBUG_OUT, OUTPUT);
+#ifdef TIMER_GPIO_DEBUG_OUT
+      mains_hal::pinOutput(TIMER_GPIO_DEBUG_OUT, false);
 #endif
-    {   // extra scope block needed since vTaskDelete doesn't call destructors as you would expect, no scope unlock
+    {
         std::scoped_lock l(instancesMutex);
-        Logger::logv(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] Adding instance %p", instance);
-        Logger::logv(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] Total instances before adding: %d",
+        LOGV(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] Adding instance %p", instance);
+        LOGV(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] Total instances before adding: %zu",
                      instancesISRs.size());
         if (instancesISRs.empty() && instance != nullptr) {
-            // using lower level drivers to be able to set flags for ISRs
-
-            gpio_pad_select_gpio(ZERO_CROSS_IN_B);
-            gpio_set_direction(ZERO_CROSS_IN_B, GPIO_MODE_INPUT);
-            gpio_pullup_en(ZERO_CROSS_IN_B);
-            gpio_pulldown_dis(ZERO_CROSS_IN_B);
-            gpio_set_intr_type(ZERO_CROSS_IN_B, GPIO_INTR_NEGEDGE);
-            gpio_install_isr_service(ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL3);
-            gpio_isr_handler_add(ZERO_CROSS_IN_B, ZeroCrossing::zeroXPulseISR, nullptr);
-            gpio_intr_enable(ZERO_CROSS_IN_B);
-            Logger::logv(TAG, "[init] ZERO_CROSS_IN_B: %d", ZERO_CROSS_IN_B);
-
-            Timer0_Cfg = timerBegin(0, 80, true); // 80MHz / 80 divider = 1MHz
-            timerAttachInterruptFlag(Timer0_Cfg, &ZeroCrossing::timerISR, true,
-                                     ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL3);
-            timerAlarmWrite(Timer0_Cfg, TIMER_TICK_US, true);
-            timerAlarmEnable(Timer0_Cfg);
-            Logger::logv(TAG, "[init] Timer0_Cfg: %p", Timer0_Cfg);
+            maskXC = false; // deinit() may have left it masked, event driven only the armed timer unmasks it
+            mains_hal::crossingInterruptAttach(ZERO_CROSS_IN_B, ZeroCrossing::zeroXPulseISR);
+            LOGV(TAG, "[init] ZERO_CROSS_IN_B: %d", ZERO_CROSS_IN_B);
+#if ZERO_CROSSING_EVENT_DRIVEN
+            mains_hal::timerAttach(&ZeroCrossing::eventTimerISR, 0); // one-shot, armed by the zero crossing ISR and then for each event
+#else
+            mains_hal::timerAttach(&ZeroCrossing::timerISR, TIMER_TICK_US);
+#endif
+#if ZERO_CROSSING_TIMING_STATS
+            static bool timingStatsStarted = false;
+            if(!timingStatsStarted) {
+                timingStatsStarted = true;
+                mains_hal::runEvery(updateTimingStats, ZERO_CROSSING_TIMING_STATS_MS, "ZroXgStats", 4096);
+            }
+#endif
         }
         if (instance != nullptr) {
             ((ZeroCrossing *) instance)->addInstanceTimerISR();
-            Logger::logv(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] Added instance %p", instance);
-            Logger::logv(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] Total instances: %d",
+            LOGV(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] Added instance %p", instance);
+            LOGV(((ZeroCrossing *) instance)->getTag(), "[zeroCrossingISRInit] Total instances: %zu",
                          instancesISRs.size());
         }
     }
-
-    vTaskDelete(nullptr);
 }
 
 void ZeroCrossing::deinit() {
-    gpio_intr_disable(ZERO_CROSS_IN_B);
-    gpio_isr_handler_remove(ZERO_CROSS_IN_B);
-
-    timerAlarmDisable(Timer0_Cfg);
-    timerDetachInterrupt(Timer0_Cfg);
-    timerEnd(Timer0_Cfg);
+    mains_hal::crossingInterruptDetach(ZERO_CROSS_IN_B);
+    mains_hal::timerDetach();
 }
 
 ZeroCrossing::~ZeroCrossing() {
+    unregisterIsr();
+}
+
+void ZeroCrossing::unregisterIsr() {
     std::scoped_lock l(instancesMutex);
-    instancesISRs.erase(std::remove_if(instancesISRs.begin(), instancesISRs.end(), [this](const auto& instanceISR) {
-        return instanceISR.first == this;
-    }), instancesISRs.end());
+    // returns once timerISR()/eventTimerISR() can no longer call this instance
+    instancesEventISRs.remove(this);
+    // events it scheduled would still be fired on it
+    timeCriticalEnter();
+    events.removeIf([this](const ScheduledEvent &event) { return event.instance == this; });
+    timeCriticalExit();
+    if(!instancesISRs.remove(this))
+        return;
     if(instancesISRs.empty())
         deinit();
 }
 
 unsigned ZeroCrossing::calcHalfPeriod_us(const unsigned xc_elapsed_us) {
-    const unsigned actualFreq = halfPeriod_us_toFreq(xc_elapsed_us);
-    unsigned closestFreq = maxFreq;
+    static constexpr DRAM_ATTR HalfPeriodBands bands = makeHalfPeriodBands();
+    unsigned calcHalfPeriod = bands[0].halfPeriod_us;
+    for(const auto &band : bands) {
+        if(xc_elapsed_us >= band.fromElapsed_us)
+            calcHalfPeriod = band.halfPeriod_us;
+    }
+    return calcHalfPeriod;
+}
+
+void ZeroCrossing::updateTimingStats() {
+    const TimingStats stats{halfPeriodHistogram.drain(), isrLatencyHistogram.drain(), isrDurationHistogram.drain()};
+    std::scoped_lock l(timingStatsMutex);
+    timingStats = stats;
+}
+
+ZeroCrossing::TimingStats ZeroCrossing::getTimingStats() {
+    std::scoped_lock l(timingStatsMutex);
+    return timingStats;
+}
+
+int ZeroCrossing::getPllDrift_mHz() {
+    const auto frequency_mHz = (int)phaseTracker.frequency_mHz();
+    if(frequency_mHz == 0)
+        return 0;
+    int drift_mHz = frequency_mHz - (int)maxFreq * 1000;
     for(const unsigned freq: VALID_FREQUENCIES_HZ) {
-        if(abs((int)freq - (int)actualFreq) < abs((int)closestFreq - (int)actualFreq))
-            closestFreq = freq;
+        if(abs(frequency_mHz - (int)freq * 1000) < abs(drift_mHz))
+            drift_mHz = frequency_mHz - (int)freq * 1000;
     }
-    const unsigned calcHalfPeriodAvg = freqToHalfPeriod_us(closestFreq);
-    const double calcFreqAvg = closestFreq; //halfPeriod_us_toFreq(calcHalfPeriodAvg);
-    return calcFreqAvg < (double)minFreq * (1-freqMargin) ? freqToHalfPeriod_us(minFreq)
-                                                          : (calcFreqAvg > (double)maxFreq * (1+freqMargin)
-                                                             ? freqToHalfPeriod_us(maxFreq)
-                                                             : calcHalfPeriodAvg);
+    return drift_mHz;
 }
 
 void ZeroCrossing::zeroXPulseISR(void* ) {
     timeCriticalEnter();
-    const unsigned long now_us = esp_timer_get_time(); //xthal_get_ccount() / 240;
+    const uint32_t now_us = mains_hal::now_us();
     const unsigned elapsed_us = now_us - lastXCTime;
     static constexpr DRAM_ATTR unsigned minHalfPeriod_us = freqToHalfPeriod_us(maxFreq * (1+freqMargin));
     if(!maskXC && elapsed_us >= minHalfPeriod_us) { // ignore glitches
+        const uint32_t crossing_us = now_us + XC_HALF_PULSE_WIDTH_US - HYSTERESIS_OFFSET_US;
+        const bool tracked = phaseTracker.update(crossing_us);
+#if ZERO_CROSSING_PLL
+        if(!tracked) { // noise far from the predicted crossing, leave the interrupt unmasked for the real one
+            timeCriticalExit();
+            return;
+        }
+#endif
         maskXC = true; // mask to ensure only called once, glitch filter
+#if ZERO_CROSSING_TIMING_STATS
+        if(elapsed_us < minHalfPeriod_us * 2) // not across missed crossings
+            halfPeriodHistogram.record(elapsed_us);
+#endif
         lastXCTime = now_us;
-        xCTime = now_us + XC_HALF_PULSE_WIDTH_US - HYSTERESIS_OFFSET_US;
+#if ZERO_CROSSING_PLL
+        if(phaseTracker.isTracking()) {
+            xCTime = phaseTracker.crossing_us();
+            halfPeriod_us = phaseTracker.halfPeriod_us();
+        } else {
+            xCTime = crossing_us;
+        }
+#else
+        (void)tracked;
+        xCTime = crossing_us;
         halfPeriod_us = calcHalfPeriod_us(elapsed_us);
+#endif
+#if ZERO_CROSSING_EVENT_DRIVEN
+        halfCycleStart_us = xCTime; // resync the predicted half cycle
+        armTimer(now_us);
+#endif
 #ifdef XC_GPIO_DEBUG_OUT
-        GPIO.out_w1tc = 1<<XC_GPIO_DEBUG_OUT;
+        mains_hal::outputClear(1<<XC_GPIO_DEBUG_OUT);
 #endif
     }
     timeCriticalExit();
@@ -116,7 +148,16 @@ void ZeroCrossing::zeroXPulseISR(void* ) {
 
 void ZeroCrossing::timerISR() {
     timeCriticalEnter();
-    const unsigned now_us = esp_timer_get_time(); //xthal_get_ccount() / 240;
+    const uint32_t now_us = mains_hal::now_us();
+#if ZERO_CROSSING_TIMING_STATS
+    // latency as the delay past the tick interval since the previous tick
+    const bool timed = ++tickCount % TIMING_TICK_SAMPLE == 0;
+    if(timed) {
+        const auto late_us = (int32_t)(now_us - lastTick_us - TIMER_TICK_US);
+        isrLatencyHistogram.record(late_us > 0 ? late_us : 0);
+    }
+    lastTick_us = now_us;
+#endif
     const unsigned halfPeriod_us_local = halfPeriod_us;
     const int elapsed_us_actual = ((int)now_us - (int)xCTime) % (int)halfPeriod_us_local; // mod checks for missed zero crossings
     if(elapsed_us_actual > 0) { // actual xCTime may be in the future (elapsed_us_actual negative) if XC was just triggered
@@ -125,23 +166,86 @@ void ZeroCrossing::timerISR() {
         if(elapsed_us > halfPeriod_us_local/2 && maskXC) { // re-enable zero crossing interrupt long after outside glitch window
             maskXC = false;
 #ifdef XC_GPIO_DEBUG_OUT
-            GPIO.out_w1ts = 1<<XC_GPIO_DEBUG_OUT;
+            mains_hal::outputSet(1<<XC_GPIO_DEBUG_OUT);
 #endif
         }
 
         const unsigned currCyclePercentage = RESOLUTION_MAX_SIZE * elapsed_us/(halfPeriod_us_local); // - XC_HALF_PULSE_WIDTH_US
         const unsigned currCyclePercentageClamped = currCyclePercentage > RESOLUTION_MAX_SIZE ? RESOLUTION_MAX_SIZE : currCyclePercentage;
-        for (auto &instanceISR: instancesISRs) // call instances using pair {this, timerISR}
-            instanceISR.second(instanceISR.first, currCyclePercentageClamped);
+        instancesISRs.dispatch(currCyclePercentageClamped); // call instances using pair {this, timerISR}
     }
+#if ZERO_CROSSING_TIMING_STATS
+    if(timed)
+        isrDurationHistogram.record(mains_hal::now_us() - now_us);
+#endif
     timeCriticalExit();
 
 #ifdef TIMER_GPIO_DEBUG_OUT
-    if((GPIO.out >> TIMER_GPIO_DEBUG_OUT) & 1)
-            GPIO.out_w1tc = 1<<TIMER_GPIO_DEBUG_OUT;
+    if((mains_hal::outputLevels() >> TIMER_GPIO_DEBUG_OUT) & 1)
+            mains_hal::outputClear(1<<TIMER_GPIO_DEBUG_OUT);
         else
-            GPIO.out_w1ts = 1<<TIMER_GPIO_DEBUG_OUT;
+            mains_hal::outputSet(1<<TIMER_GPIO_DEBUG_OUT);
 #endif
 
 }
 
+bool ZeroCrossing::scheduleEvent(ZeroCrossing* instance, const InstanceEventFunc func, const uint32_t time_us) {
+    return events.push(time_us, {instance, func});
+}
+
+void ZeroCrossing::startHalfCycle(const uint32_t start_us) {
+    const unsigned halfPeriod_us_local = halfPeriod_us;
+    events.clear(); // events left from the previous half cycle are late, ex.: the crossing came early
+    events.push(start_us + halfPeriod_us_local/2, {}); // re-enable zero crossing interrupt long after outside glitch window
+    instancesEventISRs.dispatch(InstanceEvent::HALF_CYCLE_START, start_us, halfPeriod_us_local);
+    currHalfCycleStart_us = start_us;
+    halfCycleStart_us = start_us + halfPeriod_us_local; // keeps going if crossings are missed
+}
+
+void ZeroCrossing::armTimer(const uint32_t now_us) {
+    uint32_t next_us = halfCycleStart_us;
+    if(!events.empty() && decltype(events)::before(events.nextTime(), next_us))
+        next_us = events.nextTime();
+    const auto delay_us = (int32_t)(next_us - now_us);
+    armedFor_us = now_us + (delay_us > 1 ? delay_us : 1);
+    mains_hal::timerArm(delay_us > 1 ? delay_us : 1);
+}
+
+void ZeroCrossing::eventTimerISR() {
+    timeCriticalEnter();
+    const uint32_t now_us = mains_hal::now_us();
+#if ZERO_CROSSING_TIMING_STATS
+    const auto late_us = (int32_t)(now_us - armedFor_us);
+    isrLatencyHistogram.record(late_us > 0 ? late_us : 0);
+#endif
+    if(!decltype(events)::before(now_us, halfCycleStart_us)) {
+        const unsigned halfPeriod_us_local = halfPeriod_us;
+        uint32_t start_us = halfCycleStart_us;
+        while(!decltype(events)::before(now_us, start_us + halfPeriod_us_local)) // skip half cycles missed entirely
+            start_us += halfPeriod_us_local;
+        startHalfCycle(start_us);
+    }
+    ScheduledEvent event{};
+    while(events.popDue(now_us, event)) {
+        if(event.instance == nullptr) {
+            maskXC = false;
+#ifdef XC_GPIO_DEBUG_OUT
+            mains_hal::outputSet(1<<XC_GPIO_DEBUG_OUT);
+#endif
+        } else {
+            event.func(event.instance, InstanceEvent::FIRE, currHalfCycleStart_us, halfPeriod_us);
+        }
+    }
+    armTimer(now_us);
+#if ZERO_CROSSING_TIMING_STATS
+    isrDurationHistogram.record(mains_hal::now_us() - now_us);
+#endif
+    timeCriticalExit();
+
+#ifdef TIMER_GPIO_DEBUG_OUT
+    if((mains_hal::outputLevels() >> TIMER_GPIO_DEBUG_OUT) & 1)
+            mains_hal::outputClear(1<<TIMER_GPIO_DEBUG_OUT);
+        else
+            mains_hal::outputSet(1<<TIMER_GPIO_DEBUG_OUT);
+#endif
+}
@@ -1,14 +1,18 @@
 #ifndef ZERO_CROSSING_H
 #define ZERO_CROSSING_H
 
+#if __has_include("settings.h")
 #include "settings.h"
-#include <esp_attr.h>
-//#include <esp32-hal-timer.h>
+#endif
 
 #include <Logger.h>
 #include <HasData.h>
 #include <utils.h>
-#include <utils_emb.h>
+#include <mains_hal.h>
+#include <IsrDispatchTable.h>
+#include <EventQueue.h>
+#include <PhaseTracker.h>
+#include <TimingHistogram.h>
 
 #include <string>
 #include <thread>
@@ -16,8 +20,33 @@
 #include <condition_variable>
 #include <vector>
 #include <algorithm>
+#include <array>
+#include <climits>
 #include <cmath>
 
+#ifndef ZERO_CROSSING_MAX_INSTANCES // max dimmers driven by the zero crossing timer ISR
+#define ZERO_CROSSING_MAX_INSTANCES 4
+#endif
+
+#ifndef ZERO_CROSSING_EVENT_DRIVEN // 1 to arm a one-shot timer for each firing instead of ticking every TIMER_TICK_US
+#define ZERO_CROSSING_EVENT_DRIVEN 0
+#endif
+
+#ifndef ZERO_CROSSING_PLL // 1 to fire from the phase locked loop's filtered crossings instead of the raw pulses
+#define ZERO_CROSSING_PLL 0
+#endif
+
+#ifndef ZERO_CROSSING_TIMING_STATS // 0 to not record ISR timing histograms
+#define ZERO_CROSSING_TIMING_STATS 1
+#endif
+#ifndef ZERO_CROSSING_TIMING_STATS_MS // how often the timing histograms are summarized for the timing keys
+#define ZERO_CROSSING_TIMING_STATS_MS 10000
+#endif
+
+#ifndef ZERO_CROSS_IN_B // desktop, the simulator has a single zero crossing input
+#define ZERO_CROSS_IN_B 27
+#endif
+
 // #define XC_GPIO_DEBUG_OUT RED_LED_OUT_B
 // #define TIMER_GPIO_DEBUG_OUT GREEN_LED_OUT_B
 
@@ -43,14 +72,38 @@ protected:
 
 public:
         static unsigned getFrequency() { return halfPeriod_us_toFreq(halfPeriod_us); }
+        // Phase locked loop tracking the crossings, fired from with ZERO_CROSSING_PLL, tracked either way for stats
+        static bool isPllLocked() { return phaseTracker.isLocked(); }
+        static unsigned getPllJitter_us() { return phaseTracker.jitter_us(); }
+        // Tracked frequency minus the nearest valid one, in mHz
+        static int getPllDrift_mHz();
 
         // HasData
         inline static constexpr const char *FREQUENCY{"frequency"};
-        inline static const std::vector<std::string> readOnlyKeys{FREQUENCY};
+        inline static constexpr const char *PLL_LOCKED{"pll_locked"};
+        inline static constexpr const char *PLL_JITTER_US{"pll_jitter_us"};
+        inline static constexpr const char *PLL_DRIFT_MHZ{"pll_drift_mhz"};
+        // Timing stats of the last ZERO_CROSSING_TIMING_STATS_MS: measured half periods, timer ISR entry latency and duration
+        inline static constexpr const char *HALF_PERIOD_US_MIN{"half_period_us_min"};
+        inline static constexpr const char *HALF_PERIOD_US_MAX{"half_period_us_max"};
+        inline static constexpr const char *HALF_PERIOD_US_P50{"half_period_us_p50"};
+        inline static constexpr const char *HALF_PERIOD_US_P99{"half_period_us_p99"};
+        inline static constexpr const char *ISR_LATENCY_US_MIN{"isr_latency_us_min"};
+        inline static constexpr const char *ISR_LATENCY_US_MAX{"isr_latency_us_max"};
+        inline static constexpr const char *ISR_LATENCY_US_P50{"isr_latency_us_p50"};
+        inline static constexpr const char *ISR_LATENCY_US_P99{"isr_latency_us_p99"};
+        inline static constexpr const char *ISR_DURATION_US_MIN{"isr_duration_us_min"};
+        inline static constexpr const char *ISR_DURATION_US_MAX{"isr_duration_us_max"};
+        inline static constexpr const char *ISR_DURATION_US_P50{"isr_duration_us_p50"};
+        inline static constexpr const char *ISR_DURATION_US_P99{"isr_duration_us_p99"};
+        inline static const std::vector<std::string> readOnlyKeys{FREQUENCY, PLL_LOCKED, PLL_JITTER_US, PLL_DRIFT_MHZ,
+                                                                  HALF_PERIOD_US_MIN, HALF_PERIOD_US_MAX, HALF_PERIOD_US_P50, HALF_PERIOD_US_P99,
+                                                                  ISR_LATENCY_US_MIN, ISR_LATENCY_US_MAX, ISR_LATENCY_US_P50, ISR_LATENCY_US_P99,
+                                                                  ISR_DURATION_US_MIN, ISR_DURATION_US_MAX, ISR_DURATION_US_P50, ISR_DURATION_US_P99};
         inline static const std::vector<std::string> keys = utils::concat(readOnlyKeys, {}, true);
 
-        [[nodiscard]] std::vector<std::string> getKeys() const override { return keys; }
-        [[nodiscard]] std::vector<std::string> getReadOnlyKeys() const override { return readOnlyKeys; }
+        [[nodiscard]] const std::vector<std::string> &getKeys() const override { return keys; }
+        [[nodiscard]] const std::vector<std::string> &getReadOnlyKeys() const override { return readOnlyKeys; }
 
 
     protected:
@@ -64,19 +117,30 @@ public:
         inline static unsigned long xCTime{0};
         inline static unsigned long lastXCTime{0};
 
-        inline static hw_timer_t *Timer0_Cfg{nullptr};
-
         inline static std::mutex instancesMutex{};
 
         // Can't use virtual functions in IRAM, must save them in init() for instances
         using InstanceISRFunc = void(*)(ZeroCrossing* instance, const unsigned currCyclePercentage);
-        inline static std::vector<std::pair<ZeroCrossing*, InstanceISRFunc>> instancesISRs{}; // vectors are ISR safe (IRAM)
+        // Read by timerISR() without locking, changes must hold `instancesMutex`
+        inline static DRAM_ATTR mains_timing::IsrDispatchTable<ZeroCrossing, InstanceISRFunc, ZERO_CROSSING_MAX_INSTANCES> instancesISRs{};
+
+        /* Event driven mode (ZERO_CROSSING_EVENT_DRIVEN), instead of being called every tick instances are called with
+         *  HALF_CYCLE_START when a half cycle starts, where they set their output and call scheduleEvent() for the
+         *  events they need in it, ex.: FIRE after the phase delay. Their events are dropped when the next one starts. */
+        enum class InstanceEvent : uint8_t { HALF_CYCLE_START, FIRE };
+        using InstanceEventFunc = void(*)(ZeroCrossing* instance, InstanceEvent event, uint32_t halfCycleStart_us, unsigned halfPeriod_us);
+        inline static DRAM_ATTR mains_timing::IsrDispatchTable<ZeroCrossing, InstanceEventFunc, ZERO_CROSSING_MAX_INSTANCES> instancesEventISRs{};
+        // Returns false if too many events are already scheduled in the half cycle
+        static bool IRAM_ATTR scheduleEvent(ZeroCrossing* instance, InstanceEventFunc func, uint32_t time_us);
 
 
         // methods
         virtual void addInstanceTimerISR() = 0;
         // Must be called by child class to set up ISRs
         void isrInit();
+        /* Stops the ISRs calling this instance, the destructor does it too but child classes must call it first if they
+         *  set their output off when destroyed, or an ISR could turn it back on */
+        void unregisterIsr();
         static void zeroCrossingISRInit(void* instance);
         static void deinit();
 
@@ -91,27 +155,143 @@ public:
         }
         // alarm div TIMER_TICK_US = 1/TIMER_TICK_US Hz, TIMER_TICK_US period
         inline static const DRAM_ATTR uint64_t TIMER_TICK_US{freqToHalfPeriod_us(maxFreq)/RESOLUTION_MAX_SIZE-1};
+        // Timing histograms, 16µs buckets from ~72Hz to ~45Hz for half periods and 1µs ones for the timer ISR
+        using HalfPeriodHistogram = mains_timing::TimingHistogram<256, 6912, 4>;
+        using IsrHistogram = mains_timing::TimingHistogram<64>;
+        struct TimingStats {
+            HalfPeriodHistogram::Summary halfPeriod_us;
+            IsrHistogram::Summary isrLatency_us;
+            IsrHistogram::Summary isrDuration_us;
+        };
+        // tick ISRs timed, 1 in TIMING_TICK_SAMPLE, to keep the overhead low at TIMER_TICK_US
+        inline static constexpr DRAM_ATTR unsigned TIMING_TICK_SAMPLE{16};
+        inline static DRAM_ATTR HalfPeriodHistogram halfPeriodHistogram{};
+        inline static DRAM_ATTR IsrHistogram isrLatencyHistogram{};
+        inline static DRAM_ATTR IsrHistogram isrDurationHistogram{};
+        inline static uint32_t lastTick_us{0};
+        inline static unsigned tickCount{0};
+        inline static uint32_t armedFor_us{0}; // event driven mode, when the timer ISR should run
+        inline static std::mutex timingStatsMutex{};
+        inline static TimingStats timingStats{}; // summarized by updateTimingStats()
+
+        static void updateTimingStats();
+        static TimingStats getTimingStats();
+
+        // updated by zeroXPulseISR() with the crossings it lets through
+        inline static DRAM_ATTR mains_timing::PhaseTracker phaseTracker{freqToHalfPeriod_us(maxFreq * (1+freqMargin)),
+                                                                        freqToHalfPeriod_us(minFreq * (1-freqMargin))};
 
         // HasData
         [[nodiscard]] std::string getWithOptLock(const std::string &key, const bool noLock) const override {
-            Logger::logv(TAG, "[getWithOptLock] Getting %s", key.c_str());
-            using retType = std::string;
-            using FunPtrType = retType(*)(const ZeroCrossing*, const bool noLock);
-            return getStringDataHelper<FunPtrType>({
-                {FREQUENCY, (FunPtrType)[](const auto, const bool noLock) -> retType { return std::to_string(getFrequency()); }}
-            }, key, true, (FunPtrType)[](const auto, const bool) -> retType { return HasData::EMPTY_VALUE; })(this, noLock);
+            return getValueWithOptLock(key, noLock).toString(HasData::EMPTY_VALUE);
+        }
+
+        [[nodiscard]] DataValue getValueWithOptLock(const std::string &key, const bool noLock) const override {
+            LOGV(TAG, "[getValueWithOptLock] Getting %s", key.c_str());
+            static constexpr auto getters = makeDataKeyTable<ValueGetter<ZeroCrossing>>({
+                {FREQUENCY, [](const ZeroCrossing *) -> DataValue { return getFrequency(); }},
+                {PLL_LOCKED, [](const ZeroCrossing *) -> DataValue { return isPllLocked(); }},
+                {PLL_JITTER_US, [](const ZeroCrossing *) -> DataValue { return getPllJitter_us(); }},
+                {PLL_DRIFT_MHZ, [](const ZeroCrossing *) -> DataValue { return getPllDrift_mHz(); }},
+                {HALF_PERIOD_US_MIN, [](const ZeroCrossing *) -> DataValue { return getTimingStats().halfPeriod_us.min; }},
+                {HALF_PERIOD_US_MAX, [](const ZeroCrossing *) -> DataValue { return getTimingStats().halfPeriod_us.max; }},
+                {HALF_PERIOD_US_P50, [](const ZeroCrossing *) -> DataValue { return getTimingStats().halfPeriod_us.p50; }},
+                {HALF_PERIOD_US_P99, [](const ZeroCrossing *) -> DataValue { return getTimingStats().halfPeriod_us.p99; }},
+                {ISR_LATENCY_US_MIN, [](const ZeroCrossing *) -> DataValue { return getTimingStats().isrLatency_us.min; }},
+                {ISR_LATENCY_US_MAX, [](const ZeroCrossing *) -> DataValue { return getTimingStats().isrLatency_us.max; }},
+                {ISR_LATENCY_US_P50, [](const ZeroCrossing *) -> DataValue { return getTimingStats().isrLatency_us.p50; }},
+                {ISR_LATENCY_US_P99, [](const ZeroCrossing *) -> DataValue { return getTimingStats().isrLatency_us.p99; }},
+                {ISR_DURATION_US_MIN, [](const ZeroCrossing *) -> DataValue { return getTimingStats().isrDuration_us.min; }},
+                {ISR_DURATION_US_MAX, [](const ZeroCrossing *) -> DataValue { return getTimingStats().isrDuration_us.max; }},
+                {ISR_DURATION_US_P50, [](const ZeroCrossing *) -> DataValue { return getTimingStats().isrDuration_us.p50; }},
+                {ISR_DURATION_US_P99, [](const ZeroCrossing *) -> DataValue { return getTimingStats().isrDuration_us.p99; }}
+            });
+            return getDataKeyHelper(getters, this, key, true);
         }
 
         [[nodiscard]] bool setWithOptLockAndUpdate(const std::string &key, const std::string &value_raw, const bool noLock, const bool doObjUpdate) override {
-            Logger::logv(TAG, "[setWithOptLockAndUpdate] Setting %s->%s", key.c_str(), value_raw.c_str());
+            LOGV(TAG, "[setWithOptLockAndUpdate] Setting %s->%s", key.c_str(), value_raw.c_str());
             return false; // no variables settable
         }
 
+        // Overridden so subclasses can call it without the default looping back through their string setter
+        [[nodiscard]] bool setValueWithOptLockAndUpdate(const std::string &key, const DataValue &value, const bool noLock, const bool doObjUpdate) override {
+            LOGV(TAG, "[setValueWithOptLockAndUpdate] Setting %s", key.c_str());
+            return false; // no variables settable
+        }
+
+        // Half period of the valid frequency nearest to `xc_elapsed_us` between crossings, integer compares only
         static unsigned IRAM_ATTR calcHalfPeriod_us(unsigned xc_elapsed_us);
 
+        /* The nearest valid frequency only changes at a few elapsed times, so calcHalfPeriod_us() looks them up in bands
+         *  found at compile time by searching the elapsed times with the integer frequency math and freqMargin clamping
+         *  the ISR used to do (closest frequency, ties to the first one). Elapsed times past UINT_MAX/2 are in the
+         *  last band. */
+        struct HalfPeriodBand {
+            unsigned fromElapsed_us; // the band's first elapsed time, UINT_MAX for unused bands
+            unsigned halfPeriod_us;
+        };
+        using HalfPeriodBands = std::array<HalfPeriodBand, std::size(VALID_FREQUENCIES_HZ)>;
+
+        static constexpr unsigned nearestFreq(const unsigned actualFreq) {
+            unsigned closestFreq = maxFreq;
+            for(const unsigned freq: VALID_FREQUENCIES_HZ) {
+                if(abs((int)freq - (int)actualFreq) < abs((int)closestFreq - (int)actualFreq))
+                    closestFreq = freq;
+            }
+            return closestFreq;
+        }
+
+        static constexpr unsigned clampedHalfPeriod_us(const unsigned freq) {
+            return freq < minFreq * (1-freqMargin) ? freqToHalfPeriod_us(minFreq)
+                                                   : (freq > maxFreq * (1+freqMargin) ? freqToHalfPeriod_us(maxFreq)
+                                                                                      : freqToHalfPeriod_us(freq));
+        }
+
+        static constexpr HalfPeriodBands makeHalfPeriodBands() {
+            constexpr unsigned maxElapsed_us = UINT_MAX / 2; // * 2 in halfPeriod_us_toFreq() doesn't overflow
+            const auto halfPeriodAt = [](const unsigned elapsed_us) {
+                return clampedHalfPeriod_us(nearestFreq(halfPeriod_us_toFreq(elapsed_us)));
+            };
+            HalfPeriodBands bands{};
+            for(auto &band : bands)
+                band = {UINT_MAX, 0};
+            bands[0] = {0, halfPeriodAt(0)};
+            for(std::size_t i = 1; i < bands.size(); i++) {
+                const unsigned from = bands[i - 1].fromElapsed_us;
+                if(halfPeriodAt(maxElapsed_us) == bands[i - 1].halfPeriod_us)
+                    break;
+                // the half period only grows with the elapsed time, search for the first one past the previous band
+                unsigned low = from, high = maxElapsed_us;
+                while(high - low > 1) {
+                    const unsigned mid = low + (high - low) / 2;
+                    if(halfPeriodAt(mid) == bands[i - 1].halfPeriod_us)
+                        low = mid;
+                    else
+                        high = mid;
+                }
+                bands[i] = {high, halfPeriodAt(high)};
+            }
+            return bands;
+        }
+
         static void IRAM_ATTR zeroXPulseISR(void*);
 
         static void IRAM_ATTR timerISR();
+
+        // Event driven mode
+        struct ScheduledEvent {
+            ZeroCrossing* instance; // nullptr to unmask the zero crossing interrupt
+            InstanceEventFunc func;
+        };
+        // each instance can fire once per half cycle, plus unmasking
+        inline static DRAM_ATTR mains_timing::EventQueue<ScheduledEvent, ZERO_CROSSING_MAX_INSTANCES * 2 + 1> events{};
+        inline static uint32_t halfCycleStart_us{0}; // start of the next half cycle, predicted until the crossing is seen
+        inline static uint32_t currHalfCycleStart_us{0};
+
+        static void IRAM_ATTR startHalfCycle(uint32_t start_us);
+        static void IRAM_ATTR armTimer(uint32_t now_us);
+        static void IRAM_ATTR eventTimerISR();
 };
 
 #endif // ZERO_CROSSING_H
@@ -24,9 +24,9 @@ namespace cwifi {
 
               [[nodiscard]] const char * getTag() const override { return TAG; }
 
-              [[nodiscard]] std::vector<std::string> getNvsKeys() const override { return cwifi::nvsDataKeys; }
-              [[nodiscard]] std::vector<std::string> getKeys() const override { return cwifi::readOnlyKeys; }
-              [[nodiscard]] std::vector<std::string> getReadOnlyKeys() const override { return cwifi::readOnlyKeys; }
+              [[nodiscard]] const std::vector<std::string> &getNvsKeys() const override { return cwifi::nvsDataKeys; }
+              [[nodiscard]] const std::vector<std::string> &getKeys() const override { return cwifi::readOnlyKeys; }
+              [[nodiscard]] const std::vector<std::string> &getReadOnlyKeys() const override { return cwifi::readOnlyKeys; }
 
           private:
               using HasData::getNvsNamespace;
@@ -37,24 +37,25 @@ namespace cwifi {
               using HasData::set;
 
               [[nodiscard]] std::string getWithOptLock(const std::string &key, bool noLock) const override {
-                  std::unique_lock l(_dataMutex, std::defer_lock);
-                  if(!noLock)
-                    l.lock();
-                  return getStringDataHelper<String>({{SSID, WiFi.SSID()},
-                                              {IP_ADDRESS, WiFi.localIP().toString()},
-                                              {GATEWAY, WiFi.gatewayIP().toString()},
-                                              {SUBNET, WiFi.subnetMask().toString()},
-                                              {DNS, WiFi.dnsIP().toString()},
-                                              {MAC_ADDRESS, WiFi.macAddress()},
-                                              {RSSI, String(WiFi.RSSI())}
-                                             },
-                                             key, noLock || l.owns_lock(), String{HasData::EMPTY_VALUE}).c_str();
+                  return getValueWithOptLock(key, noLock).toString(HasData::EMPTY_VALUE);
+              }
+
+              [[nodiscard]] DataValue getValueWithOptLock(const std::string &key, bool noLock) const override {
+                  static constexpr auto getters = makeDataKeyTable<ValueGetter<_>>({
+                                              {SSID,        [](const _ *) -> DataValue { return WiFi.SSID().c_str(); }},
+                                              {IP_ADDRESS,  [](const _ *) -> DataValue { return WiFi.localIP().toString().c_str(); }},
+                                              {GATEWAY,     [](const _ *) -> DataValue { return WiFi.gatewayIP().toString().c_str(); }},
+                                              {SUBNET,      [](const _ *) -> DataValue { return WiFi.subnetMask().toString().c_str(); }},
+                                              {DNS,         [](const _ *) -> DataValue { return WiFi.dnsIP().toString().c_str(); }},
+                                              {MAC_ADDRESS, [](const _ *) -> DataValue { return WiFi.macAddress().c_str(); }},
+                                              {RSSI,        [](const _ *) -> DataValue { return WiFi.RSSI(); }}
+                                             });
+                  return getDataKeyHelper(getters, this, key, noLock);
               }
 
 
               [[nodiscard]] bool setWithOptLockAndUpdate(const std::string &key, const std::string &value_raw, const bool noLock, const bool doObjUpdate) override {
-                  if(std::find(readOnlyKeys.begin(), readOnlyKeys.end(), key) != readOnlyKeys.end() ||
-                     std::find(keys.begin(), keys.end(), key) == keys.end()) {
+                  if(isReadOnlyKey(key) || !hasKey(key)) {
                       Logger::logw(TAG, "Key %s is read-only or not found", key.c_str());
                       return false;
                   }
@@ -3,6 +3,7 @@
 #include "factory_reset.h"
 
 #include <Logger.h>
+#include <NvsWriteBehind.h>
 
 #include <thread>
 #include <vector>
@@ -31,6 +32,8 @@ namespace factory_reset {
         std::this_thread::sleep_for(std::chrono::milliseconds(FACTORY_RESET_TIME_SECS * 1000));
         if(factory_reset) {
           Logger::logi(TAG, "Factory reset triggered...");
+          // so pending saves don't write the settings back after the callbacks delete them
+          NvsWriteBehind::instance().flush();
           for (const auto &onFactoryResetCallback : onFactoryResetCallbacks)
             onFactoryResetCallback();
           Logger::logi(TAG, "Factory reset callbacks have been run, restarting...");
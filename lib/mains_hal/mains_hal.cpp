@@ -0,0 +1,108 @@
+#if defined(ARDUINO)
+
+#include "mains_hal.h"
+
+#include <Arduino.h>
+#include <driver/gpio.h>
+#include <driver/timer.h>
+#include <esp_intr_alloc.h>
+#include <freertos/task.h>
+
+#include <chrono>
+#include <thread>
+
+namespace mains_hal {
+    namespace {
+        hw_timer_t *timer{nullptr};
+        // the hardware timer timerBegin(TIMER_NUM, ...) uses, for the ISR safe driver calls in timerArm()
+        constexpr uint8_t TIMER_NUM{0};
+        constexpr auto TIMER_GROUP{(timer_group_t)(TIMER_NUM / 2)};
+        constexpr auto TIMER_IDX{(timer_idx_t)(TIMER_NUM % 2)};
+
+        struct OnceArgs {
+            Task task;
+            void *arg;
+        };
+        struct EveryArgs {
+            void (*func)();
+            uint32_t period_ms;
+        };
+
+        void onceTask(void *param) {
+            {   // extra scope block needed since vTaskDelete doesn't call destructors as you would expect
+                const OnceArgs args = *(OnceArgs *)param;
+                delete (OnceArgs *)param;
+                args.task(args.arg);
+            }
+            vTaskDelete(nullptr);
+        }
+
+        void everyTask(void *param) {
+            const EveryArgs args = *(EveryArgs *)param;
+            delete (EveryArgs *)param;
+            while(true) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(args.period_ms));
+                args.func();
+            }
+        }
+    }
+
+    void pinOutput(const uint8_t pin, const bool high) {
+        pinMode(pin, OUTPUT);
+        digitalWrite(pin, high ? HIGH : LOW);
+    }
+
+    void crossingInterruptAttach(const uint8_t pin, const PinIsr isr) {
+        // using lower level drivers to be able to set flags for ISRs
+        const auto gpio = (gpio_num_t)pin;
+        gpio_pad_select_gpio(gpio);
+        gpio_set_direction(gpio, GPIO_MODE_INPUT);
+        gpio_pullup_en(gpio);
+        gpio_pulldown_dis(gpio);
+        gpio_set_intr_type(gpio, GPIO_INTR_NEGEDGE);
+        gpio_install_isr_service(ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL3);
+        gpio_isr_handler_add(gpio, isr, nullptr);
+        gpio_intr_enable(gpio);
+    }
+
+    void crossingInterruptDetach(const uint8_t pin) {
+        gpio_intr_disable((gpio_num_t)pin);
+        gpio_isr_handler_remove((gpio_num_t)pin);
+    }
+
+    void timerAttach(const Isr isr, const uint32_t period_us) {
+        timer = timerBegin(TIMER_NUM, 80, true); // 80MHz / 80 divider = 1MHz
+        timerAttachInterruptFlag(timer, isr, true, ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL3);
+        if(period_us > 0) {
+            timerAlarmWrite(timer, period_us, true);
+            timerAlarmEnable(timer);
+        } else {
+            timerAlarmWrite(timer, UINT64_MAX, false); // one-shot, not enabled until timerArm()
+        }
+    }
+
+    /* Called from IRAM ISRs, which also run while the flash cache is disabled, ex.: NVS writes, so only the driver's
+     *  _in_isr calls, the Arduino timer functions are in flash. The counter keeps running, the alarm is set ahead of it. */
+    void IRAM_ATTR timerArm(const uint32_t delay_us) {
+        const uint64_t now = timer_group_get_counter_value_in_isr(TIMER_GROUP, TIMER_IDX);
+        timer_group_set_alarm_value_in_isr(TIMER_GROUP, TIMER_IDX, now + delay_us);
+        timer_group_enable_alarm_in_isr(TIMER_GROUP, TIMER_IDX);
+    }
+
+    void timerDetach() {
+        timerAlarmDisable(timer);
+        timerDetachInterrupt(timer);
+        timerEnd(timer);
+        timer = nullptr;
+    }
+
+    void runOnce(const Task task, const char *name, const uint32_t stackSize, void *arg) {
+        xTaskCreatePinnedToCore(onceTask, name, stackSize, new OnceArgs{task, arg}, 0, nullptr, 1);
+    }
+
+    void runEvery(void (*func)(), const uint32_t period_ms, const char *name, const uint32_t stackSize) {
+        xTaskCreatePinnedToCore(everyTask, name, stackSize, new EveryArgs{func, period_ms}, 0, nullptr, 1);
+    }
+}
+
+#endif // ARDUINO
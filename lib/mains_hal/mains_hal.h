@@ -0,0 +1,51 @@
+#ifndef MAINS_HAL_H_
+#define MAINS_HAL_H_
+
+#include <mains_timing.h>
+
+#include <cstdint>
+
+/*
+ * mains_hal is the hardware ZeroCrossing and the dimmers use: the µs clock, output pins, the zero crossing pulse
+ *  interrupt, the hardware timer and background tasks. On ESP32 these are the drivers (mains_hal.cpp), on desktop the
+ *  MainsSimulator fake (test/desktop) runs them against virtual mains so the dimmers can be unit tested.
+ */
+namespace mains_hal {
+    using Isr = void(*)();
+    using PinIsr = void(*)(void *arg);
+    using Task = void(*)(void *arg);
+}
+
+#if defined(ARDUINO)
+#include <esp_timer.h>
+#include <soc/gpio_struct.h>
+#include <utils_emb.h>
+
+namespace mains_hal {
+    // definitions in header so they're inlined in IRAM ISRs
+    inline uint32_t IRAM_ATTR now_us() { return (uint32_t)esp_timer_get_time(); }
+    // Pins 0 to 31 in `mask` driven high or low
+    inline void IRAM_ATTR outputSet(const uint32_t mask) { GPIO.out_w1ts = mask; }
+    inline void IRAM_ATTR outputClear(const uint32_t mask) { GPIO.out_w1tc = mask; }
+    inline uint32_t IRAM_ATTR outputLevels() { return GPIO.out; }
+
+    // Makes `pin` an output at `high`
+    void pinOutput(uint8_t pin, bool high);
+    // Calls `isr` on the falling edge of the zero crossing pulse on `pin`
+    void crossingInterruptAttach(uint8_t pin, PinIsr isr);
+    void crossingInterruptDetach(uint8_t pin);
+    // Calls `isr` every `period_us`, or only when armed by timerArm() if 0
+    void timerAttach(Isr isr, uint32_t period_us);
+    void IRAM_ATTR timerArm(uint32_t delay_us);
+    void timerDetach();
+    // Runs `task(arg)` once in a new task
+    void runOnce(Task task, const char *name, uint32_t stackSize, void *arg);
+    // Runs `func()` every `period_ms` in a new task, forever
+    void runEvery(void (*func)(), uint32_t period_ms, const char *name, uint32_t stackSize);
+}
+
+#else
+#include <MainsSimulator.h>
+#endif
+
+#endif // MAINS_HAL_H_
@@ -0,0 +1,156 @@
+#ifndef CHANNEL_BANK_H_
+#define CHANNEL_BANK_H_
+
+#include "mains_timing.h"
+#include "phase_control.h"
+#include "pulse_skip.h"
+#include "Fade.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace mains_timing {
+
+    /*
+     * State of several dimmer channels on the same zero crossing, kept as a struct of arrays so an ISR computes the
+     *  output of every channel in one pass over them and returns a single set and clear mask for the GPIO registers
+     *  instead of each channel writing its own pin. Leading edge channels switch on past their on position (see
+     *  `leadingEdgeOnPosition()`), pulse skip channels use `sigmaDeltaStep()` every full cycle. A channel's `Fade` is
+     *  stepped every half cycle, in `leadingEdgeLevel()` levels or pulse skip brightness.
+     *
+     *  `add()`, `remove()` and the setters are for tasks, serialized by the caller, the ISR functions for one ISR.
+     *  A channel's mask is published after its state and cleared before it's removed, so the ISR skips empty slots.
+     */
+    template<std::size_t Capacity, unsigned Positions>
+    class ChannelBank {
+        static_assert(Capacity > 0 && Capacity <= 32, "ChannelBank holds 1 to 32 channels");
+
+        public:
+            enum class Kind : uint8_t { LEADING_EDGE, PULSE_SKIP };
+
+            struct Masks {
+                uint32_t set{0}; // pins to drive high, ex.: GPIO.out_w1ts
+                uint32_t clear{0}; // pins to drive low, ex.: GPIO.out_w1tc
+            };
+
+            /* Returns the channel index or -1 if the bank is full or `pin` isn't in the first GPIO bank, starts off.
+             *  `fade`, if any, must outlive the channel. */
+            int add(const uint8_t pin, const bool inverted, const Kind kind, Fade *fade = nullptr) {
+                if(pin >= 32)
+                    return -1;
+                for(std::size_t i = 0; i < Capacity; i++) {
+                    if(pinMask[i].load() != 0)
+                        continue;
+                    kinds[i] = kind;
+                    onPosition[i] = Positions;
+                    level[i] = 0;
+                    cycles[i] = 1;
+                    accumulator[i] = 0;
+                    delay_us[i] = NO_FIRING;
+                    fades[i] = fade;
+                    if(inverted)
+                        invertedMask.fetch_or(1u << pin);
+                    else
+                        invertedMask.fetch_and(~(1u << pin));
+                    pinMask[i].store(1u << pin); // publish last
+                    return (int)i;
+                }
+                return -1;
+            }
+
+            void remove(const int channel) { pinMask[channel].store(0); }
+
+            void setOnPosition(const int channel, const int32_t position) { onPosition[channel] = position; }
+
+            // Pulse skip channels, `brightness` out of `cycleCount` full cycles on
+            void setPulseSkip(const int channel, const uint16_t brightness, const uint16_t cycleCount) {
+                cycles[channel] = cycleCount > 0 ? cycleCount : 1;
+                level[channel] = brightness;
+            }
+
+            [[nodiscard]] std::size_t size() const {
+                std::size_t count = 0;
+                for(std::size_t i = 0; i < Capacity; i++)
+                    count += pinMask[i].load() != 0;
+                return count;
+            }
+
+            /* Start of a half cycle: fades step, leading edge channels turn off, or on if always on, and pulse skip
+             *  channels decide for the full cycle on every other one. Caches each channel's firing delay for `fire()`
+             *  and returns the first one in `next_us`, NO_FIRING if none. */
+            Masks IRAM_ATTR halfCycleStart(const unsigned halfPeriod_us, uint32_t &next_us) {
+                fullCycle = !fullCycle;
+                next_us = NO_FIRING;
+                uint32_t on = 0, all = 0;
+                for(std::size_t i = 0; i < Capacity; i++) {
+                    const uint32_t mask = pinMask[i].load(std::memory_order_acquire);
+                    if(mask == 0)
+                        continue;
+                    uint32_t faded;
+                    if(fades[i] != nullptr && fades[i]->step(faded)) {
+                        if(kinds[i] == Kind::PULSE_SKIP)
+                            level[i] = (uint16_t)faded;
+                        else
+                            onPosition[i] = leadingEdgeOnPositionAtLevel<Positions>(faded);
+                    }
+                    if(kinds[i] == Kind::PULSE_SKIP && fullCycle)
+                        onPosition[i] = sigmaDeltaStep(accumulator[i], level[i], cycles[i]) ? -1 : (int32_t)Positions;
+                    delay_us[i] = leadingEdgeDelayAt_us<Positions>(onPosition[i], halfPeriod_us);
+                    on |= delay_us[i] == 0 ? mask : 0;
+                    if(delay_us[i] != 0 && delay_us[i] < next_us)
+                        next_us = delay_us[i];
+                    all |= mask;
+                }
+                return outputs(on, all);
+            }
+
+            // Fixed tick timer, `cyclePosition` out of `Positions` into the half cycle
+            Masks IRAM_ATTR tick(const unsigned cyclePosition) {
+                uint32_t on = 0, all = 0;
+                for(std::size_t i = 0; i < Capacity; i++) {
+                    const uint32_t mask = pinMask[i].load(std::memory_order_acquire);
+                    on |= leadingEdgeOnAt(cyclePosition, onPosition[i]) ? mask : 0;
+                    all |= mask;
+                }
+                return outputs(on, all);
+            }
+
+            /* Event driven, `elapsed_us` into the half cycle: turns on the channels whose delay has passed and returns
+             *  the delay of the next one to fire in `next_us`, NO_FIRING if none. Channels already on are set again. */
+            Masks IRAM_ATTR fire(const uint32_t elapsed_us, uint32_t &next_us) {
+                uint32_t on = 0;
+                next_us = NO_FIRING;
+                for(std::size_t i = 0; i < Capacity; i++) {
+                    const uint32_t mask = pinMask[i].load(std::memory_order_acquire);
+                    if(mask == 0 || delay_us[i] == NO_FIRING)
+                        continue;
+                    if(delay_us[i] <= elapsed_us)
+                        on |= mask;
+                    else if(delay_us[i] < next_us)
+                        next_us = delay_us[i];
+                }
+                return outputs(on, on);
+            }
+
+        private:
+            std::atomic<uint32_t> pinMask[Capacity]{}; // 0 for free slots
+            Kind kinds[Capacity]{};
+            int32_t onPosition[Capacity]{};
+            uint16_t level[Capacity]{};
+            uint16_t cycles[Capacity]{};
+            uint32_t accumulator[Capacity]{};
+            uint32_t delay_us[Capacity]{};
+            Fade *fades[Capacity]{};
+            std::atomic<uint32_t> invertedMask{0};
+            bool fullCycle{false};
+
+            // Channels in `on` are driven on and the rest of `all` off, inverted pins are on when low
+            Masks IRAM_ATTR outputs(const uint32_t on, const uint32_t all) const {
+                const uint32_t high = (on ^ invertedMask.load(std::memory_order_relaxed)) & all;
+                return {high, all & ~high};
+            }
+    };
+}
+
+#endif // CHANNEL_BANK_H_
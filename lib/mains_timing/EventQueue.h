@@ -0,0 +1,72 @@
+#ifndef EVENT_QUEUE_H_
+#define EVENT_QUEUE_H_
+
+#include "mains_timing.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mains_timing {
+
+    /*
+     * Fixed capacity queue of timed events for one-shot timer ISRs, kept sorted so the earliest event is always at hand.
+     *  Times are µs from a free running 32 bit clock (ex.: esp_timer_get_time()) and compared with wrap around, so
+     *  events must be less than ~35 minutes apart. It's not synchronized, use it from one ISR or with interrupts masked.
+     */
+    template<class Payload, std::size_t Capacity>
+    class EventQueue {
+        public:
+            // True if `a` is before `b`, handles the clock wrapping around
+            static constexpr bool IRAM_ATTR before(const uint32_t a, const uint32_t b) { return (int32_t)(a - b) < 0; }
+
+            // Returns false if full, events with the same time are popped in the order they were pushed
+            bool IRAM_ATTR push(const uint32_t time_us, const Payload &payload) {
+                if(count == Capacity)
+                    return false;
+                // sorted latest first so pop() is from the end
+                std::size_t i = count;
+                for(; i > 0 && !before(time_us, events[i - 1].time_us); i--)
+                    events[i] = events[i - 1];
+                events[i] = {time_us, payload};
+                count++;
+                return true;
+            }
+
+            // Pops the earliest event into `payload` if it's due at `now_us`
+            bool IRAM_ATTR popDue(const uint32_t now_us, Payload &payload) {
+                if(count == 0 || before(now_us, events[count - 1].time_us))
+                    return false;
+                payload = events[--count].payload;
+                return true;
+            }
+
+            // Time of the earliest event, the queue must not be empty
+            [[nodiscard]] uint32_t IRAM_ATTR nextTime() const { return events[count - 1].time_us; }
+            [[nodiscard]] bool IRAM_ATTR empty() const { return count == 0; }
+            [[nodiscard]] std::size_t IRAM_ATTR size() const { return count; }
+            void IRAM_ATTR clear() { count = 0; }
+
+            // Drops the events whose payload `pred` is true for, the others keep their order. Returns how many were dropped.
+            template<class Pred>
+            std::size_t IRAM_ATTR removeIf(Pred pred) {
+                std::size_t kept = 0;
+                for(std::size_t i = 0; i < count; i++) {
+                    if(!pred(events[i].payload))
+                        events[kept++] = events[i];
+                }
+                const std::size_t removed = count - kept;
+                count = kept;
+                return removed;
+            }
+
+        private:
+            struct Event {
+                uint32_t time_us{0};
+                Payload payload{};
+            };
+            Event events[Capacity]{};
+            std::size_t count{0};
+    };
+}
+
+#endif // EVENT_QUEUE_H_
@@ -0,0 +1,187 @@
+#ifndef FADE_H_
+#define FADE_H_
+
+#include "mains_timing.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace mains_timing {
+    /* How a fade moves between levels: LINEAR in equal level steps, GAMMA and PERCEPTUAL in equal steps of perceived
+     *  brightness, with a 2.2 power law or the CIE 1931 lightness curve, so ramps don't seem to rush at the dim end. */
+    enum class FadeCurve : uint8_t { LINEAR, GAMMA, PERCEPTUAL };
+
+    namespace fade_detail {
+        inline constexpr uint32_t ONE_Q16{1u << 16};
+        inline constexpr unsigned TABLE_STEPS{256};
+
+        // x^(1/5) for x in [0, 1] by Newton's method from above, std::pow isn't constexpr
+        constexpr double fifthRoot(const double x) {
+            if(x <= 0)
+                return 0;
+            double y = 1;
+            for(unsigned i = 0; i < 100; i++)
+                y -= (y * y * y * y * y - x) / (5 * y * y * y * y);
+            return y;
+        }
+
+        // Level for a perceived brightness, both 0 to 1
+        constexpr double gammaLevel(const double perceived) {
+            return perceived * perceived * fifthRoot(perceived); // perceived^2.2
+        }
+        constexpr double lightnessLevel(const double perceived) {
+            const double lightness = perceived * 100; // CIE L*
+            if(lightness <= 8)
+                return lightness / 903.3;
+            const double cubeRoot = (lightness + 16) / 116;
+            return cubeRoot * cubeRoot * cubeRoot;
+        }
+
+        template<class Curve>
+        constexpr std::array<uint32_t, TABLE_STEPS + 1> makeTable(Curve &&curve) {
+            std::array<uint32_t, TABLE_STEPS + 1> lut{};
+            for(unsigned i = 0; i <= TABLE_STEPS; i++)
+                lut[i] = (uint32_t)(curve((double)i / TABLE_STEPS) * ONE_Q16 + 0.5);
+            return lut;
+        }
+
+        // Q16 level for perceived brightness i/256, the last entry is exactly 1, in DRAM since curveLevel() runs in ISRs
+        inline constexpr DRAM_ATTR std::array<uint32_t, TABLE_STEPS + 1> GAMMA_Q16{makeTable(gammaLevel)};
+        inline constexpr DRAM_ATTR std::array<uint32_t, TABLE_STEPS + 1> LIGHTNESS_Q16{makeTable(lightnessLevel)};
+
+        // Q16 level for a Q16 perceived brightness, interpolated between table entries
+        static constexpr uint32_t IRAM_ATTR curveLevel(const FadeCurve curve, const uint32_t perceived_q16) {
+            if(curve == FadeCurve::LINEAR)
+                return perceived_q16;
+            const auto &lut = curve == FadeCurve::GAMMA ? GAMMA_Q16 : LIGHTNESS_Q16;
+            const uint32_t index = perceived_q16 >> 8;
+            if(index >= TABLE_STEPS)
+                return lut[TABLE_STEPS];
+            return lut[index] + (((lut[index + 1] - lut[index]) * (perceived_q16 & 0xFF)) >> 8);
+        }
+
+        // Inverse of curveLevel(), searches the table so it's for tasks
+        constexpr uint32_t curvePerceived(const FadeCurve curve, const uint32_t level_q16) {
+            if(curve == FadeCurve::LINEAR)
+                return level_q16;
+            const auto &lut = curve == FadeCurve::GAMMA ? GAMMA_Q16 : LIGHTNESS_Q16;
+            if(level_q16 >= lut[TABLE_STEPS])
+                return ONE_Q16;
+            unsigned index = 0;
+            while(lut[index + 1] <= level_q16)
+                index++;
+            return (index << 8) + ((level_q16 - lut[index]) << 8) / (lut[index + 1] - lut[index]);
+        }
+    }
+
+    /*
+     * Brightness fade advanced once per half cycle from the dimmer's ISR, so a ramp of any length costs no task wakeups
+     *  or locking. Levels are integers out of a `full` scale chosen by the dimmer, ex.: conducting positions of the half
+     *  cycle for a leading edge dimmer, and the last step is always exactly the target.
+     *
+     *  `start()` and `jump()` are for tasks, serialized by the caller, and publish a command that `step()` picks up on
+     *  the next half cycle, the newest one wins. While a fade is active only the ISR should write the output, a task
+     *  changing the level calls `jump()` instead.
+     */
+    class Fade {
+        public:
+            /* Fades from `from` to `to` over `halfCycles` half cycles along `curve`. Levels between 0 and `floor` are
+             *  raised to it, ex.: the dimmer's minimum no flicker level. */
+            void start(const uint32_t from, const uint32_t to, const uint32_t full, const uint32_t halfCycles,
+                       const FadeCurve curve, const uint32_t floor = 0) {
+                Command command{to, full, floor, halfCycles, curve, 0, 0};
+                if(halfCycles > 1 && full > 0) { // the curve search and divisions are done here rather than in the ISR
+                    const int64_t fromPerceived = fade_detail::curvePerceived(curve, (uint32_t)(((uint64_t)from << 16) / full));
+                    const int64_t toPerceived = fade_detail::curvePerceived(curve, (uint32_t)(((uint64_t)to << 16) / full));
+                    command.perceived_q32 = fromPerceived << 16;
+                    command.step_q32 = ((toPerceived - fromPerceived) << 16) / halfCycles;
+                }
+                publish(command);
+            }
+
+            // Ends the fade at `level` on the next half cycle
+            void jump(const uint32_t level) { publish({level, 1, 0, 0, FadeCurve::LINEAR, 0, 0}); }
+
+            // True from `start()` or `jump()` until the ISR has output the target
+            [[nodiscard]] bool isActive() const {
+                return sequence.load(std::memory_order_acquire) != doneSequence.load(std::memory_order_acquire);
+            }
+
+            // Last level output by step()
+            [[nodiscard]] uint32_t level() const { return currentLevel.load(std::memory_order_relaxed); }
+
+            // Once per half cycle, returns true with the level to output while a fade is active
+            bool IRAM_ATTR step(uint32_t &level) {
+                const uint32_t seq = sequence.load(std::memory_order_acquire);
+                if(seq != seenSequence && (seq & 1) == 0) {
+                    const Command command = pending;
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if(sequence.load(std::memory_order_relaxed) == seq) { // else it's being rewritten, next half cycle
+                        seenSequence = seq;
+                        begin(command);
+                    }
+                }
+                if(!running)
+                    return false;
+                if(remaining <= 1) {
+                    level = fading.to;
+                    running = false;
+                    currentLevel.store(level, std::memory_order_relaxed);
+                    doneSequence.store(seenSequence, std::memory_order_release);
+                    return true;
+                }
+                remaining--;
+                perceived_q32 += fading.step_q32;
+                level = levelAt((uint32_t)(perceived_q32 >> 16));
+                currentLevel.store(level, std::memory_order_relaxed);
+                return true;
+            }
+
+        private:
+            struct Command {
+                uint32_t to;
+                uint32_t full;
+                uint32_t floor;
+                uint32_t halfCycles;
+                FadeCurve curve;
+                int64_t perceived_q32; // Q16 perceived brightness of `from`, with 16 more bits for small steps
+                int64_t step_q32;
+            };
+
+            // task to ISR, a sequence lock: odd while `pending` is being written
+            Command pending{};
+            std::atomic<uint32_t> sequence{0};
+            std::atomic<uint32_t> doneSequence{0};
+            std::atomic<uint32_t> currentLevel{0};
+            // ISR only
+            uint32_t seenSequence{0};
+            bool running{false};
+            Command fading{};
+            uint32_t remaining{0};
+            int64_t perceived_q32{0};
+
+            void publish(const Command &command) {
+                const uint32_t seq = sequence.load(std::memory_order_relaxed);
+                sequence.store(seq + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                pending = command;
+                sequence.store(seq + 2, std::memory_order_release);
+            }
+
+            void IRAM_ATTR begin(const Command &command) {
+                fading = command;
+                running = true;
+                remaining = command.halfCycles;
+                perceived_q32 = command.perceived_q32;
+            }
+
+            [[nodiscard]] uint32_t IRAM_ATTR levelAt(const uint32_t perceived_q16) const {
+                const uint64_t level_q16 = fade_detail::curveLevel(fading.curve, perceived_q16);
+                const auto level = (uint32_t)((level_q16 * fading.full + (1u << 15)) >> 16);
+                return level > 0 && level < fading.floor ? fading.floor : level;
+            }
+    };
+}
+
+#endif // FADE_H_
@@ -0,0 +1,110 @@
+#ifndef ISR_DISPATCH_TABLE_H_
+#define ISR_DISPATCH_TABLE_H_
+
+#include "mains_timing.h"
+
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+namespace mains_timing {
+
+    /*
+     * Fixed capacity table of {instance, function} pairs that an ISR calls without locking while instances are added or
+     *  removed from task context. There are two buffers, writers change the inactive one and then publish it by
+     *  switching the active index, so the ISR always iterates a complete table. Before a buffer is reused the writer
+     *  waits for ISRs still iterating it, ISRs pin the buffer they read with a counter and re-check it's still active.
+     *
+     *  Writers must be serialized by the caller, ex.: with a mutex, and must not run in an ISR. After `remove()` returns
+     *  no ISR can call the removed instance anymore, so it can be destroyed. Declare tables DRAM_ATTR, `dispatch()` is
+     *  IRAM_ATTR and doesn't allocate.
+     */
+    template<class Instance, class Func, std::size_t Capacity>
+    class IsrDispatchTable {
+        static_assert(Capacity > 0, "IsrDispatchTable needs room for at least one instance");
+
+        public:
+            // Returns false if the table is full, if `instance` is already in it its function is replaced
+            bool add(Instance *instance, const Func func) {
+                const unsigned from = active.load();
+                Buffer &to = buffers[from ^ 1];
+                to = buffers[from];
+                for(std::size_t i = 0; i < to.size; i++) {
+                    if(to.entries[i].instance == instance) {
+                        to.entries[i].func = func;
+                        publish(from ^ 1);
+                        return true;
+                    }
+                }
+                if(to.size == Capacity)
+                    return false;
+                to.entries[to.size++] = {instance, func};
+                publish(from ^ 1);
+                return true;
+            }
+
+            // Returns false if `instance` wasn't in the table
+            bool remove(const Instance *instance) {
+                const unsigned from = active.load();
+                Buffer &to = buffers[from ^ 1];
+                to.size = 0;
+                bool removed = false;
+                for(std::size_t i = 0; i < buffers[from].size; i++) {
+                    if(buffers[from].entries[i].instance == instance)
+                        removed = true;
+                    else
+                        to.entries[to.size++] = buffers[from].entries[i];
+                }
+                if(removed)
+                    publish(from ^ 1);
+                return removed;
+            }
+
+            [[nodiscard]] std::size_t size() const { return buffers[active.load()].size; }
+            [[nodiscard]] bool empty() const { return size() == 0; }
+            [[nodiscard]] static constexpr std::size_t capacity() { return Capacity; }
+
+            // Calls every entry's `func(instance, args...)`, safe to call from an ISR while writers change the table
+            template<class... Args>
+            void IRAM_ATTR dispatch(Args... args) {
+                unsigned index = active.load();
+                while(true) {
+                    readers[index].fetch_add(1);
+                    const unsigned check = active.load();
+                    if(check == index)
+                        break;
+                    // switched before it was pinned, the writer may already be reusing it
+                    readers[index].fetch_sub(1);
+                    index = check;
+                }
+                const Buffer &buffer = buffers[index];
+                for(std::size_t i = 0; i < buffer.size; i++)
+                    buffer.entries[i].func(buffer.entries[i].instance, args...);
+                readers[index].fetch_sub(1);
+            }
+
+        private:
+            struct Entry {
+                Instance *instance{nullptr};
+                Func func{nullptr};
+            };
+            struct Buffer {
+                Entry entries[Capacity]{};
+                std::size_t size{0};
+            };
+
+            Buffer buffers[2]{};
+            std::atomic<unsigned> active{0};
+            std::atomic<uint32_t> readers[2]{};
+
+            // Switches to buffer `index` and waits for ISRs still reading the previous one, so it's free to reuse
+            void publish(const unsigned index) {
+                active.store(index);
+                while(readers[index ^ 1].load() != 0)
+                    std::this_thread::yield();
+            }
+    };
+}
+
+#endif // ISR_DISPATCH_TABLE_H_
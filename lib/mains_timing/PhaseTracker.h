@@ -0,0 +1,154 @@
+#ifndef PHASE_TRACKER_H_
+#define PHASE_TRACKER_H_
+
+#include "mains_timing.h"
+
+#include <cstdint>
+
+namespace mains_timing {
+
+    /*
+     * Software phase locked loop tracking the mains zero crossings. Each crossing pulse is compared to the predicted
+     *  crossing and a proportional-integral loop corrects the phase (the filtered crossing time) and the half period,
+     *  so line jitter and frequency drift don't leak directly into firing times. Missed pulses are bridged by the
+     *  predicted half periods and, once locked, pulses far from the prediction are rejected as noise.
+     *
+     *  Fixed point (µs in Q8) with no division or floating point, so `update()` can run in the crossing ISR. It's not
+     *  synchronized, tasks can read the getters for stats since each value is a single 32 bit word.
+     */
+    class PhaseTracker {
+        public:
+            inline static constexpr unsigned Q{8}; // fractional bits of µs
+            inline static constexpr uint32_t MAX_MISSED{8}; // missed crossings bridged before re-acquiring
+            inline static constexpr uint32_t MAX_OUTLIERS{3}; // consecutive rejected crossings before re-acquiring
+            inline static constexpr uint32_t LOCK_CROSSINGS{16}; // crossings with low jitter needed to lock
+            inline static constexpr int32_t LOCK_JITTER_US{100}; // average phase error to lock, unlocks at twice it
+
+            constexpr PhaseTracker(const unsigned minHalfPeriod_us, const unsigned maxHalfPeriod_us) :
+                    minHalfPeriod_q8((int32_t)minHalfPeriod_us << Q), maxHalfPeriod_q8((int32_t)maxHalfPeriod_us << Q) { }
+
+            /* Feeds a crossing seen at `pulse_us`, returns false if it was rejected as noise. The caller should then
+             *  ignore the pulse, ex.: not mask the crossing interrupt, so the real crossing that follows is tracked. */
+            bool IRAM_ATTR update(const uint32_t pulse_us) {
+                const auto elapsed_us = (int32_t)(pulse_us - lastCrossing_us);
+                // also keeps the Q8 maths below from overflowing after long gaps
+                if(state == State::IDLE || elapsed_us < 0 || elapsed_us > (maxHalfPeriod_q8 >> Q) * (int32_t)(MAX_MISSED + 2)) {
+                    restart(pulse_us);
+                    return true;
+                }
+                if(state == State::FIRST_PULSE) {
+                    // a crossing missed between the first two still gives the half period
+                    const int32_t elapsed_q8 = elapsed_us << Q;
+                    if(elapsed_q8 >= minHalfPeriod_q8 && elapsed_q8 <= maxHalfPeriod_q8 * 2) {
+                        halfPeriod_q8_ = clamp(elapsed_q8 > maxHalfPeriod_q8 ? elapsed_q8 >> 1 : elapsed_q8);
+                        state = State::ACQUIRING;
+                    }
+                    lastCrossing_us = pulse_us;
+                    return true;
+                }
+
+                const uint32_t prevCrossing_us = lastCrossing_us;
+                const int32_t prevCrossingFrac_q8 = lastCrossingFrac_q8;
+                advance(halfPeriod_q8_); // predicted crossing
+                int32_t error_q8 = (int32_t)((pulse_us - lastCrossing_us) << Q) - lastCrossingFrac_q8;
+                uint32_t missedNow = 0;
+                for(; error_q8 > (halfPeriod_q8_ >> 1) && missedNow < MAX_MISSED; missedNow++) {
+                    advance(halfPeriod_q8_);
+                    error_q8 -= halfPeriod_q8_;
+                }
+                missed += missedNow;
+                if(missedNow == MAX_MISSED) {
+                    restart(pulse_us);
+                    return true;
+                }
+
+                const bool locked = state == State::LOCKED;
+                if(locked && abs(error_q8) > (halfPeriod_q8_ >> 3)) {
+                    outliers++;
+                    if(++consecutiveOutliers >= MAX_OUTLIERS) {
+                        restart(pulse_us);
+                        return true;
+                    }
+                    // keep predicting from the last good crossing
+                    lastCrossing_us = prevCrossing_us;
+                    lastCrossingFrac_q8 = prevCrossingFrac_q8;
+                    missed -= missedNow;
+                    return false;
+                }
+                consecutiveOutliers = 0;
+
+                // proportional-integral correction, wider bandwidth while acquiring
+                advance(error_q8 >> (locked ? 3 : 1));
+                halfPeriod_q8_ = clamp(halfPeriod_q8_ + (error_q8 >> (locked ? 6 : 3)));
+
+                jitter_q8 += (abs(error_q8) - jitter_q8) >> 3;
+                if(locked) {
+                    if(jitter_q8 > (LOCK_JITTER_US << Q) * 2)
+                        state = State::ACQUIRING;
+                } else if(jitter_q8 >= (LOCK_JITTER_US << Q)) {
+                    lockCount = 0;
+                } else if(++lockCount >= LOCK_CROSSINGS) {
+                    state = State::LOCKED;
+                    lockCount = 0;
+                }
+                return true;
+            }
+
+            // Filtered time of the last crossing, the phase reference for firing
+            [[nodiscard]] uint32_t IRAM_ATTR crossing_us() const { return lastCrossing_us; }
+            [[nodiscard]] unsigned IRAM_ATTR halfPeriod_us() const { return (unsigned)((halfPeriod_q8_ + (1 << (Q - 1))) >> Q); }
+            [[nodiscard]] int32_t halfPeriod_q8() const { return halfPeriod_q8_; }
+            // True once the half period is known
+            [[nodiscard]] bool IRAM_ATTR isTracking() const { return state == State::ACQUIRING || state == State::LOCKED; }
+            [[nodiscard]] bool isLocked() const { return state == State::LOCKED; }
+            // Average absolute phase error of the crossings
+            [[nodiscard]] unsigned jitter_us() const { return (unsigned)((jitter_q8 + (1 << (Q - 1))) >> Q); }
+            [[nodiscard]] uint32_t missedCount() const { return missed; }
+            [[nodiscard]] uint32_t outlierCount() const { return outliers; }
+            // Tracked mains frequency in mHz, 0 until tracking, divides so not for ISRs
+            [[nodiscard]] uint32_t frequency_mHz() const {
+                if(!isTracking())
+                    return 0;
+                return (uint32_t)(((uint64_t)500000000 << Q) / (uint64_t)halfPeriod_q8_);
+            }
+
+        private:
+            enum class State : uint8_t { IDLE, FIRST_PULSE, ACQUIRING, LOCKED };
+
+            const int32_t minHalfPeriod_q8;
+            const int32_t maxHalfPeriod_q8;
+            State state{State::IDLE};
+            uint32_t lastCrossing_us{0};
+            int32_t lastCrossingFrac_q8{0}; // fraction of µs of the crossing, 0 to 2^Q - 1
+            int32_t halfPeriod_q8_{0};
+            int32_t jitter_q8{0};
+            uint32_t lockCount{0};
+            uint32_t consecutiveOutliers{0};
+            uint32_t missed{0};
+            uint32_t outliers{0};
+
+            static constexpr int32_t IRAM_ATTR abs(const int32_t x) { return x < 0 ? -x : x; }
+
+            [[nodiscard]] int32_t IRAM_ATTR clamp(const int32_t halfPeriod) const {
+                return halfPeriod < minHalfPeriod_q8 ? minHalfPeriod_q8 : (halfPeriod > maxHalfPeriod_q8 ? maxHalfPeriod_q8 : halfPeriod);
+            }
+
+            // Moves the crossing by `delta_q8`, carrying the fraction into whole µs
+            void IRAM_ATTR advance(const int32_t delta_q8) {
+                const int32_t total_q8 = lastCrossingFrac_q8 + delta_q8;
+                lastCrossing_us += (uint32_t)(total_q8 >> Q); // arithmetic shift, floors negative deltas
+                lastCrossingFrac_q8 = total_q8 & ((1 << Q) - 1);
+            }
+
+            // Re-acquires from `pulse_us`, keeping the half period if it's known
+            void IRAM_ATTR restart(const uint32_t pulse_us) {
+                lastCrossing_us = pulse_us;
+                lastCrossingFrac_q8 = 0;
+                state = halfPeriod_q8_ == 0 ? State::FIRST_PULSE : State::ACQUIRING;
+                lockCount = consecutiveOutliers = 0;
+                jitter_q8 = 0;
+            }
+    };
+}
+
+#endif // PHASE_TRACKER_H_
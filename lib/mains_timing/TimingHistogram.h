@@ -0,0 +1,82 @@
+#ifndef TIMING_HISTOGRAM_H_
+#define TIMING_HISTOGRAM_H_
+
+#include "mains_timing.h"
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace mains_timing {
+
+    /*
+     * Lock-free histogram of µs timings recorded from ISRs and drained from a task. `Buckets` buckets of 2^WidthLog2 µs
+     *  start at `Base`, the first and last ones also count values below and above the range. Min and max are exact,
+     *  percentiles are the upper edge of their bucket (clamped to min and max), so they're within one bucket width.
+     *
+     *  `record()` only does relaxed atomic increments and compare-exchanges, no locking or division, declare histograms
+     *  DRAM_ATTR. `drain()` must be called from a single task.
+     */
+    template<std::size_t Buckets, uint32_t Base = 0, unsigned WidthLog2 = 0>
+    class TimingHistogram {
+        static_assert(Buckets >= 2, "TimingHistogram needs at least 2 buckets");
+
+        public:
+            struct Summary {
+                uint32_t count{0};
+                uint32_t min{0};
+                uint32_t max{0};
+                uint32_t p50{0};
+                uint32_t p99{0};
+            };
+
+            void IRAM_ATTR record(const uint32_t value_us) {
+                const uint32_t index = value_us < Base ? 0 : (value_us - Base) >> WidthLog2;
+                buckets[index < Buckets ? index : Buckets - 1].fetch_add(1, std::memory_order_relaxed);
+                uint32_t seen = min.load(std::memory_order_relaxed);
+                while(value_us < seen && !min.compare_exchange_weak(seen, value_us, std::memory_order_relaxed)) { }
+                seen = max.load(std::memory_order_relaxed);
+                while(value_us > seen && !max.compare_exchange_weak(seen, value_us, std::memory_order_relaxed)) { }
+            }
+
+            // Summarizes and resets what was recorded since the last drain, values recorded meanwhile go in either
+            Summary drain() {
+                std::array<uint32_t, Buckets> counts{};
+                Summary summary;
+                for(std::size_t i = 0; i < Buckets; i++) {
+                    counts[i] = buckets[i].exchange(0, std::memory_order_relaxed);
+                    summary.count += counts[i];
+                }
+                summary.min = min.exchange(UINT32_MAX, std::memory_order_relaxed);
+                summary.max = max.exchange(0, std::memory_order_relaxed);
+                if(summary.count == 0)
+                    return {};
+                if(summary.min > summary.max) // raced with record(), only counts were seen
+                    summary.min = summary.max;
+                summary.p50 = percentile(counts, summary, (summary.count + 1) / 2);
+                summary.p99 = percentile(counts, summary, summary.count - summary.count / 100);
+                return summary;
+            }
+
+        private:
+            std::atomic<uint32_t> buckets[Buckets]{};
+            std::atomic<uint32_t> min{UINT32_MAX};
+            std::atomic<uint32_t> max{0};
+
+            // Value of the `rank`th (from 1) smallest recording
+            static uint32_t percentile(const std::array<uint32_t, Buckets> &counts, const Summary &summary, const uint32_t rank) {
+                uint32_t seen = 0;
+                std::size_t i = 0;
+                for(; i < Buckets - 1; i++) {
+                    seen += counts[i];
+                    if(seen >= rank)
+                        break;
+                }
+                const uint32_t upperEdge = i == Buckets - 1 ? summary.max : Base + ((uint32_t)(i + 1) << WidthLog2) - 1;
+                return upperEdge < summary.min ? summary.min : (upperEdge > summary.max ? summary.max : upperEdge);
+            }
+    };
+}
+
+#endif // TIMING_HISTOGRAM_H_
@@ -0,0 +1,88 @@
+#ifndef APPARENT_POWER_H_
+#define APPARENT_POWER_H_
+
+#include "mains_timing.h"
+
+#include <array>
+#include <algorithm>
+#include <cstdint>
+
+/*
+ * Conversions between a leading edge dimmer's brightness (the fraction of the half cycle it conducts) and the percent of
+ *  apparent power it delivers to a resistive load, 50 - cos(π·brightness/resolution)·50. The trigonometry is done at
+ *  compile time into Q32 fixed point tables of 101 entries, so conversions need neither floating point nor libm.
+ */
+namespace mains_timing {
+    namespace apparent_power_detail {
+        inline constexpr double HALF_TURN_RAD{3.14159265358979323846};
+        inline constexpr double Q32{4294967296.0};
+
+        // cos(x) for x in [0, π] by its Taylor series, std::cos isn't constexpr (and Arduino.h defines PI)
+        constexpr double cos(const double x) {
+            double sum = 1, term = 1;
+            for(unsigned k = 1; k <= 30; k++) {
+                term *= -x * x / ((2 * k - 1) * (2 * k));
+                sum += term;
+            }
+            return sum;
+        }
+
+        // acos(y) for y in [-1, 1] by bisection, cos() decreases on [0, π]
+        constexpr double acos(const double y) {
+            double low = 0, high = HALF_TURN_RAD;
+            for(unsigned i = 0; i < 64; i++) {
+                const double mid = (low + high) / 2;
+                if(cos(mid) > y)
+                    low = mid;
+                else
+                    high = mid;
+            }
+            return (low + high) / 2;
+        }
+
+        // Fraction of the half cycle conducting for `percent` of apparent power, in Q32 saturated to UINT32_MAX
+        constexpr uint32_t phaseFraction(const double percent) {
+            const double fraction = acos(1 - 2 * percent / 100) / HALF_TURN_RAD * Q32;
+            return fraction >= Q32 - 1 ? UINT32_MAX : (uint32_t)(fraction + 0.5);
+        }
+
+        constexpr std::array<uint32_t, 101> makePercentToPhase() {
+            std::array<uint32_t, 101> lut{};
+            for(unsigned percent = 0; percent <= 100; percent++)
+                lut[percent] = phaseFraction(percent);
+            return lut;
+        }
+
+        // lut[p] is the phase fraction from which the apparent power rounds to p percent, lut[0] is unused
+        constexpr std::array<uint32_t, 101> makePhaseToPercent() {
+            std::array<uint32_t, 101> lut{};
+            for(unsigned percent = 1; percent <= 100; percent++)
+                lut[percent] = phaseFraction(percent - 0.5);
+            return lut;
+        }
+    }
+
+    inline constexpr std::array<uint32_t, 101> PERCENT_TO_PHASE_Q32{apparent_power_detail::makePercentToPhase()};
+    inline constexpr std::array<uint32_t, 101> PHASE_TO_PERCENT_Q32{apparent_power_detail::makePhaseToPercent()};
+
+    // Brightness out of `resolution`, rounded, delivering `percent` (0 to 100) of apparent power
+    constexpr uint16_t percentToBrightness(const uint8_t percent, const uint16_t resolution) {
+        const uint64_t phase = PERCENT_TO_PHASE_Q32[std::min<uint8_t>(percent, 100)];
+        return (uint16_t)((phase * resolution + (UINT64_C(1) << 31)) >> 32);
+    }
+
+    // Percent of apparent power, rounded, delivered by `brightness` out of `resolution`
+    inline uint8_t brightnessToPercent(const uint16_t brightness, const uint16_t resolution) {
+        if(resolution == 0)
+            return 0;
+        const uint64_t phase = (uint64_t)std::min(brightness, resolution) << 32;
+        // count of percents whose threshold is reached, thresholds are ascending
+        const auto end = std::upper_bound(PHASE_TO_PERCENT_Q32.begin() + 1, PHASE_TO_PERCENT_Q32.end(), phase,
+                                           [resolution](const uint64_t value, const uint32_t threshold) {
+                                               return value < (uint64_t)threshold * resolution;
+                                           });
+        return (uint8_t)(end - (PHASE_TO_PERCENT_Q32.begin() + 1));
+    }
+}
+
+#endif // APPARENT_POWER_H_
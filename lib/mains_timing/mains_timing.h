@@ -0,0 +1,20 @@
+#ifndef MAINS_TIMING_H_
+#define MAINS_TIMING_H_
+
+/*
+ * mains_timing holds the hardware independent parts of the zero crossing and dimmer ISRs so they can be unit tested on
+ *  desktop, ZeroCrossing and the dimmers use them from their ISRs.
+ */
+
+#if __has_include(<esp_attr.h>)
+#include <esp_attr.h>
+#endif
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+#ifndef DRAM_ATTR
+#define DRAM_ATTR
+#endif
+
+#endif // MAINS_TIMING_H_
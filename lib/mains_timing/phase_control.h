@@ -0,0 +1,82 @@
+#ifndef PHASE_CONTROL_H_
+#define PHASE_CONTROL_H_
+
+#include "mains_timing.h"
+
+#include <cstdint>
+
+namespace mains_timing {
+    // Returned by the delay calculations when the triac shouldn't fire in the half cycle
+    inline static constexpr DRAM_ATTR uint32_t NO_FIRING{UINT32_MAX};
+
+    /* Whether a leading edge dimmer's triac is on at `cyclePosition` of the half cycle, out of `positions` (ex.:
+     *  ZeroCrossing::RESOLUTION_MAX_SIZE), for `brightness` out of `resolution`. This is the fixed tick rule, the triac
+     *  turns on once the position is past the phase delay and off at the start of the next half cycle. */
+    static constexpr bool IRAM_ATTR leadingEdgeOn(const unsigned cyclePosition, const unsigned positions,
+                                                  const unsigned brightness, const unsigned resolution) {
+        if(brightness == 0)
+            return false;
+        const unsigned onPosition = positions - (positions * brightness / resolution);
+        return cyclePosition > onPosition || brightness == resolution;
+    }
+
+    /* Delay in µs from the start of the half cycle until the triac fires, for event driven (one-shot timer) firing,
+     *  or NO_FIRING. It's the earliest time `leadingEdgeOn()` is true for a tick at that time, so firing matches the
+     *  fixed tick rule to within one tick without ticking. */
+    static constexpr uint32_t IRAM_ATTR leadingEdgeDelay_us(const unsigned positions, const unsigned brightness,
+                                                            const unsigned resolution, const unsigned halfPeriod_us) {
+        if(brightness == 0 || halfPeriod_us == 0)
+            return NO_FIRING;
+        if(brightness == resolution)
+            return 0;
+        const unsigned onPosition = positions - (positions * brightness / resolution);
+        if(onPosition >= positions)
+            return NO_FIRING;
+        // smallest elapsed with positions * elapsed / halfPeriod > onPosition
+        const uint64_t scaled = (uint64_t)(onPosition + 1) * halfPeriod_us;
+        const auto delay_us = (uint32_t)((scaled + positions - 1) / positions);
+        return delay_us < halfPeriod_us ? delay_us : NO_FIRING;
+    }
+
+    /* Position of the half cycle, out of `Positions`, after which a leading edge triac is on for `brightness` out of
+     *  `resolution`: -1 if always on, `Positions` if never. Compute it when the brightness changes so ISRs don't divide,
+     *  `leadingEdgeOnAt()` and `leadingEdgeDelayAt_us()` then give the same results as `leadingEdgeOn()` and
+     *  `leadingEdgeDelay_us()`. */
+    template<unsigned Positions>
+    static constexpr int32_t leadingEdgeOnPosition(const unsigned brightness, const unsigned resolution) {
+        if(brightness == 0 || resolution == 0)
+            return Positions;
+        if(brightness >= resolution)
+            return -1;
+        return (int32_t)(Positions - (Positions * brightness / resolution));
+    }
+
+    static constexpr bool IRAM_ATTR leadingEdgeOnAt(const unsigned cyclePosition, const int32_t onPosition) {
+        return (int32_t)cyclePosition > onPosition;
+    }
+
+    /* Positions of the half cycle a leading edge triac conducts for, 0 to `Positions`, and back. A linear scale to fade
+     *  on, both ways are exact for on positions from `leadingEdgeOnPosition()`, which are never 0. */
+    template<unsigned Positions>
+    static constexpr uint32_t leadingEdgeLevel(const int32_t onPosition) {
+        return onPosition < 0 ? Positions : Positions - (uint32_t)onPosition;
+    }
+
+    template<unsigned Positions>
+    static constexpr int32_t IRAM_ATTR leadingEdgeOnPositionAtLevel(const uint32_t level) {
+        return level >= Positions ? -1 : (int32_t)(Positions - level);
+    }
+
+    template<unsigned Positions>
+    static constexpr uint32_t IRAM_ATTR leadingEdgeDelayAt_us(const int32_t onPosition, const unsigned halfPeriod_us) {
+        static_assert(Positions > 0 && (Positions & (Positions - 1)) == 0, "Positions must be a power of 2 to divide with a shift");
+        if(onPosition < 0)
+            return 0;
+        if(onPosition >= (int32_t)Positions || halfPeriod_us == 0)
+            return NO_FIRING;
+        const uint32_t delay_us = ((uint32_t)(onPosition + 1) * halfPeriod_us + Positions - 1) / Positions;
+        return delay_us < halfPeriod_us ? delay_us : NO_FIRING;
+    }
+}
+
+#endif // PHASE_CONTROL_H_
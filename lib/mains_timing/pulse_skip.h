@@ -0,0 +1,43 @@
+#ifndef PULSE_SKIP_H_
+#define PULSE_SKIP_H_
+
+#include "mains_timing.h"
+
+#include <cstdint>
+
+namespace mains_timing {
+    /* Pulse skip modulation decisions, each call decides if the triac is on for the next full mains cycle so that
+     *  `brightness` out of `cycles` cycles are on. Called on every other half cycle start so both halves of a cycle are
+     *  always the same and there's no DC on the load. */
+
+    /* Fires while the ratio of cycles fired so far is below brightness/cycles, restarting every `cycles` cycles.
+     *  `halfCycleCount` is the even half cycle count, incremented by the caller. Divides on every decision and tends
+     *  to bunch on cycles at the start of each period. */
+    static constexpr bool IRAM_ATTR pulseSkipRatioStep(unsigned &halfCycleCount, unsigned &cyclesFiredCount,
+                                                       const unsigned brightness, const unsigned cycles) {
+        if(halfCycleCount/2 > cycles) {
+            halfCycleCount = 0;
+            cyclesFiredCount = 0;
+        }
+        const bool fire = brightness > // check for div by 0
+                (halfCycleCount == 0 ? 0 : (cycles * cyclesFiredCount)/(halfCycleCount/2) - 1);
+        if(fire)
+            cyclesFiredCount++;
+        return fire;
+    }
+
+    /* First-order sigma-delta (error diffusion): adds the brightness to `accumulator` and fires when it reaches
+     *  `cycles`, carrying the remainder. On cycles are spread as evenly as possible and the count of on cycles is
+     *  never more than one off the exact brightness over any run of cycles, with only adds and compares. */
+    static constexpr bool IRAM_ATTR sigmaDeltaStep(uint32_t &accumulator, const unsigned brightness, const unsigned cycles) {
+        accumulator += brightness;
+        if(accumulator < cycles)
+            return false;
+        accumulator -= cycles;
+        if(accumulator >= cycles) // cycles was lowered
+            accumulator = 0;
+        return true;
+    }
+}
+
+#endif // PULSE_SKIP_H_
@@ -40,60 +40,51 @@ namespace ntp_time {
 
                 [[nodiscard]] const char * getTag() const override { return TAG; }
 
-                [[nodiscard]] std::vector<std::string> getNvsKeys() const override { return ntp_time::nvsDataKeys; }
-                [[nodiscard]] std::vector<std::string> getKeys() const override { return keys; }
-                [[nodiscard]] std::vector<std::string> getReadOnlyKeys() const override { return readOnlyKeys; }
+                [[nodiscard]] const std::vector<std::string> &getNvsKeys() const override { return ntp_time::nvsDataKeys; }
+                [[nodiscard]] const std::vector<std::string> &getKeys() const override { return keys; }
+                [[nodiscard]] const std::vector<std::string> &getReadOnlyKeys() const override { return readOnlyKeys; }
 
             private:
                 [[nodiscard]] std::string getWithOptLock(const std::string &key, const bool noLock) const override {
-                    using retType = std::string;
-                    using FunPtrType = retType(*)();
-                    return getStringDataHelper<FunPtrType>({
-                                       {UPTIME,       (FunPtrType)[]()->retType { return getUptime(); } },
-                                       {CURRENT_TIME, (FunPtrType)[]()->retType { return getCurrentTime(); } },
-                                       {FREE_MEMORY,  (FunPtrType)[]()->retType { return getFreeMemory(); } },
-                                       {TIMEZONE,     (FunPtrType)[]()->retType { return timezone; } },
-                                       {NTP_SERVER1,  (FunPtrType)[]()->retType { return ntpServer1; } }
-                                       },
-                                   key, noLock, []()->retType { return HasData::EMPTY_VALUE; })();
+                    return getValueWithOptLock(key, noLock).toString(HasData::EMPTY_VALUE);
+                }
+
+                [[nodiscard]] DataValue getValueWithOptLock(const std::string &key, const bool noLock) const override {
+                    static constexpr auto getters = makeDataKeyTable<ValueGetter<_>>({
+                                       {UPTIME,       [](const _ *) -> DataValue { return getUptime(); } },
+                                       {CURRENT_TIME, [](const _ *) -> DataValue { return getCurrentTime(); } },
+                                       {FREE_MEMORY,  [](const _ *) -> DataValue { return ESP.getFreeHeap(); } },
+                                       {TIMEZONE,     [](const _ *) -> DataValue { return timezone; } },
+                                       {NTP_SERVER1,  [](const _ *) -> DataValue { return ntpServer1; } }
+                                       });
+                    return getDataKeyHelper(getters, this, key, noLock);
                 }
 
                 [[nodiscard]] bool setWithOptLockAndUpdate(const std::string &key, const std::string &value_raw,
                                                            const bool noLock, const bool doObjUpdate) override {
-                    if(std::find(readOnlyKeys.begin(), readOnlyKeys.end(), key) != readOnlyKeys.end() ||
-                        std::find(keys.begin(), keys.end(), key) == keys.end()) {
+                    if(isReadOnlyKey(key) || !hasKey(key)) {
                         Logger::logw(TAG, "Key %s is read-only or not found", key.c_str());
                         return false;
                     }
 
                     const std::string value = utils::trim_clean(value_raw);
 
-                    static std::vector<std::string> keysToUpdateOnObj = {};
-                    const auto timezoneConverter = [](const std::string &key, std::any varPtr, const std::string &value) {
-                        Logger::logv(TAG, "[timezoneConverter]");
-                        return lookupESPTimezone(value) && setStringDataHelperStringSetter(varPtr, value);
-                    };
+                    static constexpr auto setters = makeDataKeyTable<DataSetter<_>>({
+                                                {TIMEZONE,    [](_ *self, const std::string &value) {
+                                                    Logger::logv(TAG, "[timezoneConverter]");
+                                                    return self->validateValue(TIMEZONE, value) && setIfChanged(timezone, value);
+                                                }},
+                                                {NTP_SERVER1, [](_ *, const std::string &value) { return setIfChanged(ntpServer1, value); }}
+                                                });
                     // TODO: check values are valid
-                    const auto updatedKey = setStringDataHelper({
-                                                {TIMEZONE, {&timezone, timezoneConverter}},
-                                                {NTP_SERVER1, {&ntpServer1}}},
-                                                                            key, value, noLock);
-                    bool updated = !updatedKey.empty();
-                    if(updated) {
-                        if (doObjUpdate) {
-                            keysToUpdateOnObj.push_back(updatedKey);
-                        }
-                    }
+                    const char *updatedKey = setDataKeyHelper(setters, this, key, value, noLock);
+                    return queueObjUpdate(updatedKey != nullptr ? updatedKey : std::string(), noLock, doObjUpdate);
+                }
 
-                    if(doObjUpdate && !keysToUpdateOnObj.empty()) {
-                        const bool objUpdated = updateObj(keysToUpdateOnObj, noLock) || updated; // include updated since vars were updated
-                        if(objUpdated) {
-                            Logger::logv(TAG, "Updated %s", utils::join(keysToUpdateOnObj, ", ").c_str());
-                            keysToUpdateOnObj.clear();
-                        }
-                        return objUpdated;
-                    }
-                    return updated;
+                [[nodiscard]] bool validateValue(const std::string &key, const DataValue &value) const override {
+                    if(key == TIMEZONE)
+                        return lookupESPTimezone(value.toString());
+                    return true;
                 }
 
                 bool updateObj(const std::vector<std::string> &keys, const bool _dataAlreadyLocked) override {
@@ -26,6 +26,7 @@ esp_err_t (*esp_crt_bundle_attachFunc)(void*) = esp_crt_bundle_attach;
 
 #include <Logger.h>
 #include <utils.h>
+#include <NvsWriteBehind.h>
 
 #include <thread>
 #include <condition_variable>
@@ -55,6 +56,7 @@ namespace ota_update {
     bool serverOTALoopThreadStop = true;
 
     void updateCompleted() {
+        NvsWriteBehind::instance().flush();
         if(_restartOnUpdate) {
             Logger::logi(TAG, "Restarting in 5 seconds...");
             std::this_thread::sleep_for(std::chrono::seconds(5));
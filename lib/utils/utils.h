@@ -11,6 +11,7 @@
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <cstdint>
 // #include <ranges>
 
 
@@ -41,6 +42,17 @@ namespace utils {
 
     [[nodiscard]] std::vector<std::string> split(std::string_view view, char i);
 
+    // CRC-32 (IEEE 802.3, same as zlib), pass the previous result as `crc` to continue over more data
+    [[nodiscard]] inline uint32_t crc32(const uint8_t *data, const size_t length, uint32_t crc = 0) {
+        crc = ~crc;
+        for(size_t i = 0; i < length; i++) {
+            crc ^= data[i];
+            for(int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+        return ~crc;
+    }
+
     template<typename C> //,
             // typename = std::enable_if_t<std::ranges::common_range<C>>>
     [[nodiscard]] inline std::string join(const C &container, const std::string &separator) {
@@ -85,10 +97,10 @@ namespace utils {
     }
 
     inline void printDataDebug(const std::string &name, const std::map<std::string, std::string> &data) {
-        Logger<>::logd(TAG, "%s: {", name.c_str());
+        LOGD(TAG, "%s: {", name.c_str());
         for (const auto &d: data)
-            Logger<>::logd(TAG, "    -> key: %s = value: %s", d.first.c_str(), d.second.c_str());
-        Logger<>::logd(TAG, "}");
+            LOGD(TAG, "    -> key: %s = value: %s", d.first.c_str(), d.second.c_str());
+        LOGD(TAG, "}");
     }
 
     // creates a copy of the string, removes carriage returns, spaces, newlines, and tabs on the ends
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""
+Formats deferred log records, see lib/Logger/LogDeferred.h, using the firmware ELF for the format strings and tags.
+
+Reads a serial capture from a file or stdin, ex.:
+    pio device monitor | scripts/decode_deferred_log.py .pio/build/esp32-debug/firmware.elf
+Lines with a record ("#LB <base64>") are formatted, others are copied as they are.
+"""
+import argparse
+import base64
+import re
+import struct
+import sys
+
+FRAME = re.compile(r"#LB ([A-Za-z0-9+/]+=*)")
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(?:hh|h|ll|l|j|z|t|L)?([diouxXcfFeEgGaAsp%])")
+LEVELS = {1: "ERROR", 2: "WARN", 3: "INFO", 4: "DEBUG", 5: "VERB"}
+TAG_WIDTH = 5  # LOG_TAG_MAX_LEN
+
+
+class Elf:
+    """Strings at the addresses of the ELF's loaded sections"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF":
+            sys.exit(path + " is not an ELF file")
+        self.is64 = self.data[4] == 2
+        self.endian = "<" if self.data[5] == 1 else ">"
+        if self.is64:
+            shoff, = struct.unpack_from(self.endian + "Q", self.data, 0x28)
+            shentsize, shnum = struct.unpack_from(self.endian + "HH", self.data, 0x3A)
+            section = self.endian + "IIQQQQ"
+        else:
+            shoff, = struct.unpack_from(self.endian + "I", self.data, 0x20)
+            shentsize, shnum = struct.unpack_from(self.endian + "HH", self.data, 0x2E)
+            section = self.endian + "IIIIII"
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = struct.unpack_from(section, self.data, shoff + i * shentsize)
+            SHF_ALLOC, SHT_NOBITS = 0x2, 8
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size > 0:
+                self.sections.append((addr, offset, size))
+
+    @property
+    def address_size(self):
+        return 8 if self.is64 else 4
+
+    def string(self, address):
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.index(b"\0", start, offset + size)
+                return self.data[start:end].decode("utf-8", "replace")
+        return None
+
+
+class Arguments:
+    def __init__(self, data, endian):
+        self.data = data
+        self.endian = endian
+        self.pos = 0
+
+    def next(self, types):
+        """The next argument if it has one of `types`, None if not"""
+        if self.pos >= len(self.data) or chr(self.data[self.pos]) not in types:
+            return None
+        kind = chr(self.data[self.pos])
+        value = self.pos + 1
+        if kind == "i":
+            self.pos += 5
+            return kind, struct.unpack_from(self.endian + "i", self.data, value)[0] if self.pos <= len(self.data) else None
+        if kind == "l":
+            self.pos += 9
+            return kind, struct.unpack_from(self.endian + "q", self.data, value)[0] if self.pos <= len(self.data) else None
+        if kind == "d":
+            self.pos += 9
+            return kind, struct.unpack_from(self.endian + "d", self.data, value)[0] if self.pos <= len(self.data) else None
+        length = self.data[value]
+        self.pos += 2 + length
+        return kind, self.data[value + 1:value + 1 + length].decode("utf-8", "replace")
+
+
+def render(fmt, arguments):
+    def conversion(match):
+        flags, width, precision, kind = match.groups()
+        if kind == "%":
+            return "%"
+        if width == "*":
+            arg = arguments.next("i")
+            if arg is None:
+                return "<?>"
+            width = str(arg[1])
+        if precision == "*":
+            arg = arguments.next("i")
+            if arg is None:
+                return "<?>"
+            precision = str(arg[1])
+        spec = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+        if kind in "diouxXc":
+            arg = arguments.next("il")
+            if arg is None or arg[1] is None:
+                return "<?>"
+            value = arg[1]
+            if kind in "ouxX" and value < 0:
+                value += 1 << (32 if arg[0] == "i" else 64)
+            return (spec + ("d" if kind in "iu" else kind)) % value
+        if kind in "fFeEgGaA":
+            arg = arguments.next("d")
+            if arg is None or arg[1] is None:
+                return "<?>"
+            return (spec + ("f" if kind in "aA" else kind)) % arg[1]
+        if kind == "s":
+            arg = arguments.next("s")
+            return "<?>" if arg is None else (spec + "s") % arg[1]
+        arg = arguments.next("il")  # %p
+        return "<?>" if arg is None or arg[1] is None else "0x%x" % (arg[1] % (1 << 64))
+
+    return CONVERSION.sub(conversion, fmt)
+
+
+def decode(elf, frame):
+    data = base64.b64decode(frame)
+    size = elf.address_size
+    if len(data) < 1 + 2 * size + 4:
+        return None
+    level = data[0]
+    address = "Q" if size == 8 else "I"
+    fmt_address, tag_address, time_us = struct.unpack_from(elf.endian + address + address + "I", data, 1)
+    fmt = elf.string(fmt_address)
+    tag = elf.string(tag_address)
+    if fmt is None:
+        return "%010u [%s] [%s] <format at 0x%x not in the ELF>" % (time_us, LEVELS.get(level, level), tag, fmt_address)
+    message = render(fmt, Arguments(data[1 + 2 * size + 4:], elf.endian))
+    tag = (tag or "?")[:TAG_WIDTH].ljust(TAG_WIDTH)
+    return "%010u [%s] [%s] %s" % (time_us, LEVELS.get(level, level), tag, message)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("elf", help="firmware ELF the records were logged by")
+    parser.add_argument("capture", nargs="?", type=argparse.FileType("r", errors="replace"), default=sys.stdin,
+                        help="serial capture, stdin if left out")
+    args = parser.parse_args()
+    elf = Elf(args.elf)
+    for line in args.capture:
+        match = FRAME.search(line)
+        text = decode(elf, match.group(1)) if match else None
+        sys.stdout.write(line if text is None else line[:match.start()] + text + "\n")
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -13,6 +13,7 @@ int main(int argc, char **argv) { }
 #include <DoorController.h>
 #include <SimpleLogger.h>
 #include <SyslogLogger.h>
+#include <PersistentLogger.h>
 #include <factory_reset.h>
 #include <HeaterController.h>
 #include <Heartbeat.h>
@@ -26,11 +27,16 @@ int main(int argc, char **argv) { }
 #include <TemperatureSensor.h>
 #include <WaterFlowMeter.h>
 #include <DashboardServer.h>
+#include <NvsWriteBehind.h>
+#include <NvsStats.h>
 
 #include <memory>
 
 static const char * const TAG = "Main";
 
+// the last log messages, kept across resets in RTC memory
+RTC_NOINIT_ATTR static PersistentLogger::Ring crashLog;
+
 extern "C" void app_main() {
     // Arduino
   initArduino();
@@ -40,11 +46,19 @@ extern "C" void app_main() {
   Logger<>::addLogger(std::make_unique<SimpleLogger>(true, Serial, LOG_LEVEL_INFO));
   Logger<>::setTagLevel(SyslogLogger::TAG, LOG_LEVEL_INFO);
   Logger<>::addLogger(std::make_unique<SyslogLogger>());
+  // logs what was kept from before the reset to the loggers above
+  Logger<>::setTagLevel(PersistentLogger::TAG, LOG_LEVEL_VERBOSE);
+  Logger<>::addLogger(std::make_unique<PersistentLogger>(crashLog));
+  // loggers run on their own task so callers don't wait for serial and syslog sends
+  Logger<>::startAsync();
   Logger<>::logi(TAG, "Starting %s version %s",  PRODUCT_NAME, VERSION_BUILD);
 
 
   Logger<>::setTagLevel(cwifi::TAG, LOG_LEVEL_INFO);
 
+  // Settings are saved to NVS in the background, flushed before factory reset and OTA restarts
+  NvsWriteBehind::instance().setWindow(std::chrono::milliseconds(NVS_WRITE_BEHIND_MS));
+
   // Factory reset
   Logger<>::setTagLevel(factory_reset::TAG, LOG_LEVEL_INFO);
   factory_reset::init();
@@ -72,6 +86,14 @@ extern "C" void app_main() {
   cwifi::addOnIPAddressCallback([]() { ntp_time::update(); });
   mqtt.registerHasDataItem(&ntp_time::getData());
 
+  // NVS operation counts, to keep an eye on flash wear
+  static NvsStats nvsStats{"nvs_stats"};
+  static NvsStats mqttNvsStats{"nvs_stats_mqtt", "mqtt"};
+  static NvsStats timeNvsStats{"nvs_stats_time", "time"};
+  mqtt.registerHasDataItem(&nvsStats);
+  mqtt.registerHasDataItem(&mqttNvsStats);
+  mqtt.registerHasDataItem(&timeNvsStats);
+
   // WiFi
   factory_reset::addOnFactoryResetCallback(cwifi::resetWifi);
   mqtt.registerHasDataItem(&cwifi::getData());
@@ -91,20 +113,13 @@ extern "C" void app_main() {
  std::thread testlightThread([]() {
   //  runLightDimmer.setBrightness(0, LeadingEdgePhaseDimmer::RESOLUTION_MAX_SIZE);
    while(true) {
-        for(int i = runLightDimmer.getMinNoFlickerBrightness(); i < runLightDimmer.getResolution(); i+=1) {
-            runLightDimmer.setBrightness(i);
-            vTaskDelay(1 / portTICK_PERIOD_MS);
-//            if(i % 1000 == 0)
-//                Logger<>::logi(TAG, "brightness: %d, frequency: %s", i, runLightDimmer.get(LeadingEdgePhaseDimmer::FREQUENCY).c_str());
-        }
-        for(int i = runLightDimmer.getResolution(); i >= runLightDimmer.getMinNoFlickerBrightness(); i-=1) {
-            runLightDimmer.setBrightness(i);
-            vTaskDelay(1 / portTICK_PERIOD_MS);
-//            if(i % 1000 == 0)
-//                Logger<>::logi(TAG, "brightness: %d, frequency: %s", i, runLightDimmer.get(LeadingEdgePhaseDimmer::FREQUENCY).c_str());
-        }
-       runLightDimmer.setBrightness(0);
-       vTaskDelay(1 / portTICK_PERIOD_MS);
+        // ramps are stepped by the dimmer's ISR, this task only wakes to start them
+        runLightDimmer.fadeTo(runLightDimmer.getResolution(), 10000, LeadingEdgePhaseDimmer::FadeCurve::PERCEPTUAL);
+        vTaskDelay(12000 / portTICK_PERIOD_MS);
+        runLightDimmer.fadeTo(runLightDimmer.getMinNoFlickerBrightness(), 10000, LeadingEdgePhaseDimmer::FadeCurve::PERCEPTUAL);
+        vTaskDelay(12000 / portTICK_PERIOD_MS);
+        runLightDimmer.setBrightness(0);
+        vTaskDelay(2000 / portTICK_PERIOD_MS);
           //  vTaskDelay(10 / portTICK_PERIOD_MS);
 
 //        auto freq1 = runLightDimmer.get(LeadingEdgePhaseDimmer::FREQUENCY);
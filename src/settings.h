@@ -35,6 +35,10 @@
 #define FACTORY_RESET_TIME_SECS                 10
 #endif
 
+#ifndef NVS_WRITE_BEHIND_MS                     // settings changes within this time are saved to NVS together in the background, 0 to save right away
+#define NVS_WRITE_BEHIND_MS                     2000
+#endif
+
 #ifndef WIFI_SETUP_TIMEOUT_SECS                 // time to wait for wifi AP setup until it restarts
 #define WIFI_SETUP_TIMEOUT_SECS                 300
 #endif
@@ -84,6 +88,10 @@
 #define MQTT_PUB_INTERVAL_SECS                  10
 #endif
 
+#ifndef MQTT_PUB_FULL_INTERVAL_SECS             // all keys are published at this interval, only changed keys in between, 0 to always publish all
+#define MQTT_PUB_FULL_INTERVAL_SECS             300
+#endif
+
 #ifndef MQTT_TOPIC_PREFIX
 #define MQTT_TOPIC_PREFIX                       "coop"
 #endif
@@ -0,0 +1,43 @@
+#ifndef ALLOCATIONCOUNTER_H_
+#define ALLOCATIONCOUNTER_H_
+
+#if defined(ARDUINO) || defined(ESP32)
+#pragma GCC error "This header should not be included in embedded"
+#endif
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/*
+ * Counts global heap allocations made by the current thread so desktop benchmarks can report allocations per call.
+ *   Exactly one translation unit of the test binary must define ALLOCATION_COUNTER_IMPL before including this header
+ *   to install the replacement operator new/delete.
+ */
+namespace alloc_counter {
+    inline thread_local std::size_t allocations{0};
+
+    class Scope {
+        public:
+            Scope() : start(allocations) { }
+            [[nodiscard]] std::size_t count() const { return allocations - start; }
+        private:
+            const std::size_t start;
+    };
+} // namespace alloc_counter
+
+#ifdef ALLOCATION_COUNTER_IMPL
+void *operator new(const std::size_t size) {
+    alloc_counter::allocations++;
+    if(void *ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+void *operator new[](const std::size_t size) { return operator new(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+#endif // ALLOCATION_COUNTER_IMPL
+
+#endif // ALLOCATIONCOUNTER_H_
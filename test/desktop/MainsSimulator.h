@@ -0,0 +1,231 @@
+#ifndef MAINS_SIMULATOR_H_
+#define MAINS_SIMULATOR_H_
+
+#if defined(ARDUINO) || defined(ESP32)
+#pragma GCC error "This header should not be included in embedded"
+#endif
+
+#include <mains_hal.h>
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/*
+ * This is a fake for mains_hal, a deterministic simulator of the mains and the ESP32 hardware ZeroCrossing uses.
+ *  Time is virtual and only moves in run_us(), which sends zero crossing pulses for 50/60Hz mains with optional
+ *  jitter and missed pulses, fires the timer and runs periodic tasks when they're due, all on the calling thread.
+ *  Output pin edges are recorded with their virtual time, and the wall clock cost of each ISR call is measured.
+ *  Tasks started with runOnce() run right away, ex.: ZeroCrossing's ISR setup from the dimmer's constructor.
+ */
+class MainsSimulator {
+    public:
+        struct Config {
+            unsigned frequency_Hz{60};
+            unsigned jitter_us{0}; // crossings are up to this early or late, uniformly
+            double missedRatio{0}; // fraction of crossing pulses lost
+            unsigned pulseLead_us{130}; // the pulse's falling edge before the crossing, see ZeroCrossing::XC_HALF_PULSE_WIDTH_US
+            unsigned seed{1};
+        };
+        struct Edge {
+            uint32_t time_us;
+            uint8_t pin;
+            bool high;
+        };
+        struct IsrCost {
+            unsigned long calls{0};
+            double total_ns{0};
+            double max_ns{0};
+            [[nodiscard]] double mean_ns() const { return calls == 0 ? 0 : total_ns / calls; }
+        };
+
+        static MainsSimulator &get() {
+            static MainsSimulator simulator;
+            return simulator;
+        }
+
+        /* Restarts the mains from now and clears the records, keeps the attached interrupts, timer and periodic tasks.
+         *  Virtual time keeps going so times ZeroCrossing kept from earlier runs stay in the past. */
+        void reset(const Config &newConfig) {
+            config = newConfig;
+            mainsStart_us = now;
+            rng.seed(config.seed);
+            crossingIndex = 0;
+            trueCrossings.clear();
+            clearRecords();
+            scheduleCrossing();
+        }
+
+        // Runs virtual time forward, calling ISRs and periodic tasks as they're due
+        void run_us(const uint32_t duration_us) {
+            const uint32_t end_us = now + duration_us;
+            while(true) {
+                uint32_t next_us = end_us;
+                enum class Next { END, PULSE, TIMER, PERIODIC } what = Next::END;
+                std::size_t periodicIndex = 0;
+                if(crossingIsr != nullptr && before(nextPulse_us, next_us)) {
+                    next_us = nextPulse_us;
+                    what = Next::PULSE;
+                }
+                if(timerIsr != nullptr && timerArmed && before(timerAlarm_us, next_us)) {
+                    next_us = timerAlarm_us;
+                    what = Next::TIMER;
+                }
+                for(std::size_t i = 0; i < periodics.size(); i++) {
+                    if(before(periodics[i].next_us, next_us)) {
+                        next_us = periodics[i].next_us;
+                        what = Next::PERIODIC;
+                        periodicIndex = i;
+                    }
+                }
+                now = next_us;
+                switch(what) {
+                    case Next::END:
+                        return;
+                    case Next::PULSE: {
+                        if(!missed)
+                            measure(crossingCost, [this]() { crossingIsr(crossingArg); });
+                        scheduleCrossing();
+                        break;
+                    }
+                    case Next::TIMER: {
+                        if(timerPeriod_us > 0)
+                            timerAlarm_us += timerPeriod_us;
+                        else
+                            timerArmed = false; // one-shot, the ISR re-arms
+                        measure(timerCost, timerIsr);
+                        break;
+                    }
+                    case Next::PERIODIC: {
+                        periodics[periodicIndex].next_us += periodics[periodicIndex].period_us;
+                        periodics[periodicIndex].func();
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Crossings of the mains so far with their jitter, including ones whose pulse was missed
+        [[nodiscard]] const std::vector<uint32_t> &crossings() const { return trueCrossings; }
+        [[nodiscard]] const std::vector<Edge> &edges() const { return outputEdges; }
+        [[nodiscard]] std::vector<Edge> edges(const uint8_t pin) const {
+            std::vector<Edge> pinEdges;
+            for(const auto &edge : outputEdges)
+                if(edge.pin == pin)
+                    pinEdges.push_back(edge);
+            return pinEdges;
+        }
+        [[nodiscard]] bool pinLevel(const uint8_t pin) const { return (levels >> pin) & 1; }
+        [[nodiscard]] const IsrCost &timerIsrCost() const { return timerCost; }
+        [[nodiscard]] const IsrCost &crossingIsrCost() const { return crossingCost; }
+        [[nodiscard]] bool isAttached() const { return crossingIsr != nullptr && timerIsr != nullptr; }
+        void clearRecords() {
+            outputEdges.clear();
+            timerCost = {};
+            crossingCost = {};
+        }
+
+        // mains_hal
+        [[nodiscard]] uint32_t now_us() const { return now; }
+        void output(const uint32_t mask, const bool high) {
+            const uint32_t newLevels = high ? levels | mask : levels & ~mask;
+            for(uint8_t pin = 0; pin < 32; pin++)
+                if(((levels ^ newLevels) >> pin) & 1)
+                    outputEdges.push_back({now, pin, high});
+            levels = newLevels;
+        }
+        [[nodiscard]] uint32_t outputLevels() const { return levels; }
+        void crossingInterruptAttach(void (*isr)(void *), void *arg) {
+            crossingIsr = isr;
+            crossingArg = arg;
+        }
+        void crossingInterruptDetach() { crossingIsr = nullptr; }
+        void timerAttach(void (*isr)(), const uint32_t period_us) {
+            timerIsr = isr;
+            timerPeriod_us = period_us;
+            timerArmed = period_us > 0;
+            timerAlarm_us = now + period_us;
+        }
+        void timerArm(const uint32_t delay_us) {
+            timerArmed = true;
+            timerAlarm_us = now + delay_us;
+        }
+        void timerDetach() {
+            timerIsr = nullptr;
+            timerArmed = false;
+        }
+        void runEvery(void (*func)(), const uint32_t period_ms) { periodics.push_back({func, period_ms * 1000, now + period_ms * 1000}); }
+
+    private:
+        struct Periodic {
+            void (*func)();
+            uint32_t period_us;
+            uint32_t next_us;
+        };
+
+        Config config{};
+        uint32_t now{0};
+        uint32_t mainsStart_us{0};
+        std::mt19937 rng{1};
+        unsigned long crossingIndex{0};
+        std::vector<uint32_t> trueCrossings;
+        uint32_t nextPulse_us{0};
+        bool missed{false};
+        void (*crossingIsr)(void *){nullptr};
+        void *crossingArg{nullptr};
+        void (*timerIsr)(){nullptr};
+        uint32_t timerPeriod_us{0};
+        uint32_t timerAlarm_us{0};
+        bool timerArmed{false};
+        std::vector<Periodic> periodics;
+        uint32_t levels{0};
+        std::vector<Edge> outputEdges;
+        IsrCost timerCost;
+        IsrCost crossingCost;
+
+        static bool before(const uint32_t a, const uint32_t b) { return (int32_t)(a - b) < 0; }
+
+        // Next crossing after the current one and the time of its pulse
+        void scheduleCrossing() {
+            const double halfPeriod_us = 1000000.0 / (2.0 * config.frequency_Hz);
+            std::uniform_int_distribution<int> jitter(-(int)config.jitter_us, (int)config.jitter_us);
+            std::uniform_real_distribution<double> chance(0, 1);
+            crossingIndex++;
+            const uint32_t crossing_us = mainsStart_us + (uint32_t)(crossingIndex * halfPeriod_us + 0.5) + jitter(rng);
+            trueCrossings.push_back(crossing_us);
+            nextPulse_us = crossing_us - config.pulseLead_us;
+            missed = chance(rng) < config.missedRatio;
+        }
+
+        template<class F>
+        static void measure(IsrCost &cost, F &&f) {
+            const auto start = std::chrono::steady_clock::now();
+            f();
+            const auto ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            cost.calls++;
+            cost.total_ns += ns;
+            cost.max_ns = ns > cost.max_ns ? ns : cost.max_ns;
+        }
+};
+
+namespace mains_hal {
+    inline uint32_t now_us() { return MainsSimulator::get().now_us(); }
+    inline void outputSet(const uint32_t mask) { MainsSimulator::get().output(mask, true); }
+    inline void outputClear(const uint32_t mask) { MainsSimulator::get().output(mask, false); }
+    inline uint32_t outputLevels() { return MainsSimulator::get().outputLevels(); }
+    inline void pinOutput(const uint8_t pin, const bool high) { MainsSimulator::get().output(1u << pin, high); }
+    inline void crossingInterruptAttach(const uint8_t, const PinIsr isr) { MainsSimulator::get().crossingInterruptAttach(isr, nullptr); }
+    inline void crossingInterruptDetach(const uint8_t) { MainsSimulator::get().crossingInterruptDetach(); }
+    inline void timerAttach(const Isr isr, const uint32_t period_us) { MainsSimulator::get().timerAttach(isr, period_us); }
+    inline void timerArm(const uint32_t delay_us) { MainsSimulator::get().timerArm(delay_us); }
+    inline void timerDetach() { MainsSimulator::get().timerDetach(); }
+    inline void runOnce(const Task task, const char *, const uint32_t, void *arg) { task(arg); }
+    inline void runEvery(void (*func)(), const uint32_t period_ms, const char *, const uint32_t) { MainsSimulator::get().runEvery(func, period_ms); }
+}
+
+// ISRs can't be interrupted by the simulator
+#define timeCriticalEnter()
+#define timeCriticalExit()
+
+#endif // MAINS_SIMULATOR_H_
@@ -58,6 +58,32 @@ class Preferences {
             return strlen(value);
         }
 
+        // Blobs are kept with the strings, like NVS each key only holds one value
+        size_t putBytes(const char *key, const void *value, const size_t len) {
+            if(!opened) {
+                Logger<>::loge(TAG, "Preferences not opened");
+                return 0;
+            }
+            if(_readOnly) {
+                Logger<>::loge(TAG, "Preferences is read-only");
+                return 0;
+            }
+            prefs[_namespaceStr][key].assign((const char *)value, len);
+            return len;
+        }
+
+        size_t getBytesLength(const char *key) {
+            return !isKey(key) ? 0 : prefs[_namespaceStr].at(key).length();
+        }
+
+        size_t getBytes(const char *key, void *buf, const size_t maxLen) {
+            const size_t len = getBytesLength(key);
+            if(len == 0 || len > maxLen)
+                return 0;
+            std::memcpy(buf, prefs[_namespaceStr].at(key).data(), len);
+            return len;
+        }
+
         std::string getString(const char *key, const std::string &defaultRet = "") {
             return !isKey(key) ? defaultRet : prefs[_namespaceStr].at(key);
         }
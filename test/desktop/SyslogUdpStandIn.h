@@ -0,0 +1,105 @@
+#ifndef SYSLOG_UDP_STAND_IN_H_
+#define SYSLOG_UDP_STAND_IN_H_
+
+#if defined(ARDUINO) || defined(ESP32)
+#pragma GCC error "This header should not be included in embedded"
+#endif
+
+#include <SyslogBatcher.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * A syslog server stand-in on a local UDP port, and a SyslogTransport sending to it over a real UDP socket, so
+ *  SyslogBatcher's datagrams can be checked as a server would see them. The transport's `connected` stands for WiFi.
+ */
+class SyslogUdpStandIn {
+    public:
+        SyslogUdpStandIn() {
+            fd = socket(AF_INET, SOCK_DGRAM, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = 0; // any free port
+            bind(fd, (sockaddr *)&address, sizeof(address));
+            socklen_t length = sizeof(address);
+            getsockname(fd, (sockaddr *)&address, &length);
+            port = ntohs(address.sin_port);
+        }
+        ~SyslogUdpStandIn() { close(fd); }
+        SyslogUdpStandIn(const SyslogUdpStandIn &) = delete;
+        SyslogUdpStandIn &operator=(const SyslogUdpStandIn &) = delete;
+
+        [[nodiscard]] uint16_t getPort() const { return port; }
+
+        // Datagrams received so far, waits up to `timeout_ms` for the first one
+        std::vector<std::string> receive(const int timeout_ms = 200) {
+            std::vector<std::string> datagrams;
+            pollfd poll_fd{fd, POLLIN, 0};
+            int wait_ms = timeout_ms;
+            while(poll(&poll_fd, 1, wait_ms) > 0) {
+                char buffer[65536];
+                const ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+                if(length < 0)
+                    break;
+                datagrams.emplace_back(buffer, (std::size_t)length);
+                wait_ms = 20; // the rest were sent together
+            }
+            return datagrams;
+        }
+
+        // Splits an octet counted datagram (RFC 6587) into its messages, empty if it's malformed
+        static std::vector<std::string> messages(const std::string &datagram) {
+            std::vector<std::string> result;
+            std::size_t pos = 0;
+            while(pos < datagram.size()) {
+                const std::size_t space = datagram.find(' ', pos);
+                if(space == std::string::npos)
+                    return {};
+                const std::size_t length = std::stoul(datagram.substr(pos, space - pos));
+                if(space + 1 + length > datagram.size())
+                    return {};
+                result.push_back(datagram.substr(space + 1, length));
+                pos = space + 1 + length;
+            }
+            return result;
+        }
+
+    private:
+        int fd;
+        uint16_t port{0};
+};
+
+class UdpSyslogTransport : public SyslogTransport {
+    public:
+        explicit UdpSyslogTransport(const uint16_t port) {
+            fd = socket(AF_INET, SOCK_DGRAM, 0);
+            server.sin_family = AF_INET;
+            server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            server.sin_port = htons(port);
+        }
+        ~UdpSyslogTransport() override { close(fd); }
+        UdpSyslogTransport(const UdpSyslogTransport &) = delete;
+        UdpSyslogTransport &operator=(const UdpSyslogTransport &) = delete;
+
+        bool connected{true};
+
+        [[nodiscard]] bool isConnected() const override { return connected; }
+        bool send(const char *packet, const std::size_t length) override {
+            return connected && sendto(fd, packet, length, 0, (const sockaddr *)&server, sizeof(server)) == (ssize_t)length;
+        }
+
+    private:
+        int fd;
+        sockaddr_in server{};
+};
+
+#endif // SYSLOG_UDP_STAND_IN_H_
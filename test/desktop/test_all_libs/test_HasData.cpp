@@ -8,8 +8,15 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <thread>
+#include <chrono>
+#include <atomic>
 
 #include <HasData.h>
+#include <NvsBlob.h>
+#include <Preferences.h>
+#include <NvsWriteBehind.h>
+#include <NvsStats.h>
 
 
 class TestHasDataObj : public HasData<> {
@@ -17,15 +24,23 @@ public:
     explicit TestHasDataObj(const char *name) : HasData(name) { }
 
     [[nodiscard]] std::string getNvsNamespace() const override { return "test_has_data"; }
-    [[nodiscard]] std::vector<std::string> getNvsKeys() const override { return {"test_key1"}; }
-    [[nodiscard]] std::vector<std::string> getReadOnlyKeys() const override { return {"test_key2"}; }
-    [[nodiscard]] std::vector<std::string> getKeys() const override { return utils::concat(utils::concat({"test_key3"}, getReadOnlyKeys()), getNvsKeys(), true) ; }
+    bool nvsBlob = false;
+    [[nodiscard]] bool isNvsBlob() const override { return nvsBlob; }
+    inline static const std::vector<std::string> nvsKeys{"test_key1"};
+    inline static const std::vector<std::string> readOnlyKeys{"test_key2"};
+    inline static const std::vector<std::string> keys = utils::concat(utils::concat({"test_key3"}, readOnlyKeys), nvsKeys, true);
+    [[nodiscard]] const std::vector<std::string> &getNvsKeys() const override { return nvsKeys; }
+    [[nodiscard]] const std::vector<std::string> &getReadOnlyKeys() const override { return readOnlyKeys; }
+    [[nodiscard]] const std::vector<std::string> &getKeys() const override { return keys; }
 
     std::string test_key1 = "test_value1";
     std::string test_key2 = "test_value2";
     std::string test_key3 = "test_value3";
 
     mutable bool objUpdated = false;
+    unsigned updateObjCount = 0;
+    std::vector<std::string> lastUpdatedKeys;
+    bool failUpdate = false;
     inline constexpr static const char * TAG{"thasdt"};
     [[nodiscard]] const char * getTag() const override { return TAG; }
 
@@ -50,65 +65,51 @@ public:
                                                 const bool doObjUpdate) override {
         objUpdated = false;
         Logger::logd(TAG, "setWithOptLockAndUpdate %s, value %s", key.c_str(), value.c_str());
-        const auto &keys = getKeys();
-        if(std::find(keys.begin(), keys.end(), key) == keys.end()) {
+        if(!hasKey(key)) {
             Logger::logd(TAG, "Keys: {%s}", utils::join(getKeys(), ", ").c_str());
             Logger::logw(TAG, "Key '%s' is not found", key.c_str());
             return false;
         }
-        const auto &readOnlyKeys = getReadOnlyKeys();
-        if(std::find(readOnlyKeys.begin(), readOnlyKeys.end(), key) != readOnlyKeys.end()) {
+        if(isReadOnlyKey(key)) {
             Logger::logd(TAG, "Read-only keys: {%s}", utils::join(getReadOnlyKeys(), ", ").c_str());
             Logger::logw(TAG, "Key '%s' is read-only", key.c_str());
             return false;
         }
 
-        static std::vector<std::string> keysToUpdateOnObj = {};
         bool updated = false;
 
         if (key == "test_key1") {
             Logger::logd(TAG, "setWithOptLockAndUpdate 'test_key1': '%s'", value.c_str());
             updated = test_key1 != value;
-            if(updated) {
+            if(updated)
                 test_key1 = value;
-                if (doObjUpdate)
-                    keysToUpdateOnObj.push_back(key);
-            }
         }
         if (key == "test_key2") {
             Logger::logd(TAG, "setWithOptLockAndUpdate 'test_key2': '%s'", value.c_str());
             throw std::runtime_error("test exception, test_key2 is read-only");
             updated = test_key2 != value;
-            if(updated) {
+            if(updated)
                 test_key2 = value;
-                if (doObjUpdate)
-                    keysToUpdateOnObj.push_back(key);
-            }
         }
         if (key == "test_key3") {
             Logger::logd(TAG, "setWithOptLockAndUpdate 'test_key3': '%s'", value.c_str());
             updated = test_key3 != value;
-            if(updated) {
+            if(updated)
                 test_key3 = value;
-                if (doObjUpdate)
-                    keysToUpdateOnObj.push_back(key);
-            }
         }
-        if(doObjUpdate && !keysToUpdateOnObj.empty()) {
-            const bool objUpdated = updateObj(keysToUpdateOnObj, noLock);
-            if(objUpdated) {
-                Logger::logv(TAG, "Updated [%s]", utils::join(keysToUpdateOnObj, ", ").c_str());
-                keysToUpdateOnObj.clear();
-            }
-            return objUpdated;
-        }
-        return updated;
+        return queueObjUpdate(updated ? key : std::string(), noLock, doObjUpdate);
+    }
+
+    [[nodiscard]] bool validateValue(const std::string &key, const DataValue &value) const override {
+        return value.toString() != "invalid";
     }
 
     [[nodiscard]] bool updateObj(const std::vector<std::string> &keys, const bool noLock) override {
         objUpdated = true;
+        updateObjCount++;
+        lastUpdatedKeys = keys;
         Logger::logd(TAG, "updateObj, %s [%s]", utils::join(keys, ", ").c_str(), noLock ? "noLock" : "lock");
-        return HasData<>::updateObj(keys, noLock);
+        return !failUpdate && HasData<>::updateObj(keys, noLock);
     }
 
 };
@@ -208,4 +209,290 @@ TEST_F(TestHasData, TestHasDataNVS) {
     utils::printDataDebug(newObj.getInstanceID()+"2", newObj.getData());    
     EXPECT_EQ("test_value1_new_nvs", newObj.get("test_key1"));   
     EXPECT_EQ("test_value3", newObj.get("test_key3"));  
-}
\ No newline at end of file
+}
+TEST_F(TestHasData, TestDataValue) {
+    // GTEST_SKIP();
+    EXPECT_TRUE(DataValue{}.isEmpty());
+    EXPECT_EQ("", DataValue{}.toString());
+    EXPECT_EQ(HasData::EMPTY_VALUE, DataValue{}.toString(HasData::EMPTY_VALUE));
+    EXPECT_FALSE(DataValue{}.asInt().has_value());
+
+    EXPECT_EQ("1883", DataValue{1883u}.toString());
+    EXPECT_EQ("-5", DataValue{-5}.toString());
+    EXPECT_EQ("true", DataValue{true}.toString());
+    EXPECT_EQ("0.5", DataValue{0.5}.toString());
+    EXPECT_EQ("abc", DataValue{"abc"}.toString());
+
+    EXPECT_EQ(1883, DataValue{"1883"}.asInt());
+    EXPECT_EQ(1883, DataValue{"+1883"}.asInt());
+    EXPECT_EQ(-3, DataValue{"-3"}.asInt());
+    EXPECT_FALSE(DataValue{"18a"}.asInt().has_value());
+    EXPECT_FALSE(DataValue{""}.asInt().has_value());
+    EXPECT_EQ(2, DataValue{2.9}.asInt());
+    EXPECT_DOUBLE_EQ(2.5, *DataValue{"2.5"}.asFloat());
+    EXPECT_FALSE(DataValue{"2.5x"}.asFloat().has_value());
+    EXPECT_EQ(true, DataValue{"on"}.asBool());
+    EXPECT_EQ(false, DataValue{0}.asBool());
+    EXPECT_FALSE(DataValue{"maybe"}.asBool().has_value());
+
+    EXPECT_EQ(DataValue{5}, DataValue{(uint16_t)5});
+    EXPECT_NE(DataValue{5}, DataValue{"5"}) << "values of different types should not compare equal";
+
+    // default typed path goes through the string getters/setters
+    EXPECT_EQ("test_value1", getValue("test_key1").toString());
+    EXPECT_TRUE(getValue("unknown").isEmpty());
+    EXPECT_TRUE(setValue("test_key1", "typed_value"));
+    EXPECT_EQ("typed_value", get("test_key1"));
+}
+
+TEST_F(TestHasData, TestHasDataDirtyKeys) {
+    // GTEST_SKIP();
+    const auto keyIndex = [](const std::string &key) {
+        return (size_t)(std::find(keys.begin(), keys.end(), key) - keys.begin());
+    };
+
+    EXPECT_EQ(~(uint64_t)0, takeDirtyKeys()) << "all keys should be dirty before the first take";
+    EXPECT_EQ(0, takeDirtyKeys());
+    const auto version = getDataVersion();
+
+    EXPECT_TRUE(set("test_key3", "test_value3_dirty"));
+    EXPECT_FALSE(set("test_key3", "test_value3_dirty"));
+    EXPECT_FALSE(set("test_key2", "test_value2_dirty")) << "read-only key should not be set";
+    EXPECT_EQ(version + 1, getDataVersion()) << "only changed values should bump the version";
+    auto dirtyKeys = takeDirtyKeys();
+    EXPECT_TRUE(isKeyDirty(dirtyKeys, keyIndex("test_key3")));
+    EXPECT_FALSE(isKeyDirty(dirtyKeys, keyIndex("test_key2")));
+    EXPECT_FALSE(isKeyDirty(dirtyKeys, keyIndex("test_key1")));
+    EXPECT_EQ(0, takeDirtyKeys());
+
+    EXPECT_TRUE(setData({{"test_key1", "test_value1_dirty"},
+                         {"test_key3", "test_value3_dirty2"}}));
+    dirtyKeys = takeDirtyKeys();
+    EXPECT_TRUE(isKeyDirty(dirtyKeys, keyIndex("test_key1")));
+    EXPECT_TRUE(isKeyDirty(dirtyKeys, keyIndex("test_key3")));
+    EXPECT_FALSE(isKeyDirty(dirtyKeys, keyIndex("test_key2")));
+
+    // ex.: failed to publish, merged with what changed since
+    restoreDirtyKeys((uint64_t)1 << keyIndex("test_key1"));
+    EXPECT_TRUE(set("test_key3", "test_value3_dirty3"));
+    EXPECT_EQ(((uint64_t)1 << keyIndex("test_key1")) | ((uint64_t)1 << keyIndex("test_key3")), takeDirtyKeys());
+
+    markDirty("test_key2");
+    markDirty("unknown");
+    EXPECT_EQ((uint64_t)1 << keyIndex("test_key2"), takeDirtyKeys());
+    EXPECT_FALSE(isKeyDirty(0, MAX_DIRTY_KEYS));
+    EXPECT_TRUE(isKeyDirty(~(uint64_t)0, MAX_DIRTY_KEYS)) << "keys past the bitset should be dirty when everything is";
+}
+
+TEST_F(TestHasData, TestHasDataKeyMembership) {
+    // GTEST_SKIP();
+    EXPECT_EQ(&keys, &getKeys()) << "keys should be a view of the static storage, not a copy";
+    EXPECT_TRUE(hasKey("test_key1"));
+    EXPECT_TRUE(hasKey("test_key2"));
+    EXPECT_TRUE(hasKey("test_key3"));
+    EXPECT_FALSE(hasKey("test_key4"));
+    EXPECT_FALSE(hasKey(""));
+
+    EXPECT_TRUE(isReadOnlyKey("test_key2"));
+    EXPECT_FALSE(isReadOnlyKey("test_key1"));
+    EXPECT_FALSE(isReadOnlyKey("test_key4"));
+
+    EXPECT_TRUE(isNvsKey("test_key1"));
+    EXPECT_FALSE(isNvsKey("test_key3"));
+    EXPECT_FALSE(isNvsKey("test_key4"));
+}
+
+TEST_F(TestHasData, TestHasDataSetDataBatch) {
+    // GTEST_SKIP();
+    EXPECT_FALSE(setData({{"test_key1", "test_value1_batch"},
+                          {"test_key3", "invalid"}}));
+    EXPECT_EQ(0, updateObjCount);
+    EXPECT_EQ("test_value1", get("test_key1")) << "nothing should be set when any value in the batch is invalid";
+    EXPECT_EQ("test_value3", get("test_key3"));
+
+    EXPECT_TRUE(setData({{"test_key1", "test_value1_batch"},
+                         {"test_key2", "test_value2_batch"},
+                         {"test_key3", "test_value3_batch"}}));
+    EXPECT_EQ(1, updateObjCount) << "updateObj should run once for the whole batch";
+    EXPECT_EQ(2, lastUpdatedKeys.size());
+    EXPECT_EQ("test_value1_batch", get("test_key1"));
+    EXPECT_EQ("test_value2", get("test_key2")) << "read-only key should be skipped";
+    EXPECT_EQ("test_value3_batch", get("test_key3"));
+    EXPECT_TRUE(setData({{"test_key1", " test_value1_clean\r\n"}}));
+    EXPECT_EQ("test_value1_clean", get("test_key1")) << "the value validated is the one set";
+
+    // keys of a failed update stay pending on this instance only and are retried with the next update
+    TestHasDataObj other{"TestHasDataSetDataBatch2"};
+    failUpdate = true;
+    EXPECT_TRUE(set("test_key3", "test_value3_pending")) << "value was still changed";
+    failUpdate = false;
+    EXPECT_TRUE(other.set("test_key3", "test_value3_other"));
+    EXPECT_EQ(std::vector<std::string>{"test_key3"}, other.lastUpdatedKeys);
+    EXPECT_TRUE(set("test_key1", "test_value1_after_pending"));
+    EXPECT_EQ((std::vector<std::string>{"test_key3", "test_key1"}), lastUpdatedKeys);
+    updateObjCount = 0;
+    EXPECT_FALSE(set("test_key1", "test_value1_after_pending"));
+    EXPECT_EQ(0, updateObjCount) << "nothing pending or changed so no update";
+}
+
+TEST_F(TestHasData, TestNvsBlobPack) {
+    // GTEST_SKIP();
+    const NvsBlob::Entries entries{{"int", -42}, {"float", 1.5}, {"bool", true}, {"string", "value"}, {"empty", DataValue()}};
+    const auto blob = NvsBlob::pack(entries);
+    NvsBlob::Entries unpacked;
+    ASSERT_TRUE(NvsBlob::unpack(blob.data(), blob.size(), unpacked));
+    ASSERT_EQ(4, unpacked.size()) << "empty values aren't stored";
+    for(size_t i = 0; i < unpacked.size(); i++) {
+        EXPECT_EQ(entries[i].first, unpacked[i].first);
+        EXPECT_EQ(entries[i].second, unpacked[i].second) << "types should be kept";
+    }
+
+    for(size_t length = 0; length < blob.size(); length++)
+        EXPECT_FALSE(NvsBlob::unpack(blob.data(), length, unpacked)) << "truncated to " << length;
+    auto corrupt = blob;
+    corrupt[5] ^= 0x01;
+    EXPECT_FALSE(NvsBlob::unpack(corrupt.data(), corrupt.size(), unpacked)) << "CRC should not match";
+    EXPECT_EQ(4, unpacked.size()) << "entries should not be touched on failure";
+}
+
+TEST_F(TestHasData, TestHasDataNvsBlob) {
+    // GTEST_SKIP();
+    EXPECT_TRUE(deleteNvsData());
+    Preferences prefs;
+
+    // saved per key, then migrated to the blob on the first load in blob mode
+    EXPECT_TRUE(set("test_key1", "test_value1_per_key"));
+    prefs.begin(getNvsNamespace().c_str(), true);
+    EXPECT_TRUE(prefs.isKey("test_key1"));
+    EXPECT_FALSE(prefs.isKey(NvsBlob::KEY));
+    prefs.end();
+
+    TestHasDataObj blobObj{"TestHasDataNvsBlob"};
+    blobObj.nvsBlob = true;
+    EXPECT_TRUE(blobObj.loadNvsData());
+    EXPECT_EQ("test_value1_per_key", blobObj.get("test_key1"));
+    prefs.begin(getNvsNamespace().c_str(), true);
+    EXPECT_FALSE(prefs.isKey("test_key1")) << "per-key data should be removed after migrating";
+    EXPECT_TRUE(prefs.isKey(NvsBlob::KEY));
+    prefs.end();
+
+    EXPECT_TRUE(blobObj.set("test_key1", "test_value1_blob"));
+    EXPECT_TRUE(blobObj.set("test_key3", "test_value3_blob"));
+    TestHasDataObj newBlobObj{"TestHasDataNvsBlob2"};
+    newBlobObj.nvsBlob = true;
+    EXPECT_TRUE(newBlobObj.loadNvsData());
+    EXPECT_EQ("test_value1_blob", newBlobObj.get("test_key1"));
+    EXPECT_EQ("test_value3", newBlobObj.get("test_key3")) << "test_key3 should be unchanged since not NVS";
+    EXPECT_TRUE(blobObj.saveNvsData(getNvsKeys(), false)) << "saving an unchanged blob should succeed";
+
+    // corrupt blob without per-key data to fall back to
+    prefs.begin(getNvsNamespace().c_str(), false);
+    std::vector<uint8_t> blob(prefs.getBytesLength(NvsBlob::KEY));
+    ASSERT_EQ(blob.size(), prefs.getBytes(NvsBlob::KEY, blob.data(), blob.size()));
+    blob[blob.size() / 2] ^= 0xFF;
+    EXPECT_EQ(blob.size(), prefs.putBytes(NvsBlob::KEY, blob.data(), blob.size()));
+    prefs.end();
+    TestHasDataObj corruptObj{"TestHasDataNvsBlob3"};
+    corruptObj.nvsBlob = true;
+    EXPECT_FALSE(corruptObj.loadNvsData());
+    EXPECT_EQ("test_value1", corruptObj.get("test_key1"));
+
+    EXPECT_TRUE(deleteNvsData());
+}
+
+TEST_F(TestHasData, TestHasDataNvsWriteBehind) {
+    // GTEST_SKIP();
+    auto &writeBehind = NvsWriteBehind::instance();
+    const auto savedNvsValue = [this]() {
+        Preferences prefs;
+        prefs.begin(getNvsNamespace().c_str(), true);
+        const auto value = prefs.getString("test_key1");
+        prefs.end();
+        return value;
+    };
+    const auto waitForSaves = [&writeBehind](const unsigned long count) {
+        for(int i = 0; i < 200 && writeBehind.getSaveCount() < count; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return writeBehind.getSaveCount();
+    };
+    EXPECT_TRUE(deleteNvsData());
+    writeBehind.setWindow(std::chrono::milliseconds(200));
+
+    // a burst of sets is coalesced into one save after the window
+    const auto saves = writeBehind.getSaveCount();
+    for(int i = 0; i < 50; i++)
+        EXPECT_TRUE(set("test_key1", "test_value1_burst" + std::to_string(i)));
+    EXPECT_TRUE(set("test_key3", "test_value3_burst"));
+    EXPECT_EQ(saves, writeBehind.getSaveCount()) << "nothing should be saved before the window ends";
+    EXPECT_EQ("", savedNvsValue());
+    EXPECT_EQ(saves + 1, waitForSaves(saves + 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_EQ(saves + 1, writeBehind.getSaveCount()) << "burst should be saved once";
+    EXPECT_EQ("test_value1_burst49", savedNvsValue());
+
+    // flush saves right away
+    EXPECT_TRUE(set("test_key1", "test_value1_flushed"));
+    EXPECT_TRUE(writeBehind.flush());
+    EXPECT_EQ(saves + 2, writeBehind.getSaveCount());
+    EXPECT_EQ("test_value1_flushed", savedNvsValue());
+    EXPECT_TRUE(writeBehind.flush()) << "nothing left to flush";
+    EXPECT_EQ(saves + 2, writeBehind.getSaveCount());
+
+    // destroyed objects drop their pending save
+    {
+        TestHasDataObj destroyedObj{"TestHasDataNvsWriteBehind2"};
+        EXPECT_TRUE(destroyedObj.set("test_key1", "test_value1_destroyed"));
+    }
+    EXPECT_TRUE(writeBehind.flush());
+    EXPECT_EQ(saves + 2, writeBehind.getSaveCount());
+    EXPECT_EQ("test_value1_flushed", savedNvsValue());
+
+    writeBehind.setWindow(std::chrono::milliseconds(0));
+    EXPECT_TRUE(deleteNvsData());
+}
+
+TEST_F(TestHasData, TestHasDataNvsWriteBehindRetryDelay) {
+    // GTEST_SKIP();
+    auto &writeBehind = NvsWriteBehind::instance();
+    std::atomic<int> attempts{0};
+    const int owner{0};
+    writeBehind.setWindow(std::chrono::milliseconds(0));
+    writeBehind.schedule(&owner, {"test_key1"}, [&attempts](const std::vector<std::string> &) {
+        attempts++;
+        return false;
+    });
+    for(int i = 0; i < 100 && attempts == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(NVS_WRITE_BEHIND_RETRY_MS / 2));
+    EXPECT_EQ(1, attempts) << "a failed save shouldn't be retried right away without a window";
+    writeBehind.cancel(&owner);
+}
+
+TEST_F(TestHasData, TestHasDataNvsMetrics) {
+    // GTEST_SKIP();
+    EXPECT_TRUE(deleteNvsData());
+    NvsMetrics::reset();
+    NvsStats stats{"nvs_stats", getNvsNamespace()};
+    NvsStats totalStats{"nvs_stats_total"};
+
+    EXPECT_TRUE(set("test_key1", "test_value1_metrics"));
+    EXPECT_EQ(1, stats.getValue(NvsStats::OPENS).asInt());
+    EXPECT_EQ(1, stats.getValue(NvsStats::WRITES).asInt());
+    EXPECT_EQ(std::string("test_value1_metrics").length(), stats.getValue(NvsStats::BYTES_WRITTEN).asInt());
+    EXPECT_EQ(0, stats.getValue(NvsStats::SKIPPED_WRITES).asInt());
+
+    EXPECT_TRUE(saveNvsData(getNvsKeys(), false));
+    EXPECT_EQ(1, stats.getValue(NvsStats::WRITES).asInt()) << "unchanged value should not be written again";
+    EXPECT_EQ(1, stats.getValue(NvsStats::SKIPPED_WRITES).asInt());
+
+    EXPECT_TRUE(loadNvsData());
+    EXPECT_EQ(3, stats.getValue(NvsStats::OPENS).asInt());
+    EXPECT_EQ(3, stats.getValue(NvsStats::READS).asInt()) << "two reads to compare when saving and one to load";
+    EXPECT_EQ("3", stats.get(NvsStats::READS));
+    EXPECT_FALSE(stats.set(NvsStats::READS, "0"));
+
+    EXPECT_TRUE(deleteNvsData());
+    EXPECT_EQ(1, stats.getValue(NvsStats::REMOVES).asInt());
+    EXPECT_EQ(4, totalStats.getValue(NvsStats::OPENS).asInt());
+    EXPECT_EQ(0, NvsStats("nvs_stats_other", "other_ns").getValue(NvsStats::OPENS).asInt());
+}
@@ -0,0 +1,334 @@
+
+#include <gtest/gtest.h>
+
+#include "../DesktopLoggerFixture.h"
+#define ALLOCATION_COUNTER_IMPL
+#include "../AllocationCounter.h"
+
+#include <utils.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <shared_mutex>
+
+#include <HasData.h>
+
+
+class TestHasDataBenchObj : public HasData<> {
+public:
+    explicit TestHasDataBenchObj(const char *name) : HasData(name) { }
+
+    inline constexpr static const char * TAG{"thdbch"};
+    [[nodiscard]] const char * getTag() const override { return TAG; }
+
+    inline static const std::vector<std::string> keys{"server", "port", "user", "password", "timezone", "brightness"};
+    [[nodiscard]] const std::vector<std::string> &getKeys() const override { return keys; }
+
+    std::string server = "10.0.0.2";
+    unsigned port = 1883;
+    std::string user = "mosquitto";
+    std::string password = "password";
+    std::string timezone = "America/Denver";
+    unsigned brightness = 100;
+
+    [[nodiscard]] std::string getWithOptLock(const std::string &key, const bool noLock) const override {
+        static constexpr auto getters = makeDataKeyTable<DataGetter<TestHasDataBenchObj>>({
+            {"server",     [](const TestHasDataBenchObj *t) -> std::string { return t->server; }},
+            {"port",       [](const TestHasDataBenchObj *t) -> std::string { return std::to_string(t->port); }},
+            {"user",       [](const TestHasDataBenchObj *t) -> std::string { return t->user; }},
+            {"password",   [](const TestHasDataBenchObj *t) -> std::string { return t->password; }},
+            {"timezone",   [](const TestHasDataBenchObj *t) -> std::string { return t->timezone; }},
+            {"brightness", [](const TestHasDataBenchObj *t) -> std::string { return std::to_string(t->brightness); }}
+        });
+        return getDataKeyHelper(getters, this, key, noLock);
+    }
+
+    // Native values, formatted only when read through get()
+    [[nodiscard]] DataValue getValueWithOptLock(const std::string &key, const bool noLock) const override {
+        static constexpr auto getters = makeDataKeyTable<ValueGetter<TestHasDataBenchObj>>({
+            {"server",     [](const TestHasDataBenchObj *t) -> DataValue { return t->server; }},
+            {"port",       [](const TestHasDataBenchObj *t) -> DataValue { return t->port; }},
+            {"user",       [](const TestHasDataBenchObj *t) -> DataValue { return t->user; }},
+            {"password",   [](const TestHasDataBenchObj *t) -> DataValue { return t->password; }},
+            {"timezone",   [](const TestHasDataBenchObj *t) -> DataValue { return t->timezone; }},
+            {"brightness", [](const TestHasDataBenchObj *t) -> DataValue { return t->brightness; }}
+        });
+        return getDataKeyHelper(getters, this, key, noLock);
+    }
+
+    [[nodiscard]] bool setValueWithOptLockAndUpdate(const std::string &key, const DataValue &value, const bool noLock,
+                                                    const bool doObjUpdate) override {
+        static constexpr auto setters = makeDataKeyTable<ValueSetter<TestHasDataBenchObj>>({
+            {"server",     [](TestHasDataBenchObj *t, const DataValue &value) { return setIfChanged(t->server, value.toString()); }},
+            {"user",       [](TestHasDataBenchObj *t, const DataValue &value) { return setIfChanged(t->user, value.toString()); }},
+            {"password",   [](TestHasDataBenchObj *t, const DataValue &value) { return setIfChanged(t->password, value.toString()); }},
+            {"timezone",   [](TestHasDataBenchObj *t, const DataValue &value) { return setIfChanged(t->timezone, value.toString()); }},
+            {"port",       [](TestHasDataBenchObj *t, const DataValue &value) {
+                const auto port = value.asInt();
+                return port && *port >= 0 && setIfChanged(t->port, (unsigned)*port); }},
+            {"brightness", [](TestHasDataBenchObj *t, const DataValue &value) {
+                const auto brightness = value.asInt();
+                return brightness && *brightness >= 0 && setIfChanged(t->brightness, (unsigned)*brightness); }}
+        });
+        return setDataKeyHelper(setters, this, key, value, noLock) != nullptr;
+    }
+
+    // Per-call map construction that the key tables replaced, kept here as the benchmark baseline
+    [[nodiscard]] std::string getWithLegacyMap(const std::string &key) const {
+        using FunPtrType = std::string(*)(const TestHasDataBenchObj*);
+        const std::map<const std::string, FunPtrType> keyVarPairs{
+            {"server",     [](const TestHasDataBenchObj *t) -> std::string { return t->server; }},
+            {"port",       [](const TestHasDataBenchObj *t) -> std::string { return std::to_string(t->port); }},
+            {"user",       [](const TestHasDataBenchObj *t) -> std::string { return t->user; }},
+            {"password",   [](const TestHasDataBenchObj *t) -> std::string { return t->password; }},
+            {"timezone",   [](const TestHasDataBenchObj *t) -> std::string { return t->timezone; }},
+            {"brightness", [](const TestHasDataBenchObj *t) -> std::string { return std::to_string(t->brightness); }}
+        };
+        if(keyVarPairs.find(key) == keyVarPairs.end())
+            return HasData::EMPTY_VALUE;
+        std::scoped_lock l{_dataMutex};
+        return keyVarPairs.at(key)(this);
+    }
+
+    [[nodiscard]] bool setWithOptLockAndUpdate(const std::string &key, const std::string &value, const bool noLock,
+                                               const bool doObjUpdate) override {
+        static constexpr auto setters = makeDataKeyTable<DataSetter<TestHasDataBenchObj>>({
+            {"server",     [](TestHasDataBenchObj *t, const std::string &value) { return setIfChanged(t->server, value); }},
+            {"user",       [](TestHasDataBenchObj *t, const std::string &value) { return setIfChanged(t->user, value); }},
+            {"password",   [](TestHasDataBenchObj *t, const std::string &value) { return setIfChanged(t->password, value); }},
+            {"timezone",   [](TestHasDataBenchObj *t, const std::string &value) { return setIfChanged(t->timezone, value); }},
+            {"port",       [](TestHasDataBenchObj *t, const std::string &value) {
+                return utils::isPositiveNumber(value) && setIfChanged(t->port, (unsigned)std::stoul(value)); }},
+            {"brightness", [](TestHasDataBenchObj *t, const std::string &value) {
+                return utils::isPositiveNumber(value) && setIfChanged(t->brightness, (unsigned)std::stoul(value)); }}
+        });
+        return setDataKeyHelper(setters, this, key, value, noLock) != nullptr;
+    }
+};
+
+
+class TestHasDataBenchmark : public DesktopLoggerFixture,
+                             public TestHasDataBenchObj {
+public:
+    inline static constexpr unsigned ITERATIONS{100000};
+
+    explicit TestHasDataBenchmark() : DesktopLoggerFixture(),
+                                      TestHasDataBenchObj(::testing::UnitTest::GetInstance()->current_test_info()->name()) {
+        // keep verbose logging of the HasData helpers out of the measurements
+        Logger::setTagLevel(TestHasDataBenchObj::TAG, LOG_LEVEL_INFO);
+    }
+
+    inline static constexpr unsigned READER_THREADS{3};
+    inline static constexpr std::chrono::milliseconds CONTENTION_DURATION{200};
+
+    struct ContentionResult {
+        unsigned long long reads{0};
+        unsigned long long writes{0};
+    };
+
+    // Runs `read` on READER_THREADS threads and `write` on one thread for CONTENTION_DURATION, counting calls
+    template<class R, class W>
+    static ContentionResult contention(R &&read, W &&write) {
+        std::atomic<bool> stop{false};
+        std::atomic<unsigned long long> reads{0};
+        unsigned long long writes{0};
+        std::vector<std::thread> readers;
+        for(unsigned t = 0; t < READER_THREADS; t++) {
+            readers.emplace_back([&]() {
+                unsigned long long count = 0;
+                while(!stop.load(std::memory_order_relaxed)) {
+                    read();
+                    count++;
+                }
+                reads += count;
+            });
+        }
+        std::thread writer([&]() {
+            for(unsigned i = 0; !stop.load(std::memory_order_relaxed); i++) {
+                write(i);
+                writes++;
+            }
+        });
+        std::this_thread::sleep_for(CONTENTION_DURATION);
+        stop = true;
+        for(auto &reader : readers)
+            reader.join();
+        writer.join();
+        return {reads.load(), writes};
+    }
+
+    template<class F>
+    static double nsPerCall(F &&f) {
+        const auto start = std::chrono::steady_clock::now();
+        for(unsigned i = 0; i < ITERATIONS; i++)
+            f();
+        const auto end = std::chrono::steady_clock::now();
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / ITERATIONS;
+    }
+};
+
+static constexpr const char * TAG{"thdbch"};
+
+TEST_F(TestHasDataBenchmark, KeyTableLookup) {
+    // GTEST_SKIP();
+    static constexpr auto table = makeDataKeyTable<int>({{"b", 2}, {"a", 1}, {"c", 3}});
+    static_assert(table.size() == 3);
+    static_assert(table.find("a") != nullptr && table.find("a")->func == 1);
+    static_assert(table.find("c") != nullptr && table.find("c")->func == 3);
+    static_assert(table.find("d") == nullptr);
+
+    for(const auto &key : keys)
+        EXPECT_EQ(getWithLegacyMap(key), get(key)) << key;
+    EXPECT_EQ(EMPTY_VALUE, get("unknown"));
+
+    EXPECT_TRUE(set("port", "1900"));
+    EXPECT_FALSE(set("port", "1900")) << "unchanged value should not be reported as set";
+    EXPECT_FALSE(set("port", "-1"));
+    EXPECT_EQ("1900", get("port"));
+}
+
+TEST_F(TestHasDataBenchmark, KeyMembership) {
+    // GTEST_SKIP();
+    EXPECT_TRUE(hasKey("server")); // index is built on first use
+    std::size_t lookupAllocs;
+    {
+        const alloc_counter::Scope allocs;
+        for(const auto &key : getKeys()) {
+            EXPECT_TRUE(hasKey(key));
+            EXPECT_FALSE(isReadOnlyKey(key));
+        }
+        EXPECT_FALSE(hasKey("unknown"));
+        lookupAllocs = allocs.count();
+    }
+    EXPECT_EQ(0, lookupAllocs) << "key views and membership lookups should not allocate";
+
+    const double indexNs = nsPerCall([this]() { [[maybe_unused]] const bool found = hasKey("brightness"); });
+    const double findNs = nsPerCall([]() {
+        const std::vector<std::string> keysCopy = keys; // what the by-value getKeys() cost per lookup
+        [[maybe_unused]] const bool found = std::find(keysCopy.begin(), keysCopy.end(), "brightness") != keysCopy.end();
+    });
+    DesktopLogger::logi(TAG, "key membership: index %.1fns, vector copy + find %.1fns", indexNs, findNs);
+}
+
+TEST_F(TestHasDataBenchmark, GetAllocations) {
+    // GTEST_SKIP();
+    std::size_t tableAllocs;
+    {
+        const alloc_counter::Scope allocs;
+        for(const auto &key : keys)
+            [[maybe_unused]] const auto value = get(key);
+        tableAllocs = allocs.count();
+    }
+    std::size_t legacyAllocs;
+    {
+        const alloc_counter::Scope allocs;
+        for(const auto &key : keys)
+            [[maybe_unused]] const auto value = getWithLegacyMap(key);
+        legacyAllocs = allocs.count();
+    }
+    std::size_t getDataAllocs;
+    {
+        const alloc_counter::Scope allocs;
+        [[maybe_unused]] const auto data = getData();
+        getDataAllocs = allocs.count();
+    }
+    DesktopLogger::logi(TAG, "allocations for %zu gets: key table %zu, per-call std::map %zu",
+                        keys.size(), tableAllocs, legacyAllocs);
+    DesktopLogger::logi(TAG, "allocations per getData(): %zu (%zu keys)", getDataAllocs, keys.size());
+
+    EXPECT_EQ(0, tableAllocs) << "key table lookups should not allocate";
+    EXPECT_GT(legacyAllocs, 0);
+    // only the result map nodes remain
+    EXPECT_LE(getDataAllocs, keys.size());
+
+    const double tableNs = nsPerCall([this]() { [[maybe_unused]] const auto value = get("brightness"); });
+    const double legacyNs = nsPerCall([this]() { [[maybe_unused]] const auto value = getWithLegacyMap("brightness"); });
+    DesktopLogger::logi(TAG, "get(): key table %.1fns, per-call std::map %.1fns", tableNs, legacyNs);
+}
+
+TEST_F(TestHasDataBenchmark, TypedRoundTrip) {
+    // GTEST_SKIP();
+    EXPECT_EQ(DataValue{100u}, getValue("brightness"));
+    EXPECT_TRUE(setValue("brightness", 50));
+    EXPECT_EQ("50", get("brightness"));
+    EXPECT_TRUE(setValue("brightness", "60")) << "string values should be parsed by the typed setters";
+    EXPECT_EQ(60, getValue("brightness").asInt());
+    EXPECT_FALSE(setValue("brightness", -1));
+    EXPECT_FALSE(setValue("brightness", "abc"));
+
+    std::size_t stringAllocs;
+    {
+        const alloc_counter::Scope allocs;
+        for(unsigned i = 0; i < 100; i++) {
+            [[maybe_unused]] const bool updated = set("brightness", std::to_string(i % 2));
+            [[maybe_unused]] const auto brightness = std::stoul(get("brightness"));
+        }
+        stringAllocs = allocs.count();
+    }
+    std::size_t typedAllocs;
+    {
+        const alloc_counter::Scope allocs;
+        for(unsigned i = 0; i < 100; i++) {
+            [[maybe_unused]] const bool updated = setValue("brightness", i % 2);
+            [[maybe_unused]] const auto brightness = getValue("brightness").asInt();
+        }
+        typedAllocs = allocs.count();
+    }
+    DesktopLogger::logi(TAG, "allocations for 100 set/get round trips: string %zu, typed %zu", stringAllocs, typedAllocs);
+    EXPECT_EQ(0, typedAllocs) << "numeric values should not be formatted or parsed";
+
+    unsigned i = 0;
+    const double stringNs = nsPerCall([this, &i]() {
+        [[maybe_unused]] const bool updated = set("brightness", std::to_string(i++ % 256));
+        [[maybe_unused]] const auto brightness = std::stoul(get("brightness"));
+    });
+    const double typedNs = nsPerCall([this, &i]() {
+        [[maybe_unused]] const bool updated = setValue("brightness", i++ % 256);
+        [[maybe_unused]] const auto brightness = getValue("brightness").asInt();
+    });
+    DesktopLogger::logi(TAG, "set()+get() round trip: string %.1fns, typed %.1fns", stringNs, typedNs);
+}
+
+TEST_F(TestHasDataBenchmark, ReadContention) {
+    // GTEST_SKIP();
+    const auto hasData = contention([this]() { [[maybe_unused]] const auto brightness = getValue("brightness").asInt(); },
+                                    [this](const unsigned i) { [[maybe_unused]] const bool updated = setValue("brightness", i % 256); });
+    DesktopLogger::logi(TAG, "HasData get()/set() (%s): %llu reads, %llu writes in %lldms",
+                        HAS_DATA_SHARED_MUTEX ? "shared mutex" : "mutex", hasData.reads, hasData.writes,
+                        (long long)CONTENTION_DURATION.count());
+    EXPECT_GT(hasData.reads, 0);
+    EXPECT_GT(hasData.writes, 0);
+
+    // The same contention on a small POD snapshot, writers always write matching fields so torn reads can be detected
+    struct Snapshot {
+        uint32_t brightness;
+        uint32_t resolution;
+        uint32_t check;
+    };
+    std::atomic<unsigned> torn{0};
+    const auto checkSnapshot = [&torn](const Snapshot &snapshot) {
+        if(snapshot.brightness != snapshot.resolution || snapshot.brightness != snapshot.check)
+            torn++;
+    };
+
+    Snapshot mutexSnapshot{};
+    std::mutex mutex;
+    const auto mutexResult = contention([&]() { std::scoped_lock l{mutex}; checkSnapshot(mutexSnapshot); },
+                                        [&](const unsigned i) { std::scoped_lock l{mutex}; mutexSnapshot = {i, i, i}; });
+
+    Snapshot sharedSnapshot{};
+    std::shared_mutex sharedMutex;
+    const auto sharedResult = contention([&]() { std::shared_lock l{sharedMutex}; checkSnapshot(sharedSnapshot); },
+                                         [&](const unsigned i) { std::scoped_lock l{sharedMutex}; sharedSnapshot = {i, i, i}; });
+
+    DesktopLogger::logi(TAG, "POD snapshot reads/writes: mutex %llu/%llu, shared mutex %llu/%llu",
+                        mutexResult.reads, mutexResult.writes, sharedResult.reads, sharedResult.writes);
+    EXPECT_EQ(0, torn.load()) << "snapshots should always be consistent";
+    EXPECT_GT(sharedResult.reads, 0);
+    EXPECT_GT(sharedResult.writes, 0);
+}
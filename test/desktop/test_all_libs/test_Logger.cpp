@@ -0,0 +1,298 @@
+#include <gtest/gtest.h>
+
+#include "../DesktopLoggerFixture.h"
+
+#include <Logger.h>
+#include <LogDeferred.h>
+#include <LogLine.h>
+#include <LogRing.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+inline static constexpr const char * TAG{"tlog"};
+
+// Keeps what it's sent while `capturing`, it stays added to Logger<> so later tests leave it off
+class CaptureLogger : public Logger<> {
+    public:
+        inline static std::atomic<bool> capturing{false};
+        inline static std::mutex mutex{};
+        inline static std::vector<std::string> messages{};
+        inline static std::vector<std::thread::id> threads{};
+        inline static std::atomic<bool> takesDeferred{false};
+        inline static std::vector<std::string> deferredRecords{};
+
+        static std::shared_ptr<CaptureLogger> &get() {
+            static auto logger = []() {
+                auto captureLogger = std::make_shared<CaptureLogger>();
+                Logger<>::addLogger(captureLogger);
+                return captureLogger;
+            }();
+            return logger;
+        }
+
+    private:
+        void capture(const char *msg) const {
+            if(!capturing)
+                return;
+            std::scoped_lock l(mutex);
+            messages.emplace_back(msg);
+            threads.push_back(std::this_thread::get_id());
+        }
+        void v_logv(const char *msg) const override { capture(msg); }
+        void v_logd(const char *msg) const override { capture(msg); }
+        void v_logi(const char *msg) const override { capture(msg); }
+        void v_logw(const char *msg) const override { capture(msg); }
+        void v_loge(const char *msg) const override { capture(msg); }
+        bool v_logDeferred(const uint8_t, const char *record, const std::size_t length) const override {
+            if(!capturing || !takesDeferred)
+                return false;
+            std::scoped_lock l(mutex);
+            deferredRecords.emplace_back(record, length);
+            return true;
+        }
+};
+
+class TestLogger : public DesktopLoggerFixture {
+    public:
+        TestLogger() {
+            CaptureLogger::get();
+            std::scoped_lock l(CaptureLogger::mutex);
+            CaptureLogger::messages.clear();
+            CaptureLogger::threads.clear();
+            CaptureLogger::deferredRecords.clear();
+        }
+        ~TestLogger() override {
+            CaptureLogger::capturing = false;
+            CaptureLogger::takesDeferred = false;
+        }
+
+        // Encodes like a deferred log call and renders the record back
+        template<typename... Args>
+        static std::string deferred(const char *msg, const Args &... args) {
+            char record[LOG_DEFERRED_RECORD_SIZE - 1];
+            const std::size_t length = log_deferred::encode(record, sizeof(record), msg, TAG, 0, args...);
+            char text[LOG_FORMAT_BUFFER_SIZE];
+            log_deferred::render(record, length, LOG_TAG_MAX_LEN, text, sizeof(text));
+            return text;
+        }
+
+        template<typename... Args>
+        static std::string formatted(const char *msg, const Args &... args) {
+            return LogLine<LOG_FORMAT_BUFFER_SIZE, LOG_FORMAT_MAX_SIZE>(LOG_TAG_MAX_LEN, TAG, msg, args...).c_str();
+        }
+};
+
+TEST_F(TestLogger, RingKeepsOrderAndCountsDrops) {
+    LogRing<4, 16> ring;
+    LogRing<4, 16>::Record record{};
+    EXPECT_FALSE(ring.pop(record));
+    for(int i = 0; i < 6; i++)
+        EXPECT_EQ(ring.push(LOG_LEVEL_INFO, std::to_string(i).c_str()), i < 4);
+    EXPECT_EQ(ring.droppedCount(), 2u);
+    for(int i = 0; i < 4; i++) {
+        ASSERT_TRUE(ring.pop(record));
+        EXPECT_STREQ(record.text, std::to_string(i).c_str());
+    }
+    EXPECT_FALSE(ring.pop(record));
+
+    EXPECT_TRUE(ring.push(LOG_LEVEL_WARN, "a message longer than a record"));
+    ASSERT_TRUE(ring.pop(record));
+    EXPECT_EQ(record.level, LOG_LEVEL_WARN);
+    EXPECT_EQ(record.length, 15);
+    EXPECT_STREQ(record.text, "a message longe");
+    EXPECT_EQ(ring.truncatedCount(), 1u);
+    EXPECT_EQ(ring.pushedCount(), 5u);
+}
+
+TEST_F(TestLogger, RingManyWritersOneReader) {
+    static constexpr int WRITERS{4};
+    static constexpr int PER_WRITER{20000};
+    LogRing<64, 32> ring;
+    std::atomic<bool> done{false};
+    std::vector<int> next(WRITERS, 0);
+    unsigned long popped = 0;
+    bool ordered = true;
+    std::thread reader([&]() {
+        LogRing<64, 32>::Record record{};
+        while(true) {
+            const bool finished = done.load();
+            while(ring.pop(record)) {
+                int writer, count;
+                std::sscanf(record.text, "%d %d", &writer, &count);
+                if(writer < 0 || writer >= WRITERS || count < next[writer]) {
+                    ordered = false;
+                    continue;
+                }
+                next[writer] = count + 1;
+                popped++;
+            }
+            if(finished)
+                break;
+        }
+    });
+    std::vector<std::thread> writers;
+    for(int w = 0; w < WRITERS; w++) {
+        writers.emplace_back([&ring, w]() {
+            char text[32];
+            for(int i = 0; i < PER_WRITER; i++) {
+                std::snprintf(text, sizeof(text), "%d %d", w, i);
+                ring.push(LOG_LEVEL_INFO, text);
+            }
+        });
+    }
+    for(auto &writer : writers)
+        writer.join();
+    done = true;
+    reader.join();
+
+    EXPECT_TRUE(ordered); // each writer's records in order, drops skip some
+    EXPECT_EQ(popped + ring.droppedCount(), (unsigned long)WRITERS * PER_WRITER);
+    EXPECT_EQ(popped, ring.pushedCount());
+    DesktopLogger::logi(TAG, "%lu records passed through, %lu dropped", popped, ring.droppedCount());
+}
+
+TEST_F(TestLogger, DeferredRecordRendersLikeFormatting) {
+    enum class Mode : uint8_t { OFF = 7 };
+    const std::string value{"value"};
+    EXPECT_EQ(deferred("no arguments, 100%%"), formatted("no arguments, 100%%"));
+    EXPECT_EQ(deferred("%d|%5u|%-4x|%X|%o|%c", -12, 34u, 255, -1, 8, 'z'), formatted("%d|%5u|%-4x|%X|%o|%c", -12, 34u, 255, -1, 8, 'z'));
+    EXPECT_EQ(deferred("%ld %lu %lld %zu", -5L, 6UL, -7LL, (std::size_t)8), formatted("%ld %lu %lld %zu", -5L, 6UL, -7LL, (std::size_t)8));
+    EXPECT_EQ(deferred("%.2f %8.3e %g", 1.5, -2.25f, 1e10), formatted("%.2f %8.3e %g", 1.5, -2.25f, 1e10));
+    EXPECT_EQ(deferred("[%s] %-7s|%.3s", value.c_str(), "abc", "truncated"), formatted("[%s] %-7s|%.3s", value.c_str(), "abc", "truncated"));
+    EXPECT_EQ(deferred("%*d|%-*d", 4, 1, 3, 2), formatted("%*d|%-*d", 4, 1, 3, 2));
+    EXPECT_EQ(deferred("%c|%-3c|%3c", 'a', 'b', 'c'), formatted("%c|%-3c|%3c", 'a', 'b', 'c'));
+    EXPECT_EQ(deferred("%p %d %hhu", (void *)&value, Mode::OFF, (uint8_t)200), formatted("%p %d %hhu", (void *)&value, Mode::OFF, (uint8_t)200));
+
+    EXPECT_EQ(deferred("%d and %d", 1), "[tlog ] 1 and <?>");
+    EXPECT_EQ(deferred("%s", 1), "[tlog ] <?>");
+    const std::string longValue(LOG_DEFERRED_RECORD_SIZE, 'v');
+    const std::string cut = deferred("%s|%d", longValue.c_str(), 1);
+    EXPECT_EQ(cut.rfind("[tlog ] vvv", 0), 0u);
+    EXPECT_EQ(cut.substr(cut.size() - 4), "|<?>") << "no room left for the number";
+}
+
+TEST_F(TestLogger, DeferredRecordFrames) {
+    char frame[16];
+    EXPECT_EQ(log_deferred::frame(LOG_LEVEL_INFO, "ab", 2, frame, sizeof(frame)), 8u);
+    EXPECT_STREQ(frame, "#LB A2Fi");
+    EXPECT_EQ(log_deferred::frame(LOG_LEVEL_INFO, "a", 1, frame, sizeof(frame)), 8u);
+    EXPECT_STREQ(frame, "#LB A2E=");
+    EXPECT_EQ(log_deferred::frame(LOG_LEVEL_ERROR, "abc", 3, frame, sizeof(frame)), 12u);
+    EXPECT_STREQ(frame, "#LB AWFiYw==");
+    EXPECT_EQ(log_deferred::frame(LOG_LEVEL_ERROR, "abcdefghi", 9, frame, sizeof(frame)), 0u) << "doesn't fit";
+
+    char record[LOG_DEFERRED_RECORD_SIZE - 1];
+    EXPECT_EQ(log_deferred::encode(record, sizeof(record), "%d", TAG, 1234, 1), log_deferred::HEADER_SIZE + 5);
+    EXPECT_EQ(log_deferred::timeOf(record), 1234u);
+    EXPECT_EQ(log_deferred::encode(record, log_deferred::HEADER_SIZE - 1, "%d", TAG, 1234, 1), 0u);
+}
+
+#ifdef ENABLE_LOGGING
+TEST_F(TestLogger, AsyncLogsFromDrainTask) {
+    Logger<>::startAsync();
+    CaptureLogger::capturing = true;
+    const unsigned long droppedBefore = Logger<>::getDroppedCount();
+    static constexpr int THREADS{3};
+    static constexpr int PER_THREAD{8}; // fits the buffer with room for other tests' logs
+    std::vector<std::thread> threads;
+    for(int t = 0; t < THREADS; t++) {
+        threads.emplace_back([t]() {
+            for(int i = 0; i < PER_THREAD; i++)
+                Logger<>::logi(TAG, "thread %d message %d", t, i);
+        });
+    }
+    for(auto &thread : threads)
+        thread.join();
+    ASSERT_TRUE(Logger<>::flush());
+    CaptureLogger::capturing = false;
+
+    std::scoped_lock l(CaptureLogger::mutex);
+    std::vector<int> next(THREADS, 0);
+    unsigned long count = 0;
+    for(std::size_t i = 0; i < CaptureLogger::messages.size(); i++) {
+        int t, m;
+        if(std::sscanf(CaptureLogger::messages[i].c_str(), "[tlog ] thread %d message %d", &t, &m) != 2)
+            continue;
+        EXPECT_EQ(m, next[t]++) << "out of order for thread " << t;
+        EXPECT_NE(CaptureLogger::threads[i], std::this_thread::get_id());
+        count++;
+    }
+    // other threads may log meanwhile, their drops count too
+    EXPECT_LE(count, (unsigned long)THREADS * PER_THREAD);
+    EXPECT_GE(count + Logger<>::getDroppedCount() - droppedBefore, (unsigned long)THREADS * PER_THREAD);
+}
+
+TEST_F(TestLogger, AsyncReportsDrops) {
+    Logger<>::startAsync();
+    CaptureLogger::capturing = true;
+    const unsigned long droppedBefore = Logger<>::getDroppedCount();
+    for(int i = 0; i < LOG_ASYNC_RECORDS * 4; i++)
+        Logger<>::logw(TAG, "burst %d", i);
+    ASSERT_TRUE(Logger<>::flush());
+    std::this_thread::sleep_for(std::chrono::milliseconds(LOG_ASYNC_IDLE_MS * 3)); // for the drop report
+    CaptureLogger::capturing = false;
+
+    if(Logger<>::getDroppedCount() == droppedBefore)
+        GTEST_SKIP() << "the drain task kept up with the burst";
+    std::scoped_lock l(CaptureLogger::mutex);
+    bool reported = false;
+    for(const auto &msg : CaptureLogger::messages)
+        reported = reported || msg.find("log messages dropped") != std::string::npos;
+    EXPECT_TRUE(reported);
+}
+TEST_F(TestLogger, RemovedLoggerNotCalled) {
+    const auto other = std::make_shared<CaptureLogger>();
+    Logger<>::addLogger(other);
+    CaptureLogger::capturing = true;
+    Logger<>::logi(TAG, "to both");
+    ASSERT_TRUE(Logger<>::flush());
+    EXPECT_TRUE(Logger<>::removeLogger(other));
+    EXPECT_FALSE(Logger<>::removeLogger(other));
+    Logger<>::logi(TAG, "to one");
+    ASSERT_TRUE(Logger<>::flush());
+    CaptureLogger::capturing = false;
+    EXPECT_TRUE(Logger<>::isEnabled(LOG_LEVEL_INFO, Logger<>::tagId(TAG))) << "the other loggers are left";
+
+    std::scoped_lock l(CaptureLogger::mutex);
+    EXPECT_EQ(std::count(CaptureLogger::messages.begin(), CaptureLogger::messages.end(), "[tlog ] to both"), 2);
+    EXPECT_EQ(std::count(CaptureLogger::messages.begin(), CaptureLogger::messages.end(), "[tlog ] to one"), 1);
+}
+
+TEST_F(TestLogger, DeferredFormattedByDrainTask) {
+    Logger<>::setDeferred(true);
+    CaptureLogger::capturing = true;
+    const std::string value{"value"};
+    for(int i = 0; i < 4; i++)
+        Logger<>::logi(TAG, "deferred %d of %s at %.1f", i, value.c_str(), i / 2.0);
+    ASSERT_TRUE(Logger<>::flush());
+
+    CaptureLogger::takesDeferred = true;
+    LOGW(TAG, "sent as a record %u", 42u);
+    ASSERT_TRUE(Logger<>::flush());
+    Logger<>::setDeferred(false);
+    CaptureLogger::capturing = false;
+
+    std::scoped_lock l(CaptureLogger::mutex);
+    std::vector<std::string> deferredMessages;
+    for(const auto &msg : CaptureLogger::messages)
+        if(msg.rfind("[tlog ] deferred", 0) == 0)
+            deferredMessages.push_back(msg);
+    ASSERT_EQ(deferredMessages.size(), 4u);
+    for(int i = 0; i < 4; i++)
+        EXPECT_EQ(deferredMessages[i], formatted("deferred %d of %s at %.1f", i, value.c_str(), i / 2.0));
+
+    ASSERT_EQ(CaptureLogger::deferredRecords.size(), 1u);
+    const std::string &record = CaptureLogger::deferredRecords[0];
+    char text[LOG_FORMAT_BUFFER_SIZE];
+    log_deferred::render(record.data(), record.size(), LOG_TAG_MAX_LEN, text, sizeof(text));
+    EXPECT_STREQ(text, "[tlog ] sent as a record 42");
+    for(const auto &msg : CaptureLogger::messages)
+        EXPECT_EQ(msg.find("sent as a record"), std::string::npos) << "a logger taking records gets no text";
+}
+#endif
@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+
+#include "../DesktopLoggerFixture.h"
+#include "../AllocationCounter.h"
+
+#include <Logger.h>
+#include <LogLine.h>
+#include <LogTagLevels.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+
+class TestLoggerBenchmark : public DesktopLoggerFixture {
+    public:
+        inline static constexpr const char * TAG{"tlbch"};
+        inline static constexpr unsigned ITERATIONS{100000};
+
+        inline static unsigned long expensiveCalls{0};
+
+        // Stands for arguments like `value.toString().c_str()` that cost something to build
+        static std::string expensive() {
+            expensiveCalls++;
+            return std::string(64, 'x');
+        }
+
+        TestLoggerBenchmark() {
+            EXPECT_TRUE(Logger<>::setTagLevel(TAG, LOG_LEVEL_INFO));
+        }
+
+        // How log calls formatted before LogLine: two passes and a heap string
+        template<typename... Args>
+        static std::string legacyFormat(const char *tag, const char *msg, Args&&... args) {
+            const std::string tag_msg = std::string("[%-*.*s] ") + msg;
+            const auto size = std::snprintf(nullptr, 0, tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, tag, std::forward<Args>(args)...);
+            std::string parsed_msg(size + 1, '\0');
+            std::sprintf(&parsed_msg[0], tag_msg.c_str(), LOG_TAG_MAX_LEN, LOG_TAG_MAX_LEN, tag, std::forward<Args>(args)...);
+            return parsed_msg;
+        }
+
+        template<class F>
+        static double nsPerCall(F &&f) {
+            const auto start = std::chrono::steady_clock::now();
+            for(unsigned i = 0; i < ITERATIONS; i++)
+                f();
+            const auto end = std::chrono::steady_clock::now();
+            return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / ITERATIONS;
+        }
+};
+
+TEST_F(TestLoggerBenchmark, TagLevelsTable) {
+    static_assert(LogTagLevels<4>::id("LEPhD") == Logger<>::tagId("LEPhD"));
+    static_assert(LogTagLevels<4>::id("LEPhD") != LogTagLevels<4>::id("PSMD"));
+    static_assert(LogTagLevels<4>::id("") != 0);
+
+    LogTagLevels<4> levels;
+    EXPECT_EQ(levels.get(levels.id("a")), LogTagLevels<4>::NOT_SET);
+    EXPECT_TRUE(levels.allows(levels.id("a"), LOG_LEVEL_VERBOSE));
+
+    EXPECT_TRUE(levels.set(levels.id("a"), LOG_LEVEL_WARN));
+    EXPECT_TRUE(levels.allows(levels.id("a"), LOG_LEVEL_ERROR));
+    EXPECT_TRUE(levels.allows(levels.id("a"), LOG_LEVEL_WARN));
+    EXPECT_FALSE(levels.allows(levels.id("a"), LOG_LEVEL_INFO));
+    EXPECT_TRUE(levels.allows(levels.id("b"), LOG_LEVEL_VERBOSE));
+
+    EXPECT_TRUE(levels.set(levels.id("a"), LOG_LEVEL_DEBUG)); // same slot
+    EXPECT_EQ(levels.get(levels.id("a")), LOG_LEVEL_DEBUG);
+    EXPECT_FALSE(levels.allows(levels.id("a"), LOG_LEVEL_VERBOSE));
+
+    EXPECT_TRUE(levels.set(levels.id("b"), LOG_LEVEL_ERROR));
+    EXPECT_TRUE(levels.set(levels.id("c"), LOG_LEVEL_INFO));
+    EXPECT_TRUE(levels.set(levels.id("d"), LOG_LEVEL_INFO));
+    EXPECT_FALSE(levels.set(levels.id("e"), LOG_LEVEL_INFO)) << "table is full";
+    EXPECT_TRUE(levels.set(levels.id("d"), LOG_LEVEL_WARN)) << "tags already in the table can still change";
+    EXPECT_EQ(levels.get(levels.id("b")), LOG_LEVEL_ERROR);
+    EXPECT_EQ(levels.get(levels.id("e")), LogTagLevels<4>::NOT_SET);
+}
+
+TEST_F(TestLoggerBenchmark, FilteredCallCost) {
+    // GTEST_SKIP();
+    // what log calls did before: a temporary string per lookup in a map of tag levels
+    std::map<std::string, unsigned> legacyLevels{{TAG, LOG_LEVEL_INFO}};
+    const double legacy_ns = nsPerCall([&legacyLevels]() {
+        const std::string arg = expensive();
+        if(legacyLevels.find(TAG) != legacyLevels.end() && legacyLevels[TAG] < LOG_LEVEL_VERBOSE)
+            return;
+        Logger<>::logv(TAG, "%s", arg.c_str());
+    });
+
+    expensiveCalls = 0;
+    const double logv_ns = nsPerCall([]() { Logger<>::logv(TAG, "%s", expensive().c_str()); });
+    EXPECT_EQ(expensiveCalls, ITERATIONS) << "function calls always evaluate their arguments";
+
+    expensiveCalls = 0;
+    const double macro_ns = nsPerCall([]() { LOGV(TAG, "%s", expensive().c_str()); });
+    EXPECT_EQ(expensiveCalls, 0u) << "filtered out, the arguments shouldn't be evaluated";
+
+    {
+        const alloc_counter::Scope allocs;
+        for(unsigned i = 0; i < ITERATIONS; i++) {
+            Logger<>::logv(TAG, "%u", i);
+            LOGV(TAG, "%s", expensive().c_str());
+        }
+        EXPECT_EQ(allocs.count(), 0u) << "filtered calls shouldn't allocate";
+    }
+
+    // timings are informative only, the desktop build isn't optimized
+    Logger<>::logi(TAG, "filtered verbose call: legacy map %.1fns, logv() %.1fns, LOGV() %.1fns", legacy_ns, logv_ns, macro_ns);
+}
+
+TEST_F(TestLoggerBenchmark, LineMatchesLegacyFormat) {
+    using Line = LogLine<LOG_FORMAT_BUFFER_SIZE, LOG_FORMAT_MAX_SIZE>;
+    const std::string longValue(LOG_FORMAT_BUFFER_SIZE * 2, 'v');
+    EXPECT_STREQ(Line(LOG_TAG_MAX_LEN, TAG, "no arguments, 100%%").c_str(), legacyFormat(TAG, "no arguments, 100%%").c_str());
+    EXPECT_STREQ(Line(LOG_TAG_MAX_LEN, "ab", "%d %u %s", -1, 2u, "three").c_str(), legacyFormat("ab", "%d %u %s", -1, 2u, "three").c_str());
+    EXPECT_STREQ(Line(LOG_TAG_MAX_LEN, "longer than the tag width", "%.2f", 1.5).c_str(),
+                 legacyFormat("longer than the tag width", "%.2f", 1.5).c_str());
+    const Line onHeap(LOG_TAG_MAX_LEN, TAG, "long %s", longValue.c_str());
+    EXPECT_TRUE(onHeap.isOnHeap());
+    EXPECT_FALSE(onHeap.isTruncated());
+    EXPECT_STREQ(onHeap.c_str(), legacyFormat(TAG, "long %s", longValue.c_str()).c_str());
+}
+
+TEST_F(TestLoggerBenchmark, LineTruncatesPastMaxSize) {
+    const std::string value(100, 'v');
+
+    const LogLine<32, 64> fits(5, "tag", "%s", value.substr(0, 20).c_str()); // 8 characters of prefix
+    EXPECT_FALSE(fits.isOnHeap());
+    EXPECT_FALSE(fits.isTruncated());
+    EXPECT_EQ(std::strlen(fits.c_str()), 28u);
+
+    const LogLine<32, 64> onHeap(5, "tag", "%s", value.substr(0, 40).c_str());
+    EXPECT_TRUE(onHeap.isOnHeap());
+    EXPECT_FALSE(onHeap.isTruncated());
+    EXPECT_EQ(std::string(onHeap.c_str()), "[tag  ] " + value.substr(0, 40));
+
+    const LogLine<32, 64> truncated(5, "tag", "%s", value.c_str());
+    EXPECT_TRUE(truncated.isTruncated());
+    EXPECT_EQ(std::string(truncated.c_str()), "[tag  ] " + value.substr(0, 52) + "...");
+
+    const LogLine<32, 32> noHeap(5, "tag", "%s", value.c_str());
+    EXPECT_FALSE(noHeap.isOnHeap());
+    EXPECT_TRUE(noHeap.isTruncated());
+    EXPECT_EQ(std::string(noHeap.c_str()), "[tag  ] " + value.substr(0, 20) + "...");
+}
+
+TEST_F(TestLoggerBenchmark, FormatCost) {
+    // GTEST_SKIP();
+    using Line = LogLine<LOG_FORMAT_BUFFER_SIZE, LOG_FORMAT_MAX_SIZE>;
+    static constexpr const char *msg{"[setValueWithOptLockAndUpdate] Setting %s to %u (%d%%)"};
+    std::size_t length = 0; // keeps the results in use
+    const double legacy_ns = nsPerCall([&length]() { length += legacyFormat(TAG, msg, "brightness", 512u, 50).size(); });
+    const double line_ns = nsPerCall([&length]() { length += std::strlen(Line(LOG_TAG_MAX_LEN, TAG, msg, "brightness", 512u, 50).c_str()); });
+    EXPECT_GT(length, 0u);
+
+    std::size_t legacyAllocs, lineAllocs;
+    {
+        const alloc_counter::Scope allocs;
+        length += legacyFormat(TAG, msg, "brightness", 512u, 50).size();
+        legacyAllocs = allocs.count();
+    }
+    {
+        const alloc_counter::Scope allocs;
+        length += std::strlen(Line(LOG_TAG_MAX_LEN, TAG, msg, "brightness", 512u, 50).c_str());
+        lineAllocs = allocs.count();
+    }
+    EXPECT_EQ(lineAllocs, 0u) << "messages that fit the buffer shouldn't allocate";
+
+    // timings are informative only, the desktop build isn't optimized
+    Logger<>::logi(TAG, "formatting: legacy %.1fns %zu allocations, LogLine %.1fns %zu allocations", legacy_ns, legacyAllocs,
+                   line_ns, lineAllocs);
+}
+
+#ifdef ENABLE_LOGGING
+TEST_F(TestLoggerBenchmark, MacroLogsWhenEnabled) {
+    ASSERT_TRUE(Logger<>::setTagLevel(TAG, LOG_LEVEL_VERBOSE));
+    EXPECT_TRUE(Logger<>::isEnabled(LOG_LEVEL_VERBOSE, Logger<>::tagId(TAG)));
+    expensiveCalls = 0;
+    LOGV(TAG, "enabled, argument of %zu characters", expensive().size());
+    EXPECT_EQ(expensiveCalls, 1u);
+
+    ASSERT_TRUE(Logger<>::setTagLevel(TAG, LOG_LEVEL_WARN));
+    EXPECT_FALSE(Logger<>::isEnabled(LOG_LEVEL_INFO, Logger<>::tagId(TAG)));
+    LOGI(TAG, "filtered, argument of %zu characters", expensive().size());
+    EXPECT_EQ(expensiveCalls, 1u);
+    EXPECT_TRUE(Logger<>::isEnabled(LOG_LEVEL_VERBOSE, Logger<>::tagId("other")));
+}
+#endif
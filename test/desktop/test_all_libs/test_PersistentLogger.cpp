@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+
+#include "../DesktopLoggerFixture.h"
+
+#include <PersistentLogger.h>
+#include <PersistentLogRing.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+class TestPersistentLogger : public DesktopLoggerFixture {
+    public:
+        inline static constexpr const char * TAG{"tplog"};
+
+        using SmallRing = PersistentLogRing<256>;
+
+        template<std::size_t Bytes>
+        static std::vector<std::string> texts(const PersistentLogRing<Bytes> &ring) {
+            std::vector<std::string> result;
+            typename PersistentLogRing<Bytes>::Record record{};
+            for(uint32_t cursor = ring.begin(); ring.read(cursor, record);)
+                result.emplace_back(record.text);
+            return result;
+        }
+
+        // A reset keeps the memory as it was, the ring only has to be found intact
+        template<std::size_t Bytes>
+        static std::unique_ptr<PersistentLogRing<Bytes>> reset(const PersistentLogRing<Bytes> &ring) {
+            auto rebooted = std::make_unique<PersistentLogRing<Bytes>>();
+            std::memcpy((void *)rebooted.get(), (const void *)&ring, sizeof(ring));
+            return rebooted;
+        }
+};
+
+TEST_F(TestPersistentLogger, RingKeepsNewestInOrder) {
+    SmallRing ring{};
+    EXPECT_EQ(ring.recover(), 0u);
+    for(unsigned i = 0; i < 100; i++)
+        ring.append(LOG_LEVEL_INFO, i, ("message " + std::to_string(i)).c_str());
+
+    const auto kept = texts(ring);
+    ASSERT_FALSE(kept.empty());
+    EXPECT_LT(kept.size(), 100u) << "the oldest were dropped";
+    EXPECT_EQ(kept.size(), ring.size());
+    for(std::size_t i = 0; i < kept.size(); i++)
+        EXPECT_EQ(kept[i], "message " + std::to_string(100 - kept.size() + i));
+
+    SmallRing::Record record{};
+    uint32_t cursor = ring.begin();
+    ASSERT_TRUE(ring.read(cursor, record));
+    EXPECT_EQ(record.level, LOG_LEVEL_INFO);
+    EXPECT_EQ(record.time_ms, 100 - kept.size());
+}
+
+TEST_F(TestPersistentLogger, RingTruncatesLongMessages) {
+    SmallRing ring{};
+    ring.recover();
+    const std::string longMessage(300, 'x');
+    ring.append(LOG_LEVEL_ERROR, 0, longMessage.c_str());
+    ring.append(LOG_LEVEL_ERROR, 0, "short");
+    const auto kept = texts(ring);
+    ASSERT_EQ(kept.size(), 2u);
+    EXPECT_EQ(kept[0], longMessage.substr(0, SmallRing::MAX_TEXT));
+    EXPECT_EQ(kept[1], "short");
+}
+
+TEST_F(TestPersistentLogger, RingSurvivesReset) {
+    SmallRing ring{};
+    ring.recover();
+    for(unsigned i = 0; i < 30; i++)
+        ring.append(LOG_LEVEL_WARN, i, ("message " + std::to_string(i)).c_str());
+
+    const auto rebooted = reset(ring);
+    EXPECT_EQ(rebooted->recover(), ring.size());
+    EXPECT_EQ(texts(*rebooted), texts(ring));
+}
+
+TEST_F(TestPersistentLogger, RingNotIntactStartsOver) {
+    SmallRing ring{};
+    std::memset((void *)&ring, 0xa5, sizeof(ring)); // as after a power on
+    EXPECT_EQ(ring.recover(), 0u);
+    EXPECT_TRUE(ring.empty());
+    ring.append(LOG_LEVEL_INFO, 0, "first");
+    EXPECT_EQ(texts(ring), std::vector<std::string>{"first"});
+
+    // a record's length past the newest one
+    const auto rebooted = reset(ring);
+    char *bytes = (char *)rebooted.get();
+    for(std::size_t i = 0; i + 5 < sizeof(SmallRing); i++) {
+        if(std::memcmp(bytes + i, "first", 5) == 0) {
+            bytes[i - 7] = 6; // the 7 byte header before the text starts with its length
+            break;
+        }
+    }
+    EXPECT_EQ(rebooted->recover(), 0u);
+    EXPECT_TRUE(rebooted->empty());
+
+    PersistentLogRing<1024> other{};
+    std::memcpy((void *)&other, (const void *)&ring, sizeof(ring));
+    EXPECT_EQ(other.recover(), 0u) << "a ring of another size isn't intact";
+}
+
+#ifdef ENABLE_LOGGING
+TEST_F(TestPersistentLogger, ReplaysMessagesFromBeforeReset) {
+    static PersistentLogger::Ring kept{};
+    [[maybe_unused]] static bool added = []() {
+        Logger<>::addLogger(std::make_shared<PersistentLogger>(kept, "power on"));
+        return true;
+    }();
+    ASSERT_TRUE(Logger<>::flush());
+    kept.clear(); // only this test's messages
+
+    Logger<>::logw(TAG, "before the panic %d", 42);
+    ASSERT_TRUE(Logger<>::flush());
+    PersistentLogger::Ring::Record record{};
+    uint32_t cursor = kept.begin();
+    ASSERT_TRUE(kept.read(cursor, record));
+    EXPECT_STREQ(record.text, "[tplog] before the panic 42");
+    EXPECT_EQ(record.level, LOG_LEVEL_WARN);
+
+    // replayed to the loggers added before it, `kept` among them here
+    const auto rebooted = reset(kept);
+    kept.clear();
+    PersistentLogger afterReset(*rebooted, "panic");
+    EXPECT_TRUE(rebooted->empty()) << "starts over once replayed";
+    ASSERT_TRUE(Logger<>::flush());
+    const auto replayed = texts(kept);
+    ASSERT_EQ(replayed.size(), 2u);
+    EXPECT_EQ(replayed[0], "[plog ] Reset by panic, the last 1 log messages from before follow");
+    EXPECT_EQ(replayed[1].rfind("[plog ] before reset ", 0), 0u) << replayed[1];
+    EXPECT_NE(replayed[1].find("s [tplog] before the panic 42"), std::string::npos) << replayed[1];
+}
+#endif
@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+
+#include "../DesktopLoggerFixture.h"
+#include "../SyslogUdpStandIn.h"
+
+#include <SyslogBatcher.h>
+
+#include <string>
+#include <vector>
+
+class TestSyslogLogger : public DesktopLoggerFixture {
+    public:
+        inline static constexpr const char * TAG{"tsysl"};
+
+        SyslogUdpStandIn server;
+        UdpSyslogTransport transport{server.getPort()};
+
+        // Messages of the datagrams received, checking they're octet counted
+        std::vector<std::string> receiveMessages(std::size_t *datagramCount = nullptr) {
+            const auto datagrams = server.receive();
+            if(datagramCount != nullptr)
+                *datagramCount = datagrams.size();
+            std::vector<std::string> messages;
+            for(const auto &datagram : datagrams) {
+                const auto datagramMessages = SyslogUdpStandIn::messages(datagram);
+                EXPECT_FALSE(datagramMessages.empty()) << "not octet counted: " << datagram;
+                messages.insert(messages.end(), datagramMessages.begin(), datagramMessages.end());
+            }
+            return messages;
+        }
+
+        static std::string message(const unsigned i) { return "<6>1 - coop - - - - message " + std::to_string(i); }
+};
+
+TEST_F(TestSyslogLogger, BatchesInOrder) {
+    SyslogBatcher<> batcher(transport, "coop", "-", 1000, 1000, 8);
+    for(unsigned i = 0; i < 20; i++)
+        batcher.log(SyslogBatcher<>::SEVERITY_INFO, "-", ("message " + std::to_string(i)).c_str(), 0);
+    EXPECT_EQ(batcher.packetCount(), 2u) << "full batches go out right away";
+    EXPECT_EQ(batcher.queuedCount(), 4u);
+    EXPECT_TRUE(batcher.pump(0));
+
+    std::size_t datagrams;
+    const auto messages = receiveMessages(&datagrams);
+    EXPECT_EQ(datagrams, 3u);
+    ASSERT_EQ(messages.size(), 20u);
+    for(unsigned i = 0; i < 20; i++)
+        EXPECT_EQ(messages[i], message(i));
+    EXPECT_EQ(batcher.sentCount(), 20u);
+    EXPECT_EQ(batcher.droppedCount(), 0u);
+}
+
+TEST_F(TestSyslogLogger, OneMessagePerDatagramWithoutBatching) {
+    SyslogBatcher<> batcher(transport, "coop", "app", 1000, 1000, 1);
+    batcher.log(SyslogBatcher<>::SEVERITY_ERROR, "2024-05-01T10:00:00.000Z", "first", 0);
+    batcher.log(SyslogBatcher<>::SEVERITY_DEBUG, "-", "second", 0);
+    EXPECT_TRUE(batcher.pump(0));
+    const auto datagrams = server.receive();
+    ASSERT_EQ(datagrams.size(), 2u);
+    EXPECT_EQ(datagrams[0], "<3>1 2024-05-01T10:00:00.000Z coop app - - - first");
+    EXPECT_EQ(datagrams[1], "<7>1 - coop app - - - second");
+}
+
+TEST_F(TestSyslogLogger, SpoolsWhileDisconnected) {
+    SyslogBatcher<> batcher(transport, "coop", "-", 1000, 1000, 8);
+    transport.connected = false;
+    for(unsigned i = 0; i < 30; i++)
+        batcher.log(SyslogBatcher<>::SEVERITY_INFO, "-", ("message " + std::to_string(i)).c_str(), i);
+    EXPECT_FALSE(batcher.pump(100));
+    EXPECT_TRUE(server.receive(50).empty());
+    EXPECT_EQ(batcher.queuedCount(), 30u);
+
+    transport.connected = true; // reconnected
+    EXPECT_TRUE(batcher.pump(200));
+    const auto messages = receiveMessages();
+    ASSERT_EQ(messages.size(), 30u);
+    for(unsigned i = 0; i < 30; i++)
+        EXPECT_EQ(messages[i], message(i));
+    EXPECT_EQ(batcher.droppedCount(), 0u);
+}
+
+TEST_F(TestSyslogLogger, FullSpoolDropsOldestAndReports) {
+    static constexpr unsigned LOGGED{40};
+    SyslogBatcher<256> batcher(transport, "coop", "-", 1000, 1000, 8);
+    transport.connected = false;
+    for(unsigned i = 0; i < LOGGED; i++)
+        batcher.log(SyslogBatcher<>::SEVERITY_INFO, "-", ("message " + std::to_string(i)).c_str(), 0);
+    const unsigned long dropped = batcher.droppedCount();
+    EXPECT_GT(dropped, 0u);
+    EXPECT_EQ(batcher.queuedCount() + dropped, LOGGED);
+
+    transport.connected = true;
+    EXPECT_TRUE(batcher.pump(0));
+    const auto messages = receiveMessages();
+    ASSERT_EQ(messages.size(), batcher.queuedCount() + batcher.sentCount() + 1);
+    EXPECT_EQ(messages[0], "<4>1 - coop - - - - " + std::to_string(dropped) + " messages dropped, the spool was full");
+    for(std::size_t i = 1; i < messages.size(); i++)
+        EXPECT_EQ(messages[i], message(dropped + i - 1)) << "the newest messages are kept, in order";
+
+    batcher.log(SyslogBatcher<>::SEVERITY_INFO, "-", "after", 0);
+    EXPECT_TRUE(batcher.pump(0));
+    const auto after = receiveMessages();
+    ASSERT_EQ(after.size(), 1u) << "drops are reported once";
+    EXPECT_EQ(after[0], "<6>1 - coop - - - - after");
+}
+
+TEST_F(TestSyslogLogger, RateLimited) {
+    // 10 messages per second, 5 at once
+    SyslogBatcher<> batcher(transport, "coop", "-", 10, 5, 8);
+    for(unsigned i = 0; i < 20; i++)
+        batcher.log(SyslogBatcher<>::SEVERITY_INFO, "-", ("message " + std::to_string(i)).c_str(), 0);
+    EXPECT_FALSE(batcher.pump(0));
+    EXPECT_EQ(batcher.sentCount(), 5u) << "the burst";
+    EXPECT_FALSE(batcher.pump(250));
+    EXPECT_EQ(batcher.sentCount(), 7u);
+    EXPECT_FALSE(batcher.pump(10000));
+    EXPECT_EQ(batcher.sentCount(), 12u) << "no more than a burst after a pause";
+    EXPECT_FALSE(batcher.pump(10500));
+    EXPECT_EQ(batcher.sentCount(), 17u);
+    EXPECT_TRUE(batcher.pump(11000));
+    EXPECT_EQ(batcher.sentCount(), 20u);
+
+    const auto messages = receiveMessages();
+    ASSERT_EQ(messages.size(), 20u);
+    for(unsigned i = 0; i < 20; i++)
+        EXPECT_EQ(messages[i], message(i));
+    DesktopLogger::logi(TAG, "20 messages in %lu datagrams", batcher.packetCount());
+}
@@ -0,0 +1,276 @@
+#include <gtest/gtest.h>
+
+#include "../DesktopLoggerFixture.h"
+#include "../MainsSimulator.h"
+
+#include <ZeroCrossing.h>
+#include <LeadingEdgePhaseDimmer.h>
+#include <PulseSkipModulationDimmer.h>
+#include <DimmerBank.h>
+#include <phase_control.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+inline static constexpr const char * TAG{"tzroxg"};
+
+// For ZeroCrossing's protected statics
+class ZeroCrossingInternals : public ZeroCrossing {
+    public:
+        using ZeroCrossing::calcHalfPeriod_us;
+        using ZeroCrossing::halfPeriod_us_toFreq;
+        using ZeroCrossing::freqToHalfPeriod_us;
+        using ZeroCrossing::freqMargin;
+        using ZeroCrossing::abs;
+
+        // calcHalfPeriod_us() as it was before its thresholds were precomputed
+        static unsigned referenceCalcHalfPeriod_us(const unsigned xc_elapsed_us) {
+            const unsigned actualFreq = halfPeriod_us_toFreq(xc_elapsed_us);
+            unsigned closestFreq = maxFreq;
+            for(const unsigned freq: VALID_FREQUENCIES_HZ) {
+                if(abs((int)freq - (int)actualFreq) < abs((int)closestFreq - (int)actualFreq))
+                    closestFreq = freq;
+            }
+            const unsigned calcHalfPeriodAvg = freqToHalfPeriod_us(closestFreq);
+            const double calcFreqAvg = closestFreq;
+            return calcFreqAvg < (double)minFreq * (1-freqMargin) ? freqToHalfPeriod_us(minFreq)
+                                                                  : (calcFreqAvg > (double)maxFreq * (1+freqMargin)
+                                                                     ? freqToHalfPeriod_us(maxFreq)
+                                                                     : calcHalfPeriodAvg);
+        }
+};
+
+/*
+ * Dimmers against MainsSimulator's virtual mains, the outputs are checked from the recorded triac pin edges. Tick mode
+ *  by default, build with -DZERO_CROSSING_EVENT_DRIVEN=1 for the event driven mode.
+ */
+class TestZeroCrossing : public DesktopLoggerFixture {
+    public:
+        static constexpr uint8_t TRIAC_PIN{4};
+        static constexpr uint8_t TRIAC_PIN_2{5};
+        static constexpr uint32_t WARM_UP_US{200000}; // ZeroCrossing keeps the last run's half period until new crossings
+#if ZERO_CROSSING_EVENT_DRIVEN
+        static constexpr uint32_t FIRING_TOLERANCE_US{2};
+#else
+        static constexpr uint32_t FIRING_TOLERANCE_US{16}; // a tick of the timer and a position of the half cycle
+#endif
+
+        MainsSimulator &mains = MainsSimulator::get();
+
+        void start(const MainsSimulator::Config &config) {
+            mains.reset(config);
+            mains.run_us(WARM_UP_US);
+            mains.clearRecords();
+        }
+
+        // Delays from the latest mains crossing to each rising edge of `pin`
+        [[nodiscard]] std::vector<uint32_t> firingDelays_us(const uint8_t pin) const {
+            std::vector<uint32_t> delays;
+            const auto &crossings = mains.crossings();
+            for(const auto &edge : mains.edges(pin)) {
+                if(!edge.high)
+                    continue;
+                const auto crossing = std::upper_bound(crossings.begin(), crossings.end(), edge.time_us);
+                if(crossing != crossings.begin())
+                    delays.push_back(edge.time_us - *(crossing - 1));
+            }
+            return delays;
+        }
+
+        // Fraction of the time since `since_us` `pin` was high, from its edges
+        [[nodiscard]] double highRatio(const uint8_t pin, const uint32_t since_us, bool high) const {
+            uint32_t last_us = since_us, high_us = 0;
+            for(const auto &edge : mains.edges(pin)) {
+                if(high)
+                    high_us += edge.time_us - last_us;
+                last_us = edge.time_us;
+                high = edge.high;
+            }
+            if(high)
+                high_us += mains.now_us() - last_us;
+            return (double)high_us / (mains.now_us() - since_us);
+        }
+
+        static uint32_t expectedDelay_us(const uint16_t brightness, const uint16_t resolution, const unsigned halfPeriod_us) {
+            using namespace mains_timing;
+            return leadingEdgeDelayAt_us<ZeroCrossing::RESOLUTION_MAX_SIZE>(
+                    leadingEdgeOnPosition<ZeroCrossing::RESOLUTION_MAX_SIZE>(brightness, resolution), halfPeriod_us);
+        }
+};
+
+TEST_F(TestZeroCrossing, LeadingEdgeFiresAtPhaseDelay) {
+    LeadingEdgePhaseDimmer dimmer{"zx_lepd", TRIAC_PIN, false, 128};
+    ASSERT_TRUE(mains.isAttached());
+    dimmer.setBrightness(64);
+    start({});
+    const bool high = mains.pinLevel(TRIAC_PIN);
+    mains.run_us(1000000);
+
+    EXPECT_EQ(ZeroCrossing::getFrequency(), 60);
+    const auto delays = firingDelays_us(TRIAC_PIN);
+    EXPECT_GE(delays.size(), 119u); // once per half cycle
+    const uint32_t expected_us = expectedDelay_us(64, 128, 8333);
+    for(const auto delay_us : delays)
+        EXPECT_NEAR(delay_us, expected_us, FIRING_TOLERANCE_US);
+    EXPECT_NEAR(highRatio(TRIAC_PIN, mains.now_us() - 1000000, high), 1 - (double)expected_us / 8333, 0.01);
+}
+
+TEST_F(TestZeroCrossing, FollowsFiftyHzWithJitterAndMissedPulses) {
+    LeadingEdgePhaseDimmer dimmer{"zx_lepd", TRIAC_PIN, false, 128};
+    dimmer.setBrightness(96);
+    static constexpr unsigned JITTER_US{20};
+    start({50, JITTER_US, .02});
+    mains.run_us(1000000);
+
+    EXPECT_EQ(ZeroCrossing::getFrequency(), 50);
+    const auto delays = firingDelays_us(TRIAC_PIN);
+    EXPECT_GE(delays.size(), 99u); // keeps firing through missed pulses
+    const uint32_t expected_us = expectedDelay_us(96, 128, 10000);
+    for(const auto delay_us : delays)
+        EXPECT_NEAR(delay_us, expected_us, FIRING_TOLERANCE_US + 2 * JITTER_US); // fired from the previous crossing's pulse
+}
+
+TEST_F(TestZeroCrossing, PulseSkipOnCycleRatio) {
+    PulseSkipModulationDimmer dimmer{"zx_psm", TRIAC_PIN, false, 128};
+    dimmer.setBrightness(32);
+    start({});
+    const bool high = mains.pinLevel(TRIAC_PIN);
+    mains.run_us(2000000);
+
+    EXPECT_NEAR(highRatio(TRIAC_PIN, mains.now_us() - 2000000, high), 32.0 / 128, 0.02);
+    // whole cycles, both half cycles are on
+    const auto edges = mains.edges(TRIAC_PIN);
+    for(std::size_t i = 1; i < edges.size(); i++) {
+        if(!edges[i].high) {
+            EXPECT_GE(edges[i].time_us - edges[i - 1].time_us, 2 * 8333 - FIRING_TOLERANCE_US);
+        }
+    }
+}
+
+TEST_F(TestZeroCrossing, FadeFiresEarlierEachHalfCycle) {
+    LeadingEdgePhaseDimmer dimmer{"zx_lepd", TRIAC_PIN, false, 128};
+    dimmer.setBrightness(dimmer.getMinNoFlickerBrightness());
+    start({});
+    dimmer.fadeTo(120, 500, LeadingEdgePhaseDimmer::FadeCurve::LINEAR);
+    mains.run_us(600000);
+
+    EXPECT_FALSE(dimmer.isFading());
+    const auto delays = firingDelays_us(TRIAC_PIN);
+    ASSERT_GE(delays.size(), 60u);
+    for(std::size_t i = 1; i < delays.size(); i++)
+        EXPECT_LE(delays[i], delays[i - 1] + FIRING_TOLERANCE_US);
+    EXPECT_GT(delays.front(), delays.back() + 2000);
+    EXPECT_NEAR(delays.back(), expectedDelay_us(120, 128, 8333), FIRING_TOLERANCE_US);
+}
+
+TEST_F(TestZeroCrossing, BankFiresLikeOwnIsrs) {
+    std::vector<uint32_t> ownDelays, bankDelays;
+    {
+        LeadingEdgePhaseDimmer dimmer{"zx_lepd", TRIAC_PIN, false, 128};
+        LeadingEdgePhaseDimmer dimmer2{"zx_lepd2", TRIAC_PIN_2, false, 128};
+        dimmer.setBrightness(64);
+        dimmer2.setBrightness(100);
+        start({});
+        mains.run_us(1000000);
+        ownDelays = firingDelays_us(TRIAC_PIN_2);
+        const auto &cost = mains.timerIsrCost();
+        DesktopLogger::logi(TAG, "Timer ISR with 2 dimmers: %lu calls, mean %.0fns, max %.0fns", cost.calls, cost.mean_ns(), cost.max_ns);
+    }
+    {
+        DimmerBank bank{"zx_bank"};
+        LeadingEdgePhaseDimmer dimmer{"zx_lepd", TRIAC_PIN, false, 128, &bank};
+        LeadingEdgePhaseDimmer dimmer2{"zx_lepd2", TRIAC_PIN_2, false, 128, &bank};
+        dimmer.setBrightness(64);
+        dimmer2.setBrightness(100);
+        start({});
+        mains.run_us(1000000);
+        bankDelays = firingDelays_us(TRIAC_PIN_2);
+        const auto &cost = mains.timerIsrCost();
+        DesktopLogger::logi(TAG, "Timer ISR with a bank of 2 dimmers: %lu calls, mean %.0fns, max %.0fns", cost.calls, cost.mean_ns(), cost.max_ns);
+    }
+
+    ASSERT_GE(bankDelays.size(), 119u);
+    ASSERT_GE(ownDelays.size(), 119u);
+    const uint32_t expected_us = expectedDelay_us(100, 128, 8333);
+    for(std::size_t i = 0; i < bankDelays.size(); i++)
+        EXPECT_NEAR(bankDelays[i], expected_us, FIRING_TOLERANCE_US);
+    for(std::size_t i = 0; i < ownDelays.size(); i++)
+        EXPECT_NEAR(ownDelays[i], expected_us, FIRING_TOLERANCE_US);
+    EXPECT_FALSE(mains.isAttached()); // last instance gone
+}
+
+TEST_F(TestZeroCrossing, DestroyedDimmerDoesntFire) {
+    LeadingEdgePhaseDimmer dimmer2{"zx_lepd2", TRIAC_PIN_2, false, 128}; // keeps the ISRs attached
+    auto dimmer = std::make_unique<LeadingEdgePhaseDimmer>("zx_lepd", TRIAC_PIN, false, 128);
+    dimmer->setBrightness(64);
+    dimmer2.setBrightness(64);
+    start({});
+    // destroyed in a half cycle before it fires in it
+    const auto crossings = mains.crossings().size();
+    while(mains.crossings().size() == crossings)
+        mains.run_us(100);
+    mains.run_us(1000);
+    ASSERT_GT(expectedDelay_us(64, 128, 8333), 2000u);
+    dimmer.reset();
+    mains.clearRecords();
+    mains.run_us(100000);
+
+    EXPECT_TRUE(mains.edges(TRIAC_PIN).empty());
+    EXPECT_FALSE(mains.pinLevel(TRIAC_PIN));
+    EXPECT_GE(firingDelays_us(TRIAC_PIN_2).size(), 11u);
+}
+
+TEST_F(TestZeroCrossing, DataOnlyChangedByAcceptedValues) {
+    LeadingEdgePhaseDimmer dimmer{"zx_lepd", TRIAC_PIN, false, 128};
+    PulseSkipModulationDimmer psm{"zx_psm", TRIAC_PIN_2, false, 128};
+    dimmer.setBrightness(64);
+    psm.setBrightness(64);
+    (void)dimmer.takeDirtyKeys();
+    (void)psm.takeDirtyKeys();
+
+    // the setters' ranges
+    EXPECT_FALSE(dimmer.setData({{LeadingEdgePhaseDimmer::BRIGHTNESS, "129"}}));
+    EXPECT_FALSE(dimmer.setData({{LeadingEdgePhaseDimmer::RESOLUTION, "1"}}));
+    EXPECT_FALSE(dimmer.setData({{LeadingEdgePhaseDimmer::RESOLUTION, std::to_string(ZeroCrossing::RESOLUTION_MAX_SIZE + 1)}}));
+    EXPECT_FALSE(psm.setData({{PulseSkipModulationDimmer::BRIGHTNESS, "129"}}));
+    EXPECT_FALSE(psm.setData({{PulseSkipModulationDimmer::CYCLES, "1"}}));
+    EXPECT_FALSE(psm.setData({{PulseSkipModulationDimmer::CYCLES, "129"}}));
+    EXPECT_EQ(0u, dimmer.takeDirtyKeys());
+    EXPECT_EQ(0u, psm.takeDirtyKeys());
+    EXPECT_EQ(64, dimmer.getBrightness());
+    EXPECT_EQ(128, dimmer.getResolution());
+    EXPECT_EQ(128, psm.getCycles());
+
+    EXPECT_TRUE(dimmer.setData({{LeadingEdgePhaseDimmer::BRIGHTNESS, " 128\n"}}));
+    EXPECT_EQ(128, dimmer.getBrightness());
+    // raised to the minimum without flicker, changed but not to the value given
+    dimmer.setBrightness(dimmer.getMinNoFlickerBrightness());
+    EXPECT_FALSE(dimmer.setValue(LeadingEdgePhaseDimmer::BRIGHTNESS, 1)) << "same brightness as before";
+    EXPECT_EQ(dimmer.getMinNoFlickerBrightness(), dimmer.getBrightness());
+}
+
+TEST_F(TestZeroCrossing, TimingStatsFromSimulatedMains) {
+    LeadingEdgePhaseDimmer dimmer{"zx_lepd", TRIAC_PIN, false, 128};
+    start({60, 10});
+    mains.run_us(2 * ZERO_CROSSING_TIMING_STATS_MS * 1000); // a full stats period of these mains
+
+    EXPECT_NEAR(*dimmer.getValue(ZeroCrossing::HALF_PERIOD_US_P50).asInt(), 8333, 16);
+    EXPECT_GE(*dimmer.getValue(ZeroCrossing::HALF_PERIOD_US_MIN).asInt(), 8333 - 2 * 10 - 16);
+    EXPECT_LE(*dimmer.getValue(ZeroCrossing::HALF_PERIOD_US_MAX).asInt(), 8333 + 2 * 10 + 16);
+    EXPECT_TRUE(ZeroCrossing::isPllLocked());
+}
+
+TEST_F(TestZeroCrossing, CalcHalfPeriodMatchesFloatingPoint) {
+    // every elapsed time up to well past the lowest frequency, then a stride over the rest where `* 2` doesn't overflow
+    for(unsigned elapsed_us = 0; elapsed_us <= 100000; elapsed_us++)
+        ASSERT_EQ(ZeroCrossingInternals::calcHalfPeriod_us(elapsed_us), ZeroCrossingInternals::referenceCalcHalfPeriod_us(elapsed_us)) << elapsed_us;
+    for(unsigned elapsed_us = 100000; elapsed_us <= UINT_MAX / 2 - 4099; elapsed_us += 4099)
+        ASSERT_EQ(ZeroCrossingInternals::calcHalfPeriod_us(elapsed_us), ZeroCrossingInternals::referenceCalcHalfPeriod_us(elapsed_us)) << elapsed_us;
+    EXPECT_EQ(ZeroCrossingInternals::calcHalfPeriod_us(UINT_MAX), ZeroCrossingInternals::freqToHalfPeriod_us(50));
+    // switches between 60Hz and 50Hz where 1000000/(2 * elapsed) rounds down to 54
+    EXPECT_EQ(ZeroCrossingInternals::calcHalfPeriod_us(9090), 8333u);
+    EXPECT_EQ(ZeroCrossingInternals::calcHalfPeriod_us(9091), 10000u);
+}
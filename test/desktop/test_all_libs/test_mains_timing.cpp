@@ -0,0 +1,840 @@
+#include <gtest/gtest.h>
+
+#include "../DesktopLoggerFixture.h"
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include <IsrDispatchTable.h>
+#include <EventQueue.h>
+#include <phase_control.h>
+#include <apparent_power.h>
+#include <PhaseTracker.h>
+#include <TimingHistogram.h>
+#include <pulse_skip.h>
+#include <ChannelBank.h>
+#include <Fade.h>
+
+#include <random>
+#include <algorithm>
+#include <cmath>
+#if __has_include(<x86intrin.h>)
+#include <x86intrin.h>
+#endif
+
+inline static constexpr const char * TAG{"tmaint"};
+
+class TestMainsTiming : public DesktopLoggerFixture {
+    public:
+        // Same as ZeroCrossing, a 60Hz half period split in RESOLUTION_MAX_SIZE ticks
+        inline static constexpr unsigned RESOLUTION_MAX_SIZE{1024};
+        inline static constexpr unsigned TIMER_TICK_US{(1000000/60)/2/RESOLUTION_MAX_SIZE-1};
+
+        // Synthetic zero crossing timestamps, `halfPeriod_us` apart plus up to `jitter_us`, starting near the clock wrap
+        static std::vector<uint32_t> crossings(const unsigned halfPeriod_us, const unsigned count, const unsigned jitter_us) {
+            std::mt19937 rng{halfPeriod_us};
+            std::uniform_int_distribution<int> jitter(-(int)jitter_us, (int)jitter_us);
+            std::vector<uint32_t> times;
+            uint32_t time_us = UINT32_MAX - halfPeriod_us * count / 2;
+            for(unsigned i = 0; i < count; i++, time_us += halfPeriod_us)
+                times.push_back(time_us + jitter(rng));
+            return times;
+        }
+
+        /* First tick of the fixed tick timer ISR that turns a leading edge triac on, as a delay from `crossing_us`, or
+         *  NO_FIRING. Mirrors ZeroCrossing::timerISR() with ticks every TIMER_TICK_US from `firstTick_us`. */
+        static uint32_t tickFiringDelay_us(const uint32_t crossing_us, const uint32_t firstTick_us, const unsigned halfPeriod_us,
+                                           const unsigned brightness, const unsigned resolution) {
+            for(uint32_t tick_us = firstTick_us; (int32_t)(tick_us - crossing_us) < (int32_t)halfPeriod_us; tick_us += TIMER_TICK_US + 1) {
+                const int elapsed_us = (int32_t)(tick_us - crossing_us);
+                if(elapsed_us <= 0)
+                    continue;
+                const unsigned currCyclePercentage = std::min(RESOLUTION_MAX_SIZE, RESOLUTION_MAX_SIZE * elapsed_us / halfPeriod_us);
+                if(mains_timing::leadingEdgeOn(currCyclePercentage, RESOLUTION_MAX_SIZE, brightness, resolution))
+                    return elapsed_us;
+            }
+            return mains_timing::NO_FIRING;
+        }
+
+        struct Trace {
+            double halfPeriod_us{0};
+            double jitter_us{0}; // standard deviation of the pulses
+            double missedRatio{0};
+            double glitchRatio{0}; // pulses replaced by one far from the crossing
+        };
+        struct TraceResult {
+            double rmsError_us{0};
+            double maxError_us{0};
+        };
+
+        /* Replays a synthetic crossing trace with `count` half cycles through a firing model: `update(pulse_us)` gets
+         *  each pulse and `reference()` returns {crossing_us, halfPeriod_us} the ISRs would fire from. The error is
+         *  between firing at 50% brightness from the reference and from the real crossing, after `warmup` half cycles. */
+        template<class Update, class Reference>
+        static TraceResult replay(const Trace &trace, const unsigned count, const unsigned warmup, Update &&update, Reference &&reference) {
+            std::mt19937 rng{(unsigned)trace.halfPeriod_us};
+            std::normal_distribution<double> jitter(0, trace.jitter_us);
+            std::uniform_real_distribution<double> chance(0, 1);
+            std::uniform_real_distribution<double> glitch(trace.halfPeriod_us / 6, trace.halfPeriod_us / 3);
+            const uint32_t start_us = UINT32_MAX - 1000000; // wraps around during the trace
+            double sumSquares = 0, maxError = 0;
+            for(unsigned k = 0; k < count; k++) {
+                const double crossing = k * trace.halfPeriod_us;
+                const double roll = chance(rng);
+                if(roll >= trace.missedRatio) {
+                    const double offset = roll < trace.missedRatio + trace.glitchRatio ? (chance(rng) < .5 ? -1 : 1) * glitch(rng) : jitter(rng);
+                    update(start_us + (uint32_t)std::lround(crossing + offset));
+                }
+                if(k < warmup)
+                    continue;
+                const auto [crossing_us, halfPeriod_us] = reference();
+                const uint32_t realCrossing_us = start_us + (uint32_t)std::lround(crossing);
+                const double offset = (int32_t)(crossing_us - realCrossing_us) - (crossing - std::round(crossing));
+                // whole half periods from the reference, as the timer ISR's modulo
+                const double halfCycleStart = offset - std::round(offset / halfPeriod_us) * halfPeriod_us;
+                const double error = halfCycleStart + halfPeriod_us / 2.0 - trace.halfPeriod_us / 2;
+                sumSquares += error * error;
+                maxError = std::max(maxError, std::abs(error));
+            }
+            return {std::sqrt(sumSquares / (count - warmup)), maxError};
+        }
+
+        inline static constexpr unsigned ITERATIONS{1000000};
+        inline static volatile unsigned long sink{0};
+        struct Cost {
+            double ns{0};
+            double cycles{0}; // time stamp counter ticks, 0 where there's none
+        };
+
+        // Average cost of `f(i)` over ITERATIONS, results are summed into a volatile so calls aren't optimized out
+        template<class F>
+        static Cost costPerCall(F &&f) {
+            unsigned long sum = 0;
+            const auto start = std::chrono::steady_clock::now();
+#if __has_include(<x86intrin.h>)
+            const auto startTsc = __rdtsc();
+#endif
+            for(unsigned i = 0; i < ITERATIONS; i++)
+                sum += f(i);
+#if __has_include(<x86intrin.h>)
+            const double cycles = (double)(__rdtsc() - startTsc) / ITERATIONS;
+#else
+            const double cycles = 0;
+#endif
+            const auto end = std::chrono::steady_clock::now();
+            sink = sum;
+            return {(double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / ITERATIONS, cycles};
+        }
+};
+
+namespace {
+    struct FakeDimmer {
+        std::atomic<bool> alive{true};
+        std::atomic<unsigned long> calls{0};
+    };
+    std::atomic<unsigned long> deadCalls{0};
+
+    void fakeTimerISR(FakeDimmer *dimmer, const unsigned currCyclePercentage) {
+        if(!dimmer->alive.load())
+            deadCalls++;
+        dimmer->calls++;
+    }
+    void otherTimerISR(FakeDimmer *dimmer, const unsigned currCyclePercentage) { }
+
+    using Func = void(*)(FakeDimmer *, unsigned);
+}
+
+TEST_F(TestMainsTiming, IsrDispatchTableAddRemove) {
+    // GTEST_SKIP();
+    mains_timing::IsrDispatchTable<FakeDimmer, Func, 2> table;
+    FakeDimmer a, b, c;
+    EXPECT_TRUE(table.empty());
+    EXPECT_TRUE(table.add(&a, fakeTimerISR));
+    EXPECT_TRUE(table.add(&b, otherTimerISR));
+    EXPECT_TRUE(table.add(&b, fakeTimerISR)) << "adding again should replace the function";
+    EXPECT_EQ(2, table.size());
+    EXPECT_FALSE(table.add(&c, fakeTimerISR)) << "table is full";
+
+    table.dispatch(10u);
+    EXPECT_EQ(1, a.calls);
+    EXPECT_EQ(1, b.calls);
+    EXPECT_EQ(0, c.calls);
+
+    EXPECT_TRUE(table.remove(&a));
+    EXPECT_FALSE(table.remove(&a));
+    EXPECT_TRUE(table.add(&c, fakeTimerISR));
+    table.dispatch(20u);
+    EXPECT_EQ(1, a.calls);
+    EXPECT_EQ(2, b.calls);
+    EXPECT_EQ(1, c.calls);
+}
+
+// ISR reads racing registration, removed instances are marked dead and must never be called
+TEST_F(TestMainsTiming, IsrDispatchTableStress) {
+    // GTEST_SKIP();
+    static constexpr std::size_t CAPACITY{4};
+    static constexpr std::chrono::milliseconds DURATION{300};
+    mains_timing::IsrDispatchTable<FakeDimmer, Func, CAPACITY> table;
+    std::vector<FakeDimmer> dimmers(CAPACITY * 2);
+    for(auto &dimmer : dimmers)
+        dimmer.alive = false;
+    deadCalls = 0;
+
+    std::atomic<bool> stop{false};
+    unsigned long dispatches = 0;
+    std::thread isr([&]() {
+        while(!stop.load())
+            table.dispatch((unsigned)dispatches++ % 1024);
+    });
+    unsigned long changes = 0;
+    const auto end = std::chrono::steady_clock::now() + DURATION;
+    for(std::size_t i = 0; std::chrono::steady_clock::now() < end; i++) {
+        FakeDimmer &dimmer = dimmers[i % dimmers.size()];
+        if(dimmer.alive.load()) {
+            EXPECT_TRUE(table.remove(&dimmer));
+            dimmer.alive = false; // the ISR must not see it anymore
+        } else if(table.size() < CAPACITY) {
+            dimmer.alive = true;
+            EXPECT_TRUE(table.add(&dimmer, fakeTimerISR));
+        }
+        changes++;
+    }
+    stop = true;
+    isr.join();
+
+    DesktopLogger::logi(TAG, "%lu dispatches racing %lu table changes", dispatches, changes);
+    EXPECT_EQ(0, deadCalls.load()) << "removed instances were called";
+    EXPECT_GT(dispatches, 0);
+    EXPECT_LE(table.size(), CAPACITY);
+}
+
+TEST_F(TestMainsTiming, EventQueueOrder) {
+    // GTEST_SKIP();
+    mains_timing::EventQueue<int, 4> queue;
+    const uint32_t base = UINT32_MAX - 10; // wraps around between events
+    EXPECT_TRUE(queue.push(base + 30, 3));
+    EXPECT_TRUE(queue.push(base + 5, 1));
+    EXPECT_TRUE(queue.push(base + 30, 4));
+    EXPECT_TRUE(queue.push(base + 20, 2));
+    EXPECT_FALSE(queue.push(base + 1, 0)) << "queue is full";
+    EXPECT_EQ(base + 5, queue.nextTime());
+
+    int payload = 0;
+    EXPECT_FALSE(queue.popDue(base + 4, payload));
+    EXPECT_TRUE(queue.popDue(base + 25, payload));
+    EXPECT_EQ(1, payload);
+    EXPECT_TRUE(queue.popDue(base + 25, payload));
+    EXPECT_EQ(2, payload);
+    EXPECT_FALSE(queue.popDue(base + 25, payload));
+    EXPECT_TRUE(queue.popDue(base + 30, payload));
+    EXPECT_EQ(3, payload) << "same time events should keep their order";
+    EXPECT_TRUE(queue.popDue(base + 30, payload));
+    EXPECT_EQ(4, payload);
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST_F(TestMainsTiming, EventQueueRemoveIf) {
+    // GTEST_SKIP();
+    mains_timing::EventQueue<int, 4> queue;
+    EXPECT_TRUE(queue.push(30, 3));
+    EXPECT_TRUE(queue.push(10, 1));
+    EXPECT_TRUE(queue.push(20, 2));
+    EXPECT_TRUE(queue.push(40, 1));
+    EXPECT_EQ(2u, queue.removeIf([](const int payload) { return payload == 1; }));
+    EXPECT_EQ(0u, queue.removeIf([](const int payload) { return payload == 1; }));
+    EXPECT_EQ(2u, queue.size());
+    EXPECT_EQ(20u, queue.nextTime());
+
+    int payload = 0;
+    EXPECT_TRUE(queue.popDue(40, payload));
+    EXPECT_EQ(2, payload);
+    EXPECT_TRUE(queue.popDue(40, payload));
+    EXPECT_EQ(3, payload);
+    EXPECT_TRUE(queue.empty());
+}
+
+// Event driven firing times against the fixed tick ISR for every brightness, on jittery 60Hz and 50Hz crossings
+TEST_F(TestMainsTiming, LeadingEdgeEventMatchesTicks) {
+    // GTEST_SKIP();
+    unsigned long compared = 0;
+    for(const unsigned halfPeriod_us : {8333u, 10000u}) {
+        const auto times = crossings(halfPeriod_us, 8, 40);
+        for(const unsigned resolution : {2u, 100u, 128u, 1024u}) {
+            for(unsigned brightness = 0; brightness <= resolution; brightness++) {
+                for(std::size_t i = 0; i < times.size(); i++) {
+                    const uint32_t firstTick_us = times[i] - (uint32_t)(i * 3 % (TIMER_TICK_US + 1)); // tick phase varies
+                    const uint32_t tick = tickFiringDelay_us(times[i], firstTick_us, halfPeriod_us, brightness, resolution);
+                    const uint32_t event = mains_timing::leadingEdgeDelay_us(RESOLUTION_MAX_SIZE, brightness, resolution, halfPeriod_us);
+                    if(tick == mains_timing::NO_FIRING || event == mains_timing::NO_FIRING) {
+                        // the tick ISR can miss a firing in the last tick of the half cycle
+                        EXPECT_TRUE(tick == event || halfPeriod_us - event <= TIMER_TICK_US + 1)
+                            << "brightness " << brightness << "/" << resolution << ", tick " << tick << ", event " << event;
+                        continue;
+                    }
+                    ASSERT_LE(event, tick) << "brightness " << brightness << "/" << resolution;
+                    ASSERT_LE(tick - event, TIMER_TICK_US + 1) << "brightness " << brightness << "/" << resolution
+                                                               << " should fire within one tick";
+                    compared++;
+                }
+            }
+        }
+    }
+    DesktopLogger::logi(TAG, "%lu firing times within one tick (%uus)", compared, TIMER_TICK_US + 1);
+}
+
+// Interrupts per half cycle driving several dimmers with one-shot events rather than ticks
+TEST_F(TestMainsTiming, LeadingEdgeEventCount) {
+    // GTEST_SKIP();
+    static constexpr unsigned HALF_PERIOD_US{8333};
+    const unsigned brightnesses[]{0, 1, 64, 127, 128};
+    mains_timing::EventQueue<unsigned, std::size(brightnesses) + 1> queue;
+
+    const uint32_t start_us = UINT32_MAX - 1000;
+    queue.push(start_us + HALF_PERIOD_US/2, UINT32_MAX); // unmask zero crossing
+    unsigned fired = 0;
+    for(unsigned i = 0; i < std::size(brightnesses); i++) {
+        const uint32_t delay_us = mains_timing::leadingEdgeDelay_us(RESOLUTION_MAX_SIZE, brightnesses[i], 128, HALF_PERIOD_US);
+        if(delay_us == 0) {
+            fired++; // fired in the half cycle start interrupt
+        } else if(delay_us != mains_timing::NO_FIRING) {
+            EXPECT_TRUE(queue.push(start_us + delay_us, i));
+        }
+    }
+    unsigned interrupts = 1; // half cycle start
+    uint32_t previous_us = start_us;
+    while(!queue.empty()) {
+        const uint32_t now_us = queue.nextTime();
+        EXPECT_FALSE((mains_timing::EventQueue<unsigned, 1>::before(now_us, previous_us))) << "events should be in order";
+        previous_us = now_us;
+        interrupts++;
+        unsigned event;
+        while(queue.popDue(now_us, event))
+            fired += event != UINT32_MAX;
+    }
+    EXPECT_EQ(4, fired);
+    DesktopLogger::logi(TAG, "%u interrupts per half cycle instead of %u ticks", interrupts, HALF_PERIOD_US / (TIMER_TICK_US + 1));
+    EXPECT_LE(interrupts, 2 + std::size(brightnesses));
+}
+
+// The precomputed on position gives the same firing as dividing the brightness in the ISR, for every resolution
+TEST_F(TestMainsTiming, LeadingEdgeOnPositionAccuracy) {
+    // GTEST_SKIP();
+    for(const unsigned halfPeriod_us : {8333u, 10000u}) {
+        for(unsigned resolution = 2; resolution <= RESOLUTION_MAX_SIZE; resolution++) {
+            for(unsigned brightness = 0; brightness <= resolution; brightness++) {
+                const int32_t onPosition = mains_timing::leadingEdgeOnPosition<RESOLUTION_MAX_SIZE>(brightness, resolution);
+                ASSERT_EQ(mains_timing::leadingEdgeDelay_us(RESOLUTION_MAX_SIZE, brightness, resolution, halfPeriod_us),
+                          mains_timing::leadingEdgeDelayAt_us<RESOLUTION_MAX_SIZE>(onPosition, halfPeriod_us))
+                    << "brightness " << brightness << "/" << resolution;
+                // ends of the half cycle and around the switch on
+                const int32_t around = std::clamp(onPosition, (int32_t)1, (int32_t)RESOLUTION_MAX_SIZE - 1);
+                for(const unsigned position : {0u, 1u, (unsigned)around - 1, (unsigned)around, (unsigned)around + 1,
+                                               RESOLUTION_MAX_SIZE - 1u, (unsigned)RESOLUTION_MAX_SIZE})
+                    ASSERT_EQ(mains_timing::leadingEdgeOn(position, RESOLUTION_MAX_SIZE, brightness, resolution),
+                              mains_timing::leadingEdgeOnAt(position, onPosition))
+                        << "brightness " << brightness << "/" << resolution << " at " << position;
+            }
+        }
+    }
+}
+
+// Table conversions against the floating point formulas they replace
+TEST_F(TestMainsTiming, ApparentPowerAccuracy) {
+    // GTEST_SKIP();
+    static_assert(mains_timing::percentToBrightness(0, 128) == 0);
+    static_assert(mains_timing::percentToBrightness(50, 128) == 64);
+    static_assert(mains_timing::percentToBrightness(100, 128) == 128);
+    static_assert(mains_timing::percentToBrightness(100, UINT16_MAX) == UINT16_MAX);
+
+    unsigned long compared = 0;
+    for(unsigned resolution = 2; resolution <= RESOLUTION_MAX_SIZE; resolution++) {
+        for(unsigned percent = 0; percent <= 100; percent++) {
+            const auto expected = (uint16_t)std::lround(std::acos(1 - 2.0 * percent / 100) / M_PI * resolution);
+            ASSERT_EQ(expected, mains_timing::percentToBrightness(percent, resolution)) << percent << "% at resolution " << resolution;
+        }
+        for(unsigned brightness = 0; brightness <= resolution; brightness++, compared++) {
+            const auto expected = (uint8_t)std::round((0.5 - std::cos(((double)brightness / resolution) * M_PI) / 2) * 100);
+            ASSERT_EQ(expected, mains_timing::brightnessToPercent(brightness, resolution)) << "brightness " << brightness << "/" << resolution;
+        }
+    }
+    DesktopLogger::logi(TAG, "%lu brightness to percent conversions match", compared);
+}
+
+// What the ISRs and HasData getters/setters save by not dividing or using libm
+TEST_F(TestMainsTiming, PhaseLutBenchmark) {
+    // GTEST_SKIP();
+    static constexpr unsigned RESOLUTION{100}; // not a power of 2, so the compiler can't turn the division into a shift
+    volatile unsigned brightness = 37, resolution = RESOLUTION; // not known at compile time
+    const int32_t onPosition = mains_timing::leadingEdgeOnPosition<RESOLUTION_MAX_SIZE>(brightness, resolution);
+
+    const Cost tickDivide = costPerCall([&](const unsigned i) {
+        return mains_timing::leadingEdgeOn(i % (RESOLUTION_MAX_SIZE + 1), RESOLUTION_MAX_SIZE, brightness, resolution); });
+    const Cost tickLut = costPerCall([&](const unsigned i) {
+        return mains_timing::leadingEdgeOnAt(i % (RESOLUTION_MAX_SIZE + 1), onPosition); });
+    DesktopLogger::logi(TAG, "tick ISR on test: divide %.2fns (%.1f cycles), on position %.2fns (%.1f cycles)",
+                        tickDivide.ns, tickDivide.cycles, tickLut.ns, tickLut.cycles);
+
+    const Cost delayDivide = costPerCall([&](const unsigned i) {
+        return mains_timing::leadingEdgeDelay_us(RESOLUTION_MAX_SIZE, brightness, resolution, 8000 + i % 512); });
+    const Cost delayLut = costPerCall([&](const unsigned i) {
+        return mains_timing::leadingEdgeDelayAt_us<RESOLUTION_MAX_SIZE>(onPosition, 8000 + i % 512); });
+    DesktopLogger::logi(TAG, "event ISR delay: divide %.2fns (%.1f cycles), on position %.2fns (%.1f cycles)",
+                        delayDivide.ns, delayDivide.cycles, delayLut.ns, delayLut.cycles);
+
+    const Cost percentLibm = costPerCall([&](const unsigned i) {
+        return (unsigned)std::round((0.5 - std::cos(((double)(i % (resolution + 1)) / resolution) * M_PI) / 2) * 100); });
+    const Cost percentLut = costPerCall([&](const unsigned i) {
+        return mains_timing::brightnessToPercent(i % (resolution + 1), resolution); });
+    DesktopLogger::logi(TAG, "brightness to percent: cos %.2fns (%.1f cycles), table %.2fns (%.1f cycles)",
+                        percentLibm.ns, percentLibm.cycles, percentLut.ns, percentLut.cycles);
+
+    const Cost brightnessLibm = costPerCall([&](const unsigned i) {
+        return (unsigned)std::lround(std::acos(1 - 2.0 * (i % 101) / 100) / M_PI * resolution); });
+    const Cost brightnessLut = costPerCall([&](const unsigned i) {
+        return mains_timing::percentToBrightness(i % 101, resolution); });
+    DesktopLogger::logi(TAG, "percent to brightness: acos %.2fns (%.1f cycles), table %.2fns (%.1f cycles)",
+                        brightnessLibm.ns, brightnessLibm.cycles, brightnessLut.ns, brightnessLut.cycles);
+}
+
+// Firing error of the PLL against the raw crossing and snapped frequency, on jittery traces with missed and noisy pulses
+TEST_F(TestMainsTiming, PhaseTrackerJitterReplay) {
+    // GTEST_SKIP();
+    static constexpr unsigned COUNT{4000}, WARMUP{200};
+    const Trace traces[]{
+        {8333.33, 0, 0, 0},
+        {10000, 40, 0, 0},
+        {8333.33, 40, .02, .01},
+        {8305.65, 80, .05, .02}, // 60.2Hz
+        {9900.99, 40, .02, .01}, // 50.5Hz
+    };
+    for(const auto &trace : traces) {
+        mains_timing::PhaseTracker tracker{(unsigned)(1000000/(60*1.1)/2), (unsigned)(1000000/(50*0.9)/2)};
+        const TraceResult pll = replay(trace, COUNT, WARMUP, [&](const uint32_t pulse_us) { tracker.update(pulse_us); },
+                                       [&]() { return std::pair<uint32_t, unsigned>{tracker.crossing_us(), tracker.halfPeriod_us()}; });
+
+        // as ZeroCrossing without the PLL: the last pulse and the half period snapped to 50 or 60Hz
+        uint32_t lastPulse_us = 0, xc_us = 0;
+        unsigned halfPeriod_us = 8333;
+        const TraceResult raw = replay(trace, COUNT, WARMUP, [&](const uint32_t pulse_us) {
+                                           const auto elapsed_us = pulse_us - lastPulse_us;
+                                           if(elapsed_us < 6000)
+                                               return;
+                                           lastPulse_us = xc_us = pulse_us;
+                                           if(elapsed_us < 12000)
+                                               halfPeriod_us = elapsed_us < 9166 ? 8333 : 10000;
+                                       },
+                                       [&]() { return std::pair<uint32_t, unsigned>{xc_us, halfPeriod_us}; });
+
+        DesktopLogger::logi(TAG, "%.2fHz, %.0fus jitter, %.0f%% missed, %.0f%% glitches: firing error rms/max raw %.1f/%.0fus, pll %.1f/%.0fus "
+                                 "(locked %d, jitter %uus, %.3fHz, missed %u, outliers %u)",
+                            500000 / trace.halfPeriod_us, trace.jitter_us, trace.missedRatio * 100, trace.glitchRatio * 100,
+                            raw.rmsError_us, raw.maxError_us, pll.rmsError_us, pll.maxError_us, tracker.isLocked(),
+                            tracker.jitter_us(), tracker.frequency_mHz() / 1000.0, tracker.missedCount(), tracker.outlierCount());
+        EXPECT_TRUE(tracker.isLocked());
+        EXPECT_NEAR(500000000 / trace.halfPeriod_us, tracker.frequency_mHz(), 20) << "tracked frequency in mHz";
+        EXPECT_NEAR(trace.jitter_us * std::sqrt(2 / M_PI), tracker.jitter_us(), trace.jitter_us / 2 + 2) << "mean absolute jitter";
+        if(trace.jitter_us == 0) {
+            EXPECT_LE(pll.maxError_us, 2);
+        } else {
+            EXPECT_LT(pll.rmsError_us, raw.rmsError_us / 2) << "the PLL should at least halve the firing jitter";
+            EXPECT_LT(pll.maxError_us, raw.maxError_us);
+        }
+    }
+}
+
+TEST_F(TestMainsTiming, TimingHistogramSummary) {
+    // GTEST_SKIP();
+    mains_timing::TimingHistogram<256, 6912, 4> histogram; // as ZeroCrossing's half periods
+    EXPECT_EQ(0, histogram.drain().count);
+
+    std::mt19937 rng{1};
+    std::normal_distribution<double> halfPeriod(8333, 30);
+    std::vector<uint32_t> values;
+    for(unsigned i = 0; i < 10000; i++)
+        values.push_back((uint32_t)std::lround(halfPeriod(rng)));
+    values.push_back(5000); // below the first bucket
+    values.push_back(20000); // above the last one
+    for(const auto value : values)
+        histogram.record(value);
+    std::sort(values.begin(), values.end());
+
+    const auto summary = histogram.drain();
+    EXPECT_EQ(values.size(), summary.count);
+    EXPECT_EQ(5000, summary.min);
+    EXPECT_EQ(20000, summary.max);
+    const uint32_t p50 = values[(values.size() + 1) / 2 - 1], p99 = values[values.size() - values.size() / 100 - 1];
+    EXPECT_GE(summary.p50, p50);
+    EXPECT_LT(summary.p50, p50 + 16) << "within a bucket";
+    EXPECT_GE(summary.p99, p99);
+    EXPECT_LT(summary.p99, p99 + 16) << "within a bucket";
+    DesktopLogger::logi(TAG, "half periods min %u, max %u, p50 %u (exact %u), p99 %u (exact %u)",
+                        summary.min, summary.max, summary.p50, p50, summary.p99, p99);
+
+    EXPECT_EQ(0, histogram.drain().count) << "drain() should reset";
+    histogram.record(7);
+    const auto single = histogram.drain();
+    EXPECT_EQ(1, single.count);
+    EXPECT_EQ(7, single.p50) << "percentiles are clamped to min and max";
+    EXPECT_EQ(7, single.p99);
+}
+
+// Recording from an "ISR" thread while a task drains, no recording is lost
+TEST_F(TestMainsTiming, TimingHistogramStress) {
+    // GTEST_SKIP();
+    static constexpr std::chrono::milliseconds DURATION{200};
+    mains_timing::TimingHistogram<64> histogram;
+    std::atomic<bool> stop{false};
+    unsigned long recorded = 0;
+    std::thread isr([&]() {
+        while(!stop.load())
+            histogram.record((uint32_t)(recorded++ % 80));
+    });
+    unsigned long drained = 0, drains = 0;
+    const auto end = std::chrono::steady_clock::now() + DURATION;
+    while(std::chrono::steady_clock::now() < end) {
+        const auto summary = histogram.drain();
+        drained += summary.count;
+        drains++;
+        if(summary.count > 0) {
+            EXPECT_LE(summary.min, summary.p50);
+            EXPECT_LE(summary.p50, summary.p99);
+            EXPECT_LE(summary.p99, summary.max);
+            EXPECT_LT(summary.max, 80);
+        }
+    }
+    stop = true;
+    isr.join();
+    drained += histogram.drain().count;
+    DesktopLogger::logi(TAG, "%lu recordings over %lu drains", recorded, drains);
+    EXPECT_EQ(recorded, drained);
+}
+
+namespace {
+    struct PatternScore {
+        double dutyError{0}; // on ratio minus brightness/cycles
+        unsigned maxRun{0}; // longest run of the same state, when both states are used
+        double flicker{0}; // max difference of on cycles in any FLICKER_WINDOW cycles from the exact brightness
+    };
+    // ~7.5Hz at 60Hz, around where eyes are most sensitive to flicker
+    constexpr unsigned FLICKER_WINDOW{8};
+
+    // Scores the full cycles (pairs of half cycles) fired by `halfCycleStarted()`, as PulseSkipModulationDimmer's
+    template<class Step>
+    PatternScore scorePattern(const unsigned brightness, const unsigned cycles, Step &&step) {
+        std::vector<bool> on;
+        unsigned halfCycleCount = 0;
+        for(unsigned i = 0; on.size() < cycles * 16; i++) {
+            if(++halfCycleCount % 2 == 0)
+                on.push_back(step(halfCycleCount));
+        }
+        on.erase(on.begin(), on.begin() + cycles * 2); // settled
+
+        PatternScore score;
+        score.dutyError = (double)std::count(on.begin(), on.end(), true) / on.size() - (double)brightness / cycles;
+        if(brightness > 0 && brightness < cycles) {
+            unsigned run = 0;
+            for(std::size_t i = 0; i < on.size(); i++) {
+                run = i > 0 && on[i] == on[i - 1] ? run + 1 : 1;
+                score.maxRun = std::max(score.maxRun, run);
+            }
+        }
+        for(std::size_t i = 0; i + FLICKER_WINDOW <= on.size(); i++) {
+            const auto count = std::count(on.begin() + i, on.begin() + i + FLICKER_WINDOW, true);
+            score.flicker = std::max(score.flicker, std::abs(count - (double)FLICKER_WINDOW * brightness / cycles));
+        }
+        return score;
+    }
+}
+
+// Sigma-delta against the ratio pulse skip decisions over every brightness
+TEST_F(TestMainsTiming, PulseSkipPatternScore) {
+    // GTEST_SKIP();
+    for(const unsigned cycles : {128u, 100u, 16u}) {
+        PatternScore ratioTotal, sigmaDeltaTotal;
+        unsigned ratioWorseRuns = 0;
+        for(unsigned brightness = 0; brightness <= cycles; brightness++) {
+            unsigned cyclesFiredCount = 0;
+            const auto ratio = scorePattern(brightness, cycles, [&](unsigned &halfCycleCount) {
+                return mains_timing::pulseSkipRatioStep(halfCycleCount, cyclesFiredCount, brightness, cycles); });
+            uint32_t accumulator = 0;
+            const auto sigmaDelta = scorePattern(brightness, cycles, [&](unsigned &) {
+                return mains_timing::sigmaDeltaStep(accumulator, brightness, cycles); });
+
+            EXPECT_LT(std::abs(sigmaDelta.dutyError), 1.0 / (cycles * 14)) << "brightness " << brightness << "/" << cycles;
+            EXPECT_LT(sigmaDelta.flicker, 1) << "brightness " << brightness << "/" << cycles;
+            if(brightness > 0 && brightness < cycles) { // runs of the majority state can't be shorter than that
+                const unsigned minority = std::min(brightness, cycles - brightness);
+                EXPECT_LE(sigmaDelta.maxRun, (cycles - minority + minority - 1) / minority) << "brightness " << brightness << "/" << cycles;
+            }
+            ratioWorseRuns += ratio.maxRun > sigmaDelta.maxRun;
+            ratioTotal.dutyError += std::abs(ratio.dutyError);
+            ratioTotal.maxRun = std::max(ratioTotal.maxRun, ratio.maxRun);
+            ratioTotal.flicker += ratio.flicker;
+            sigmaDeltaTotal.dutyError += std::abs(sigmaDelta.dutyError);
+            sigmaDeltaTotal.maxRun = std::max(sigmaDeltaTotal.maxRun, sigmaDelta.maxRun);
+            sigmaDeltaTotal.flicker += sigmaDelta.flicker;
+        }
+        const unsigned count = cycles + 1;
+        DesktopLogger::logi(TAG, "%u cycles, avg duty error / max run / avg flicker: ratio %.4f / %u / %.2f, sigma-delta %.4f / %u / %.2f "
+                                 "(ratio has longer runs at %u brightnesses)",
+                            cycles, ratioTotal.dutyError / count, ratioTotal.maxRun, ratioTotal.flicker / count,
+                            sigmaDeltaTotal.dutyError / count, sigmaDeltaTotal.maxRun, sigmaDeltaTotal.flicker / count, ratioWorseRuns);
+        EXPECT_LT(sigmaDeltaTotal.flicker, ratioTotal.flicker);
+    }
+}
+
+TEST_F(TestMainsTiming, ChannelBankMasks) {
+    using Bank = mains_timing::ChannelBank<4, RESOLUTION_MAX_SIZE>;
+    Bank bank;
+    EXPECT_EQ(bank.add(32, false, Bank::Kind::LEADING_EDGE), -1);
+    const int normal = bank.add(2, false, Bank::Kind::LEADING_EDGE);
+    const int inverted = bank.add(5, true, Bank::Kind::LEADING_EDGE);
+    ASSERT_EQ(normal, 0);
+    ASSERT_EQ(inverted, 1);
+    EXPECT_EQ(bank.size(), 2);
+
+    // channels start off, inverted ones are off when high
+    auto masks = bank.tick(RESOLUTION_MAX_SIZE - 1);
+    EXPECT_EQ(masks.set, 1u << 5);
+    EXPECT_EQ(masks.clear, 1u << 2);
+
+    bank.setOnPosition(normal, -1);
+    bank.setOnPosition(inverted, -1);
+    masks = bank.tick(0);
+    EXPECT_EQ(masks.set, 1u << 2);
+    EXPECT_EQ(masks.clear, 1u << 5);
+
+    // removed channels aren't driven and their slot is reused
+    bank.remove(normal);
+    masks = bank.tick(0);
+    EXPECT_EQ(masks.set | masks.clear, 1u << 5);
+    EXPECT_EQ(bank.size(), 1);
+    EXPECT_EQ(bank.add(7, false, Bank::Kind::PULSE_SKIP), normal);
+    EXPECT_EQ(bank.add(8, false, Bank::Kind::PULSE_SKIP), 2);
+    EXPECT_EQ(bank.add(9, false, Bank::Kind::PULSE_SKIP), 3);
+    EXPECT_EQ(bank.add(10, false, Bank::Kind::PULSE_SKIP), -1);
+}
+
+// One pass over the bank must drive each channel as its own dimmer's ISR would
+TEST_F(TestMainsTiming, ChannelBankMatchesChannels) {
+    static constexpr unsigned CHANNELS{8}, HALF_PERIOD_US{8333};
+    using Bank = mains_timing::ChannelBank<CHANNELS, RESOLUTION_MAX_SIZE>;
+    Bank bank;
+    std::vector<int32_t> onPositions;
+    std::vector<uint32_t> accumulators(CHANNELS, 0);
+    const auto kindOf = [](const unsigned channel) { return channel % 3 == 2 ? Bank::Kind::PULSE_SKIP : Bank::Kind::LEADING_EDGE; };
+    for(unsigned channel = 0; channel < CHANNELS; channel++) {
+        ASSERT_EQ(bank.add(channel * 2, channel % 2 == 1, kindOf(channel)), (int)channel);
+        onPositions.push_back(mains_timing::leadingEdgeOnPosition<RESOLUTION_MAX_SIZE>(channel * 37 % 129, 128));
+        if(kindOf(channel) == Bank::Kind::PULSE_SKIP)
+            bank.setPulseSkip(channel, channel * 11 % 101, 100);
+        else
+            bank.setOnPosition(channel, onPositions[channel]);
+    }
+    const auto pinOn = [](const Bank::Masks &masks, const unsigned channel) {
+        const uint32_t pin = 1u << (channel * 2);
+        EXPECT_NE((masks.set | masks.clear) & pin, 0u) << "channel " << channel;
+        return ((masks.set & pin) != 0) ^ (channel % 2 == 1);
+    };
+
+    bool fullCycle = false;
+    for(unsigned halfCycle = 0; halfCycle < 400; halfCycle++) {
+        fullCycle = !fullCycle;
+        for(unsigned channel = 0; channel < CHANNELS; channel++)
+            if(kindOf(channel) == Bank::Kind::PULSE_SKIP && fullCycle)
+                onPositions[channel] = mains_timing::sigmaDeltaStep(accumulators[channel], channel * 11 % 101, 100) ? -1 : RESOLUTION_MAX_SIZE;
+
+        // event driven, start and each fire at the next delay
+        uint32_t next_us;
+        auto masks = bank.halfCycleStart(HALF_PERIOD_US, next_us);
+        std::vector<uint32_t> firedAt(CHANNELS, mains_timing::NO_FIRING);
+        for(unsigned channel = 0; channel < CHANNELS; channel++)
+            if(pinOn(masks, channel))
+                firedAt[channel] = 0;
+        while(next_us != mains_timing::NO_FIRING) {
+            const uint32_t elapsed_us = next_us;
+            masks = bank.fire(elapsed_us, next_us);
+            ASSERT_GT(next_us, elapsed_us);
+            for(unsigned channel = 0; channel < CHANNELS; channel++)
+                if((masks.set | masks.clear) & (1u << (channel * 2)) && firedAt[channel] == mains_timing::NO_FIRING) {
+                    EXPECT_TRUE(pinOn(masks, channel));
+                    firedAt[channel] = elapsed_us;
+                }
+        }
+        for(unsigned channel = 0; channel < CHANNELS; channel++)
+            EXPECT_EQ(firedAt[channel], mains_timing::leadingEdgeDelayAt_us<RESOLUTION_MAX_SIZE>(onPositions[channel], HALF_PERIOD_US))
+                                << "channel " << channel << " half cycle " << halfCycle;
+
+        // fixed ticks
+        for(unsigned position = 0; position <= RESOLUTION_MAX_SIZE; position += 7) {
+            masks = bank.tick(position);
+            for(unsigned channel = 0; channel < CHANNELS; channel++)
+                EXPECT_EQ(pinOn(masks, channel), mains_timing::leadingEdgeOnAt(position, onPositions[channel]))
+                                    << "channel " << channel << " position " << position;
+        }
+    }
+}
+
+TEST_F(TestMainsTiming, ChannelBankBenchmark) {
+    // GTEST_SKIP();
+    static constexpr unsigned CHANNELS{8};
+    using Bank = mains_timing::ChannelBank<CHANNELS, RESOLUTION_MAX_SIZE>;
+    Bank bank;
+    int32_t onPositions[CHANNELS];
+    for(unsigned channel = 0; channel < CHANNELS; channel++) {
+        bank.add(channel, false, Bank::Kind::LEADING_EDGE);
+        onPositions[channel] = mains_timing::leadingEdgeOnPosition<RESOLUTION_MAX_SIZE>(channel * 16, 128);
+        bank.setOnPosition(channel, onPositions[channel]);
+    }
+
+    // each dimmer's ISR dispatched through a function pointer and writing its own pin, as LeadingEdgePhaseDimmer does
+    static volatile uint32_t setRegister, clearRegister;
+    using ChannelISR = void(*)(int32_t onPosition, unsigned pin, unsigned cyclePosition);
+    ChannelISR isrs[CHANNELS];
+    for(auto &isr : isrs)
+        isr = [](const int32_t onPosition, const unsigned pin, const unsigned cyclePosition) {
+            if(mains_timing::leadingEdgeOnAt(cyclePosition, onPosition))
+                setRegister = 1u << pin;
+            else
+                clearRegister = 1u << pin;
+        };
+    const Cost perChannel = costPerCall([&](const unsigned i) {
+        const unsigned position = i % (RESOLUTION_MAX_SIZE + 1);
+        for(unsigned channel = 0; channel < CHANNELS; channel++)
+            isrs[channel](onPositions[channel], channel, position);
+        return setRegister ^ clearRegister; });
+    const Cost banked = costPerCall([&](const unsigned i) {
+        const auto masks = bank.tick(i % (RESOLUTION_MAX_SIZE + 1));
+        setRegister = masks.set;
+        clearRegister = masks.clear;
+        return setRegister ^ clearRegister; });
+    DesktopLogger::logi(TAG, "%u channels tick: per channel %.2fns (%.1f cycles, %u register writes), bank %.2fns (%.1f cycles, 2 register writes)",
+                        CHANNELS, perChannel.ns, perChannel.cycles, CHANNELS, banked.ns, banked.cycles);
+}
+
+TEST_F(TestMainsTiming, FadeCurves) {
+    using namespace mains_timing;
+    for(const auto curve : {FadeCurve::GAMMA, FadeCurve::PERCEPTUAL}) {
+        uint32_t previous = 0;
+        for(uint32_t perceived = 0; perceived <= fade_detail::ONE_Q16; perceived += 16) {
+            const uint32_t level = fade_detail::curveLevel(curve, perceived);
+            EXPECT_GE(level, previous) << "perceived " << perceived;
+            EXPECT_NEAR(fade_detail::curvePerceived(curve, level), perceived, 300) << "perceived " << perceived;
+            previous = level;
+        }
+        EXPECT_EQ(fade_detail::curveLevel(curve, 0), 0u);
+        EXPECT_EQ(fade_detail::curveLevel(curve, fade_detail::ONE_Q16), fade_detail::ONE_Q16);
+    }
+    // half perceived brightness is a fifth of the level or less
+    EXPECT_NEAR(fade_detail::curveLevel(FadeCurve::GAMMA, fade_detail::ONE_Q16 / 2) / (double)fade_detail::ONE_Q16, std::pow(0.5, 2.2), 0.001);
+    EXPECT_NEAR(fade_detail::curveLevel(FadeCurve::PERCEPTUAL, fade_detail::ONE_Q16 / 2) / (double)fade_detail::ONE_Q16, 0.1842, 0.001);
+}
+
+TEST_F(TestMainsTiming, FadeSteps) {
+    using namespace mains_timing;
+    for(const auto curve : {FadeCurve::LINEAR, FadeCurve::GAMMA, FadeCurve::PERCEPTUAL}) {
+        for(const auto &[from, to] : {std::pair<uint32_t, uint32_t>{0, 1024}, {1000, 0}, {300, 700}}) {
+            Fade fade;
+            uint32_t level;
+            EXPECT_FALSE(fade.step(level));
+            static constexpr uint32_t HALF_CYCLES{600}, FLOOR{40};
+            fade.start(from, to, 1024, HALF_CYCLES, curve, FLOOR);
+            EXPECT_TRUE(fade.isActive());
+            std::vector<uint32_t> levels;
+            while(fade.step(level))
+                levels.push_back(level);
+            EXPECT_FALSE(fade.isActive());
+            ASSERT_EQ(levels.size(), HALF_CYCLES);
+            EXPECT_EQ(levels.back(), to);
+            EXPECT_EQ(fade.level(), to);
+            for(std::size_t i = 0; i < levels.size(); i++) {
+                EXPECT_TRUE(levels[i] == 0 || levels[i] >= FLOOR) << "step " << i;
+                if(i > 0) {
+                    EXPECT_TRUE(from < to ? levels[i] >= levels[i - 1] : levels[i] <= levels[i - 1]) << "step " << i;
+                }
+            }
+            // equal steps of perceived brightness, the search loses up to a table step at the ends
+            const auto perceived = [&](const uint32_t l) { return (double)fade_detail::curvePerceived(curve, (l << 16) / 1024) / fade_detail::ONE_Q16; };
+            const double expected = (perceived(to) - perceived(from)) / HALF_CYCLES;
+            for(std::size_t i = HALF_CYCLES / 4; i < HALF_CYCLES; i += HALF_CYCLES / 4)
+                EXPECT_NEAR(perceived(levels[i]) - perceived(from), expected * (i + 1), 0.01) << "step " << i;
+        }
+    }
+
+    // a jump ends the fade on the next half cycle
+    Fade fade;
+    uint32_t level;
+    fade.start(0, 1024, 1024, 100, FadeCurve::LINEAR);
+    for(unsigned i = 0; i < 10; i++)
+        ASSERT_TRUE(fade.step(level));
+    fade.jump(512);
+    EXPECT_TRUE(fade.isActive());
+    EXPECT_TRUE(fade.step(level));
+    EXPECT_EQ(level, 512);
+    EXPECT_FALSE(fade.isActive());
+    EXPECT_FALSE(fade.step(level));
+}
+
+// Commands published while the ISR steps must never be seen torn
+TEST_F(TestMainsTiming, FadeStress) {
+    using namespace mains_timing;
+    static constexpr uint32_t COMMANDS{20000}, SPAN{50};
+    Fade fade;
+    std::atomic<bool> publishing{true};
+    std::atomic<unsigned long> torn{0}, steps{0};
+    std::thread isr([&]() {
+        uint32_t level;
+        while(publishing.load() || fade.isActive()) {
+            if(!fade.step(level))
+                continue;
+            steps++;
+            if(level % 100 > SPAN) // every command stays within [base, base + SPAN]
+                torn++;
+        }
+    });
+    uint32_t base = 0;
+    for(uint32_t command = 0; command < COMMANDS; command++) {
+        base = (command % 600) * 100;
+        fade.start(base, base + SPAN, fade_detail::ONE_Q16, 1 + command % 7 * 9, FadeCurve::LINEAR);
+        if(command % 64 == 0)
+            std::this_thread::yield();
+    }
+    publishing = false;
+    isr.join();
+    EXPECT_EQ(torn.load(), 0);
+    EXPECT_GT(steps.load(), 0);
+    EXPECT_EQ(fade.level(), base + SPAN);
+}
+
+TEST_F(TestMainsTiming, ChannelBankFade) {
+    static constexpr unsigned HALF_PERIOD_US{10000}, HALF_CYCLES{64};
+    using Bank = mains_timing::ChannelBank<2, RESOLUTION_MAX_SIZE>;
+    Bank bank;
+    mains_timing::Fade leadingEdge, pulseSkip;
+    ASSERT_EQ(bank.add(1, false, Bank::Kind::LEADING_EDGE, &leadingEdge), 0);
+    ASSERT_EQ(bank.add(2, false, Bank::Kind::PULSE_SKIP, &pulseSkip), 1);
+    bank.setPulseSkip(1, 0, 16);
+    leadingEdge.start(0, RESOLUTION_MAX_SIZE, RESOLUTION_MAX_SIZE, HALF_CYCLES, mains_timing::FadeCurve::LINEAR);
+    pulseSkip.start(0, 16, 16, HALF_CYCLES, mains_timing::FadeCurve::LINEAR);
+
+    uint32_t previousDelay_us = mains_timing::NO_FIRING, onCycles = 0, onCyclesFirstHalf = 0;
+    for(unsigned halfCycle = 0; halfCycle < HALF_CYCLES; halfCycle++) {
+        uint32_t next_us;
+        const auto masks = bank.halfCycleStart(HALF_PERIOD_US, next_us);
+        // the leading edge channel fires earlier each half cycle until it's always on
+        const uint32_t delay_us = masks.set & (1u << 1) ? 0 : next_us;
+        EXPECT_LT(delay_us, previousDelay_us) << "half cycle " << halfCycle;
+        previousDelay_us = delay_us;
+        if(masks.set & (1u << 2) && halfCycle % 2 == 0) {
+            onCycles++;
+            onCyclesFirstHalf += halfCycle < HALF_CYCLES / 2;
+        }
+    }
+    EXPECT_EQ(previousDelay_us, 0);
+    EXPECT_FALSE(leadingEdge.isActive());
+    EXPECT_FALSE(pulseSkip.isActive());
+    // more pulse skip cycles on as it brightens
+    EXPECT_GT(onCycles, 2 * onCyclesFirstHalf);
+}
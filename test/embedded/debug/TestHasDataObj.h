@@ -9,7 +9,8 @@ public:
     inline constexpr static const char * TAG{"thasdO"};
     [[nodiscard]] const char * getTag() const override { return TAG; }
 
-    [[nodiscard]] std::vector<std::string> getKeys() const override { return {"test_key1", "test_key2"}; }
+    inline static const std::vector<std::string> keys{"test_key1", "test_key2"};
+    [[nodiscard]] const std::vector<std::string> &getKeys() const override { return keys; }
 
     std::string test_key1 = "test_value1";
     std::string test_key2 = "test_value2";    